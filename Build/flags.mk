@@ -1,15 +1,46 @@
 
+ifeq ($(strip $(BUILD_CONFIG)),Release)
+DEBUG_OP = -g 
+CPP_DEBUG_OP = 
+
+# NDEBUG also drops debug log messages at compile time, see avoidrickshaw.h
+OPTIMIZATION_OP = -O2 -flto -DNDEBUG 
+CPP_OPTIMIZATION_OP = 
+
+LTO_LINK_OP = -O2 -flto 
+else
 DEBUG_OP = -g3 
 CPP_DEBUG_OP = 
 
 OPTIMIZATION_OP = -O0 
 CPP_OPTIMIZATION_OP = 
 
-COMPILE_FLAGS = $(DEBUG_OP) $(OPTIMIZATION_OP) -Wall -c -fmessage-length=0 -fPIC 
+LTO_LINK_OP = 
+endif
+
+# Profile guided optimization of a Release build:
+#   PGO=generate  instrumented build, profiles are written to PGO_DEVICE_DIR on the
+#                 device; run the latency benchmark (latency_bench.c), a few
+#                 sessions and the History view there
+#   PGO=use       pull PGO_DEVICE_DIR into PGO_DIR (with clang, merge the .profraw files
+#                 with llvm-profdata into $(PGO_DIR)/default.profdata) and rebuild
+# tools/pgo.sh runs the same pipeline on the host and reports the speedup.
+PGO_DEVICE_DIR = /opt/usr/apps/org.example.avoidrickshaw/data/pgo
+PGO_DIR = $(PROJ_PATH)/pgo
+
+ifeq ($(strip $(PGO)),generate)
+PGO_OP = -fprofile-generate=$(PGO_DEVICE_DIR) 
+else ifeq ($(strip $(PGO)),use)
+PGO_OP = -fprofile-use=$(PGO_DIR) -Wno-missing-profile 
+else
+PGO_OP = 
+endif
+
+COMPILE_FLAGS = $(DEBUG_OP) $(OPTIMIZATION_OP) $(PGO_OP) -Wall -c -fmessage-length=0 -fPIC 
 
 CPP_COMPILE_FLAGS = $(CPP_DEBUG_OP) $(CPP_OPTIMIZATION_OP) 
 
-LINK_FLAGS = -shared -Wl,--no-undefined 
+LINK_FLAGS = -shared -Wl,--no-undefined $(LTO_LINK_OP) $(PGO_OP) 
 
 AR_FLAGS = 
 
@@ -1,3 +1,14 @@
+#if !defined(_SQLITEDBHELPER_H)
+#define _SQLITEDBHELPER_H
+
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <time.h>
+#include "arena.h"
+#include "energy.h"
+#include "tracker_core.h"
+#include "tdigest.h"
+
 /*this structure will be commonly used in both database and application layer*/
 #define MAX_LEN 200
 
@@ -9,28 +20,82 @@ typedef struct
     int steps;
     float calories;
     int fare;
+    int revision; /*bumped on every change, used by delta sync*/
 
 } QueryData;
 
+/*one tracking session, stored in the session table next to the day totals*/
+typedef struct
+{
+    long long start_time;   /*unix time the session started*/
+    int duration;           /*seconds*/
+    float distance;
+    energy_session_s energy;
+    session_stats_s stats;
+
+} SessionData;
+
+/*
+ * Quantile sketches of the history, kept per day and, once a month is
+ * over and rolled up, per month, so any date range merges a few of them.
+ */
+#define SKETCH_METRIC_LIST(X) \
+	X(PACE,     "pace")     /*s/km per fix interval while walking*/ \
+	X(CADENCE,  "cadence")  /*steps/min per fix interval while walking*/ \
+	X(DISTANCE, "distance") /*m per session*/
+
+#define SKETCH_METRIC_ENUM(id, name) SKETCH_##id,
+typedef enum {
+	SKETCH_METRIC_LIST(SKETCH_METRIC_ENUM)
+	SKETCH_METRIC_COUNT
+} sketch_metric_e;
+#undef SKETCH_METRIC_ENUM
+
+/*column-wise view of stored distance ordered by date*/
+typedef struct
+{
+    int count;
+    int *days;
+    float *distance;
+    int *fare;
+
+} DistanceColumns;
+
+/*reserve SQLite's heap and the database path once at startup, before any other call*/
+int prepareDbStorage(void);
+
 int initdb();
 
-int insertIntoDb(float distance, int steps, float calories, int fare);
+/*clock deciding the day of saved rows and the days kept, time() by default*/
+void setDbClock(time_t (*clock)(time_t *));
+time_t dbTime(void);
 
-/*update Db row with input data*/
-int updateInfoDb(float distance, int steps, float calories, int fare);
+/*calories_per_kg is the weight term of calories divided by weight, the body weight they use*/
+int insertIntoDb(float distance, int steps, float calories, float calories_per_kg, double weight, int fare);
+
+/*update Db row with input data; calories are the session's and added to the row's*/
+int updateInfoDb(float distance, int steps, float calories, float calories_per_kg, double weight, int fare);
+
+/*the rows of the fetch APIs taking an arena live until arena_release() of it*/
 
 /*fetch all stored message from database. This API will return total number of rows found in this call*/
-int getAllMsgFromDb(QueryData **msg_data, int* num_of_rows);
+int getAllMsgFromDb(arena_s *arena, QueryData **msg_data, int* num_of_rows);
 
 /*fetch all stored message from database 28 days from that day.
  * This API will return total number of rows found in this call*/
-int getLast28DaysInfo(QueryData **msg_data, int* num_of_rows);
+int getLast28DaysInfo(arena_s *arena, QueryData **msg_data, int* num_of_rows);
 
 /*fetch stored message form database based on given ID. Application needs to send desired ID*/
-int getMsgById(QueryData **msg_data, int id);
+int getMsgById(arena_s *arena, QueryData **msg_data, int id);
+
+/*fetch stored message form database based on current date into a caller provided row*/
+int getMsgByCurrentDate(QueryData *msg_data, int* num_of_rows);
+
+/*store a finished session; the day it belongs to is taken from start_time*/
+int insertSession(const SessionData *session);
 
-/*fetch stored message form database based on current date*/
-int getMsgByCurrentDate(QueryData **msg_data, int* num_of_rows);
+/*merge the sketches of a metric from from_date to to_date, both YYYY-MM-DD and included*/
+int getSketchRange(sketch_metric_e metric, const char *from_date, const char *to_date, tdigest_s *sketch);
 
 /*delete stored message form database based on given ID. Application needs to send desired ID*/
 int deleteMsgById(int id);
@@ -41,8 +106,60 @@ int deleteMsgAll();
 /*delete all rows except last 28 days with current day included*/
 int delAllExceptLast28Days();
 
+/*same on a worker connection*/
+int deleteExpiredRows(sqlite3 *db);
+
 /*count number of stored msg in the database and will return the total number*/
 int getTotalMsgItemsCount(int* num_of_rows);
 
+/*split a YYYY-MM-DD date into its numbers*/
+void getNumericDate(int *d, int *m, int *y, const char *day);
+
+/*count the days from day1 to day2, both YYYY-MM-DD*/
+int getDays(const char* day1, const char* day2);
+
 /*Db Populate function*/
 void populateDb(void);
+
+/*open a private connection for background threads. Caller closes it with sqlite3_close()*/
+int openWorkerDb(sqlite3 **db);
+
+/*count the day rows whose calories use another weight*/
+int countCaloriesToReweigh(sqlite3 *db, double weight, int *count);
+
+/*read day number, Distance and Fare of all rows ordered by date as columns*/
+int getDistanceColumns(sqlite3 *db, DistanceColumns *cols);
+
+/*release columns filled by getDistanceColumns*/
+void freeDistanceColumns(DistanceColumns *cols);
+
+/*read up to capacity rows changed after the given revision, in revision order*/
+int getRowsAfterRevision(sqlite3 *db, int after_revision, QueryData *rows, int capacity, int *num_of_rows);
+
+/*read and store the last revision acknowledged by a sync peer*/
+int getSyncWatermark(sqlite3 *db, const char *peer, int *watermark);
+int setSyncWatermark(sqlite3 *db, const char *peer, int watermark);
+
+/*read and store when a maintenance task last completed*/
+int getMaintenanceRun(sqlite3 *db, const char *task, long long *last_run);
+int setMaintenanceRun(sqlite3 *db, const char *task, long long last_run);
+
+/*merge the day sketches of every month before the current one into a month sketch*/
+int rollupSketches(sqlite3 *db, bool (*stop)(void *data), void *data);
+
+/*copy the database to sample.db.bak, stop is polled between steps*/
+int backupDb(sqlite3 *db, int pages_per_step, bool (*stop)(void *data), void *data);
+
+/*read the weight a pending calorie recalculation brings stored rows to, 0 when none is pending*/
+int getRecalcTarget(sqlite3 *db, double *weight);
+
+/*record a weight change to recalculate stored calories for, on the main loop's connection*/
+int setRecalcTarget(double old_weight, double new_weight);
+
+/*clear the recalculation target if it is still weight*/
+int clearRecalcTarget(sqlite3 *db, double weight);
+
+/*bring Calories of the next chunk of rows to weight*/
+int reweighCaloriesChunk(sqlite3 *db, double weight, int limit, int *rows);
+
+#endif
@@ -0,0 +1,40 @@
+#if !defined(_ARENA_H)
+#define _ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "memtrack.h"
+
+/*
+ * Bump-pointer arena for data living as long as one query or one view
+ * instance. Allocations are carved from chunks taken with mt_malloc() under
+ * the arena's tag and are never freed one by one; arena_release() returns
+ * all chunks at once. An arena is not thread safe.
+ */
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_SIZE 8192
+
+typedef struct arena_chunk arena_chunk_s;
+
+typedef struct
+{
+    arena_chunk_s *chunk;   /*newest chunk, the one allocations are carved from*/
+    void *last;             /*latest allocation, the one arena_resize() grows in place*/
+    memtrack_tag_e tag;
+    size_t chunk_size;
+    size_t used;            /*bytes handed out, alignment included*/
+    size_t reserved;        /*bytes of all chunks*/
+    uint32_t chunks;
+
+} arena_s;
+
+#define ARENA_INIT(tag) { NULL, NULL, (tag), ARENA_CHUNK_SIZE, 0, 0, 0 }
+
+void arena_init(arena_s *arena, memtrack_tag_e tag, size_t chunk_size);
+void *arena_alloc(arena_s *arena, size_t size);
+void *arena_calloc(arena_s *arena, size_t count, size_t size);
+void *arena_resize(arena_s *arena, void *ptr, size_t old_size, size_t size);
+void arena_release(arena_s *arena);
+
+#endif
@@ -17,10 +17,14 @@
 #if !defined(_AVOIDRICKSHAW_H_)
 #define _AVOIDRICKSHAW_H_
 
+#if defined(AR_HOST_BUILD)
+#include "host_shim.h"
+#else
 #include <app.h>
 #include <Elementary.h>
 #include <efl_extension.h>
 #include <dlog.h>
+#endif
 
 #if !defined(PACKAGE)
 #define PACKAGE "org.example.avoidrickshaw"
@@ -31,4 +35,13 @@
 #endif
 #define LOG_TAG "avoidrickshaw"
 
+/*
+ * Release builds drop debug messages at compile time: the priority is a
+ * constant, so the formatting and the call to the log daemon fold away.
+ * Hot paths use the binary tracer in trace.h instead.
+ */
+#if defined(NDEBUG) && !defined(AR_HOST_BUILD)
+#define dlog_print(prio, tag, ...) ((prio) == DLOG_DEBUG ? (void) 0 : (void) (dlog_print)(prio, tag, __VA_ARGS__))
+#endif
+
 #endif
@@ -1,6 +1,8 @@
 #if !defined(_DATA_H)
 #define _DATA_H
 
+struct sensor_backend;
+
 typedef void (*data_position_changed_callback_t)(double);
 typedef void (*data_gps_steps_count_callback_t)(int);
 typedef void (*data_fare_count_callback_t)(int);
@@ -8,6 +10,8 @@ typedef void (*data_calorie_count_callback_t)(double);
 
 
 Eina_Bool data_initialize(void);
+void data_use_injected_events(void);
+struct sensor_backend *data_backend_get(void);
 void data_finalize(void);
 bool data_tracking_start(void);
 bool data_tracking_stop(void);
@@ -0,0 +1,37 @@
+#if !defined(_DB_HEAP_H)
+#define _DB_HEAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Preallocated heap for SQLite, so saving a session does not go to the
+ * system heap. db_heap_init() reserves one arena and installs it with
+ * SQLITE_CONFIG_MALLOC; it must run before the first SQLite call of the
+ * process.
+ *
+ * Blocks are carved from the arena in size classes, powers of two with a
+ * class halfway between each (16, 24, 32, 48 ... bytes), and a freed block
+ * goes to the free list of its class, so the same connection open, query
+ * and close reuse the same blocks every time. When the arena is used up
+ * blocks come from mt_malloc(MT_DB) and are counted as overflow.
+ */
+
+#define DB_HEAP_DEFAULT_SIZE (1024 * 1024)
+
+typedef struct
+{
+    size_t arena_size;
+    size_t arena_used;      /*carved from the arena so far, in use or on a free list*/
+    int64_t live_bytes;     /*size of the blocks in use, overflow blocks included*/
+    int64_t peak_bytes;
+    uint64_t allocs;
+    uint64_t overflow_allocs;
+
+} db_heap_stats_s;
+
+bool db_heap_init(size_t size);
+void db_heap_stats(db_heap_stats_s *stats);
+
+#endif
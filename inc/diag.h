@@ -0,0 +1,89 @@
+#if !defined(_DIAG_H)
+#define _DIAG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Latency histograms for the main-loop entry points and a watchdog that
+ * reports main-loop stalls together with the probe that caused them.
+ *
+ * Probes are meant for the main loop only; they are not thread safe.
+ * Each histogram has log2 buckets of microseconds: bucket 0 counts calls
+ * under 2 us, bucket i calls in [2^i, 2^(i+1)) us and the last bucket
+ * everything slower.
+ */
+
+#define DIAG_BUCKETS 24
+#define DIAG_MAX_DEPTH 8
+#define DIAG_STALL_HISTORY 16
+#define DIAG_WATCHDOG_INTERVAL 0.1  /*seconds between watchdog ticks*/
+#define DIAG_STALL_THRESHOLD 0.2    /*tick lateness in seconds reported as a stall*/
+
+#define DIAG_PROBE_LIST(X) \
+	X(ACCEL,          "accel_cb") \
+	X(POSITION,       "pos_updated_cb") \
+	X(BTN_START,      "start_cb") \
+	X(BTN_STOP,       "stop_cb") \
+	X(BTN_HISTORY,    "show_history_cb") \
+	X(BTN_SAVE,       "save_cb") \
+	X(GRAPH_DRAW,     "cairo_drawing") \
+	X(DB_INIT,        "initdb") \
+	X(DB_QUERY_TODAY, "getMsgByCurrentDate") \
+	X(DB_INSERT,      "insertIntoDb") \
+	X(DB_UPDATE,      "updateInfoDb") \
+	X(DB_COUNT,       "getTotalMsgItemsCount") \
+	X(DB_DELETE,      "delAllExceptLast28Days") \
+	X(DB_HISTORY,     "getLast28DaysInfo")
+
+#define DIAG_PROBE_ENUM(id, name) DIAG_PROBE_##id,
+typedef enum {
+	DIAG_PROBE_LIST(DIAG_PROBE_ENUM)
+	DIAG_PROBE_COUNT
+} diag_probe_e;
+#undef DIAG_PROBE_ENUM
+
+typedef struct
+{
+    uint64_t buckets[DIAG_BUCKETS];
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+
+} diag_histogram_s;
+
+typedef struct
+{
+    int64_t time;           /*unix time in seconds*/
+    double duration;        /*how late the watchdog tick was, in seconds*/
+    int probe;              /*slowest top-level probe since the previous tick, -1 if none ran*/
+    double probe_duration;
+    int inner_probe;        /*slowest nested probe, -1 if none ran*/
+    double inner_duration;
+
+} diag_stall_s;
+
+uint64_t diag_probe_begin(diag_probe_e probe);
+void diag_probe_end(diag_probe_e probe, uint64_t start);
+
+/*wrap a block in the current function; the probe name is the suffix of DIAG_PROBE_*/
+#define DIAG_BEGIN(probe) uint64_t _diag_start_##probe = diag_probe_begin(DIAG_PROBE_##probe)
+#define DIAG_END(probe) diag_probe_end(DIAG_PROBE_##probe, _diag_start_##probe)
+
+const char *diag_probe_name(diag_probe_e probe);
+const diag_histogram_s *diag_histogram(diag_probe_e probe);
+void diag_histogram_add(diag_histogram_s *histogram, uint64_t us);
+uint64_t diag_histogram_percentile(const diag_histogram_s *histogram, double percentile);
+int diag_stall_count(void);
+const diag_stall_s *diag_stall_get(int index);
+void diag_reset(void);
+size_t diag_report(char *buf, size_t len);
+
+void diag_watchdog_tick(double now);
+#if !defined(AR_HOST_BUILD)
+bool diag_watchdog_start(void);
+void diag_watchdog_stop(void);
+#endif
+
+#endif
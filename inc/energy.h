@@ -0,0 +1,73 @@
+#if !defined(_ENERGY_H)
+#define _ENERGY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Energy accounting per tracking session.
+ *
+ * Counts the events that cost battery (sensor events, GPS fixes and
+ * receiver time, database page writes and fsyncs, frames drawn, main-loop
+ * wakeups) and turns them into an estimated charge with a per-event cost
+ * model. Counters may be bumped from any thread.
+ *
+ * Database writes and fsyncs are counted by a pass-through SQLite VFS, so
+ * every connection is included, those of the worker threads too.
+ */
+
+/*
+ * Event table: id, name, column in the session table and the default cost
+ * in microampere-hours. Defaults are rough figures for a Gear S2 class
+ * watch; each cost can be overridden with the preference "energy_cost_<name>".
+ */
+#define ENERGY_EVENT_LIST(X) \
+	X(GPS_ON,    "gps_on_s", "GpsOnSeconds", 5.5)  /*receiver tracking, about 20 mA*/ \
+	X(GPS_FIX,   "gps_fix",  "GpsFixes",     0.3)  \
+	X(ACCEL,     "accel",    "AccelEvents",  0.01) \
+	X(DB_WRITE,  "db_write", "DbWrites",     0.05) /*one page written*/ \
+	X(FSYNC,     "fsync",    "Fsyncs",       0.5)  \
+	X(UI_REDRAW, "redraw",   "Redraws",      0.2)  /*one frame rendered*/ \
+	X(WAKEUP,    "wakeup",   "Wakeups",      0.03) /*main loop leaving idle*/
+
+#define ENERGY_EVENT_ENUM(id, name, column, cost) ENERGY_##id,
+typedef enum {
+	ENERGY_EVENT_LIST(ENERGY_EVENT_ENUM)
+	ENERGY_EVENT_COUNT
+} energy_event_e;
+#undef ENERGY_EVENT_ENUM
+
+typedef struct
+{
+    uint32_t counts[ENERGY_EVENT_COUNT];
+    double mah;             /*estimated charge used by the counted events*/
+
+} energy_session_s;
+
+/*counters of the running session, use energy_count() and energy_add()*/
+extern uint32_t energy_counters[ENERGY_EVENT_COUNT];
+
+static inline void energy_add(energy_event_e event, uint32_t count)
+{
+	__atomic_add_fetch(&energy_counters[event], count, __ATOMIC_RELAXED);
+}
+
+static inline void energy_count(energy_event_e event)
+{
+	energy_add(event, 1);
+}
+
+const char *energy_event_name(energy_event_e event);
+void energy_cost_set(energy_event_e event, double uah);
+double energy_cost_get(energy_event_e event);
+double energy_estimate_mah(const uint32_t counts[ENERGY_EVENT_COUNT]);
+
+void energy_session_begin(void);
+void energy_session_end(energy_session_s *session);
+size_t energy_report(char *buf, size_t len);
+
+/*installs the counting VFS as the default one; safe to call more than once*/
+bool energy_vfs_register(void);
+
+#endif
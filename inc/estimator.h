@@ -0,0 +1,46 @@
+#if !defined(_ESTIMATOR_H)
+#define _ESTIMATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "track_file.h"
+
+/*
+ * Interchangeable step detectors and distance estimators. The first entry of
+ * each table is the algorithm the tracker runs (tracker_core.c); the others
+ * are candidates compared against it with tools/algoeval. All state lives in
+ * a caller provided block of state_size bytes, nothing is allocated.
+ */
+
+typedef struct
+{
+    const char *name;
+    const char *description;
+    size_t state_size;
+    void (*reset)(void *state);
+    /*true if the sample completes a step*/
+    bool (*feed)(void *state, const track_accel_s *sample);
+
+} step_estimator_s;
+
+typedef struct
+{
+    const char *name;
+    const char *description;
+    size_t state_size;
+    void (*reset)(void *state);
+    /*steps_count: steps of the session so far, as counted by the tracker*/
+    void (*feed)(void *state, const track_fix_s *fix, int steps_count);
+    /*meters walked so far*/
+    double (*distance)(const void *state);
+
+} distance_estimator_s;
+
+/*NULL terminated*/
+extern const step_estimator_s *const step_estimators[];
+extern const distance_estimator_s *const distance_estimators[];
+
+const step_estimator_s *step_estimator_find(const char *name);
+const distance_estimator_s *distance_estimator_find(const char *name);
+
+#endif
@@ -11,6 +11,7 @@
 #include <Elementary.h>
 #include <cairo.h>
 #include "Sqlitedbhelper.h"
+#include "arena.h"
 
 typedef struct appdata {
 
@@ -21,6 +22,8 @@ typedef struct appdata {
 	cairo_surface_t *surface;
 	cairo_t *cairo;
 
+	arena_s arena;  /*holds this struct and the query rows of the view*/
+
 } appdata_s;
 
 
@@ -0,0 +1,67 @@
+#if !defined(_HOST_SHIM_H)
+#define _HOST_SHIM_H
+
+/*
+ * Minimal stand-ins for the Tizen platform APIs used by the portable modules,
+ * so they can be built into Linux tools with -DAR_HOST_BUILD.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+	DLOG_DEBUG = 3,
+	DLOG_INFO,
+	DLOG_WARN,
+	DLOG_ERROR,
+} log_priority;
+
+/*messages below this priority are dropped; tools lower it for verbose output*/
+extern log_priority host_log_level;
+
+#define dlog_print(prio, tag, ...) \
+	((prio) >= host_log_level ? (fprintf(stderr, "%s: ", tag), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr)) : 0)
+
+/*directory holding sample.db, taken from AR_DATA_PATH, must end with '/'*/
+char *app_get_data_path(void);
+
+#if defined(AR_HOST_UI)
+/*
+ * The views on upstream EFL, for tools/uisim (-DAR_HOST_UI): the hardware
+ * keys of efl_extension are pressed with host_ui_key(), preferences are
+ * kept in memory for the run.
+ */
+#include <Elementary.h>
+
+typedef enum {
+	EEXT_CALLBACK_BACK,
+	EEXT_CALLBACK_MORE,
+} Eext_Callback_Type;
+
+typedef void (*Eext_Event_Cb)(void *data, Evas_Object *obj, void *event_info);
+
+void eext_object_event_callback_add(Evas_Object *obj, Eext_Callback_Type type, Eext_Event_Cb func, void *data);
+void eext_naviframe_back_cb(void *data, Evas_Object *obj, void *event_info);
+void eext_popup_back_cb(void *data, Evas_Object *obj, void *event_info);
+
+/*runs the callback registered last for the key on an object still alive, false if none*/
+bool host_ui_key(Eext_Callback_Type type);
+
+/*directory holding edje/main.edj, taken from AR_RES_PATH, must end with '/'*/
+char *app_get_resource_path(void);
+
+/*only records the request, see host_ui_exit_requested()*/
+void ui_app_exit(void);
+bool host_ui_exit_requested(void);
+
+#define PREFERENCE_ERROR_NONE 0
+#define PREFERENCE_ERROR_NO_KEY -1
+
+int preference_is_existing(const char *key, bool *existing);
+int preference_get_double(const char *key, double *value);
+int preference_set_double(const char *key, double value);
+#endif
+
+#endif
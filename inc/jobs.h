@@ -0,0 +1,71 @@
+#if !defined(_JOBS_H)
+#define _JOBS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "diag.h"
+
+/*
+ * Background jobs of all modules on one fixed pool of worker threads.
+ *
+ * A job runs on a worker, highest priority class first and in submission
+ * order within a class. Its notify and done callbacks run in the main loop
+ * (on the host, in whoever calls jobs_dispatch()). Idle jobs never take the
+ * last free worker, so an interactive job does not wait behind them.
+ *
+ * Submitting, cancelling and the callbacks belong to the main loop. A job
+ * handle stays valid until its done callback returned.
+ */
+
+#define JOBS_DEFAULT_WORKERS 2
+
+#define JOB_CLASS_LIST(X) \
+	X(INTERACTIVE, "interactive") \
+	X(NORMAL,      "normal") \
+	X(IDLE,        "idle")
+
+#define JOB_CLASS_ENUM(id, name) JOB_##id,
+typedef enum {
+	JOB_CLASS_LIST(JOB_CLASS_ENUM)
+	JOB_CLASS_COUNT
+} job_class_e;
+#undef JOB_CLASS_ENUM
+
+typedef struct job job_s;
+
+typedef struct
+{
+    void (*run)(void *data, job_s *job);                    /*on a worker; long jobs poll jobs_cancelled()*/
+    void (*notify)(void *data, job_s *job, void *msg);      /*main loop, a message of jobs_feedback(); may be NULL*/
+    void (*done)(void *data, job_s *job, bool cancelled);   /*main loop, once; may be NULL*/
+
+} job_callbacks_s;
+
+typedef struct
+{
+    uint32_t queued;        /*waiting now*/
+    uint32_t running;       /*on a worker now*/
+    uint64_t submitted;
+    uint64_t completed;     /*ran to the end, cancelled ones included*/
+    uint64_t cancelled;     /*cancelled, before or while running*/
+    diag_histogram_s wait;  /*submission to start, us*/
+    diag_histogram_s run;   /*start to end, us*/
+
+} jobs_stats_s;
+
+bool jobs_init(int workers);
+void jobs_shutdown(void);
+
+job_s *jobs_submit(job_class_e job_class, const job_callbacks_s *callbacks, void *data);
+void jobs_cancel(job_s *job);
+bool jobs_cancelled(job_s *job);
+bool jobs_feedback(job_s *job, void *msg);
+void jobs_dispatch(void);
+int jobs_pending(void);
+
+const char *jobs_class_name(job_class_e job_class);
+void jobs_stats(job_class_e job_class, jobs_stats_s *stats);
+size_t jobs_report(char *buf, size_t len);
+
+#endif
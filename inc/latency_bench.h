@@ -0,0 +1,7 @@
+#if !defined(_LATENCY_BENCH_H)
+#define _LATENCY_BENCH_H
+
+int latency_bench_requested(void);
+bool latency_bench_start(Evas_Object *layout);
+
+#endif
@@ -0,0 +1,82 @@
+#if !defined(_LIVE_METRICS_H)
+#define _LIVE_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Live session metrics published in shared memory for other processes,
+ * such as a watch face widget or diagnostics tools.
+ *
+ * The app is the only writer. It bumps the sequence to an odd value,
+ * updates the values and bumps it to the next even value, so it never
+ * waits for readers. Readers copy the values and retry if the sequence
+ * was odd or changed meanwhile (a seqlock), so they never block the writer
+ * and never see a half-written snapshot.
+ */
+
+#define LIVE_METRICS_SHM_NAME "/avoidrickshaw.metrics"
+#define LIVE_METRICS_MAGIC 0x4d525641  /*"AVRM"*/
+#define LIVE_METRICS_VERSION 1
+#define LIVE_METRICS_READ_ATTEMPTS 64
+
+typedef struct
+{
+    double distance;        /*meters this session*/
+    double calories;
+    int64_t session_start;  /*unix time in seconds, 0 when no session ran yet*/
+    int64_t updated;        /*unix time in milliseconds of the last publish*/
+    uint32_t steps;
+    uint32_t fare;
+    uint8_t tracking;
+    uint8_t gps_fix;
+
+} live_metrics_values_s;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;      /*odd while the writer is updating values*/
+    uint32_t reserved;
+    live_metrics_values_s values;
+
+} live_metrics_region_s;
+
+/*writer side, used by the app*/
+bool live_metrics_open(void);
+void live_metrics_publish(const live_metrics_values_s *values);
+void live_metrics_close(void);
+
+/*reader side*/
+const live_metrics_region_s *live_metrics_attach(void);
+void live_metrics_detach(const live_metrics_region_s *region);
+
+/**
+ * @brief Copies a consistent snapshot of the published metrics.
+ * Lock-free; gives up after LIVE_METRICS_READ_ATTEMPTS torn reads, which
+ * only happens if the writer publishes continuously.
+ * @param[in] region The region returned by live_metrics_attach().
+ * @param[out] values The snapshot.
+ * @return This function returns 'true' on success, otherwise 'false' is returned.
+ */
+static inline bool live_metrics_read(const live_metrics_region_s *region, live_metrics_values_s *values)
+{
+	for (int attempt = 0; attempt < LIVE_METRICS_READ_ATTEMPTS; attempt++) {
+		uint32_t begin = __atomic_load_n(&region->sequence, __ATOMIC_ACQUIRE);
+
+		if (begin & 1)
+			continue;
+
+		memcpy(values, (const void *) &region->values, sizeof(*values));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&region->sequence, __ATOMIC_RELAXED) == begin)
+			return true;
+	}
+
+	return false;
+}
+
+#endif
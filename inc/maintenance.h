@@ -0,0 +1,77 @@
+#if !defined(_MAINTENANCE_H)
+#define _MAINTENANCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sqlite3.h>
+#if !defined(AR_HOST_BUILD)
+#include <app.h>
+#endif
+
+/*
+ * Opportunistic maintenance: backups, compaction and derived data are
+ * prepared while the watch is charging and no session runs, so that the
+ * interactive paths find them ready.
+ *
+ * Tasks are registered with the interval they want to run at. Once the
+ * conditions hold and a task is due, one window runs as an idle job on its
+ * own connection: the due tasks run in registration order until the
+ * window's thread CPU budget is spent. A task that did not complete is not
+ * recorded and is resumed by the next window. Last runs are stored in the
+ * database, on its clock.
+ *
+ * A timer starts the window once the next task is due, also after the
+ * pause that follows a failed or exhausted window; host tools without a
+ * main loop call maintenance_check() themselves.
+ *
+ * On the device the charging state follows the battery. While it charges,
+ * an alarm relaunches the app now and then so windows also happen while it
+ * is closed; an app the alarm brought up exits once its window and the
+ * other background jobs are over, unless the user opened it meanwhile.
+ * Everything else belongs to the main loop.
+ */
+
+#define MAINTENANCE_MAX_TASKS 8
+#define MAINTENANCE_CPU_BUDGET_MS 2000          /*thread CPU time of one window*/
+#define MAINTENANCE_ALARM_PERIOD (6 * 3600)     /*s between relaunches by the alarm*/
+#define MAINTENANCE_APP_CONTROL_KEY "maintenance"
+
+typedef struct maintenance_window maintenance_window_s;
+
+typedef struct
+{
+    const char *name;       /*stored with the last run, unique*/
+    int interval;           /*s of the database clock between runs*/
+    bool (*run)(sqlite3 *db, maintenance_window_s *window); /*on a worker; true once complete*/
+
+} maintenance_task_s;
+
+typedef struct
+{
+    uint32_t windows;       /*windows run to the end*/
+    uint32_t over_budget;   /*windows stopped by the CPU budget*/
+    uint32_t cancelled;     /*windows stopped because charging ended or a session started*/
+    uint32_t task_runs;
+    uint32_t task_failures; /*runs that did not complete*/
+    uint64_t cpu_us;        /*thread CPU time of all windows*/
+
+} maintenance_stats_s;
+
+bool maintenance_register(const maintenance_task_s *task);
+bool maintenance_stop_requested(maintenance_window_s *window);
+
+bool maintenance_init(void);
+void maintenance_finalize(void);
+void maintenance_set_charging(bool charging);
+void maintenance_set_tracking(bool tracking);
+void maintenance_check(void);
+bool maintenance_running(void);
+void maintenance_stats(maintenance_stats_s *stats);
+size_t maintenance_report(char *buf, size_t len);
+
+#if !defined(AR_HOST_BUILD)
+bool maintenance_app_control(app_control_h app_control);
+#endif
+
+#endif
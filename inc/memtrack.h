@@ -0,0 +1,64 @@
+#if !defined(_MEMTRACK_H)
+#define _MEMTRACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Heap accounting per module. Blocks from mt_malloc() and friends carry a
+ * small header with their size and module tag and must be released with
+ * mt_free(); memory from other libraries (app_get_data_path(), sqlite3,
+ * elm_entry_utf8_to_markup()) is still released with free().
+ *
+ * Counters are updated atomically, so worker threads may allocate too.
+ *
+ * Once a session started, the tracking and save paths run on storage
+ * reserved beforehand. They run between memtrack_steady_enter() and
+ * memtrack_steady_leave(), and an mt_*() allocation there on the same
+ * thread is counted as a violation; debug builds (no NDEBUG) assert.
+ */
+
+#define MEMTRACK_TAG_LIST(X) \
+	X(DB,     "db") \
+	X(DATA,   "data") \
+	X(VIEW,   "view") \
+	X(RECALC, "recalc") \
+	X(TRACE,  "trace") \
+	X(JOBS,   "jobs") \
+	X(OTHER,  "other")
+
+#define MEMTRACK_TAG_ENUM(id, name) MT_##id,
+typedef enum {
+	MEMTRACK_TAG_LIST(MEMTRACK_TAG_ENUM)
+	MT_TAG_COUNT
+} memtrack_tag_e;
+#undef MEMTRACK_TAG_ENUM
+
+typedef struct
+{
+    int64_t live_bytes;
+    int64_t live_blocks;
+    int64_t peak_bytes;     /*high-water mark of live_bytes*/
+    uint64_t allocs;        /*allocations ever made, reallocations included*/
+    uint64_t alloc_bytes;
+
+} memtrack_stats_s;
+
+void *mt_malloc(memtrack_tag_e tag, size_t size);
+void *mt_calloc(memtrack_tag_e tag, size_t count, size_t size);
+void *mt_realloc(memtrack_tag_e tag, void *ptr, size_t size);
+char *mt_strdup(memtrack_tag_e tag, const char *str);
+void mt_free(void *ptr);
+
+const char *memtrack_tag_name(memtrack_tag_e tag);
+void memtrack_stats(memtrack_tag_e tag, memtrack_stats_s *stats);
+int64_t memtrack_live_bytes(void);
+size_t memtrack_report(char *buf, size_t len);
+void memtrack_log_report(void);
+
+void memtrack_steady_enter(void);
+void memtrack_steady_leave(void);
+uint64_t memtrack_steady_violations(void);
+
+#endif
@@ -0,0 +1,13 @@
+#if !defined(_RECALC_H)
+#define _RECALC_H
+
+typedef void (*recalc_progress_callback_t)(int done, int total);
+typedef void (*recalc_done_callback_t)(bool success);
+
+void recalc_set_callbacks(recalc_progress_callback_t progress_callback, recalc_done_callback_t done_callback);
+bool recalc_calories_start(double old_weight, double new_weight);
+bool recalc_calories_resume(void);
+void recalc_calories_cancel(void);
+bool recalc_calories_running(void);
+
+#endif
@@ -0,0 +1,80 @@
+#if !defined(_SENSOR_BACKEND_H)
+#define _SENSOR_BACKEND_H
+
+#include <stdbool.h>
+#include "track_file.h"
+
+/*
+ * Sources of position fixes and accelerometer samples for the tracker.
+ *
+ * The Tizen backend wraps the location manager and the accelerometer
+ * listener; its events arrive from the main loop. The inject backend only
+ * delivers the events handed to sensor_backend_inject_*(). The replay and
+ * synthetic backends have no event loop: sensor_backend_run() delivers all their
+ * events synchronously, in timestamp order, so the tracking pipeline can run
+ * inside a plain Linux process, as fast as possible or paced like the
+ * recording with sensor_backend_set_speed(). Events of a source that is not
+ * started are dropped, as a stopped sensor would not report them.
+ */
+
+typedef struct sensor_backend sensor_backend_s;
+
+struct sensor_backend
+{
+    const char *name;
+    void *ctx;
+
+    bool (*location_enabled)(sensor_backend_s *backend);
+    bool (*location_start)(sensor_backend_s *backend);
+    bool (*location_stop)(sensor_backend_s *backend);
+    bool (*motion_start)(sensor_backend_s *backend);
+    bool (*motion_stop)(sensor_backend_s *backend);
+    /*meters between two positions, negative on failure*/
+    double (*distance)(sensor_backend_s *backend, double latitude1, double longitude1,
+            double latitude2, double longitude2);
+    /*seconds on the backend's clock; replayed sources report the time of the last event*/
+    double (*now)(sensor_backend_s *backend);
+    /*delivers all remaining events, NULL for backends driven by the main loop*/
+    bool (*run)(sensor_backend_s *backend);
+    void (*destroy)(sensor_backend_s *backend);
+
+    /*where events go, set by the consumer*/
+    track_file_handlers_s handlers;
+    void *user_data;
+};
+
+/*parameters of a generated walk*/
+typedef struct
+{
+    double duration;        /*seconds of walk generated by each run*/
+    double accel_rate;      /*samples per second*/
+    double fix_interval;    /*seconds between fixes*/
+    double cadence;         /*steps per second, 0 to stand still*/
+    double speed;           /*meters per second along heading*/
+    double latitude;        /*start position, degrees*/
+    double longitude;
+    double heading;         /*degrees clockwise from north*/
+    double gps_noise;       /*meters of jitter added to each fix*/
+    unsigned int seed;
+
+} sensor_synth_params_s;
+
+/*a 30 minute walk sampled like the device: 5 Hz accelerometer, a fix every 4 s*/
+#define SENSOR_SYNTH_PARAMS_WALK { \
+	.duration = 1800.0, .accel_rate = 5.0, .fix_interval = 4.0, .cadence = 1.6, .speed = 1.3, \
+	.latitude = 23.7806, .longitude = 90.4070, .heading = 45.0, .gps_noise = 3.0, .seed = 1 }
+
+#if !defined(AR_HOST_BUILD)
+sensor_backend_s *sensor_backend_tizen_create(void);
+#endif
+sensor_backend_s *sensor_backend_replay_create(const char *path);
+sensor_backend_s *sensor_backend_synth_create(const sensor_synth_params_s *params);
+sensor_backend_s *sensor_backend_inject_create(void);
+
+bool sensor_backend_run(sensor_backend_s *backend);
+bool sensor_backend_set_speed(sensor_backend_s *backend, double speed);
+bool sensor_backend_inject_accel(sensor_backend_s *backend, const track_accel_s *sample);
+bool sensor_backend_inject_fix(sensor_backend_s *backend, const track_fix_s *fix);
+void sensor_backend_destroy(sensor_backend_s *backend);
+
+#endif
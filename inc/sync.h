@@ -0,0 +1,20 @@
+#if !defined(_SYNC_H)
+#define _SYNC_H
+
+#include <sqlite3.h>
+#include "sync_proto.h"
+
+#define SYNC_BATCH_ROWS 64
+#define SYNC_PEER_COMPANION "companion"
+
+typedef bool (*sync_stop_callback_t)(void *data);
+
+int sync_push(sqlite3 *db, const char *peer, const char *device_id, sync_transport_s *transport,
+		sync_stop_callback_t stop_callback, void *data);
+
+#if !defined(AR_HOST_BUILD)
+bool sync_start(void);
+void sync_cancel(void);
+#endif
+
+#endif
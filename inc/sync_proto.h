@@ -0,0 +1,73 @@
+#if !defined(_SYNC_PROTO_H)
+#define _SYNC_PROTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Wire format of delta sync. Every frame is a little-endian u32 payload length
+ * followed by the payload, whose first byte is the frame type.
+ *
+ *   HELLO  sender -> receiver  u8 version, u8 id_len, device id
+ *   ACK    receiver -> sender  u32 watermark: highest revision the receiver stored
+ *   BATCH  sender -> receiver  u32 sequence, u16 count, then count records of
+ *                              u8 record length followed by the record fields
+ *
+ * Records carry a length so fields can be appended without breaking older
+ * receivers; they skip whatever follows the fields they know.
+ */
+
+#define SYNC_PROTO_VERSION 1
+#define SYNC_DEVICE_ID_MAX 64
+#define SYNC_BATCH_MAX_RECORDS 256
+#define SYNC_RECORD_SIZE 28
+#define SYNC_FRAME_MAX (16 + SYNC_BATCH_MAX_RECORDS * (1 + SYNC_RECORD_SIZE))
+#define SYNC_ACK_SIZE 5
+
+typedef enum {
+	SYNC_FRAME_HELLO = 1,
+	SYNC_FRAME_ACK = 2,
+	SYNC_FRAME_BATCH = 3,
+} sync_frame_type_e;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t revision;
+    uint32_t date;      /*YYYYMMDD*/
+    float distance;
+    uint32_t steps;
+    float calories;
+    uint32_t fare;
+
+} sync_record_s;
+
+/*byte stream a sync session runs over; every call transfers the whole buffer or fails*/
+typedef struct
+{
+    void *ctx;
+    bool (*send)(void *ctx, const void *buf, size_t len);
+    bool (*recv)(void *ctx, void *buf, size_t len);
+    void (*close)(void *ctx);
+
+} sync_transport_s;
+
+bool sync_transport_unix_connect(sync_transport_s *transport, const char *path);
+bool sync_transport_fd(sync_transport_s *transport, int fd);
+
+bool sync_frame_send(sync_transport_s *transport, const uint8_t *payload, size_t len);
+bool sync_frame_recv(sync_transport_s *transport, uint8_t *payload, size_t capacity, size_t *len);
+
+size_t sync_encode_hello(uint8_t *buf, const char *device_id);
+bool sync_decode_hello(const uint8_t *buf, size_t len, char *device_id);
+size_t sync_encode_ack(uint8_t *buf, uint32_t watermark);
+bool sync_decode_ack(const uint8_t *buf, size_t len, uint32_t *watermark);
+size_t sync_encode_batch(uint8_t *buf, uint32_t sequence, const sync_record_s *records, int count);
+bool sync_decode_batch(const uint8_t *buf, size_t len, uint32_t *sequence, sync_record_s *records, int *count);
+
+bool sync_record_valid(const sync_record_s *record);
+uint32_t sync_date_pack(const char *date);
+void sync_date_unpack(uint32_t date, char *buf, size_t len);
+
+#endif
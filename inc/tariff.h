@@ -0,0 +1,32 @@
+#if !defined(_TARIFF_H)
+#define _TARIFF_H
+
+#include <stdbool.h>
+
+#define TARIFF_MAX_COUNT 32
+
+/*rickshaw rate card: flat base_fare up to base_distance, then per_km for the rest*/
+typedef struct
+{
+    double base_fare;     /*Tk*/
+    double base_distance; /*meters*/
+    double per_km;        /*Tk per kilometer beyond base_distance*/
+
+} tariff_s;
+
+/*totals of one tariff over the stored history*/
+typedef struct
+{
+    double total_fare;   /*Tk the history would have saved at this tariff*/
+    double stored_fare;  /*Tk recorded at save time, for comparison*/
+    int days;
+
+} tariff_result_s;
+
+/*the rate count_fare has used so far: 15 Tk per kilometer, no base fare*/
+extern const tariff_s tariff_default;
+
+int tariff_price(const tariff_s *tariff, double distance);
+bool tariff_simulate_history(const tariff_s *tariffs, int tariff_count, tariff_result_s *results);
+
+#endif
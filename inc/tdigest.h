@@ -0,0 +1,54 @@
+#if !defined(_TDIGEST_H)
+#define _TDIGEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Merging t-digest: a quantile sketch of a stream in fixed space. Values
+ * are buffered and merged into weighted centroids, which are kept small
+ * near the extremes and larger around the median, so tail quantiles stay
+ * accurate. Digests of any number of streams merge into one of their union,
+ * which is what makes per-day digests answer queries over any date range.
+ *
+ * A digest lives in place, without heap memory. Values must have integer
+ * weights for the serialized form.
+ */
+
+#define TDIGEST_COMPRESSION 50.0    /*at most about this many centroids*/
+#define TDIGEST_CENTROIDS 64
+#define TDIGEST_BUFFER 64           /*room for values added between merges*/
+#define TDIGEST_VERSION 1
+
+/*version, count, min, max, centroid count, then per centroid a float mean and a weight*/
+#define TDIGEST_HEADER_SIZE (1 + 4 + 8 + 8 + 2)
+#define TDIGEST_SERIALIZED_MAX (TDIGEST_HEADER_SIZE + TDIGEST_CENTROIDS * 8)
+
+typedef struct
+{
+    double mean;
+    double weight;
+
+} tdigest_centroid_s;
+
+typedef struct
+{
+    tdigest_centroid_s centroids[TDIGEST_CENTROIDS + TDIGEST_BUFFER]; /*merged ones first, then the buffer*/
+    int merged;
+    int buffered;
+    double count;           /*total weight*/
+    double min;
+    double max;
+
+} tdigest_s;
+
+void tdigest_init(tdigest_s *digest);
+void tdigest_add(tdigest_s *digest, double value, double weight);
+void tdigest_merge(tdigest_s *digest, const tdigest_s *other);
+void tdigest_compress(tdigest_s *digest);
+double tdigest_quantile(tdigest_s *digest, double q);
+size_t tdigest_serialize(tdigest_s *digest, uint8_t *buf, size_t len);
+bool tdigest_deserialize(tdigest_s *digest, const uint8_t *buf, size_t len);
+
+#endif
@@ -0,0 +1,148 @@
+#if !defined(_TRACE_H)
+#define _TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Binary event tracing for hot paths.
+ *
+ * A trace point stores a fixed-size record (event id, monotonic timestamp,
+ * up to three numeric arguments) in a ring buffer owned by the calling
+ * thread: no formatting, no locks and no IPC. trace_dump() writes all rings
+ * to a file which tools/tracedump decodes.
+ *
+ * Trace points above TRACE_LEVEL compile to nothing. Release builds
+ * (NDEBUG) keep TRACE_INFO points and drop TRACE_DEBUG ones.
+ */
+
+#define TRACE_LEVEL_OFF 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DEBUG 3
+
+#if !defined(TRACE_LEVEL)
+#if defined(NDEBUG)
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#else
+#define TRACE_LEVEL TRACE_LEVEL_DEBUG
+#endif
+#endif
+
+#define TRACE_RING_RECORDS 4096 /*per thread, power of two*/
+#define TRACE_MAX_THREADS 16
+#define TRACE_FILE_MAGIC 0x52545241 /*"ARTR"*/
+#define TRACE_FILE_VERSION 1
+#define TRACE_FILE_NAME "trace.bin" /*written to the data directory on exit*/
+
+/*
+ * Event table shared with the decoder: id, name and the names of the arguments.
+ * Append new events at the end so older dumps still decode.
+ */
+#define TRACE_EVENT_LIST(X) \
+	X(FIX_ACCURACY,  "fix_accuracy",  "horizontal_m", "vertical_m", NULL) \
+	X(FIX_FIRST,     "fix_first",     "latitude", "longitude", NULL) \
+	X(FIX,           "fix",           "latitude", "longitude", "distance_m") \
+	X(FIX_STILL,     "fix_still",     "latitude", "longitude", "steps") \
+	X(DISTANCE,      "distance",      "total_m", NULL, NULL) \
+	X(FARE,          "fare",          "fare_tk", "total_m", NULL) \
+	X(CALORIES,      "calories",      "kcal", "elapsed_h", "weight_kg") \
+	X(STEP,          "step",          "steps", NULL, NULL) \
+	X(SESSION_START, "session_start", "gps", "accel", NULL) \
+	X(SESSION_STOP,  "session_stop",  "total_m", "steps", NULL) \
+	X(SESSION_SAVE,  "session_save",  "status", "total_m", "fare_tk") \
+	X(STALL,         "stall",         "late_ms", "probe", "inner_probe")
+
+#define TRACE_EVENT_ENUM(id, name, a0, a1, a2) TRACE_EV_##id,
+typedef enum {
+	TRACE_EVENT_LIST(TRACE_EVENT_ENUM)
+	TRACE_EV_COUNT
+} trace_event_e;
+#undef TRACE_EVENT_ENUM
+
+typedef struct
+{
+    uint64_t timestamp;     /*CLOCK_MONOTONIC nanoseconds*/
+    uint16_t event;
+    uint16_t level;
+    uint32_t reserved;
+    double args[3];
+
+} trace_record_s;
+
+typedef struct
+{
+    uint64_t head;          /*records ever written; the newest is at (head - 1) % TRACE_RING_RECORDS*/
+    uint32_t thread;
+    bool in_use;
+    trace_record_s records[TRACE_RING_RECORDS];
+
+} trace_ring_s;
+
+/*dump file: a header, then per ring a trace_file_ring_s followed by its records*/
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t ring_count;
+    int64_t realtime_offset;    /*CLOCK_REALTIME minus CLOCK_MONOTONIC in nanoseconds at dump time*/
+
+} trace_file_header_s;
+
+typedef struct
+{
+    uint32_t thread;
+    uint32_t count;
+    uint64_t head;
+
+} trace_file_ring_s;
+
+/*ring of the calling thread, NULL until its first trace point*/
+extern __thread trace_ring_s *trace_current_ring;
+
+trace_ring_s *trace_ring_attach(void);
+bool trace_dump(const char *path);
+
+static inline void trace_emit(uint16_t level, uint16_t event, double a0, double a1, double a2)
+{
+	trace_ring_s *ring = trace_current_ring;
+	trace_record_s *record;
+	struct timespec ts;
+
+	if (!ring && !(ring = trace_ring_attach()))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	record = &ring->records[ring->head & (TRACE_RING_RECORDS - 1)];
+	record->timestamp = (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+	record->event = event;
+	record->level = level;
+	record->args[0] = a0;
+	record->args[1] = a1;
+	record->args[2] = a2;
+
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR(event, a0, a1, a2) trace_emit(TRACE_LEVEL_ERROR, TRACE_EV_##event, (a0), (a1), (a2))
+#else
+#define TRACE_ERROR(event, a0, a1, a2) ((void) 0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(event, a0, a1, a2) trace_emit(TRACE_LEVEL_INFO, TRACE_EV_##event, (a0), (a1), (a2))
+#else
+#define TRACE_INFO(event, a0, a1, a2) ((void) 0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(event, a0, a1, a2) trace_emit(TRACE_LEVEL_DEBUG, TRACE_EV_##event, (a0), (a1), (a2))
+#else
+#define TRACE_DEBUG(event, a0, a1, a2) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+#if !defined(_TRACK_FILE_H)
+#define _TRACK_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Streaming reader for recorded sensor/GPS tracks.
+ *
+ * Text trace (.trace, .csv), one event per line, '#' starts a comment:
+ *   A,<seconds>,<x>,<y>,<z>                     accelerometer sample in m/s^2
+ *   G,<seconds>,<latitude>,<longitude>[,<accuracy>[,<altitude>]]   GPS fix
+ *
+ * GPX (.gpx): every trkpt/rtept with its optional time and ele.
+ *
+ * Binary recording (.artrk), written by track_writer_*, little endian:
+ *   header  "ARTK", u16 version, u16 flags, f64 time of the first event
+ *   'A'     u32 microseconds since the previous event, f32 x, y, z
+ *   'G'     u32 microseconds since the previous event, f64 latitude, longitude,
+ *           f32 altitude, accuracy
+ * A record type with bit 0x80 set carries no time (delta 0) and is
+ * read back with timestamp 0. Gaps longer than a u32 are bridged by a 'T'
+ * record holding the absolute f64 time of the next event.
+ */
+
+typedef enum {
+	TRACK_FORMAT_UNKNOWN = 0,
+	TRACK_FORMAT_TEXT,
+	TRACK_FORMAT_GPX,
+	TRACK_FORMAT_BINARY,
+} track_format_e;
+
+typedef struct
+{
+    double timestamp; /*seconds, arbitrary epoch*/
+    float x;
+    float y;
+    float z;
+
+} track_accel_s;
+
+typedef struct
+{
+    double timestamp; /*seconds, arbitrary epoch, 0 when the source has none*/
+    double latitude;
+    double longitude;
+    double altitude;
+    double accuracy;  /*horizontal accuracy in meters, 0 when unknown*/
+
+} track_fix_s;
+
+typedef struct
+{
+    void (*accel_cb)(const track_accel_s *sample, void *user_data);
+    void (*fix_cb)(const track_fix_s *fix, void *user_data);
+
+} track_file_handlers_s;
+
+typedef struct
+{
+    size_t bytes;
+    int samples;
+    int fixes;
+    int bad_lines;
+
+} track_file_stats_s;
+
+/*writer of the binary recording*/
+typedef struct track_writer track_writer_s;
+
+track_format_e track_file_format(const char *path);
+bool track_file_read(const char *path, const track_file_handlers_s *handlers, void *user_data,
+		track_file_stats_s *stats);
+
+track_writer_s *track_writer_open(const char *path);
+bool track_writer_accel(track_writer_s *writer, const track_accel_s *sample);
+bool track_writer_fix(track_writer_s *writer, const track_fix_s *fix);
+bool track_writer_close(track_writer_s *writer);
+
+#endif
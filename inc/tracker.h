@@ -0,0 +1,47 @@
+#if !defined(_TRACKER_H)
+#define _TRACKER_H
+
+#include <stdbool.h>
+#include "sensor_backend.h"
+
+/*
+ * The tracking session: step detection, distance, fare and calories from
+ * the events of a sensor backend, and the save to the database at stop.
+ * Runs on the device and, with an offline backend, in a Linux process.
+ * Not thread safe; events must arrive on the thread calling the API.
+ */
+
+/*view updates; any of them may be NULL*/
+typedef struct
+{
+    void (*distance_changed)(double total_distance);
+    void (*steps_changed)(int steps);
+    void (*fare_changed)(int fare);
+    void (*calories_changed)(double calories);
+    void (*saved)(int status);          /*SQLITE_OK or SQLITE_ERROR*/
+
+} tracker_callbacks_s;
+
+/*totals of the running session*/
+typedef struct
+{
+    double distance;        /*meters*/
+    int steps;              /*detected by the accelerometer*/
+    int fare;
+    double calories;
+    double elapsed;         /*seconds since start on the backend's clock*/
+    bool tracking;
+    bool gps_fix;
+
+} tracker_totals_s;
+
+bool tracker_init(sensor_backend_s *backend, const tracker_callbacks_s *callbacks);
+void tracker_finalize(void);
+bool tracker_start(void);
+bool tracker_stop(void);
+bool tracker_location_enabled(void);
+void tracker_set_weight(double weight);
+bool tracker_set_recording(const char *path);
+void tracker_get_totals(tracker_totals_s *totals);
+
+#endif
@@ -0,0 +1,108 @@
+#if !defined(_TRACKER_CORE_H)
+#define _TRACKER_CORE_H
+
+#include <float.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "tdigest.h"
+
+/*
+ * Platform independent part of the tracking pipeline. data.c feeds it from
+ * the Tizen sensor and location callbacks; host tools feed it from trace files.
+ */
+
+#define STEP_LENGTH 0.6 /*meters per step used to derive steps from distance*/
+#define MAX_ACCEL_INIT_VALUE 1000
+#define LAT_UNINITIATED DBL_MAX
+#define LONG_UNINITIATED DBL_MAX
+
+/*acceleration drop detector registering one step per drop below the resting average*/
+typedef struct
+{
+    double prev_acc_av;
+    double init_acc_av;
+
+} step_detector_s;
+
+#define STEP_DETECTOR_INIT { MAX_ACCEL_INIT_VALUE, MAX_ACCEL_INIT_VALUE }
+
+/*accumulates GPS distance only while steps are being made*/
+typedef struct
+{
+    double prev_latitude;
+    double prev_longitude;
+    int prev_steps_count;
+    double total_distance;
+
+} position_filter_s;
+
+#define POSITION_FILTER_INIT { LAT_UNINITIATED, LONG_UNINITIATED, 0, 0.0 }
+
+/*running mean and variance of a stream (Welford), optionally weighted, with its extremes*/
+typedef struct
+{
+    uint32_t count;
+    double weight;          /*sum of the weights, count for unit weights*/
+    double mean;
+    double m2;              /*sum of squared deviations from the mean*/
+    double min;
+    double max;
+
+} running_stat_s;
+
+#define RUNNING_STAT_INIT { 0, 0.0, 0.0, 0.0, DBL_MAX, -DBL_MAX }
+
+#define SESSION_SPLIT_METERS 1000.0
+#define SESSION_SPLITS_MAX 64   /*kilometres with a split time, later ones are only counted*/
+
+/*
+ * Statistics of a session updated with every fix, in the same few
+ * kilobytes however long the session runs. Rates are taken per fix interval
+ * in which the position filter counted distance, that is while walking, and
+ * weighted by its time, pace by its distance, so means are session averages.
+ */
+typedef struct
+{
+    double prev_time;       /*session clock at the previous fix, negative before the first*/
+    int prev_steps_count;
+    double moving_time;     /*s of the intervals counted*/
+    double distance;        /*m counted*/
+    running_stat_s speed;   /*m/s*/
+    running_stat_s pace;    /*s/km*/
+    running_stat_s cadence; /*steps/min*/
+    tdigest_s pace_sketch;  /*the same values, for their quantiles across sessions*/
+    tdigest_s cadence_sketch;
+    double split_start;     /*session clock when the running kilometre began*/
+    int split_count;        /*kilometres completed*/
+    float splits[SESSION_SPLITS_MAX]; /*s each kilometre took, the first SESSION_SPLITS_MAX*/
+
+} session_stats_s;
+
+void step_detector_reset(step_detector_s *detector);
+bool step_detector_feed(step_detector_s *detector, float x, float y, float z);
+
+void position_filter_reset(position_filter_s *filter);
+bool position_filter_has_fix(const position_filter_s *filter);
+bool position_filter_feed(position_filter_s *filter, double latitude, double longitude,
+		double distance, int steps_count);
+
+void running_stat_reset(running_stat_s *stat);
+void running_stat_add(running_stat_s *stat, double value);
+void running_stat_add_weighted(running_stat_s *stat, double value, double weight);
+double running_stat_variance(const running_stat_s *stat);
+double running_stat_max(const running_stat_s *stat);
+
+void session_stats_reset(session_stats_s *stats);
+void session_stats_feed(session_stats_s *stats, double time, double distance, int steps_count);
+
+double tracker_core_distance(double latitude1, double longitude1, double latitude2, double longitude2);
+double tracker_core_calories(double distance, double elapsed_hours, double weight);
+double tracker_core_calories_per_kg(double elapsed_hours);
+
+/*distance dependent part of burnt calories, inline so batch loops over columns vectorize*/
+static inline double tracker_core_calorie_distance_term(double distance_km)
+{
+	return ((0.0215 * distance_km - 0.1765) * distance_km + 0.8710) * distance_km;
+}
+
+#endif
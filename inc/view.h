@@ -15,10 +15,12 @@ void view_set_calories(double calories);
 void view_set_button_callbacks(view_button_clicked_callback_t start_button_clicked_cb,
 		view_button_clicked_callback_t stop_button_clicked_cb,
 		view_button_clicked_callback_t history_button_clicked_cb);
+Evas_Object *view_layout_get(void);
 void view_destroy(void);
 
 Eina_Bool view_settings_create(void *user_data);
 Evas_Object *view_create_settings_layout(Evas_Object *parent);
 Eina_Bool view_history_create(void *data);
+Eina_Bool view_diag_create(void *data);
 
 #endif
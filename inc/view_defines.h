@@ -56,6 +56,7 @@
 #define BTN_STOP_TEXT "Stop"
 #define BTN_HISTORY_TEXT "Show History"
 #define BTN_SAVE_TEXT "Save"
+#define BTN_RESET_TEXT "Reset"
 
 #define GPS_OK_TEXT "GPS OK"
 #define GPS_NOT_DETECTED "No GPS. Enable GPS, Wi-Fi and restart."
@@ -1,14 +1,21 @@
+#include <limits.h>
+#include <pthread.h>
 #include <string.h>
 #include <time.h>
 #include <sqlite3.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
+#if !defined(AR_HOST_BUILD)
 #include <storage.h>
 #include <app_common.h>
-#include <stdio.h>
 #include <dlog.h>
+#endif
 #include "avoidrickshaw.h"
 #include "Sqlitedbhelper.h"
+#include "arena.h"
+#include "db_heap.h"
+#include "memtrack.h"
 
 #define DB_NAME "sample.db"
 #define TABLE_NAME "infoTable"
@@ -20,45 +27,197 @@
 #define COL_STP "Steps"
 #define COL_CAL "Calories"
 #define COL_FARE "Fare"
+#define COL_REV "Revision"
+#define COL_WEIGHT "Weight"             /*kg Calories are computed with, NULL for rows saved before it was kept*/
+#define COL_CAL_KG "CaloriesPerKg"      /*weight term of Calories divided by Weight*/
+
+#define RECALC_TABLE_NAME "recalcTarget"
+
+#define SESSION_TABLE_NAME "sessionTable"
+#define COL_START "StartTime"
+#define COL_DURATION "Duration"
+#define COL_ENERGY "EnergyMah"
+#define COL_SPLIT_COUNT "SplitCount"
+#define COL_SPLITS "Splits"
+
+#define SYNC_TABLE_NAME "syncState"
+#define COL_PEER "Peer"
+#define COL_WATERMARK "Watermark"
+
+#define REVISION_TABLE_NAME "revisionCounter"
+#define COL_LAST "Last"
+
+#define SKETCH_TABLE_NAME "sketchTable"
+#define COL_METRIC "Metric"
+#define COL_SKETCH "Sketch"
+
+#define MAINTENANCE_TABLE_NAME "maintenanceState"
+#define COL_TASK "Task"
+#define COL_LAST_RUN "LastRun"
 
 /***************/
 
 #define BUFLEN 500 /*assume buffer length for query string's size.*/
-
-// Helper functions for counting days between two date of format YYYY-MM-DD
+#define BUSY_TIMEOUT_MS 2000 /*how long a writer waits for another connection's transaction*/
+#define CACHE_SIZE_SQL "PRAGMA cache_size=-256;" /*KiB of page cache per connection*/
+#define BACKUP_SUFFIX ".bak"
+#define BACKUP_RETRY_MS 100 /*pause of the backup while another connection writes*/
+/*local date of the unix time in the first %lld, the day rows are stored under*/
+#define DAY_OF_SQL "date(%lld, 'unixepoch', 'localtime')"
+#define RECALC_TABLE_SQL "CREATE TABLE IF NOT EXISTS "RECALC_TABLE_NAME" ("COL_WEIGHT" REAL NOT NULL);"
+#define SYNC_TABLE_SQL "CREATE TABLE IF NOT EXISTS "SYNC_TABLE_NAME" ("COL_PEER" TEXT PRIMARY KEY, "COL_WATERMARK" INTEGER NOT NULL);"
+/*takes the next revision in a trigger; the counter never goes down, even when rows are deleted*/
+#define NEXT_REVISION_SQL "UPDATE "REVISION_TABLE_NAME" SET "COL_LAST"="COL_LAST"+1; "\
+		"UPDATE "TABLE_NAME" SET "COL_REV"=(SELECT "COL_LAST" FROM "REVISION_TABLE_NAME") WHERE "COL_ID"=NEW."COL_ID"; "
+/*day and month sketch rows of the unix time in the first parameter*/
+#define SKETCH_DAY_SQL "strftime('%Y-%m-%d', ?1, 'unixepoch', 'localtime')"
+#define SKETCH_MONTH_SQL "strftime('%Y-%m', ?1, 'unixepoch', 'localtime')"
+/*a month row YYYY-MM lies within [?2, ?3]*/
+#define SKETCH_MONTH_IN_RANGE(month) month"||'-01'>=?2 AND date("month"||'-01', '+1 month', '-1 day')<=?3"
+
+// Helper for getDays(): leap days from year 0 up to the given month
 int countLeapDays(int m, int y);
-void getNumericDate(int *d, int *m, int *y, const char *day);
-int getDays(const char* day1, const char* day2);
+
+static int migrateRevision(sqlite3 *db, char **ErrMsg);
+static int migrateSessionStats(sqlite3 *db, char **ErrMsg);
+static int migrateCalorieWeight(sqlite3 *db, char **ErrMsg);
+static int mergeSessionSketch(sqlite3 *db, const char *metric, long long start_time, const tdigest_s *sketch);
+
+/*names the sketch rows of each metric are stored under*/
+#define SKETCH_METRIC_NAME(id, name) name,
+static const char *const sketchMetrics[SKETCH_METRIC_COUNT] = { SKETCH_METRIC_LIST(SKETCH_METRIC_NAME) };
+#undef SKETCH_METRIC_NAME
+
+/*session table columns holding the energy event counts*/
+#define ENERGY_COLUMN_DEF(id, name, column, cost) column" INTEGER NOT NULL DEFAULT 0, "
+#define ENERGY_COLUMN_NAME(id, name, column, cost) column", "
+#define ENERGY_COLUMN_PARAM(id, name, column, cost) "?, "
+
+/*session table columns holding the statistics of session_stats_s*/
+#define SESSION_STAT_LIST(X) \
+	X("MovingSeconds",   stats->moving_time) \
+	X("SpeedMean",       (stats->moving_time > 0.0 ? stats->distance / stats->moving_time : 0.0)) \
+	X("SpeedMax",        running_stat_max(&stats->speed)) \
+	X("PaceMean",        stats->pace.mean) \
+	X("PaceVariance",    running_stat_variance(&stats->pace)) \
+	X("CadenceMean",     stats->cadence.mean) \
+	X("CadenceVariance", running_stat_variance(&stats->cadence))
+
+#define SESSION_STAT_DEF(column, value) column" REAL NOT NULL DEFAULT 0, "
+#define SESSION_STAT_ADD(column, value) "ALTER TABLE "SESSION_TABLE_NAME" ADD COLUMN "column" REAL NOT NULL DEFAULT 0; "
+#define SESSION_STAT_NAME(column, value) column", "
+#define SESSION_STAT_PARAM(column, value) "?, "
 
 
 sqlite3 *avoidRickshawDb; /*name of database*/
-QueryData *qrydata;
-int select_row_count = 0;
 int g_row_count = 0;
-char *tmp_date;
+static time_t (*dbClock)(time_t *) = time; /*source of "today" for stored and queried rows*/
 
-/*open database instance*/
-int opendb()
+/**
+ * @brief Replaces the clock that decides which day rows are saved under and
+ * which days are kept, so tools can run days of sessions in minutes.
+ *
+ * @param[in] clock Called like time(), NULL restores time().
+ */
+void setDbClock(time_t (*clock)(time_t *))
+{
+	dbClock = clock ? clock : time;
+}
+
+/*current unix time on the database clock*/
+time_t dbTime(void)
+{
+	return dbClock(NULL);
+}
+
+/*full path of the database file, set once so opening a connection does not allocate*/
+static char dbPath[PATH_MAX];
+static pthread_once_t dbPathOnce = PTHREAD_ONCE_INIT;
+
+static void setDbPath(void)
 {
-     char * dataPath = app_get_data_path(); /*fetched package path available physically in the device*/
-	 int size = strlen(dataPath)+10;
+	char *dataPath = app_get_data_path(); /*fetched package path available physically in the device*/
+
+	snprintf(dbPath, sizeof(dbPath), "%s%s", dataPath, DB_NAME);
+	free(dataPath);
+}
 
-	 char * path = malloc(sizeof(char)*size);
+/**
+ * @brief Prepares the database storage before the first session: SQLite
+ * gets its preallocated heap and the database path is looked up, so the
+ * save path does not allocate. Called once at startup, before any other
+ * function of this file.
+ *
+ * @return Status SQLITE_ERROR if SQLite keeps the system heap, SQLITE_OK otherwise
+ */
+int prepareDbStorage(void)
+{
+	bool reserved = db_heap_init(DB_HEAP_DEFAULT_SIZE);
 
-	 strcpy(path,dataPath);
-	 strncat(path, DB_NAME, size);
+	pthread_once(&dbPathOnce, setDbPath);
 
-	 int ret = sqlite3_open_v2( path , &avoidRickshawDb, SQLITE_OPEN_CREATE|SQLITE_OPEN_READWRITE, NULL);
-	 if(ret != SQLITE_OK)
+	return reserved ? SQLITE_OK : SQLITE_ERROR;
+}
 
-	 free(dataPath);
-	 free(path);
+/*SQL function calorie_distance_term(km), the same polynomial the tracker uses*/
+static void calorieDistanceTermFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	sqlite3_result_double(context, tracker_core_calorie_distance_term(sqlite3_value_double(argv[0])));
+}
 
-	 /*didn't close database instance as this will be handled by caller e.g. insert, delete*/
+/*open a database connection to the app's database file*/
+static int opendb_handle(sqlite3 **db)
+{
+	 pthread_once(&dbPathOnce, setDbPath);
+
+	 /*count page writes and syncs for the energy estimate*/
+	 energy_vfs_register();
+
+	 int ret = sqlite3_open_v2(dbPath, db, SQLITE_OPEN_CREATE|SQLITE_OPEN_READWRITE, NULL);
+
+	 /*background workers may hold the write lock for one chunk; wait for it instead of failing*/
+	 if (ret == SQLITE_OK)
+		 sqlite3_busy_timeout(*db, BUSY_TIMEOUT_MS);
+
+	 /*the default cache of 2 MB outgrows the SQLite heap once vacuum or backup read the whole file*/
+	 if (ret == SQLITE_OK)
+		 ret = sqlite3_exec(*db, CACHE_SIZE_SQL, NULL, 0, NULL);
+
+	 /*splits Calories of day rows saved before their weight was kept*/
+	 if (ret == SQLITE_OK)
+		 ret = sqlite3_create_function(*db, "calorie_distance_term", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+				 calorieDistanceTermFunc, NULL, NULL);
 
 	 return ret;
 }
 
+/*open database instance*/
+int opendb()
+{
+	 /*didn't close database instance as this will be handled by caller e.g. insert, delete*/
+	 return opendb_handle(&avoidRickshawDb);
+}
+
+/**
+ * @brief Opens a private connection for work running outside the main loop.
+ * The shared avoidRickshawDb handle is owned by the main loop and must not be
+ * used from another thread.
+ *
+ * @param[out] db The new connection. Caller closes it with sqlite3_close().
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int openWorkerDb(sqlite3 **db)
+{
+	if (opendb_handle(db) != SQLITE_OK) {
+		sqlite3_close(*db);
+		*db = NULL;
+		return SQLITE_ERROR;
+	}
+
+	return SQLITE_OK;
+}
+
 /**
  * @brief Creates Table for storing app info in Database
  * @return Status SQLITE_ERROR or SQLITE_OK
@@ -80,10 +239,48 @@ int initdb()
 			COL_FARE" INTEGER NOT NULL, " \
 			COL_CAL" REAL NOT NULL, " \
 			COL_STP" INTEGER NOT NULL,"\
-			COL_ID" INTEGER PRIMARY KEY AUTOINCREMENT);";
+			COL_ID" INTEGER PRIMARY KEY AUTOINCREMENT,"\
+			COL_REV" INTEGER NOT NULL DEFAULT 0, "\
+			COL_WEIGHT" REAL, "\
+			COL_CAL_KG" REAL);";
 
    ret = sqlite3_exec(avoidRickshawDb, sql, NULL, 0, &ErrMsg); /*execute query*/
 
+   /*tables created before sync support get the revision column now*/
+   if (ret == SQLITE_OK)
+	   ret = migrateRevision(avoidRickshawDb, &ErrMsg);
+
+   /*and those created before calories kept their weight get its columns*/
+   if (ret == SQLITE_OK)
+	   ret = migrateCalorieWeight(avoidRickshawDb, &ErrMsg);
+
+   if (ret == SQLITE_OK)
+	   ret = sqlite3_exec(avoidRickshawDb, "CREATE TABLE IF NOT EXISTS "\
+			   SESSION_TABLE_NAME" ("\
+			   COL_ID" INTEGER PRIMARY KEY AUTOINCREMENT, "\
+			   COL_DATE" TEXT NOT NULL, "\
+			   COL_START" INTEGER NOT NULL, "\
+			   COL_DURATION" INTEGER NOT NULL, "\
+			   COL_DIST" REAL NOT NULL, "\
+			   ENERGY_EVENT_LIST(ENERGY_COLUMN_DEF)
+			   COL_ENERGY" REAL NOT NULL, "\
+			   SESSION_STAT_LIST(SESSION_STAT_DEF)
+			   COL_SPLIT_COUNT" INTEGER NOT NULL DEFAULT 0, "\
+			   COL_SPLITS" BLOB);", NULL, 0, &ErrMsg);
+
+   /*session tables created before the statistics get their columns now*/
+   if (ret == SQLITE_OK)
+	   ret = migrateSessionStats(avoidRickshawDb, &ErrMsg);
+
+   /*one row per day or month, Info_DATE YYYY-MM-DD or YYYY-MM, and metric*/
+   if (ret == SQLITE_OK)
+	   ret = sqlite3_exec(avoidRickshawDb, "CREATE TABLE IF NOT EXISTS "\
+			   SKETCH_TABLE_NAME" ("\
+			   COL_DATE" TEXT NOT NULL, "\
+			   COL_METRIC" TEXT NOT NULL, "\
+			   COL_SKETCH" BLOB NOT NULL, "\
+			   "PRIMARY KEY ("COL_DATE", "COL_METRIC"));", NULL, 0, &ErrMsg);
+
    if(ret != SQLITE_OK)
    {
 	   dlog_print(DLOG_DEBUG, LOG_TAG, "Table Create Error! [%s]", ErrMsg);
@@ -101,6 +298,293 @@ int initdb()
    return SQLITE_OK;
 }
 
+/**
+ * @brief Adds the Revision column to older tables and installs the triggers
+ * stamping every inserted or changed row with the next revision number.
+ * Delta sync sends rows whose revision is above the peer's watermark.
+ *
+ * Revisions come from a one-row counter that only goes up. Taking the
+ * highest stored revision plus one would hand a number out again once the
+ * row holding it is deleted, possibly at or below a peer's watermark, and
+ * that change would never be sent. The counter starts above every stored
+ * revision and every watermark, so databases stamped the old way move on.
+ */
+static int migrateRevision(sqlite3 *db, char **ErrMsg)
+{
+	sqlite3_stmt *stmt;
+
+	/*preparing a select of the column fails only if the column is missing*/
+	if (sqlite3_prepare_v2(db, "SELECT "COL_REV" FROM "TABLE_NAME" LIMIT 0;", -1, &stmt, NULL) == SQLITE_OK) {
+		sqlite3_finalize(stmt);
+	}
+	else {
+		int ret = sqlite3_exec(db, "ALTER TABLE "TABLE_NAME" ADD COLUMN "COL_REV" INTEGER NOT NULL DEFAULT 0; "\
+				"UPDATE "TABLE_NAME" SET "COL_REV"="COL_ID";", NULL, 0, ErrMsg);
+		if (ret != SQLITE_OK)
+			return ret;
+	}
+
+	return sqlite3_exec(db, "BEGIN; "\
+			SYNC_TABLE_SQL" "\
+			"CREATE TABLE IF NOT EXISTS "REVISION_TABLE_NAME" ("COL_LAST" INTEGER NOT NULL); "\
+			"INSERT INTO "REVISION_TABLE_NAME" SELECT MAX(IFNULL((SELECT MAX("COL_REV") FROM "TABLE_NAME"), 0), "\
+				"IFNULL((SELECT MAX("COL_WATERMARK") FROM "SYNC_TABLE_NAME"), 0)) "\
+				"WHERE NOT EXISTS (SELECT 1 FROM "REVISION_TABLE_NAME"); "\
+			"CREATE INDEX IF NOT EXISTS "TABLE_NAME"_rev ON "TABLE_NAME"("COL_REV"); "\
+			"DROP TRIGGER IF EXISTS "TABLE_NAME"_rev_insert; "\
+			"DROP TRIGGER IF EXISTS "TABLE_NAME"_rev_update; "\
+			"CREATE TRIGGER "TABLE_NAME"_rev_insert AFTER INSERT ON "TABLE_NAME" BEGIN "\
+				NEXT_REVISION_SQL\
+			"END; "\
+			"CREATE TRIGGER "TABLE_NAME"_rev_update AFTER UPDATE OF "\
+					COL_DATE", "COL_DIST", "COL_FARE", "COL_CAL", "COL_STP" ON "TABLE_NAME" BEGIN "\
+				NEXT_REVISION_SQL\
+			"END; "\
+			"COMMIT;", NULL, 0, ErrMsg);
+}
+
+/**
+ * @brief Adds the statistics columns to session tables of older versions;
+ * they are added together, so probing the last one is enough.
+ */
+static int migrateSessionStats(sqlite3 *db, char **ErrMsg)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, "SELECT "COL_SPLITS" FROM "SESSION_TABLE_NAME" LIMIT 0;", -1, &stmt, NULL) == SQLITE_OK) {
+		sqlite3_finalize(stmt);
+		return SQLITE_OK;
+	}
+
+	return sqlite3_exec(db, "BEGIN; "\
+			SESSION_STAT_LIST(SESSION_STAT_ADD)
+			"ALTER TABLE "SESSION_TABLE_NAME" ADD COLUMN "COL_SPLIT_COUNT" INTEGER NOT NULL DEFAULT 0; "\
+			"ALTER TABLE "SESSION_TABLE_NAME" ADD COLUMN "COL_SPLITS" BLOB; "\
+			"COMMIT;", NULL, 0, ErrMsg);
+}
+
+/**
+ * @brief Adds the weight columns to day tables of older versions. Their rows
+ * keep NULL there; the weight term is split off their Calories when a weight
+ * change or a save first needs it.
+ */
+static int migrateCalorieWeight(sqlite3 *db, char **ErrMsg)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, "SELECT "COL_CAL_KG" FROM "TABLE_NAME" LIMIT 0;", -1, &stmt, NULL) == SQLITE_OK) {
+		sqlite3_finalize(stmt);
+		return SQLITE_OK;
+	}
+
+	return sqlite3_exec(db, "BEGIN; "\
+			"ALTER TABLE "TABLE_NAME" ADD COLUMN "COL_WEIGHT" REAL; "\
+			"ALTER TABLE "TABLE_NAME" ADD COLUMN "COL_CAL_KG" REAL; "\
+			"COMMIT;", NULL, 0, ErrMsg);
+}
+
+/**
+ * @brief Stores a finished session with its energy counters and statistics,
+ * and merges its sketches into those of its day, in one transaction.
+ * The split times are stored as little-endian 32 bit milliseconds, one per
+ * kilometre, for the first SESSION_SPLITS_MAX kilometres.
+ *
+ * @param[in] session The session; its day is the local date of start_time.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int insertSession(const SessionData *session)
+{
+	if(opendb() != SQLITE_OK) /*create database instance*/
+		return SQLITE_ERROR;
+
+	const session_stats_s *stats = &session->stats;
+	uint8_t splits[SESSION_SPLITS_MAX * 4];
+	int split_count = stats->split_count < SESSION_SPLITS_MAX ? stats->split_count : SESSION_SPLITS_MAX;
+	sqlite3_stmt *stmt;
+	int ret, column = 1;
+
+	if (sqlite3_exec(avoidRickshawDb, "BEGIN;", NULL, 0, NULL) != SQLITE_OK) {
+		sqlite3_close(avoidRickshawDb);
+		return SQLITE_ERROR;
+	}
+
+	ret = sqlite3_prepare_v2(avoidRickshawDb, "INSERT INTO "SESSION_TABLE_NAME" ("\
+			COL_DATE", "COL_START", "COL_DURATION", "COL_DIST", "\
+			ENERGY_EVENT_LIST(ENERGY_COLUMN_NAME)
+			COL_ENERGY", "\
+			SESSION_STAT_LIST(SESSION_STAT_NAME)
+			COL_SPLIT_COUNT", "COL_SPLITS") VALUES (date(?, 'unixepoch', 'localtime'), ?, ?, ?, "\
+			ENERGY_EVENT_LIST(ENERGY_COLUMN_PARAM)
+			"?, "\
+			SESSION_STAT_LIST(SESSION_STAT_PARAM)
+			"?, ?);", -1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Session insert error [%s]", sqlite3_errmsg(avoidRickshawDb));
+		sqlite3_exec(avoidRickshawDb, "ROLLBACK;", NULL, 0, NULL);
+		sqlite3_close(avoidRickshawDb);
+		return SQLITE_ERROR;
+	}
+
+	sqlite3_bind_int64(stmt, column++, session->start_time);
+	sqlite3_bind_int64(stmt, column++, session->start_time);
+	sqlite3_bind_int(stmt, column++, session->duration);
+	sqlite3_bind_double(stmt, column++, session->distance);
+	for (int e = 0; e < ENERGY_EVENT_COUNT; e++)
+		sqlite3_bind_int64(stmt, column++, session->energy.counts[e]);
+	sqlite3_bind_double(stmt, column++, session->energy.mah);
+
+#define SESSION_STAT_BIND(name, value) sqlite3_bind_double(stmt, column++, value);
+	SESSION_STAT_LIST(SESSION_STAT_BIND)
+#undef SESSION_STAT_BIND
+
+	for (int i = 0; i < split_count; i++) {
+		uint32_t ms = (uint32_t) (stats->splits[i] * 1000.0f + 0.5f);
+
+		splits[4 * i] = ms;
+		splits[4 * i + 1] = ms >> 8;
+		splits[4 * i + 2] = ms >> 16;
+		splits[4 * i + 3] = ms >> 24;
+	}
+	sqlite3_bind_int(stmt, column++, stats->split_count);
+	sqlite3_bind_blob(stmt, column++, splits, 4 * split_count, SQLITE_STATIC);
+
+	ret = (sqlite3_step(stmt) == SQLITE_DONE) ? SQLITE_OK : SQLITE_ERROR;
+	if (ret != SQLITE_OK)
+		dlog_print(DLOG_ERROR, LOG_TAG, "Session insert error [%s]", sqlite3_errmsg(avoidRickshawDb));
+
+	sqlite3_finalize(stmt);
+
+	tdigest_s distance;
+
+	tdigest_init(&distance);
+	tdigest_add(&distance, session->distance, 1.0);
+
+	const tdigest_s *sketches[SKETCH_METRIC_COUNT] = {
+		[SKETCH_PACE] = &stats->pace_sketch,
+		[SKETCH_CADENCE] = &stats->cadence_sketch,
+		[SKETCH_DISTANCE] = &distance,
+	};
+
+	for (int m = 0; m < SKETCH_METRIC_COUNT && ret == SQLITE_OK; m++)
+		ret = mergeSessionSketch(avoidRickshawDb, sketchMetrics[m], session->start_time, sketches[m]);
+
+	if (ret == SQLITE_OK && sqlite3_exec(avoidRickshawDb, "COMMIT;", NULL, 0, NULL) != SQLITE_OK)
+		ret = SQLITE_ERROR;
+	if (ret != SQLITE_OK)
+		sqlite3_exec(avoidRickshawDb, "ROLLBACK;", NULL, 0, NULL);
+
+	sqlite3_close(avoidRickshawDb);
+
+	return ret;
+}
+
+/**
+ * @brief Merges the sketch of a session into the row of its day, and into
+ * the row of its month if that was rolled up already.
+ */
+static int mergeSessionSketch(sqlite3 *db, const char *metric, long long start_time, const tdigest_s *sketch)
+{
+	static const char *const selects[] = {
+		"SELECT "COL_SKETCH" FROM "SKETCH_TABLE_NAME" WHERE "COL_DATE"="SKETCH_DAY_SQL" AND "COL_METRIC"=?2;",
+		"SELECT "COL_SKETCH" FROM "SKETCH_TABLE_NAME" WHERE "COL_DATE"="SKETCH_MONTH_SQL" AND "COL_METRIC"=?2;",
+	};
+	static const char *const stores[] = {
+		"INSERT OR REPLACE INTO "SKETCH_TABLE_NAME" VALUES ("SKETCH_DAY_SQL", ?2, ?3);",
+		"INSERT OR REPLACE INTO "SKETCH_TABLE_NAME" VALUES ("SKETCH_MONTH_SQL", ?2, ?3);",
+	};
+	uint8_t blob[TDIGEST_SERIALIZED_MAX];
+	sqlite3_stmt *stmt;
+	tdigest_s stored;
+	size_t size;
+	bool found;
+
+	for (int period = 0; period < 2; period++) {
+		if (sqlite3_prepare_v2(db, selects[period], -1, &stmt, NULL) != SQLITE_OK)
+			return SQLITE_ERROR;
+
+		sqlite3_bind_int64(stmt, 1, start_time);
+		sqlite3_bind_text(stmt, 2, metric, -1, SQLITE_STATIC);
+		found = sqlite3_step(stmt) == SQLITE_ROW;
+		if (found && !tdigest_deserialize(&stored, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)))
+			dlog_print(DLOG_ERROR, LOG_TAG, "Damaged %s sketch replaced", metric);
+		sqlite3_finalize(stmt);
+
+		/*month rows are made by rollupSketches() only*/
+		if (!found && period)
+			break;
+		if (!found)
+			tdigest_init(&stored);
+
+		tdigest_merge(&stored, sketch);
+		size = tdigest_serialize(&stored, blob, sizeof(blob));
+
+		if (sqlite3_prepare_v2(db, stores[period], -1, &stmt, NULL) != SQLITE_OK)
+			return SQLITE_ERROR;
+
+		sqlite3_bind_int64(stmt, 1, start_time);
+		sqlite3_bind_text(stmt, 2, metric, -1, SQLITE_STATIC);
+		sqlite3_bind_blob(stmt, 3, blob, size, SQLITE_STATIC);
+		found = sqlite3_step(stmt) == SQLITE_DONE;
+		sqlite3_finalize(stmt);
+
+		if (!found) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Sketch save error [%s]", sqlite3_errmsg(db));
+			return SQLITE_ERROR;
+		}
+	}
+
+	return SQLITE_OK;
+}
+
+/**
+ * @brief Merges the stored sketches of a metric over a date range. Months
+ * rolled up and entirely within the range are read as one row.
+ *
+ * @param[in] metric The metric.
+ * @param[in] from_date First day, YYYY-MM-DD.
+ * @param[in] to_date Last day, YYYY-MM-DD.
+ * @param[out] sketch The merged sketch, empty if nothing was stored.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int getSketchRange(sketch_metric_e metric, const char *from_date, const char *to_date, tdigest_s *sketch)
+{
+	sqlite3_stmt *stmt;
+	tdigest_s stored;
+	int ret;
+
+	tdigest_init(sketch);
+
+	if (opendb() != SQLITE_OK)
+		return SQLITE_ERROR;
+
+	ret = sqlite3_prepare_v2(avoidRickshawDb, "SELECT "COL_SKETCH" FROM "SKETCH_TABLE_NAME" AS s WHERE "COL_METRIC"=?1 AND ("\
+			"(length("COL_DATE")=7 AND "SKETCH_MONTH_IN_RANGE(COL_DATE)") OR "\
+			"(length("COL_DATE")=10 AND "COL_DATE" BETWEEN ?2 AND ?3 AND NOT EXISTS (SELECT 1 FROM "SKETCH_TABLE_NAME" AS m "\
+				"WHERE m."COL_METRIC"=?1 AND m."COL_DATE"=substr(s."COL_DATE", 1, 7) AND "SKETCH_MONTH_IN_RANGE("m."COL_DATE)")));",
+			-1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Sketch query error [%s]", sqlite3_errmsg(avoidRickshawDb));
+		sqlite3_close(avoidRickshawDb);
+		return SQLITE_ERROR;
+	}
+
+	sqlite3_bind_text(stmt, 1, sketchMetrics[metric], -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, from_date, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, to_date, -1, SQLITE_STATIC);
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (tdigest_deserialize(&stored, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)))
+			tdigest_merge(sketch, &stored);
+	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_close(avoidRickshawDb);
+
+	return ret == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+}
+
 /*callback for insert operation*/
 static int insertcb(void *NotUsed, int argc, char **argv, char **azColName){
    int i;
@@ -116,13 +600,15 @@ static int insertcb(void *NotUsed, int argc, char **argv, char **azColName){
  * @param[in] distance [float Type]
  * @param[in] steps [int Type]
  * @param[in] calories [float Type]
+ * @param[in] calories_per_kg Weight term of calories divided by weight
+ * @param[in] weight Body weight calories were computed with
  * @param[in] fare [int Type]
  *
  * @return Status SQLITE_ERROR or SQLITE_OK
  * SQLITE_ERROR = 1
  * SQLITE_OK = 0
  */
-int insertIntoDb(float distance, int steps, float calories, int fare)
+int insertIntoDb(float distance, int steps, float calories, float calories_per_kg, double weight, int fare)
 {
 	if(opendb() != SQLITE_OK) /*create database instance*/
 		return SQLITE_ERROR;
@@ -130,8 +616,8 @@ int insertIntoDb(float distance, int steps, float calories, int fare)
 	char sqlbuff[BUFLEN];
 	char *ErrMsg;
 	int ret;
-	/*read system date time using sqlite function*/
-	char* dateTime = "strftime('%Y-%m-%d','now')";
+	/*today in local time, as the history and the session rows use it*/
+	long long now = dbTime();
 
 	/*prepare query for INSERT operation*/
 	snprintf(sqlbuff, BUFLEN, "INSERT INTO "\
@@ -140,9 +626,11 @@ int insertIntoDb(float distance, int steps, float calories, int fare)
 			COL_DIST"," \
 			COL_FARE"," \
 			COL_CAL"," \
-			COL_STP")"\
-			" VALUES(%s, %f, %d, %f, %d);", /*didn't include id as it is autoincrement*/
-					dateTime, distance, fare, calories, steps);
+			COL_STP"," \
+			COL_WEIGHT"," \
+			COL_CAL_KG")"\
+			" VALUES("DAY_OF_SQL", %f, %d, %f, %d, %f, %f);", /*didn't include id as it is autoincrement*/
+					now, distance, fare, calories, steps, weight, calories_per_kg);
 
 	ret = sqlite3_exec(avoidRickshawDb, sqlbuff, insertcb, 0, &ErrMsg); /*execute query*/
 	if (ret != SQLITE_OK)
@@ -159,16 +647,22 @@ int insertIntoDb(float distance, int steps, float calories, int fare)
 /**
  * @brief Update info in Database
  *
+ * Calories are added to the row in SQL rather than written as a total read
+ * before, as a weight recalculation may rewrite them meanwhile. The row is
+ * first brought to the session's weight, so it holds one weight throughout.
+ *
  * @param[in] distance [float Type]
  * @param[in] steps [int Type]
- * @param[in] calories [float Type]
+ * @param[in] calories Calories of the session, added to the row
+ * @param[in] calories_per_kg Weight term of the session's calories divided by weight
+ * @param[in] weight Body weight the session's calories were computed with
  * @param[in] fare [int Type]
  *
  * @return Status SQLITE_ERROR or SQLITE_OK
  * SQLITE_ERROR = 1
  * SQLITE_OK = 0
  */
-int updateInfoDb(float distance, int steps, float calories, int fare)
+int updateInfoDb(float distance, int steps, float calories, float calories_per_kg, double weight, int fare)
 {
 	if(opendb() != SQLITE_OK) /*create database instance*/
 		return SQLITE_ERROR;
@@ -176,19 +670,21 @@ int updateInfoDb(float distance, int steps, float calories, int fare)
 	char sqlbuff[BUFLEN];
 	char *ErrMsg;
 	int ret;
-	/*read system date time using sqlite function*/
-	char* dateTime = "strftime('%Y-%m-%d','now')";
+	/*today in local time, as the history and the session rows use it*/
+	long long now = dbTime();
 
 	/*prepare query for INSERT operation*/
 	snprintf(sqlbuff, BUFLEN, "UPDATE "\
 			TABLE_NAME" SET "\
 			COL_DIST"=%f," \
 			COL_FARE"=%d," \
-			COL_CAL"=%f," \
+			COL_CAL"="COL_CAL"+IFNULL("COL_CAL_KG"*(%f-"COL_WEIGHT"), 0)+%f," \
+			COL_CAL_KG"=IFNULL("COL_CAL_KG", ("COL_CAL"-calorie_distance_term("COL_DIST"/1000.0))/%f)+%f," \
+			COL_WEIGHT"=%f," \
 			COL_STP"=%d"\
 			" WHERE "\
-			COL_DATE"=%s;", /*didn't include id as it is autoincrement*/
-					distance, fare, calories, steps, dateTime);
+			COL_DATE"="DAY_OF_SQL";", /*didn't include id as it is autoincrement*/
+					distance, fare, weight, calories, weight, calories_per_kg, weight, steps, now);
 
 	dlog_print(DLOG_DEBUG, LOG_TAG, "Update query = [%s]", sqlbuff);
 
@@ -204,111 +700,117 @@ int updateInfoDb(float distance, int steps, float calories, int fare)
 	return SQLITE_OK;
 }
 
+/*rows of a select, grown in the caller's arena as the callbacks receive them*/
+typedef struct
+{
+	arena_s *arena;
+	QueryData *rows;
+	int count;      /*rows filled*/
+	int capacity;   /*rows allocated*/
+	char prev_date[sizeof("YYYY-MM-DD")]; /*date of the previous row in selectAllItemcb*/
+
+} SelectRows;
+
+/*makes room for count rows; the rows are the arena's latest block, so this grows in place*/
+static bool reserveRows(SelectRows *sel, int count)
+{
+	QueryData *temp;
+
+	if (count <= sel->capacity)
+		return true;
+
+	temp = arena_resize(sel->arena, sel->rows, sel->capacity * sizeof(QueryData), count * sizeof(QueryData));
+	if (temp == NULL) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot reallocate memory for QueryData");
+		return false;
+	}
+
+	sel->rows = temp;
+	sel->capacity = count;
+
+	return true;
+}
+
+/*store the retrieved elements of a row; SQLite returns data in argv as character pointers*/
+static void storeRow(QueryData *row, int argc, char **argv)
+{
+	strcpy(row->date, argv[0]);
+	row->distance = atof(argv[1]);
+	row->fare = atoi(argv[2]);
+	row->calories = atof(argv[3]);
+	row->steps = atoi(argv[4]);
+	row->id = atoi(argv[5]);
+	row->revision = (argc > 6) ? atoi(argv[6]) : 0;
+}
+
 /***************************************************/
-/*this callback will be called for each row fetched from database. we need to handle retrieved elements for each row manually and store data for further use*/
+/*this callback will be called for each row fetched from database. Days missing between rows are filled with empty rows*/
 static int selectAllItemcb(void *data, int argc, char **argv, char **azColName){
-	/*
-	* SQLite queries return data in argv parameter as  character pointer */
-	/*prepare a temporary structure*/
-	QueryData *temp;
+	SelectRows *sel = data;
 	int dayDiff;
 
-	if (select_row_count == 0)
-		dayDiff = getDays(argv[0], tmp_date) + 1;
+	if (sel->count == 0)
+		dayDiff = getDays(argv[0], sel->prev_date) + 1;
 	else
-		dayDiff = getDays(argv[0], tmp_date);
+		dayDiff = getDays(argv[0], sel->prev_date);
 
 	if (dayDiff > 1) {
-
-		temp = (QueryData*)realloc(qrydata, ((select_row_count + dayDiff) * sizeof(QueryData)));
+		if (!reserveRows(sel, sel->count + dayDiff))
+			return SQLITE_ERROR;
 
 		for(int i = 0; i < dayDiff; i++){
-			strcpy(temp[select_row_count+i].date, "0");
-			temp[select_row_count+i].distance = 0.0;
-			temp[select_row_count+i].fare = 0;
-			temp[select_row_count+i].calories = 0.0;
-			temp[select_row_count+i].steps = 0;
-			temp[select_row_count+i].id = 0;
+			strcpy(sel->rows[sel->count+i].date, "0");
+			sel->rows[sel->count+i].distance = 0.0;
+			sel->rows[sel->count+i].fare = 0;
+			sel->rows[sel->count+i].calories = 0.0;
+			sel->rows[sel->count+i].steps = 0;
+			sel->rows[sel->count+i].id = 0;
 		}
-		select_row_count += dayDiff-1;
-		strcpy(tmp_date, argv[0]);
+		sel->count += dayDiff-1;
 	}
-	else {
-		temp = (QueryData*) realloc(qrydata, ((select_row_count + 1) * sizeof(QueryData)));
-		strcpy(tmp_date, argv[0]);
-	}
-
-	if(temp == NULL){
-		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot reallocate memory for QueryData");
+	else if (!reserveRows(sel, sel->count + 1)) {
 		return SQLITE_ERROR;
 	}
-	else {
-        /*store data into temp structure*/
-		strcpy(temp[select_row_count].date, argv[0]);
-		temp[select_row_count].distance = atof(argv[1]);
-		temp[select_row_count].fare = atoi(argv[2]);
-		temp[select_row_count].calories = atof(argv[3]);
-		temp[select_row_count].steps = atoi(argv[4]);
-		temp[select_row_count].id = atoi(argv[5]);
-
-		qrydata = temp;
-	}
-	temp = NULL;
-	free(temp);
+	snprintf(sel->prev_date, sizeof(sel->prev_date), "%s", argv[0]);
 
-	select_row_count++; /*keep row count*/
+	storeRow(&sel->rows[sel->count], argc, argv);
+	sel->count++; /*keep row count*/
 
 	return SQLITE_OK;
 }
 
-/*this callback will be called for each row fetched from database. we need to handle retrieved elements for each row manually and store data for further use*/
+/*this callback will be called for each row fetched from database*/
 static int selectItemcb(void *data, int argc, char **argv, char **azColName){
-	/*
-	* SQLite queries return data in argv parameter as  character pointer */
-	/*prepare a temporary structure*/
-	QueryData *temp = (QueryData*)realloc(qrydata, ((select_row_count + 1) * sizeof(QueryData)));
+	SelectRows *sel = data;
 
-	if(temp == NULL){
-		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot reallocate memory for QueryData");
+	if (!reserveRows(sel, sel->count + 1))
 		return SQLITE_ERROR;
-	}
-	else {
-        /*store data into temp structure*/
-		strcpy(temp[select_row_count].date, argv[0]);
-		temp[select_row_count].distance = atof(argv[1]);
-		temp[select_row_count].fare = atoi(argv[2]);
-		temp[select_row_count].calories = atof(argv[3]);
-		temp[select_row_count].steps = atoi(argv[4]);
-		temp[select_row_count].id = atoi(argv[5]);
-
-		qrydata = temp;
-	}
-	temp = NULL;
-	free(temp);
 
-	select_row_count++; /*keep row count*/
+	storeRow(&sel->rows[sel->count], argc, argv);
+	sel->count++; /*keep row count*/
 
 	return SQLITE_OK;
 }
 
-/**
- * @brief Gets all data from Database
- */
-int getAllMsgFromDb(QueryData **msg_data, int* num_of_rows)
+/*runs a select into rows allocated from arena; the first row is allocated even when none is found*/
+static int selectRows(arena_s *arena, const char *sql, int (*callback)(void *, int, char **, char **),
+		SelectRows *sel)
 {
-	if(opendb() != SQLITE_OK) /*create database instance*/
-		return SQLITE_ERROR;
-
-	qrydata = (QueryData *) calloc (1, sizeof(QueryData)); /*preparing local querydata struct*/
-
-	char *sql = "SELECT * FROM infoTable ORDER BY ID DESC"; /*select query*/
-	int ret;
 	char *ErrMsg;
-	select_row_count = 0;
+	int ret;
+
+	sel->arena = arena;
+	sel->count = 0;
+	sel->capacity = 1;
+	sel->rows = arena_calloc(arena, 1, sizeof(QueryData)); /*preparing local querydata struct*/
+	if (!sel->rows)
+		return SQLITE_ERROR;
 
-    ret = sqlite3_exec(avoidRickshawDb, sql, selectItemcb, (void*)msg_data, &ErrMsg);
+	if(opendb() != SQLITE_OK) /*create database instance*/
+		return SQLITE_ERROR;
 
-    if (ret != SQLITE_OK)
+	ret = sqlite3_exec(avoidRickshawDb, sql, callback, sel, &ErrMsg);
+	if (ret != SQLITE_OK)
 	{
 	   dlog_print(DLOG_ERROR, LOG_TAG, "Select query execution error [%s]", ErrMsg);
 	   sqlite3_free(ErrMsg);
@@ -317,132 +819,129 @@ int getAllMsgFromDb(QueryData **msg_data, int* num_of_rows)
 	   return SQLITE_ERROR;
 	}
 
-   *msg_data = qrydata;
-   *num_of_rows = select_row_count;
+	sqlite3_close(avoidRickshawDb); /*close db for success case*/
 
-   sqlite3_close(avoidRickshawDb); /*close db for success case*/
-
-   return SQLITE_OK;
+	return SQLITE_OK;
 }
 
-/*
- * @brief Gets data of last 28 days from Database with current date included.
+/**
+ * @brief Gets all data from Database
+ *
+ * @param[in] arena Holds the rows until the caller releases it.
  */
-int getLast28DaysInfo(QueryData **msg_data, int* num_of_rows)
+int getAllMsgFromDb(arena_s *arena, QueryData **msg_data, int* num_of_rows)
 {
-	if(opendb() != SQLITE_OK) /*create database instance*/
-		return SQLITE_ERROR;
+	SelectRows sel = {0, };
 
-	qrydata = (QueryData *) calloc (1, sizeof(QueryData)); /*preparing local querydata struct*/
-
-	char *sql = "SELECT * FROM infoTable WHERE "\
-			COL_DATE" BETWEEN date('now','-27 days')"
-					" AND date('now') ORDER BY ID DESC;";
+	if (selectRows(arena, "SELECT * FROM infoTable ORDER BY ID DESC", selectItemcb, &sel) != SQLITE_OK)
+		return SQLITE_ERROR;
 
-	size_t len = sizeof("YYYY-MM-DD");
-	tmp_date = (char *) calloc(1, len);
-	time_t now = time(NULL);
-	struct tm *t = localtime(&now);
-	strftime(tmp_date, len, "%Y-%m-%d", t);
+	*msg_data = sel.rows;
+	*num_of_rows = sel.count;
 
-	int ret;
-	char *ErrMsg;
-	select_row_count = 0;
+	return SQLITE_OK;
+}
 
-    ret = sqlite3_exec(avoidRickshawDb, sql, selectAllItemcb, (void*)msg_data, &ErrMsg);
+/*
+ * @brief Gets data of last 28 days from Database with current date included.
+ *
+ * @param[in] arena Holds the rows until the caller releases it.
+ */
+int getLast28DaysInfo(arena_s *arena, QueryData **msg_data, int* num_of_rows)
+{
+	SelectRows sel = {0, };
+	char sql[BUFLEN];
+	time_t now = dbTime();
+	struct tm t;
 
-    if (ret != SQLITE_OK)
-	{
-	   dlog_print(DLOG_ERROR, LOG_TAG, "Select query execution error [%s]", ErrMsg);
-	   sqlite3_free(ErrMsg);
-	   sqlite3_close(avoidRickshawDb); /*close db for failed case*/
+	snprintf(sql, BUFLEN, "SELECT * FROM infoTable WHERE "\
+			COL_DATE" BETWEEN date(%lld, 'unixepoch', 'localtime', '-27 days')"
+					" AND "DAY_OF_SQL" ORDER BY ID DESC;", (long long) now, (long long) now);
 
-	   return SQLITE_ERROR;
-	}
+	localtime_r(&now, &t);
+	strftime(sel.prev_date, sizeof(sel.prev_date), "%Y-%m-%d", &t);
 
-   *msg_data = qrydata;
-   *num_of_rows = select_row_count;
-   tmp_date = NULL;
-   free(tmp_date);
+	if (selectRows(arena, sql, selectAllItemcb, &sel) != SQLITE_OK)
+		return SQLITE_ERROR;
 
-   sqlite3_close(avoidRickshawDb); /*close db for success case*/
+	*msg_data = sel.rows;
+	*num_of_rows = sel.count;
 
-   return SQLITE_OK;
+	return SQLITE_OK;
 }
 
 
-int getMsgById(QueryData **msg_data, int id)
+/**
+ * @brief Gets the row with the given ID.
+ *
+ * @param[in] arena Holds the row until the caller releases it.
+ */
+int getMsgById(arena_s *arena, QueryData **msg_data, int id)
 {
-	if(opendb() != SQLITE_OK) /*create database instance*/
-		return SQLITE_ERROR;
-
-	qrydata = (QueryData *) calloc (1, sizeof(QueryData));
-
+	SelectRows sel = {0, };
 	char sql[BUFLEN];
-	snprintf(sql, BUFLEN, "SELECT * FROM infoTable where ID=%d;", id);
-
-	int ret = 0;
-	char *ErrMsg;
-
-    ret = sqlite3_exec(avoidRickshawDb, sql, selectAllItemcb, (void*)msg_data, &ErrMsg);
-	if (ret != SQLITE_OK)
-	{
-	   sqlite3_free(ErrMsg);
-	   sqlite3_close(avoidRickshawDb);
 
-	   return SQLITE_ERROR;
-	}
+	snprintf(sql, BUFLEN, "SELECT * FROM infoTable where ID=%d;", id);
 
-	*msg_data = qrydata;
+	if (selectRows(arena, sql, selectItemcb, &sel) != SQLITE_OK)
+		return SQLITE_ERROR;
 
-	sqlite3_close(avoidRickshawDb); /*close db*/
+	*msg_data = sel.rows;
 
 	return SQLITE_OK;
 }
 
 /**
- * @brief Gets info from Database corresponding to current date
+ * @brief Gets info from Database corresponding to current date. Does not
+ * allocate, as it runs on the save path of a session.
+ *
+ * @param[out] msg_data Caller provided row receiving the day totals.
+ * @param[out] num_of_rows 1 if the day has a row, 0 otherwise.
  *
- * @return SQLITE_OK info for current date is found, SQLITE_ERROR otherwise.
+ * @return SQLITE_OK if the query ran, SQLITE_ERROR otherwise.
  */
-int getMsgByCurrentDate(QueryData **msg_data, int* num_of_rows)
+int getMsgByCurrentDate(QueryData *msg_data, int* num_of_rows)
 {
-	if(opendb() != SQLITE_OK) /*create database instance*/
-			return SQLITE_ERROR;
-
-	qrydata = (QueryData *) calloc (1, sizeof(QueryData)); /*preparing local querydata struct*/
-	char* dateTime = "strftime('%Y-%m-%d','now')";
-
-	char sqlBuff[BUFLEN];
+	sqlite3_stmt *stmt;
+	const unsigned char *date;
 	int ret;
-	char *ErrMsg;
-	select_row_count = 0;
-
-	/*prepare query for SELECT operation*/
-	snprintf(sqlBuff, BUFLEN, "SELECT * FROM infoTable WHERE "\
-			COL_DATE"=%s;", dateTime);
-
 
-	ret = sqlite3_exec(avoidRickshawDb, sqlBuff, selectItemcb, (void*)msg_data, &ErrMsg);
+	*num_of_rows = 0;
 
-	if (ret != SQLITE_OK)
-	{
-	   dlog_print(DLOG_ERROR, LOG_TAG, "Select query execution error [%s]", ErrMsg);
-	   sqlite3_free(ErrMsg);
-	   sqlite3_close(avoidRickshawDb); /*close db for failed case*/
+	if(opendb() != SQLITE_OK) /*create database instance*/
+			return SQLITE_ERROR;
 
-	   return SQLITE_ERROR;
+	if (sqlite3_prepare_v2(avoidRickshawDb, "SELECT "COL_DATE", "COL_DIST", "COL_FARE", "COL_CAL", "COL_STP", "COL_ID", "COL_REV
+			" FROM "TABLE_NAME" WHERE "COL_DATE"=date(?, 'unixepoch', 'localtime') LIMIT 1;", -1, &stmt, NULL) != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Select query error [%s]", sqlite3_errmsg(avoidRickshawDb));
+		sqlite3_close(avoidRickshawDb); /*close db for failed case*/
+		return SQLITE_ERROR;
 	}
 
-   *msg_data = qrydata;
-   *num_of_rows = select_row_count;
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64) dbTime());
+
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_ROW) {
+		date = sqlite3_column_text(stmt, 0);
+		snprintf(msg_data->date, MAX_LEN, "%s", date ? (const char *) date : "");
+		msg_data->distance = (float) sqlite3_column_double(stmt, 1);
+		msg_data->fare = sqlite3_column_int(stmt, 2);
+		msg_data->calories = (float) sqlite3_column_double(stmt, 3);
+		msg_data->steps = sqlite3_column_int(stmt, 4);
+		msg_data->id = sqlite3_column_int(stmt, 5);
+		msg_data->revision = sqlite3_column_int(stmt, 6);
+		*num_of_rows = 1;
+	}
+	else if (ret != SQLITE_DONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Select query execution error [%s]", sqlite3_errmsg(avoidRickshawDb));
+	}
 
-   sqlite3_close(avoidRickshawDb); /*close db for success case*/
+	sqlite3_finalize(stmt);
+	sqlite3_close(avoidRickshawDb); /*close db*/
 
-   return SQLITE_OK;
+	return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
 }
 
-
 static int deletecb(void *data, int argc, char **argv, char **azColName)
 {
    int i;
@@ -485,25 +984,39 @@ int delAllExceptLast28Days()
 	if(opendb() != SQLITE_OK) /*create database instance*/
 		return SQLITE_ERROR;
 
-   char *sql = "DELETE FROM infoTable WHERE "\
-   			COL_DATE" < date('now','-27 days') OR "
-   			COL_DATE" > date('now');";
+	int ret = deleteExpiredRows(avoidRickshawDb);
+
+	sqlite3_close(avoidRickshawDb);
+
+	return ret;
+}
+
+/**
+ * @brief Deletes the day rows outside the last 28 days, on any connection.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int deleteExpiredRows(sqlite3 *db)
+{
+   char sql[BUFLEN];
+   long long now = dbTime();
+
+   snprintf(sql, BUFLEN, "DELETE FROM infoTable WHERE "\
+   			COL_DATE" < date(%lld, 'unixepoch', 'localtime', '-27 days') OR "
+   			COL_DATE" > "DAY_OF_SQL";", now, now);
 
    int counter = 0, ret = 0;
    char *ErrMsg;
 
-   ret = sqlite3_exec(avoidRickshawDb, sql, deletecb, &counter, &ErrMsg);
+   ret = sqlite3_exec(db, sql, deletecb, &counter, &ErrMsg);
    if (ret != SQLITE_OK)
    {
 	  dlog_print(DLOG_ERROR, LOG_TAG, "Delete query execution error [%s]", ErrMsg);
 	  sqlite3_free(ErrMsg);
-	  sqlite3_close(avoidRickshawDb);
 
 	  return SQLITE_ERROR;
    }
 
-   sqlite3_close(avoidRickshawDb);
-
    return SQLITE_OK;
 }
 
@@ -575,6 +1088,527 @@ int getTotalMsgItemsCount(int* num_of_rows)
    return SQLITE_OK;
 }
 
+/**
+ * @brief Counts the day rows whose Calories use another weight than the given one.
+ *
+ * @param[in] db Connection opened with openWorkerDb().
+ * @param[in] weight The weight of the pending recalculation.
+ * @param[out] count Number of rows.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int countCaloriesToReweigh(sqlite3 *db, double weight, int *count)
+{
+	sqlite3_stmt *stmt;
+	int ret;
+
+	*count = 0;
+
+	ret = sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM "TABLE_NAME" WHERE "COL_WEIGHT"!=?;", -1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Count query error [%s]", sqlite3_errmsg(db));
+		return SQLITE_ERROR;
+	}
+	sqlite3_bind_double(stmt, 1, weight);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_ROW)
+		*count = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return ret == SQLITE_ROW ? SQLITE_OK : SQLITE_ERROR;
+}
+
+/**
+ * @brief Reads day number and Distance of every stored row into column arrays,
+ * ordered by date. Day numbers are whole days since the Julian epoch, so
+ * consecutive dates differ by one.
+ *
+ * @param[in] db Connection opened with openWorkerDb().
+ * @param[out] cols Column arrays, released with freeDistanceColumns().
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int getDistanceColumns(sqlite3 *db, DistanceColumns *cols)
+{
+	sqlite3_stmt *stmt;
+	int capacity = 0;
+	int ret;
+
+	memset(cols, 0, sizeof(*cols));
+
+	ret = sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM "TABLE_NAME";", -1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Count query error [%s]", sqlite3_errmsg(db));
+		return SQLITE_ERROR;
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		capacity = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	if (capacity == 0)
+		return SQLITE_OK;
+
+	cols->days = mt_malloc(MT_DB, capacity * sizeof(int));
+	cols->distance = mt_malloc(MT_DB, capacity * sizeof(float));
+	cols->fare = mt_malloc(MT_DB, capacity * sizeof(int));
+	if (!cols->days || !cols->distance || !cols->fare) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot allocate distance columns");
+		freeDistanceColumns(cols);
+		return SQLITE_ERROR;
+	}
+
+	ret = sqlite3_prepare_v2(db, "SELECT CAST(julianday("COL_DATE") AS INTEGER), "COL_DIST", "COL_FARE
+			" FROM "TABLE_NAME" ORDER BY "COL_DATE";", -1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Select query error [%s]", sqlite3_errmsg(db));
+		freeDistanceColumns(cols);
+		return SQLITE_ERROR;
+	}
+
+	while (cols->count < capacity && sqlite3_step(stmt) == SQLITE_ROW) {
+		cols->days[cols->count] = sqlite3_column_int(stmt, 0);
+		cols->distance[cols->count] = (float) sqlite3_column_double(stmt, 1);
+		cols->fare[cols->count] = sqlite3_column_int(stmt, 2);
+		cols->count++;
+	}
+	sqlite3_finalize(stmt);
+
+	return SQLITE_OK;
+}
+
+/**
+ * @brief Releases arrays filled by getDistanceColumns().
+ */
+void freeDistanceColumns(DistanceColumns *cols)
+{
+	mt_free(cols->days);
+	mt_free(cols->distance);
+	mt_free(cols->fare);
+	memset(cols, 0, sizeof(*cols));
+}
+
+/**
+ * @brief Reads the rows changed after the given revision, in revision order.
+ *
+ * @param[in] db Connection opened with openWorkerDb().
+ * @param[in] after_revision Only rows with a greater revision are read.
+ * @param[out] rows Caller provided array receiving the rows.
+ * @param[in] capacity Size of rows.
+ * @param[out] num_of_rows Number of rows read.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int getRowsAfterRevision(sqlite3 *db, int after_revision, QueryData *rows, int capacity, int *num_of_rows)
+{
+	sqlite3_stmt *stmt;
+	const unsigned char *date;
+
+	*num_of_rows = 0;
+
+	if (sqlite3_prepare_v2(db, "SELECT "COL_DATE", "COL_DIST", "COL_FARE", "COL_CAL", "COL_STP", "COL_ID", "COL_REV
+			" FROM "TABLE_NAME" WHERE "COL_REV">? ORDER BY "COL_REV" LIMIT ?;", -1, &stmt, NULL) != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Select query error [%s]", sqlite3_errmsg(db));
+		return SQLITE_ERROR;
+	}
+
+	sqlite3_bind_int(stmt, 1, after_revision);
+	sqlite3_bind_int(stmt, 2, capacity);
+
+	while (*num_of_rows < capacity && sqlite3_step(stmt) == SQLITE_ROW) {
+		QueryData *row = &rows[*num_of_rows];
+
+		date = sqlite3_column_text(stmt, 0);
+		snprintf(row->date, MAX_LEN, "%s", date ? (const char *) date : "");
+		row->distance = (float) sqlite3_column_double(stmt, 1);
+		row->fare = sqlite3_column_int(stmt, 2);
+		row->calories = (float) sqlite3_column_double(stmt, 3);
+		row->steps = sqlite3_column_int(stmt, 4);
+		row->id = sqlite3_column_int(stmt, 5);
+		row->revision = sqlite3_column_int(stmt, 6);
+		(*num_of_rows)++;
+	}
+	sqlite3_finalize(stmt);
+
+	return SQLITE_OK;
+}
+
+/**
+ * @brief Reads the last revision acknowledged by a sync peer, 0 if it never synced.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int getSyncWatermark(sqlite3 *db, const char *peer, int *watermark)
+{
+	sqlite3_stmt *stmt;
+	char *ErrMsg;
+
+	*watermark = 0;
+
+	if (sqlite3_exec(db, SYNC_TABLE_SQL, NULL, 0, &ErrMsg) != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Sync table create error [%s]", ErrMsg);
+		sqlite3_free(ErrMsg);
+		return SQLITE_ERROR;
+	}
+
+	if (sqlite3_prepare_v2(db, "SELECT "COL_WATERMARK" FROM "SYNC_TABLE_NAME" WHERE "COL_PEER"=?;",
+			-1, &stmt, NULL) != SQLITE_OK)
+		return SQLITE_ERROR;
+
+	sqlite3_bind_text(stmt, 1, peer, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		*watermark = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return SQLITE_OK;
+}
+
+/**
+ * @brief Stores the last revision acknowledged by a sync peer.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int setSyncWatermark(sqlite3 *db, const char *peer, int watermark)
+{
+	sqlite3_stmt *stmt;
+	int ret;
+
+	if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO "SYNC_TABLE_NAME" ("COL_PEER", "COL_WATERMARK") VALUES (?, ?);",
+			-1, &stmt, NULL) != SQLITE_OK)
+		return SQLITE_ERROR;
+
+	sqlite3_bind_text(stmt, 1, peer, -1, SQLITE_STATIC);
+	sqlite3_bind_int(stmt, 2, watermark);
+	ret = (sqlite3_step(stmt) == SQLITE_DONE) ? SQLITE_OK : SQLITE_ERROR;
+	sqlite3_finalize(stmt);
+
+	return ret;
+}
+
+/**
+ * @brief Merges the day sketches of each month before the current one into
+ * a month row, a month per transaction. Months rolled up before are skipped;
+ * sessions saved for them later update their month row themselves.
+ *
+ * @param[in] db Connection opened with openWorkerDb().
+ * @param[in] stop Polled between months, may be NULL.
+ * @param[in] data Passed to stop.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int rollupSketches(sqlite3 *db, bool (*stop)(void *data), void *data)
+{
+	uint8_t blob[TDIGEST_SERIALIZED_MAX];
+	char month[sizeof("YYYY-MM")];
+	sqlite3_stmt *stmt;
+	tdigest_s merged, stored;
+	int ret;
+
+	while (!stop || !stop(data)) {
+		if (sqlite3_prepare_v2(db, "SELECT substr("COL_DATE", 1, 7) AS month FROM "SKETCH_TABLE_NAME" "\
+				"WHERE length("COL_DATE")=10 AND month<"SKETCH_MONTH_SQL" AND month NOT IN "\
+				"(SELECT "COL_DATE" FROM "SKETCH_TABLE_NAME" WHERE length("COL_DATE")=7) LIMIT 1;",
+				-1, &stmt, NULL) != SQLITE_OK)
+			return SQLITE_ERROR;
+
+		sqlite3_bind_int64(stmt, 1, dbTime());
+		ret = sqlite3_step(stmt);
+		if (ret == SQLITE_ROW)
+			snprintf(month, sizeof(month), "%s", (const char *) sqlite3_column_text(stmt, 0));
+		sqlite3_finalize(stmt);
+
+		if (ret != SQLITE_ROW)
+			return ret == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+
+		if (sqlite3_exec(db, "BEGIN;", NULL, 0, NULL) != SQLITE_OK)
+			return SQLITE_ERROR;
+
+		for (int m = 0; m < SKETCH_METRIC_COUNT && ret != SQLITE_ERROR; m++) {
+			tdigest_init(&merged);
+
+			if (sqlite3_prepare_v2(db, "SELECT "COL_SKETCH" FROM "SKETCH_TABLE_NAME" "\
+					"WHERE "COL_METRIC"=?1 AND length("COL_DATE")=10 AND substr("COL_DATE", 1, 7)=?2;",
+					-1, &stmt, NULL) != SQLITE_OK) {
+				ret = SQLITE_ERROR;
+				break;
+			}
+
+			sqlite3_bind_text(stmt, 1, sketchMetrics[m], -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 2, month, -1, SQLITE_STATIC);
+			while ((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+				if (tdigest_deserialize(&stored, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)))
+					tdigest_merge(&merged, &stored);
+			sqlite3_finalize(stmt);
+
+			if (ret != SQLITE_DONE) {
+				ret = SQLITE_ERROR;
+				break;
+			}
+
+			/*every metric gets a row, so the month counts as rolled up for all of them*/
+			if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO "SKETCH_TABLE_NAME" VALUES (?1, ?2, ?3);",
+					-1, &stmt, NULL) != SQLITE_OK) {
+				ret = SQLITE_ERROR;
+				break;
+			}
+
+			sqlite3_bind_text(stmt, 1, month, -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 2, sketchMetrics[m], -1, SQLITE_STATIC);
+			sqlite3_bind_blob(stmt, 3, blob, tdigest_serialize(&merged, blob, sizeof(blob)), SQLITE_STATIC);
+			ret = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+			sqlite3_finalize(stmt);
+		}
+
+		if (ret == SQLITE_ERROR || sqlite3_exec(db, "COMMIT;", NULL, 0, NULL) != SQLITE_OK) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Sketch rollup of %s failed [%s]", month, sqlite3_errmsg(db));
+			sqlite3_exec(db, "ROLLBACK;", NULL, 0, NULL);
+			return SQLITE_ERROR;
+		}
+	}
+
+	return SQLITE_OK;
+}
+
+/**
+ * @brief Reads when a maintenance task last completed, 0 if it never did.
+ *
+ * @param[in] db Connection opened with openWorkerDb().
+ * @param[in] task Name of the task.
+ * @param[out] last_run Unix time on the database clock.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int getMaintenanceRun(sqlite3 *db, const char *task, long long *last_run)
+{
+	sqlite3_stmt *stmt;
+	char *ErrMsg;
+
+	*last_run = 0;
+
+	if (sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS "MAINTENANCE_TABLE_NAME" ("\
+			COL_TASK" TEXT PRIMARY KEY, "\
+			COL_LAST_RUN" INTEGER NOT NULL);", NULL, 0, &ErrMsg) != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Maintenance table create error [%s]", ErrMsg);
+		sqlite3_free(ErrMsg);
+		return SQLITE_ERROR;
+	}
+
+	if (sqlite3_prepare_v2(db, "SELECT "COL_LAST_RUN" FROM "MAINTENANCE_TABLE_NAME" WHERE "COL_TASK"=?;",
+			-1, &stmt, NULL) != SQLITE_OK)
+		return SQLITE_ERROR;
+
+	sqlite3_bind_text(stmt, 1, task, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		*last_run = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return SQLITE_OK;
+}
+
+/**
+ * @brief Records that a maintenance task completed.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int setMaintenanceRun(sqlite3 *db, const char *task, long long last_run)
+{
+	sqlite3_stmt *stmt;
+	int ret;
+
+	if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO "MAINTENANCE_TABLE_NAME" ("COL_TASK", "COL_LAST_RUN") VALUES (?, ?);",
+			-1, &stmt, NULL) != SQLITE_OK)
+		return SQLITE_ERROR;
+
+	sqlite3_bind_text(stmt, 1, task, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, last_run);
+	ret = (sqlite3_step(stmt) == SQLITE_DONE) ? SQLITE_OK : SQLITE_ERROR;
+	sqlite3_finalize(stmt);
+
+	return ret;
+}
+
+/**
+ * @brief Copies the database next to itself (sample.db.bak) with the online
+ * backup API, a few pages at a time, so writers are only held off per step.
+ *
+ * @param[in] db Connection opened with openWorkerDb().
+ * @param[in] pages_per_step Pages copied between checks of stop.
+ * @param[in] stop Polled between steps, the copy is abandoned when it returns true. May be NULL.
+ * @param[in] data Passed to stop.
+ *
+ * @return Status SQLITE_OK once the copy is complete, SQLITE_ERROR otherwise
+ */
+int backupDb(sqlite3 *db, int pages_per_step, bool (*stop)(void *data), void *data)
+{
+	char path[PATH_MAX];
+	sqlite3_backup *backup;
+	sqlite3 *copy;
+	int ret;
+
+	pthread_once(&dbPathOnce, setDbPath);
+	if (snprintf(path, sizeof(path), "%s"BACKUP_SUFFIX, dbPath) >= (int) sizeof(path))
+		return SQLITE_ERROR;
+
+	/*the copy spills its pages to the file instead of holding all of them until the end*/
+	if (sqlite3_open_v2(path, &copy, SQLITE_OPEN_CREATE|SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK
+			|| sqlite3_exec(copy, CACHE_SIZE_SQL, NULL, 0, NULL) != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot open backup [%s]", sqlite3_errmsg(copy));
+		sqlite3_close(copy);
+		return SQLITE_ERROR;
+	}
+
+	backup = sqlite3_backup_init(copy, "main", db, "main");
+	if (!backup) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Backup init error [%s]", sqlite3_errmsg(copy));
+		sqlite3_close(copy);
+		return SQLITE_ERROR;
+	}
+
+	do {
+		ret = sqlite3_backup_step(backup, pages_per_step);
+		if (ret == SQLITE_BUSY || ret == SQLITE_LOCKED)
+			sqlite3_sleep(BACKUP_RETRY_MS);
+	} while ((ret == SQLITE_OK || ret == SQLITE_BUSY || ret == SQLITE_LOCKED) && !(stop && stop(data)));
+
+	sqlite3_backup_finish(backup);
+	sqlite3_close(copy);
+
+	return ret == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+}
+
+/**
+ * @brief Reads the weight a pending calorie recalculation brings the day rows to.
+ *
+ * @param[in] db Connection opened with openWorkerDb().
+ * @param[out] weight The weight, 0 if nothing is pending.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int getRecalcTarget(sqlite3 *db, double *weight)
+{
+	sqlite3_stmt *stmt;
+	char *ErrMsg;
+
+	*weight = 0.0;
+
+	if (sqlite3_exec(db, RECALC_TABLE_SQL, NULL, 0, &ErrMsg) != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Recalc table create error [%s]", ErrMsg);
+		sqlite3_free(ErrMsg);
+		return SQLITE_ERROR;
+	}
+
+	if (sqlite3_prepare_v2(db, "SELECT "COL_WEIGHT" FROM "RECALC_TABLE_NAME";", -1, &stmt, NULL) != SQLITE_OK)
+		return SQLITE_ERROR;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		*weight = sqlite3_column_double(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return SQLITE_OK;
+}
+
+/**
+ * @brief Records a weight change for the recalculation, before it is queued,
+ * so it survives an exit. Rows saved before weights were kept get theirs,
+ * old_weight, in the same transaction: no save at the new weight can reach
+ * them first. A later change replaces the target, so changes made while a
+ * recalculation runs combine into one.
+ *
+ * @param[in] old_weight The weight stored calories were computed with.
+ * @param[in] new_weight The weight to recompute them with.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int setRecalcTarget(double old_weight, double new_weight)
+{
+	char sqlbuff[BUFLEN];
+	char *ErrMsg;
+	int ret;
+
+	if (initdb() != SQLITE_OK || opendb() != SQLITE_OK)
+		return SQLITE_ERROR;
+
+	snprintf(sqlbuff, BUFLEN, "BEGIN IMMEDIATE; "\
+			RECALC_TABLE_SQL" "\
+			"UPDATE "TABLE_NAME" SET "COL_CAL_KG"=("COL_CAL"-calorie_distance_term("COL_DIST"/1000.0))/%.17g, "\
+				COL_WEIGHT"=%.17g WHERE "COL_WEIGHT" IS NULL; "\
+			"DELETE FROM "RECALC_TABLE_NAME"; "\
+			"INSERT INTO "RECALC_TABLE_NAME" VALUES(%.17g); "\
+			"COMMIT;", old_weight, old_weight, new_weight);
+
+	ret = sqlite3_exec(avoidRickshawDb, sqlbuff, NULL, 0, &ErrMsg);
+	if (ret != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Recalc target error [%s]", ErrMsg);
+		sqlite3_free(ErrMsg);
+		sqlite3_exec(avoidRickshawDb, "ROLLBACK;", NULL, 0, NULL);
+	}
+
+	sqlite3_close(avoidRickshawDb);
+	return ret == SQLITE_OK ? SQLITE_OK : SQLITE_ERROR;
+}
+
+/**
+ * @brief Clears the recalculation target once every row uses it. A newer
+ * target recorded meanwhile is kept.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int clearRecalcTarget(sqlite3 *db, double weight)
+{
+	sqlite3_stmt *stmt;
+	int ret;
+
+	if (sqlite3_prepare_v2(db, "DELETE FROM "RECALC_TABLE_NAME" WHERE "COL_WEIGHT"=?;", -1, &stmt, NULL) != SQLITE_OK)
+		return SQLITE_ERROR;
+
+	sqlite3_bind_double(stmt, 1, weight);
+	ret = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+	sqlite3_finalize(stmt);
+
+	return ret;
+}
+
+/**
+ * @brief Brings the next chunk of day rows to the given weight. Each row
+ * holds the weight its Calories use, and its weight term per kg, so the
+ * weight term is replaced whatever mix of sessions the day holds. A row
+ * already at the weight, such as one saved since the change, is left alone:
+ * running a chunk again, after an exit or a second change, changes nothing
+ * twice. One UPDATE reads and writes the rows, so a save meanwhile is never
+ * overwritten with a stale value.
+ *
+ * @param[in] db Connection opened with openWorkerDb().
+ * @param[in] weight The weight to compute calories with.
+ * @param[in] limit Most rows in the chunk.
+ * @param[out] rows Number of rows changed, 0 once every row uses the weight.
+ *
+ * @return Status SQLITE_ERROR or SQLITE_OK
+ */
+int reweighCaloriesChunk(sqlite3 *db, double weight, int limit, int *rows)
+{
+	sqlite3_stmt *stmt;
+	int ret;
+
+	*rows = 0;
+
+	ret = sqlite3_prepare_v2(db, "UPDATE "TABLE_NAME" SET "\
+			COL_CAL"="COL_CAL"+"COL_CAL_KG"*(?1-"COL_WEIGHT"), "COL_WEIGHT"=?1 "\
+			"WHERE "COL_ID" IN (SELECT "COL_ID" FROM "TABLE_NAME" WHERE "COL_WEIGHT"!=?1 ORDER BY "COL_ID" LIMIT ?2);",
+			-1, &stmt, NULL);
+	if (ret == SQLITE_OK) {
+		sqlite3_bind_double(stmt, 1, weight);
+		sqlite3_bind_int(stmt, 2, limit);
+		ret = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+		sqlite3_finalize(stmt);
+	}
+
+	if (ret != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Calories update error [%s]", sqlite3_errmsg(db));
+		return SQLITE_ERROR;
+	}
+
+	*rows = sqlite3_changes(db);
+	return SQLITE_OK;
+}
 
 int countLeapDays(int m, int y){
     if (m <= 2)
@@ -584,23 +1618,18 @@ int countLeapDays(int m, int y){
 }
 
 void getNumericDate(int *d, int *m, int *y, const char *day){
-    char *temp = (char *) calloc(1, 5);
+    char temp[5] = {0, };
 
     strncpy(temp, &day[0], 4);
     *y = atoi(temp);
-    temp = NULL;
 
-    temp = calloc(1, 3);
+    memset(temp, 0, sizeof(temp));
     strncpy(temp, &day[5], 2);
     *m = atoi(temp);
-    temp = NULL;
 
-    temp = calloc(1, 3);
+    memset(temp, 0, sizeof(temp));
     strncpy(temp, &day[8], 2);
     *d = atoi(temp);
-
-    temp = NULL;
-    free(temp);
 }
 
 int getDays(const char* day1, const char* day2){
@@ -0,0 +1,145 @@
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+struct arena_chunk {
+	arena_chunk_s *prev;
+	size_t size;    /*usable bytes after the header*/
+	size_t top;     /*bytes carved so far*/
+};
+
+#define ARENA_HEADER_SIZE ARENA_ROUND(sizeof(arena_chunk_s))
+
+static char *_arena_chunk_data(arena_chunk_s *chunk)
+{
+	return (char *) chunk + ARENA_HEADER_SIZE;
+}
+
+/*a new chunk holding at least size bytes, chunk_size for small ones*/
+static arena_chunk_s *_arena_chunk_add(arena_s *arena, size_t size)
+{
+	size_t usable = size > arena->chunk_size ? size : arena->chunk_size;
+	arena_chunk_s *chunk;
+
+	if (usable > SIZE_MAX - ARENA_HEADER_SIZE)
+		return NULL;
+
+	chunk = mt_malloc(arena->tag, ARENA_HEADER_SIZE + usable);
+	if (!chunk)
+		return NULL;
+
+	chunk->prev = arena->chunk;
+	chunk->size = usable;
+	chunk->top = 0;
+	arena->chunk = chunk;
+	arena->reserved += usable;
+	arena->chunks++;
+
+	return chunk;
+}
+
+/**
+ * @brief Prepares an empty arena; no memory is taken before the first allocation.
+ * @param[in] tag The module the chunks are accounted to.
+ * @param[in] chunk_size Usable bytes of a chunk, larger allocations get their own.
+ */
+void arena_init(arena_s *arena, memtrack_tag_e tag, size_t chunk_size)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->tag = tag;
+	arena->chunk_size = chunk_size ? ARENA_ROUND(chunk_size) : ARENA_CHUNK_SIZE;
+}
+
+/**
+ * @brief Allocates size bytes aligned to ARENA_ALIGN, valid until arena_release().
+ * @return The block, NULL if out of memory.
+ */
+void *arena_alloc(arena_s *arena, size_t size)
+{
+	arena_chunk_s *chunk = arena->chunk;
+	char *ptr;
+
+	if (size > SIZE_MAX - ARENA_ALIGN)
+		return NULL;
+
+	size = ARENA_ROUND(size);
+	if ((!chunk || chunk->size - chunk->top < size) && !(chunk = _arena_chunk_add(arena, size)))
+		return NULL;
+
+	ptr = _arena_chunk_data(chunk) + chunk->top;
+	chunk->top += size;
+	arena->used += size;
+	arena->last = ptr;
+
+	return ptr;
+}
+
+void *arena_calloc(arena_s *arena, size_t count, size_t size)
+{
+	void *ptr;
+
+	if (size && count > SIZE_MAX / size)
+		return NULL;
+
+	ptr = arena_alloc(arena, count * size);
+	if (ptr)
+		memset(ptr, 0, count * size);
+
+	return ptr;
+}
+
+/**
+ * @brief Resizes a block like realloc(). The latest allocation grows or
+ * shrinks in place while its chunk has room, so arrays built up row by row
+ * are not copied; other blocks are copied and their old space stays used.
+ * @param[in] ptr A block of this arena, or NULL.
+ * @param[in] old_size The size ptr was allocated or last resized with.
+ * @return The block, NULL if out of memory; ptr is kept then.
+ */
+void *arena_resize(arena_s *arena, void *ptr, size_t old_size, size_t size)
+{
+	arena_chunk_s *chunk = arena->chunk;
+	void *resized;
+
+	if (!ptr)
+		return arena_alloc(arena, size);
+
+	if (ptr == arena->last && size <= SIZE_MAX - ARENA_ALIGN) {
+		size_t offset = (char *) ptr - _arena_chunk_data(chunk);
+
+		if (ARENA_ROUND(size) <= chunk->size - offset) {
+			arena->used += ARENA_ROUND(size);
+			arena->used -= chunk->top - offset;
+			chunk->top = offset + ARENA_ROUND(size);
+			return ptr;
+		}
+	}
+
+	resized = arena_alloc(arena, size);
+	if (resized)
+		memcpy(resized, ptr, old_size < size ? old_size : size);
+
+	return resized;
+}
+
+/**
+ * @brief Frees every chunk and leaves the arena empty for reuse. The arena
+ * may itself live in one of its chunks, it is not touched after that chunk
+ * is freed.
+ */
+void arena_release(arena_s *arena)
+{
+	arena_chunk_s *chunk = arena->chunk;
+	memtrack_tag_e tag = arena->tag;
+	size_t chunk_size = arena->chunk_size;
+
+	arena_init(arena, tag, chunk_size);
+
+	while (chunk) {
+		arena_chunk_s *prev = chunk->prev;
+
+		mt_free(chunk);
+		chunk = prev;
+	}
+}
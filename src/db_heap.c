@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "avoidrickshaw.h"
+#include "db_heap.h"
+#include "memtrack.h"
+
+#define DB_HEAP_CLASSES 33          /*16 bytes to 1 MB*/
+#define DB_HEAP_OVERFLOW 0xffffffffu /*size class of blocks from mt_malloc()*/
+
+/*SQLite wants 8 byte alignment, which the 8 byte header and the class sizes keep*/
+typedef union {
+	struct {
+		uint32_t size_class;
+		uint32_t size;      /*usable size, for overflow blocks*/
+	} info;
+	void *align_ptr;
+	int64_t align_i64;
+	double align_d;
+} db_heap_header_u;
+
+static struct db_heap_info {
+	pthread_mutex_t lock;
+	bool initialized;
+	char *arena;
+	db_heap_header_u *free_lists[DB_HEAP_CLASSES]; /*next block kept in the user area*/
+	db_heap_stats_s stats;
+} s_info = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.initialized = false,
+	.arena = NULL,
+};
+
+/*block size of a class, header included*/
+static size_t _db_heap_class_size(int size_class)
+{
+	return (size_class & 1) ? (size_t) 3 << (size_class / 2 + 3) : (size_t) 1 << (size_class / 2 + 4);
+}
+
+/*smallest class holding size bytes with the header, -1 if none does*/
+static int _db_heap_class(size_t size)
+{
+	size_t total = sizeof(db_heap_header_u) + size;
+
+	for (int size_class = 0; size_class < DB_HEAP_CLASSES; size_class++)
+		if (_db_heap_class_size(size_class) >= total)
+			return size_class;
+
+	return -1;
+}
+
+static int _db_heap_size(void *ptr)
+{
+	db_heap_header_u *header = (db_heap_header_u *) ptr - 1;
+
+	if (!ptr)
+		return 0;
+
+	if (header->info.size_class == DB_HEAP_OVERFLOW)
+		return header->info.size;
+
+	return _db_heap_class_size(header->info.size_class) - sizeof(db_heap_header_u);
+}
+
+/*called with the lock held*/
+static void _db_heap_account(int64_t bytes)
+{
+	s_info.stats.live_bytes += bytes;
+	if (bytes <= 0)
+		return;
+
+	s_info.stats.allocs++;
+	if (s_info.stats.live_bytes > s_info.stats.peak_bytes)
+		s_info.stats.peak_bytes = s_info.stats.live_bytes;
+}
+
+static void *_db_heap_malloc(int size)
+{
+	int size_class = _db_heap_class(size);
+	db_heap_header_u *header = NULL;
+
+	pthread_mutex_lock(&s_info.lock);
+
+	if (size_class >= 0) {
+		header = s_info.free_lists[size_class];
+		if (header) {
+			s_info.free_lists[size_class] = *(db_heap_header_u **) (header + 1);
+		}
+		else if (s_info.stats.arena_size - s_info.stats.arena_used >= _db_heap_class_size(size_class)) {
+			header = (db_heap_header_u *) (s_info.arena + s_info.stats.arena_used);
+			s_info.stats.arena_used += _db_heap_class_size(size_class);
+		}
+	}
+
+	if (header) {
+		header->info.size_class = size_class;
+		_db_heap_account(_db_heap_size(header + 1));
+		pthread_mutex_unlock(&s_info.lock);
+		return header + 1;
+	}
+
+	pthread_mutex_unlock(&s_info.lock);
+
+	header = mt_malloc(MT_DB, sizeof(db_heap_header_u) + size);
+	if (!header)
+		return NULL;
+
+	header->info.size_class = DB_HEAP_OVERFLOW;
+	header->info.size = size;
+
+	pthread_mutex_lock(&s_info.lock);
+	s_info.stats.overflow_allocs++;
+	_db_heap_account(size);
+	pthread_mutex_unlock(&s_info.lock);
+
+	return header + 1;
+}
+
+static void _db_heap_free(void *ptr)
+{
+	db_heap_header_u *header = (db_heap_header_u *) ptr - 1;
+
+	if (!ptr)
+		return;
+
+	pthread_mutex_lock(&s_info.lock);
+	_db_heap_account(-(int64_t) _db_heap_size(ptr));
+
+	if (header->info.size_class == DB_HEAP_OVERFLOW) {
+		pthread_mutex_unlock(&s_info.lock);
+		mt_free(header);
+		return;
+	}
+
+	*(db_heap_header_u **) ptr = s_info.free_lists[header->info.size_class];
+	s_info.free_lists[header->info.size_class] = header;
+	pthread_mutex_unlock(&s_info.lock);
+}
+
+/*keeps the block when it is large enough already; the old block is kept on failure*/
+static void *_db_heap_realloc(void *ptr, int size)
+{
+	void *resized;
+	int old_size = _db_heap_size(ptr);
+
+	if (size <= old_size)
+		return ptr;
+
+	resized = _db_heap_malloc(size);
+	if (!resized)
+		return NULL;
+
+	memcpy(resized, ptr, old_size);
+	_db_heap_free(ptr);
+
+	return resized;
+}
+
+static int _db_heap_roundup(int size)
+{
+	int size_class = _db_heap_class(size);
+
+	if (size_class < 0)
+		return (size + 7) & ~7;
+
+	return _db_heap_class_size(size_class) - sizeof(db_heap_header_u);
+}
+
+static int _db_heap_init_cb(void *data)
+{
+	return SQLITE_OK;
+}
+
+static void _db_heap_shutdown_cb(void *data)
+{
+}
+
+/**
+ * @brief Reserves the arena and makes SQLite allocate from it. Does nothing
+ * when it is installed already.
+ * @param[in] size Bytes of the arena, DB_HEAP_DEFAULT_SIZE suits the app.
+ * @return This function returns 'false' if SQLite was used before or the
+ * arena could not be reserved; SQLite then keeps the system heap.
+ */
+bool db_heap_init(size_t size)
+{
+	static const sqlite3_mem_methods methods = {
+		.xMalloc = _db_heap_malloc,
+		.xFree = _db_heap_free,
+		.xRealloc = _db_heap_realloc,
+		.xSize = _db_heap_size,
+		.xRoundup = _db_heap_roundup,
+		.xInit = _db_heap_init_cb,
+		.xShutdown = _db_heap_shutdown_cb,
+		.pAppData = NULL,
+	};
+	int ret;
+
+	if (s_info.initialized)
+		return true;
+
+	s_info.arena = mt_malloc(MT_DB, size);
+	if (!s_info.arena)
+		return false;
+
+	ret = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+	if (ret != SQLITE_OK) {
+		dlog_print(DLOG_WARN, LOG_TAG, "SQLite keeps the system heap, config failed [%d]", ret);
+		mt_free(s_info.arena);
+		s_info.arena = NULL;
+		return false;
+	}
+
+	s_info.stats.arena_size = size;
+	s_info.initialized = true;
+
+	return true;
+}
+
+/**
+ * @brief Copies the arena counters, all zero before db_heap_init().
+ */
+void db_heap_stats(db_heap_stats_s *stats)
+{
+	pthread_mutex_lock(&s_info.lock);
+	*stats = s_info.stats;
+	pthread_mutex_unlock(&s_info.lock);
+}
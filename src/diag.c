@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if !defined(AR_HOST_BUILD)
+#include <Ecore.h>
+#endif
+#include "avoidrickshaw.h"
+#include "diag.h"
+#include "trace.h"
+
+#define DIAG_PROBE_NAME(id, name) name,
+static const char *s_probe_names[] = {
+	DIAG_PROBE_LIST(DIAG_PROBE_NAME)
+};
+#undef DIAG_PROBE_NAME
+
+static struct diag_info {
+	diag_histogram_s histograms[DIAG_PROBE_COUNT];
+	int depth;
+	/*slowest probes since the last watchdog tick*/
+	int worst_probe;
+	uint64_t worst_us;
+	int worst_inner_probe;
+	uint64_t worst_inner_us;
+	double last_tick;
+	diag_stall_s stalls[DIAG_STALL_HISTORY];
+	int stall_count;    /*ever recorded; the newest is at (stall_count - 1) % DIAG_STALL_HISTORY*/
+#if !defined(AR_HOST_BUILD)
+	Ecore_Timer *watchdog;
+#endif
+} s_info = {
+	.depth = 0,
+	.worst_probe = -1,
+	.worst_inner_probe = -1,
+	.last_tick = 0.0,
+	.stall_count = 0,
+#if !defined(AR_HOST_BUILD)
+	.watchdog = NULL,
+#endif
+};
+
+static uint64_t _diag_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int _diag_bucket(uint64_t us)
+{
+	int bucket = us < 2 ? 0 : 63 - __builtin_clzll(us);
+
+	return bucket < DIAG_BUCKETS ? bucket : DIAG_BUCKETS - 1;
+}
+
+/**
+ * @brief Marks the start of a probed block.
+ * @return The start time to pass to diag_probe_end().
+ */
+uint64_t diag_probe_begin(diag_probe_e probe)
+{
+	s_info.depth++;
+
+	return _diag_now_us();
+}
+
+/**
+ * @brief Records the duration of a probed block in its histogram and
+ * remembers the slowest blocks for stall attribution.
+ */
+void diag_probe_end(diag_probe_e probe, uint64_t start)
+{
+	uint64_t us = _diag_now_us() - start;
+
+	diag_histogram_add(&s_info.histograms[probe], us);
+
+	if (s_info.depth > 0)
+		s_info.depth--;
+
+	if (s_info.depth == 0) {
+		if (s_info.worst_probe < 0 || us > s_info.worst_us) {
+			s_info.worst_probe = probe;
+			s_info.worst_us = us;
+		}
+	}
+	else if (s_info.worst_inner_probe < 0 || us > s_info.worst_inner_us) {
+		s_info.worst_inner_probe = probe;
+		s_info.worst_inner_us = us;
+	}
+}
+
+/**
+ * @brief Records one duration in a histogram, for measurements that do not
+ * fit a probe, like ones spanning several main-loop iterations.
+ */
+void diag_histogram_add(diag_histogram_s *histogram, uint64_t us)
+{
+	histogram->buckets[_diag_bucket(us)]++;
+	histogram->count++;
+	histogram->total_us += us;
+	if (us > histogram->max_us)
+		histogram->max_us = us;
+}
+
+const char *diag_probe_name(diag_probe_e probe)
+{
+	return probe >= 0 && probe < DIAG_PROBE_COUNT ? s_probe_names[probe] : "unknown";
+}
+
+const diag_histogram_s *diag_histogram(diag_probe_e probe)
+{
+	return &s_info.histograms[probe];
+}
+
+/**
+ * @brief Estimates a percentile as the upper bound of the bucket holding it.
+ * @return Microseconds, the recorded maximum for the last bucket.
+ */
+uint64_t diag_histogram_percentile(const diag_histogram_s *histogram, double percentile)
+{
+	uint64_t rank = (uint64_t) (percentile / 100.0 * histogram->count + 0.5);
+	uint64_t seen = 0;
+
+	if (histogram->count == 0)
+		return 0;
+	if (rank < 1)
+		rank = 1;
+
+	for (int i = 0; i < DIAG_BUCKETS - 1; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			uint64_t upper = 2ull << i;
+
+			return upper < histogram->max_us ? upper : histogram->max_us;
+		}
+	}
+
+	return histogram->max_us;
+}
+
+/**
+ * @brief Number of stalls retained, at most DIAG_STALL_HISTORY.
+ */
+int diag_stall_count(void)
+{
+	return s_info.stall_count < DIAG_STALL_HISTORY ? s_info.stall_count : DIAG_STALL_HISTORY;
+}
+
+/**
+ * @brief Gets a retained stall, index 0 being the newest.
+ */
+const diag_stall_s *diag_stall_get(int index)
+{
+	if (index < 0 || index >= diag_stall_count())
+		return NULL;
+
+	return &s_info.stalls[(s_info.stall_count - 1 - index) % DIAG_STALL_HISTORY];
+}
+
+/**
+ * @brief Clears all histograms and stalls.
+ */
+void diag_reset(void)
+{
+	memset(s_info.histograms, 0, sizeof(s_info.histograms));
+	s_info.stall_count = 0;
+	s_info.worst_probe = s_info.worst_inner_probe = -1;
+}
+
+/**
+ * @brief Formats the histograms and recent stalls as text for the diagnostics screen.
+ * @return The length of the text, truncated to len - 1 characters.
+ */
+size_t diag_report(char *buf, size_t len)
+{
+	size_t used = 0;
+
+#define DIAG_APPEND(...) \
+	do { \
+		if (used < len) { \
+			int n = snprintf(buf + used, len - used, __VA_ARGS__); \
+			used += n > 0 ? (size_t) n : 0; \
+		} \
+	} while (0)
+
+	DIAG_APPEND("probe: calls, avg / p50 / p99 / max ms\n");
+
+	for (int p = 0; p < DIAG_PROBE_COUNT; p++) {
+		const diag_histogram_s *h = &s_info.histograms[p];
+
+		if (!h->count)
+			continue;
+
+		DIAG_APPEND("%s: %llu, %.2f / %.2f / %.2f / %.2f\n", s_probe_names[p], (unsigned long long) h->count,
+				h->total_us / 1000.0 / h->count, diag_histogram_percentile(h, 50) / 1000.0,
+				diag_histogram_percentile(h, 99) / 1000.0, h->max_us / 1000.0);
+	}
+
+	DIAG_APPEND("\nstalls over %.0f ms: %d\n", DIAG_STALL_THRESHOLD * 1000, s_info.stall_count);
+
+	for (int i = 0; i < diag_stall_count(); i++) {
+		const diag_stall_s *stall = diag_stall_get(i);
+		time_t time = stall->time;
+		struct tm tm;
+		char clock[16];
+
+		localtime_r(&time, &tm);
+		strftime(clock, sizeof(clock), "%H:%M:%S", &tm);
+
+		DIAG_APPEND("%s %.0f ms in %s", clock, stall->duration * 1000, diag_probe_name(stall->probe));
+		if (stall->probe >= 0)
+			DIAG_APPEND(" (%.0f ms)", stall->probe_duration * 1000);
+		if (stall->inner_probe >= 0)
+			DIAG_APPEND(", slowest inside %s (%.0f ms)", diag_probe_name(stall->inner_probe), stall->inner_duration * 1000);
+		DIAG_APPEND("\n");
+	}
+
+#undef DIAG_APPEND
+
+	return used < len ? used : len - 1;
+}
+
+/**
+ * @brief Checks how late the watchdog tick is. Runs in the main loop, so a late
+ * tick means the loop was blocked; the slowest probe since the previous tick
+ * is blamed.
+ * @param[in] now Monotonic time in seconds.
+ */
+void diag_watchdog_tick(double now)
+{
+	if (s_info.last_tick > 0.0) {
+		double late = now - s_info.last_tick - DIAG_WATCHDOG_INTERVAL;
+
+		if (late > DIAG_STALL_THRESHOLD) {
+			diag_stall_s *stall = &s_info.stalls[s_info.stall_count++ % DIAG_STALL_HISTORY];
+
+			stall->time = time(NULL);
+			stall->duration = late;
+			stall->probe = s_info.worst_probe;
+			stall->probe_duration = s_info.worst_us / 1e6;
+			stall->inner_probe = s_info.worst_inner_probe;
+			stall->inner_duration = s_info.worst_inner_us / 1e6;
+
+			dlog_print(DLOG_WARN, LOG_TAG, "Main loop stalled %.0f ms in %s", late * 1000, diag_probe_name(stall->probe));
+			TRACE_INFO(STALL, late * 1000, stall->probe, stall->inner_probe);
+		}
+	}
+
+	s_info.last_tick = now;
+	s_info.worst_probe = s_info.worst_inner_probe = -1;
+	s_info.worst_us = s_info.worst_inner_us = 0;
+}
+
+#if !defined(AR_HOST_BUILD)
+
+static Eina_Bool _diag_watchdog_cb(void *data)
+{
+	diag_watchdog_tick(ecore_time_get());
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+/**
+ * @brief Starts the stall watchdog. It wakes the main loop every
+ * DIAG_WATCHDOG_INTERVAL, so it only runs while the app is visible.
+ */
+bool diag_watchdog_start(void)
+{
+	if (s_info.watchdog)
+		return true;
+
+	s_info.last_tick = 0.0;
+	s_info.watchdog = ecore_timer_add(DIAG_WATCHDOG_INTERVAL, _diag_watchdog_cb, NULL);
+
+	return s_info.watchdog != NULL;
+}
+
+void diag_watchdog_stop(void)
+{
+	if (!s_info.watchdog)
+		return;
+
+	ecore_timer_del(s_info.watchdog);
+	s_info.watchdog = NULL;
+}
+
+#endif
@@ -0,0 +1,401 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sqlite3.h>
+#if !defined(AR_HOST_BUILD)
+#include <Ecore.h>
+#include <app_preference.h>
+#endif
+#include "avoidrickshaw.h"
+#include "energy.h"
+
+#define ENERGY_VFS_NAME "energy"
+#define ENERGY_COST_KEY_PREFIX "energy_cost_"
+
+uint32_t energy_counters[ENERGY_EVENT_COUNT];
+
+#define ENERGY_EVENT_NAME(id, name, column, cost) name,
+static const char *s_event_names[] = {
+	ENERGY_EVENT_LIST(ENERGY_EVENT_NAME)
+};
+#undef ENERGY_EVENT_NAME
+
+#define ENERGY_EVENT_COST(id, name, column, cost) cost,
+static const double s_default_costs[] = {
+	ENERGY_EVENT_LIST(ENERGY_EVENT_COST)
+};
+#undef ENERGY_EVENT_COST
+
+/*file handle of the counting VFS; the real handle follows it in the same allocation*/
+typedef struct {
+	sqlite3_file base;
+	sqlite3_file *real;
+} energy_file_s;
+
+static struct energy_info {
+	double costs[ENERGY_EVENT_COUNT];  /*microampere-hours per event*/
+	sqlite3_vfs vfs;
+	sqlite3_vfs *real_vfs;
+	pthread_once_t vfs_once;
+	bool vfs_registered;
+#if !defined(AR_HOST_BUILD)
+	Ecore_Idle_Exiter *wakeup_counter;
+#endif
+} s_info = {
+	.costs = {
+#define ENERGY_EVENT_COST(id, name, column, cost) cost,
+		ENERGY_EVENT_LIST(ENERGY_EVENT_COST)
+#undef ENERGY_EVENT_COST
+	},
+	.vfs_once = PTHREAD_ONCE_INIT,
+	.vfs_registered = false,
+#if !defined(AR_HOST_BUILD)
+	.wakeup_counter = NULL,
+#endif
+};
+
+const char *energy_event_name(energy_event_e event)
+{
+	return event < ENERGY_EVENT_COUNT ? s_event_names[event] : "unknown";
+}
+
+/**
+ * @brief Sets the cost of one event in microampere-hours. A negative cost
+ * restores the default.
+ */
+void energy_cost_set(energy_event_e event, double uah)
+{
+	if (event >= ENERGY_EVENT_COUNT)
+		return;
+
+	s_info.costs[event] = uah < 0.0 ? s_default_costs[event] : uah;
+}
+
+double energy_cost_get(energy_event_e event)
+{
+	return event < ENERGY_EVENT_COUNT ? s_info.costs[event] : 0.0;
+}
+
+/**
+ * @brief Applies the cost model to a set of counters.
+ */
+double energy_estimate_mah(const uint32_t counts[ENERGY_EVENT_COUNT])
+{
+	double uah = 0.0;
+
+	for (int e = 0; e < ENERGY_EVENT_COUNT; e++)
+		uah += counts[e] * s_info.costs[e];
+
+	return uah / 1000.0;
+}
+
+#if !defined(AR_HOST_BUILD)
+
+/*reads cost overrides so the model can be tuned without a rebuild*/
+static void _energy_load_costs(void)
+{
+	char key[64];
+
+	for (int e = 0; e < ENERGY_EVENT_COUNT; e++) {
+		bool existing = false;
+		double uah;
+
+		snprintf(key, sizeof(key), ENERGY_COST_KEY_PREFIX"%s", s_event_names[e]);
+		preference_is_existing(key, &existing);
+		if (existing && preference_get_double(key, &uah) == PREFERENCE_ERROR_NONE)
+			energy_cost_set(e, uah);
+	}
+}
+
+/*called each time the main loop wakes up to handle timers, fd events or signals*/
+static Eina_Bool _energy_wakeup_cb(void *data)
+{
+	energy_count(ENERGY_WAKEUP);
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+#endif
+
+/**
+ * @brief Clears the counters for a new session. On the device it also
+ * reloads the cost overrides and starts counting main-loop wakeups.
+ */
+void energy_session_begin(void)
+{
+	for (int e = 0; e < ENERGY_EVENT_COUNT; e++)
+		__atomic_store_n(&energy_counters[e], 0, __ATOMIC_RELAXED);
+
+#if !defined(AR_HOST_BUILD)
+	_energy_load_costs();
+
+	if (!s_info.wakeup_counter)
+		s_info.wakeup_counter = ecore_idle_exiter_add(_energy_wakeup_cb, NULL);
+#endif
+}
+
+/**
+ * @brief Takes the counters of the session and its estimated charge.
+ * Counting goes on until the next energy_session_begin().
+ */
+void energy_session_end(energy_session_s *session)
+{
+#if !defined(AR_HOST_BUILD)
+	if (s_info.wakeup_counter) {
+		ecore_idle_exiter_del(s_info.wakeup_counter);
+		s_info.wakeup_counter = NULL;
+	}
+#endif
+
+	for (int e = 0; e < ENERGY_EVENT_COUNT; e++)
+		session->counts[e] = __atomic_load_n(&energy_counters[e], __ATOMIC_RELAXED);
+	session->mah = energy_estimate_mah(session->counts);
+
+	dlog_print(DLOG_INFO, LOG_TAG, "Session energy estimate: %.3f mAh", session->mah);
+}
+
+/**
+ * @brief Formats the counters of the running session with the charge each
+ * kind of event accounts for.
+ * @return The length of the text, truncated to len - 1 characters.
+ */
+size_t energy_report(char *buf, size_t len)
+{
+	uint32_t counts[ENERGY_EVENT_COUNT];
+	size_t used = 0;
+	int n;
+
+	for (int e = 0; e < ENERGY_EVENT_COUNT; e++)
+		counts[e] = __atomic_load_n(&energy_counters[e], __ATOMIC_RELAXED);
+
+	n = snprintf(buf, len, "energy: %.3f mAh\n", energy_estimate_mah(counts));
+	used += n > 0 ? n : 0;
+
+	for (int e = 0; e < ENERGY_EVENT_COUNT && used < len; e++) {
+		n = snprintf(buf + used, len - used, "%s: %u, %.3f mAh\n", s_event_names[e], counts[e],
+				counts[e] * s_info.costs[e] / 1000.0);
+		used += n > 0 ? n : 0;
+	}
+
+	return used < len ? used : len - 1;
+}
+
+/*
+ * Pass-through VFS. Every call goes to the default VFS; page writes and
+ * syncs are counted on the way.
+ */
+
+static int _energy_close(sqlite3_file *file)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xClose(real);
+}
+
+static int _energy_read(sqlite3_file *file, void *buf, int amount, sqlite3_int64 offset)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xRead(real, buf, amount, offset);
+}
+
+static int _energy_write(sqlite3_file *file, const void *buf, int amount, sqlite3_int64 offset)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	energy_count(ENERGY_DB_WRITE);
+	return real->pMethods->xWrite(real, buf, amount, offset);
+}
+
+static int _energy_truncate(sqlite3_file *file, sqlite3_int64 size)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xTruncate(real, size);
+}
+
+static int _energy_sync(sqlite3_file *file, int flags)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	energy_count(ENERGY_FSYNC);
+	return real->pMethods->xSync(real, flags);
+}
+
+static int _energy_file_size(sqlite3_file *file, sqlite3_int64 *size)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xFileSize(real, size);
+}
+
+static int _energy_lock(sqlite3_file *file, int lock)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xLock(real, lock);
+}
+
+static int _energy_unlock(sqlite3_file *file, int lock)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xUnlock(real, lock);
+}
+
+static int _energy_check_reserved_lock(sqlite3_file *file, int *out)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xCheckReservedLock(real, out);
+}
+
+static int _energy_file_control(sqlite3_file *file, int op, void *arg)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xFileControl(real, op, arg);
+}
+
+static int _energy_sector_size(sqlite3_file *file)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xSectorSize(real);
+}
+
+static int _energy_device_characteristics(sqlite3_file *file)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xDeviceCharacteristics(real);
+}
+
+static int _energy_shm_map(sqlite3_file *file, int page, int page_size, int extend, void volatile **out)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xShmMap(real, page, page_size, extend, out);
+}
+
+static int _energy_shm_lock(sqlite3_file *file, int offset, int n, int flags)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xShmLock(real, offset, n, flags);
+}
+
+static void _energy_shm_barrier(sqlite3_file *file)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	real->pMethods->xShmBarrier(real);
+}
+
+static int _energy_shm_unmap(sqlite3_file *file, int delete_flag)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xShmUnmap(real, delete_flag);
+}
+
+static int _energy_fetch(sqlite3_file *file, sqlite3_int64 offset, int amount, void **out)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xFetch(real, offset, amount, out);
+}
+
+static int _energy_unfetch(sqlite3_file *file, sqlite3_int64 offset, void *page)
+{
+	sqlite3_file *real = ((energy_file_s *) file)->real;
+
+	return real->pMethods->xUnfetch(real, offset, page);
+}
+
+/*one table per version of the real methods, so SQLite sees the same capabilities*/
+#define ENERGY_IO_METHODS(version) { \
+	.iVersion = version, \
+	.xClose = _energy_close, \
+	.xRead = _energy_read, \
+	.xWrite = _energy_write, \
+	.xTruncate = _energy_truncate, \
+	.xSync = _energy_sync, \
+	.xFileSize = _energy_file_size, \
+	.xLock = _energy_lock, \
+	.xUnlock = _energy_unlock, \
+	.xCheckReservedLock = _energy_check_reserved_lock, \
+	.xFileControl = _energy_file_control, \
+	.xSectorSize = _energy_sector_size, \
+	.xDeviceCharacteristics = _energy_device_characteristics, \
+	.xShmMap = version >= 2 ? _energy_shm_map : NULL, \
+	.xShmLock = version >= 2 ? _energy_shm_lock : NULL, \
+	.xShmBarrier = version >= 2 ? _energy_shm_barrier : NULL, \
+	.xShmUnmap = version >= 2 ? _energy_shm_unmap : NULL, \
+	.xFetch = version >= 3 ? _energy_fetch : NULL, \
+	.xUnfetch = version >= 3 ? _energy_unfetch : NULL, \
+}
+
+static const sqlite3_io_methods s_io_methods[] = {
+	ENERGY_IO_METHODS(1),
+	ENERGY_IO_METHODS(2),
+	ENERGY_IO_METHODS(3),
+};
+
+static int _energy_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags, int *out_flags)
+{
+	energy_file_s *wrapper = (energy_file_s *) file;
+	int version;
+	int ret;
+
+	wrapper->real = (sqlite3_file *) &wrapper[1];
+	ret = s_info.real_vfs->xOpen(s_info.real_vfs, name, wrapper->real, flags, out_flags);
+
+	/*SQLite only calls xClose when pMethods is set, so leave it NULL when the real open failed*/
+	if (!wrapper->real->pMethods) {
+		wrapper->base.pMethods = NULL;
+		return ret;
+	}
+
+	version = wrapper->real->pMethods->iVersion;
+	if (version < 1)
+		version = 1;
+	if (version > 3)
+		version = 3;
+	wrapper->base.pMethods = &s_io_methods[version - 1];
+
+	return ret;
+}
+
+static void _energy_vfs_init(void)
+{
+	s_info.real_vfs = sqlite3_vfs_find(NULL);
+	if (!s_info.real_vfs) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "No default SQLite VFS to count writes on");
+		return;
+	}
+
+	/*everything but xOpen goes straight to the default VFS*/
+	s_info.vfs = *s_info.real_vfs;
+	s_info.vfs.pNext = NULL;
+	s_info.vfs.zName = ENERGY_VFS_NAME;
+	s_info.vfs.szOsFile = sizeof(energy_file_s) + s_info.real_vfs->szOsFile;
+	s_info.vfs.xOpen = _energy_open;
+
+	if (sqlite3_vfs_register(&s_info.vfs, 1) != SQLITE_OK) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to register the counting SQLite VFS");
+		return;
+	}
+
+	s_info.vfs_registered = true;
+}
+
+/**
+ * @brief Makes the counting VFS the default one for connections opened afterwards.
+ */
+bool energy_vfs_register(void)
+{
+	pthread_once(&s_info.vfs_once, _energy_vfs_init);
+
+	return s_info.vfs_registered;
+}
@@ -0,0 +1,314 @@
+#include <math.h>
+#include <string.h>
+#include "estimator.h"
+#include "tracker_core.h"
+
+#define PEAK_GRAVITY_ALPHA 0.05     /*smoothing of the gravity estimate per sample*/
+#define PEAK_THRESHOLD 0.8          /*m/s^2 below, then above gravity for a step*/
+#define PEAK_MIN_INTERVAL 0.25      /*seconds, faster than any running cadence*/
+#define ADAPTIVE_MIN_THRESHOLD 0.3
+#define ADAPTIVE_FACTOR 0.5         /*of the average swing around gravity*/
+#define ADAPTIVE_SWING_ALPHA 0.1
+#define ANCHOR_MAX_ACCURACY 30.0    /*meters, worse fixes are dropped*/
+#define ANCHOR_DEFAULT_ACCURACY 5.0 /*for fixes without an accuracy*/
+#define ANCHOR_JITTER_FACTOR 2.0    /*a move shorter than this many accuracies is jitter*/
+
+/*
+ * drop: the tracker's detector, one step per drop below the resting average.
+ */
+
+static void _drop_reset(void *state)
+{
+	step_detector_reset(state);
+}
+
+static bool _drop_feed(void *state, const track_accel_s *sample)
+{
+	return step_detector_feed(state, sample->x, sample->y, sample->z);
+}
+
+static const step_estimator_s _drop_estimator = {
+	.name = "drop",
+	.description = "drop of the axis average below the resting level (tracker)",
+	.state_size = sizeof(step_detector_s),
+	.reset = _drop_reset,
+	.feed = _drop_feed,
+};
+
+/*
+ * peak and adaptive: the magnitude around a slowly tracked gravity has to
+ * swing below and then above a threshold; the rise counts the step.
+ * adaptive scales the threshold with the recent swing, so soft steps on a
+ * wrist still count while hand jitter at rest does not.
+ */
+
+typedef struct {
+	double gravity;
+	double swing;           /*average absolute deviation from gravity*/
+	double last_step;
+	bool armed;
+	bool started;
+} peak_state_s;
+
+static void _peak_reset(void *state)
+{
+	memset(state, 0, sizeof(peak_state_s));
+}
+
+static bool _peak_detect(peak_state_s *peak, const track_accel_s *sample, double threshold, double deviation)
+{
+	if (deviation < -threshold) {
+		peak->armed = true;
+		return false;
+	}
+
+	if (!peak->armed || deviation <= threshold)
+		return false;
+
+	/* Times are optional; without them every rise counts */
+	if (sample->timestamp > 0.0 && peak->last_step > 0.0 &&
+			sample->timestamp - peak->last_step < PEAK_MIN_INTERVAL)
+		return false;
+
+	peak->armed = false;
+	peak->last_step = sample->timestamp;
+	return true;
+}
+
+/*deviation of the magnitude from gravity, which it then follows*/
+static bool _peak_deviation(peak_state_s *peak, const track_accel_s *sample, double *deviation)
+{
+	double magnitude = sqrt((double) sample->x * sample->x + (double) sample->y * sample->y +
+			(double) sample->z * sample->z);
+
+	/* The first sample is taken at rest, as for the tracker's detector */
+	if (!peak->started) {
+		peak->gravity = magnitude;
+		peak->started = true;
+		return false;
+	}
+
+	*deviation = magnitude - peak->gravity;
+	peak->gravity += PEAK_GRAVITY_ALPHA * *deviation;
+	return true;
+}
+
+static bool _peak_feed(void *state, const track_accel_s *sample)
+{
+	peak_state_s *peak = state;
+	double deviation;
+
+	if (!_peak_deviation(peak, sample, &deviation))
+		return false;
+
+	return _peak_detect(peak, sample, PEAK_THRESHOLD, deviation);
+}
+
+static bool _adaptive_feed(void *state, const track_accel_s *sample)
+{
+	peak_state_s *peak = state;
+	double deviation;
+
+	if (!_peak_deviation(peak, sample, &deviation))
+		return false;
+
+	peak->swing += ADAPTIVE_SWING_ALPHA * (fabs(deviation) - peak->swing);
+
+	return _peak_detect(peak, sample, fmax(ADAPTIVE_MIN_THRESHOLD, ADAPTIVE_FACTOR * peak->swing), deviation);
+}
+
+static const step_estimator_s _peak_estimator = {
+	.name = "peak",
+	.description = "magnitude swing around gravity with a fixed threshold",
+	.state_size = sizeof(peak_state_s),
+	.reset = _peak_reset,
+	.feed = _peak_feed,
+};
+
+static const step_estimator_s _adaptive_estimator = {
+	.name = "adaptive",
+	.description = "magnitude swing around gravity, threshold following the swing",
+	.state_size = sizeof(peak_state_s),
+	.reset = _peak_reset,
+	.feed = _adaptive_feed,
+};
+
+/*
+ * gated: the tracker's filter, distance only counts while steps are made.
+ */
+
+static void _gated_reset(void *state)
+{
+	position_filter_reset(state);
+}
+
+static void _gated_feed(void *state, const track_fix_s *fix, int steps_count)
+{
+	position_filter_s *filter = state;
+	double distance = 0.0;
+
+	if (position_filter_has_fix(filter))
+		distance = tracker_core_distance(fix->latitude, fix->longitude,
+				filter->prev_latitude, filter->prev_longitude);
+
+	position_filter_feed(filter, fix->latitude, fix->longitude, distance, steps_count);
+}
+
+static double _gated_distance(const void *state)
+{
+	return ((const position_filter_s *) state)->total_distance;
+}
+
+static const distance_estimator_s _gated_estimator = {
+	.name = "gated",
+	.description = "every fix to fix distance made while stepping (tracker)",
+	.state_size = sizeof(position_filter_s),
+	.reset = _gated_reset,
+	.feed = _gated_feed,
+	.distance = _gated_distance,
+};
+
+/*
+ * raw: every fix to fix distance, the baseline for what gating saves.
+ */
+
+typedef struct {
+	double latitude;
+	double longitude;
+	double accuracy;
+	int steps_count;
+	bool has_fix;
+	double total_distance;
+} path_state_s;
+
+static void _path_reset(void *state)
+{
+	memset(state, 0, sizeof(path_state_s));
+}
+
+static void _raw_feed(void *state, const track_fix_s *fix, int steps_count)
+{
+	path_state_s *path = state;
+
+	if (path->has_fix)
+		path->total_distance += tracker_core_distance(fix->latitude, fix->longitude,
+				path->latitude, path->longitude);
+
+	path->latitude = fix->latitude;
+	path->longitude = fix->longitude;
+	path->has_fix = true;
+}
+
+static double _path_distance(const void *state)
+{
+	return ((const path_state_s *) state)->total_distance;
+}
+
+static const distance_estimator_s _raw_estimator = {
+	.name = "raw",
+	.description = "every fix to fix distance",
+	.state_size = sizeof(path_state_s),
+	.reset = _path_reset,
+	.feed = _raw_feed,
+	.distance = _path_distance,
+};
+
+/*
+ * anchored: gated, but the previous position only moves once a fix is
+ * clearly away from it given both accuracies, so jitter around the true
+ * path is not summed up. Fixes too inaccurate to use are dropped.
+ */
+
+static void _anchored_feed(void *state, const track_fix_s *fix, int steps_count)
+{
+	path_state_s *path = state;
+	double accuracy = fix->accuracy > 0.0 ? fix->accuracy : ANCHOR_DEFAULT_ACCURACY;
+	double distance;
+
+	if (accuracy > ANCHOR_MAX_ACCURACY)
+		return;
+
+	if (!path->has_fix) {
+		distance = 0.0;
+	}
+	else {
+		distance = tracker_core_distance(fix->latitude, fix->longitude, path->latitude, path->longitude);
+		if (distance < ANCHOR_JITTER_FACTOR * fmax(accuracy, path->accuracy))
+			return;
+
+		/* Moved without steps is a ride, only the position follows */
+		if (steps_count > path->steps_count)
+			path->total_distance += distance;
+	}
+
+	path->latitude = fix->latitude;
+	path->longitude = fix->longitude;
+	path->accuracy = accuracy;
+	path->steps_count = steps_count;
+	path->has_fix = true;
+}
+
+static const distance_estimator_s _anchored_estimator = {
+	.name = "anchored",
+	.description = "gated, ignoring moves within the fix accuracy",
+	.state_size = sizeof(path_state_s),
+	.reset = _path_reset,
+	.feed = _anchored_feed,
+	.distance = _path_distance,
+};
+
+/*
+ * steps: no GPS at all, the step count times the step length.
+ */
+
+static void _steps_feed(void *state, const track_fix_s *fix, int steps_count)
+{
+	((path_state_s *) state)->steps_count = steps_count;
+}
+
+static double _steps_distance(const void *state)
+{
+	return ((const path_state_s *) state)->steps_count * STEP_LENGTH;
+}
+
+static const distance_estimator_s _steps_estimator = {
+	.name = "steps",
+	.description = "step count times STEP_LENGTH",
+	.state_size = sizeof(path_state_s),
+	.reset = _path_reset,
+	.feed = _steps_feed,
+	.distance = _steps_distance,
+};
+
+const step_estimator_s *const step_estimators[] = {
+	&_drop_estimator,
+	&_peak_estimator,
+	&_adaptive_estimator,
+	NULL,
+};
+
+const distance_estimator_s *const distance_estimators[] = {
+	&_gated_estimator,
+	&_raw_estimator,
+	&_anchored_estimator,
+	&_steps_estimator,
+	NULL,
+};
+
+const step_estimator_s *step_estimator_find(const char *name)
+{
+	for (int i = 0; step_estimators[i]; i++)
+		if (!strcmp(step_estimators[i]->name, name))
+			return step_estimators[i];
+
+	return NULL;
+}
+
+const distance_estimator_s *distance_estimator_find(const char *name)
+{
+	for (int i = 0; distance_estimators[i]; i++)
+		if (!strcmp(distance_estimators[i]->name, name))
+			return distance_estimators[i];
+
+	return NULL;
+}
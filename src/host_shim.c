@@ -0,0 +1,155 @@
+#if defined(AR_HOST_BUILD)
+
+#include "avoidrickshaw.h"
+
+log_priority host_log_level = DLOG_WARN;
+
+/**
+ * @brief Returns a copy of the data directory, './' unless AR_DATA_PATH is set.
+ * The caller frees the returned string, as with the Tizen API.
+ */
+char *app_get_data_path(void)
+{
+	const char *path = getenv("AR_DATA_PATH");
+
+	return strdup(path ? path : "./");
+}
+
+#if defined(AR_HOST_UI)
+
+#define HOST_UI_KEY_MAX 64
+#define HOST_PREFERENCE_MAX 16
+#define HOST_PREFERENCE_KEY_MAX 64
+
+static struct host_ui_info {
+	struct {
+		Evas_Object *obj;
+		Eext_Callback_Type type;
+		Eext_Event_Cb func;
+		void *data;
+	} keys[HOST_UI_KEY_MAX];
+	int key_count;
+	struct {
+		char key[HOST_PREFERENCE_KEY_MAX];
+		double value;
+	} preferences[HOST_PREFERENCE_MAX];
+	int preference_count;
+	bool exit_requested;
+} s_host_ui = {
+	.key_count = 0,
+	.preference_count = 0,
+	.exit_requested = false,
+};
+
+static void _host_ui_object_del_cb(void *data, Evas *e, Evas_Object *obj, void *event_info)
+{
+	int kept = 0;
+
+	for (int i = 0; i < s_host_ui.key_count; i++)
+		if (s_host_ui.keys[i].obj != obj)
+			s_host_ui.keys[kept++] = s_host_ui.keys[i];
+
+	s_host_ui.key_count = kept;
+}
+
+void eext_object_event_callback_add(Evas_Object *obj, Eext_Callback_Type type, Eext_Event_Cb func, void *data)
+{
+	if (!obj || s_host_ui.key_count == HOST_UI_KEY_MAX)
+		return;
+
+	s_host_ui.keys[s_host_ui.key_count].obj = obj;
+	s_host_ui.keys[s_host_ui.key_count].type = type;
+	s_host_ui.keys[s_host_ui.key_count].func = func;
+	s_host_ui.keys[s_host_ui.key_count].data = data;
+	s_host_ui.key_count++;
+
+	evas_object_event_callback_add(obj, EVAS_CALLBACK_DEL, _host_ui_object_del_cb, NULL);
+}
+
+void eext_naviframe_back_cb(void *data, Evas_Object *obj, void *event_info)
+{
+	/* The pop callback of the last item decides, as on the device */
+	elm_naviframe_item_pop(obj);
+}
+
+void eext_popup_back_cb(void *data, Evas_Object *obj, void *event_info)
+{
+	evas_object_del(obj);
+}
+
+bool host_ui_key(Eext_Callback_Type type)
+{
+	for (int i = s_host_ui.key_count - 1; i >= 0; i--) {
+		if (s_host_ui.keys[i].type == type) {
+			s_host_ui.keys[i].func(s_host_ui.keys[i].data, s_host_ui.keys[i].obj, NULL);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Returns a copy of the resource directory, './res/' unless AR_RES_PATH is set.
+ */
+char *app_get_resource_path(void)
+{
+	const char *path = getenv("AR_RES_PATH");
+
+	return strdup(path ? path : "./res/");
+}
+
+void ui_app_exit(void)
+{
+	s_host_ui.exit_requested = true;
+}
+
+bool host_ui_exit_requested(void)
+{
+	return s_host_ui.exit_requested;
+}
+
+static int _host_preference_find(const char *key)
+{
+	for (int i = 0; i < s_host_ui.preference_count; i++)
+		if (!strcmp(s_host_ui.preferences[i].key, key))
+			return i;
+
+	return -1;
+}
+
+int preference_is_existing(const char *key, bool *existing)
+{
+	*existing = _host_preference_find(key) >= 0;
+	return PREFERENCE_ERROR_NONE;
+}
+
+int preference_get_double(const char *key, double *value)
+{
+	int i = _host_preference_find(key);
+
+	if (i < 0)
+		return PREFERENCE_ERROR_NO_KEY;
+
+	*value = s_host_ui.preferences[i].value;
+	return PREFERENCE_ERROR_NONE;
+}
+
+int preference_set_double(const char *key, double value)
+{
+	int i = _host_preference_find(key);
+
+	if (i < 0) {
+		if (s_host_ui.preference_count == HOST_PREFERENCE_MAX || strlen(key) >= HOST_PREFERENCE_KEY_MAX)
+			return PREFERENCE_ERROR_NO_KEY;
+		i = s_host_ui.preference_count++;
+		strcpy(s_host_ui.preferences[i].key, key);
+	}
+
+	s_host_ui.preferences[i].value = value;
+	return PREFERENCE_ERROR_NONE;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,444 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#if !defined(AR_HOST_BUILD) || defined(AR_HOST_UI)
+#include <Ecore.h>
+#define JOBS_MAIN_LOOP 1 /*callbacks are delivered by the Ecore main loop*/
+#endif
+#include "avoidrickshaw.h"
+#include "jobs.h"
+#include "memtrack.h"
+
+#define JOBS_MAX_WORKERS 8
+
+/*callback waiting for the main loop: a message of jobs_feedback(), or the end of a job*/
+typedef struct job_event {
+	struct job_event *next;
+	job_s *job;
+	void *msg;
+	bool done;
+} job_event_s;
+
+struct job {
+	job_s *next;            /*in its class queue*/
+	job_s *next_running;
+	job_class_e job_class;
+	job_callbacks_s callbacks;
+	void *data;
+	uint64_t submit_us;
+	bool queued;
+	bool running;
+	bool cancelled;
+	job_event_s done_event;
+};
+
+#define JOB_CLASS_NAME(id, name) name,
+static const char *s_class_names[] = {
+	JOB_CLASS_LIST(JOB_CLASS_NAME)
+};
+#undef JOB_CLASS_NAME
+
+static struct jobs_info {
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;  /*a job was queued, a worker got free or the pool is stopping*/
+	pthread_t threads[JOBS_MAX_WORKERS];
+	int workers;
+	int running;
+	bool stopping;
+	job_s *queue_head[JOB_CLASS_COUNT];
+	job_s *queue_tail[JOB_CLASS_COUNT];
+	job_s *running_jobs;
+	int pending;            /*submitted, done callback not run yet; main loop only*/
+	job_event_s *events_head;
+	job_event_s *events_tail;
+	jobs_stats_s stats[JOB_CLASS_COUNT];
+} s_info = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wakeup = PTHREAD_COND_INITIALIZER,
+	.workers = 0,
+	.running = 0,
+	.pending = 0,
+	.stopping = false,
+};
+
+static void *_jobs_worker(void *data);
+
+static uint64_t _jobs_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+#if defined(JOBS_MAIN_LOOP)
+static void _jobs_dispatch_cb(void *data)
+{
+	jobs_dispatch();
+}
+#endif
+
+/*queues a callback for the main loop, called with the lock held*/
+static void _jobs_post(job_event_s *event)
+{
+	bool wake = !s_info.events_head;
+
+	event->next = NULL;
+	if (s_info.events_tail)
+		s_info.events_tail->next = event;
+	else
+		s_info.events_head = event;
+	s_info.events_tail = event;
+
+#if defined(JOBS_MAIN_LOOP)
+	if (wake)
+		ecore_main_loop_thread_safe_call_async(_jobs_dispatch_cb, NULL);
+#else
+	(void) wake;
+#endif
+}
+
+/*takes a queued job out of its queue, called with the lock held*/
+static void _jobs_unqueue(job_s *job)
+{
+	job_s **link = &s_info.queue_head[job->job_class];
+	job_s *prev = NULL;
+
+	while (*link && *link != job) {
+		prev = *link;
+		link = &(*link)->next;
+	}
+	if (!*link)
+		return;
+
+	*link = job->next;
+	if (s_info.queue_tail[job->job_class] == job)
+		s_info.queue_tail[job->job_class] = prev;
+
+	job->queued = false;
+	s_info.stats[job->job_class].queued--;
+}
+
+/*next job a free worker may start, NULL if none; called with the lock held*/
+static job_s *_jobs_next(void)
+{
+	for (int job_class = 0; job_class < JOB_CLASS_COUNT; job_class++) {
+		job_s *job = s_info.queue_head[job_class];
+
+		if (!job)
+			continue;
+
+		/*keep the last free worker for interactive and normal jobs*/
+		if (job_class == JOB_IDLE && s_info.workers > 1 && s_info.workers - s_info.running <= 1)
+			return NULL;
+
+		_jobs_unqueue(job);
+		return job;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Starts the worker threads. Does nothing if they run already.
+ * @param[in] workers Number of threads, JOBS_DEFAULT_WORKERS suits the app.
+ * @return This function returns 'false' if no thread could be started.
+ */
+bool jobs_init(int workers)
+{
+	if (s_info.workers)
+		return true;
+
+	if (workers < 1)
+		workers = 1;
+	if (workers > JOBS_MAX_WORKERS)
+		workers = JOBS_MAX_WORKERS;
+
+	s_info.stopping = false;
+
+	for (int i = 0; i < workers; i++) {
+		if (pthread_create(&s_info.threads[i], NULL, _jobs_worker, NULL) != 0) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Cannot start job worker %d", i);
+			break;
+		}
+		s_info.workers++;
+	}
+
+	return s_info.workers > 0;
+}
+
+/**
+ * @brief Cancels every job, waits for the running ones to return and runs
+ * the remaining callbacks in the calling thread. Meant for application exit.
+ */
+void jobs_shutdown(void)
+{
+	int workers;
+
+	pthread_mutex_lock(&s_info.lock);
+	s_info.stopping = true;
+
+	for (int job_class = 0; job_class < JOB_CLASS_COUNT; job_class++) {
+		while (s_info.queue_head[job_class]) {
+			job_s *job = s_info.queue_head[job_class];
+
+			_jobs_unqueue(job);
+			job->cancelled = true;
+			s_info.stats[job_class].cancelled++;
+			_jobs_post(&job->done_event);
+		}
+	}
+
+	for (job_s *job = s_info.running_jobs; job; job = job->next_running) {
+		if (!job->cancelled)
+			s_info.stats[job->job_class].cancelled++;
+		__atomic_store_n(&job->cancelled, true, __ATOMIC_RELAXED);
+	}
+
+	pthread_cond_broadcast(&s_info.wakeup);
+	workers = s_info.workers;
+	pthread_mutex_unlock(&s_info.lock);
+
+	for (int i = 0; i < workers; i++)
+		pthread_join(s_info.threads[i], NULL);
+
+	s_info.workers = 0;
+	jobs_dispatch();
+}
+
+/**
+ * @brief Queues a job.
+ * @param[in] job_class Priority of the job.
+ * @param[in] callbacks The run callback and the optional main-loop ones, copied.
+ * @param[in] data Passed to every callback.
+ * @return The job, NULL if the pool is not running or out of memory.
+ */
+job_s *jobs_submit(job_class_e job_class, const job_callbacks_s *callbacks, void *data)
+{
+	job_s *job;
+
+	if (job_class >= JOB_CLASS_COUNT || !callbacks->run || !s_info.workers)
+		return NULL;
+
+	job = mt_calloc(MT_JOBS, 1, sizeof(job_s));
+	if (!job)
+		return NULL;
+
+	job->job_class = job_class;
+	job->callbacks = *callbacks;
+	job->data = data;
+	job->done_event.job = job;
+	job->done_event.done = true;
+	job->queued = true;
+
+	pthread_mutex_lock(&s_info.lock);
+	job->submit_us = _jobs_now_us();
+	if (s_info.queue_tail[job_class])
+		s_info.queue_tail[job_class]->next = job;
+	else
+		s_info.queue_head[job_class] = job;
+	s_info.queue_tail[job_class] = job;
+	s_info.stats[job_class].queued++;
+	s_info.stats[job_class].submitted++;
+	pthread_cond_signal(&s_info.wakeup);
+	pthread_mutex_unlock(&s_info.lock);
+
+	s_info.pending++;
+
+	return job;
+}
+
+/**
+ * @brief Cancels a job. A queued job never runs, a running one sees
+ * jobs_cancelled() return 'true'. Its done callback still runs, asynchronously,
+ * with cancelled set unless the job had already returned.
+ */
+void jobs_cancel(job_s *job)
+{
+	pthread_mutex_lock(&s_info.lock);
+
+	if (job->queued) {
+		_jobs_unqueue(job);
+		job->cancelled = true;
+		s_info.stats[job->job_class].cancelled++;
+		_jobs_post(&job->done_event);
+	}
+	else if (job->running && !job->cancelled) {
+		__atomic_store_n(&job->cancelled, true, __ATOMIC_RELAXED);
+		s_info.stats[job->job_class].cancelled++;
+	}
+
+	pthread_mutex_unlock(&s_info.lock);
+}
+
+/**
+ * @brief Checks from the run callback whether the job should return early.
+ */
+bool jobs_cancelled(job_s *job)
+{
+	return __atomic_load_n(&job->cancelled, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sends a message from the run callback to the notify callback.
+ * @return This function returns 'false' if out of memory; msg is not
+ * delivered then and stays the caller's.
+ */
+bool jobs_feedback(job_s *job, void *msg)
+{
+	job_event_s *event = mt_calloc(MT_JOBS, 1, sizeof(job_event_s));
+
+	if (!event)
+		return false;
+
+	event->job = job;
+	event->msg = msg;
+
+	pthread_mutex_lock(&s_info.lock);
+	_jobs_post(event);
+	pthread_mutex_unlock(&s_info.lock);
+
+	return true;
+}
+
+/**
+ * @brief Runs the notify and done callbacks waiting for the main loop, in
+ * the order they were posted. The app's main loop calls it by itself;
+ * tools without one call it from their own loop.
+ */
+void jobs_dispatch(void)
+{
+	job_event_s *event;
+
+	pthread_mutex_lock(&s_info.lock);
+	event = s_info.events_head;
+	s_info.events_head = NULL;
+	s_info.events_tail = NULL;
+	pthread_mutex_unlock(&s_info.lock);
+
+	while (event) {
+		job_event_s *next = event->next;
+		job_s *job = event->job;
+
+		if (event->done) {
+			s_info.pending--;
+			if (job->callbacks.done)
+				job->callbacks.done(job->data, job, jobs_cancelled(job));
+			mt_free(job);
+		}
+		else {
+			if (job->callbacks.notify)
+				job->callbacks.notify(job->data, job, event->msg);
+			mt_free(event);
+		}
+
+		event = next;
+	}
+}
+
+/*a worker thread: runs jobs until jobs_shutdown()*/
+static void *_jobs_worker(void *data)
+{
+	pthread_mutex_lock(&s_info.lock);
+
+	while (!s_info.stopping) {
+		job_s *job = _jobs_next();
+		jobs_stats_s *stats;
+		uint64_t start;
+
+		if (!job) {
+			pthread_cond_wait(&s_info.wakeup, &s_info.lock);
+			continue;
+		}
+
+		stats = &s_info.stats[job->job_class];
+		start = _jobs_now_us();
+		diag_histogram_add(&stats->wait, start - job->submit_us);
+		stats->running++;
+		s_info.running++;
+		job->running = true;
+		job->next_running = s_info.running_jobs;
+		s_info.running_jobs = job;
+		pthread_mutex_unlock(&s_info.lock);
+
+		job->callbacks.run(job->data, job);
+
+		pthread_mutex_lock(&s_info.lock);
+		for (job_s **link = &s_info.running_jobs; *link; link = &(*link)->next_running) {
+			if (*link == job) {
+				*link = job->next_running;
+				break;
+			}
+		}
+		job->running = false;
+		s_info.running--;
+		stats->running--;
+		stats->completed++;
+		diag_histogram_add(&stats->run, _jobs_now_us() - start);
+		_jobs_post(&job->done_event);
+
+		/*an idle job may have waited for this worker*/
+		if (s_info.queue_head[JOB_IDLE])
+			pthread_cond_broadcast(&s_info.wakeup);
+	}
+
+	pthread_mutex_unlock(&s_info.lock);
+
+	return NULL;
+}
+
+/**
+ * @brief Counts the jobs submitted whose done callback has not run yet,
+ * whether queued, running or finished and waiting for the main loop.
+ */
+int jobs_pending(void)
+{
+	return s_info.pending;
+}
+
+const char *jobs_class_name(job_class_e job_class)
+{
+	return job_class < JOB_CLASS_COUNT ? s_class_names[job_class] : "unknown";
+}
+
+/**
+ * @brief Copies the counters and histograms of one priority class.
+ */
+void jobs_stats(job_class_e job_class, jobs_stats_s *stats)
+{
+	pthread_mutex_lock(&s_info.lock);
+	*stats = s_info.stats[job_class];
+	pthread_mutex_unlock(&s_info.lock);
+}
+
+/**
+ * @brief Formats the per class counters as text for the diagnostics screen.
+ * @return The length of the text, truncated to len - 1 characters.
+ */
+size_t jobs_report(char *buf, size_t len)
+{
+	size_t used = 0;
+	int n;
+
+	n = snprintf(buf, len, "jobs: queued, running, done, cancelled, wait p50 / p99 / max ms, run p50 / p99 / max ms\n");
+	used += n > 0 ? n : 0;
+
+	for (int job_class = 0; job_class < JOB_CLASS_COUNT && used < len; job_class++) {
+		jobs_stats_s stats;
+
+		jobs_stats(job_class, &stats);
+		if (!stats.submitted)
+			continue;
+
+		n = snprintf(buf + used, len - used, "%s: %u, %u, %llu, %llu, %.2f / %.2f / %.2f, %.2f / %.2f / %.2f\n",
+				s_class_names[job_class], stats.queued, stats.running, (unsigned long long) stats.completed,
+				(unsigned long long) stats.cancelled,
+				diag_histogram_percentile(&stats.wait, 50) / 1000.0, diag_histogram_percentile(&stats.wait, 99) / 1000.0,
+				stats.wait.max_us / 1000.0,
+				diag_histogram_percentile(&stats.run, 50) / 1000.0, diag_histogram_percentile(&stats.run, 99) / 1000.0,
+				stats.run.max_us / 1000.0);
+		used += n > 0 ? n : 0;
+	}
+
+	return used < len ? used : len - 1;
+}
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <Ecore_Evas.h>
+#include "avoidrickshaw.h"
+#include "latency_bench.h"
+#include "view_defines.h"
+#include "data.h"
+#include "sensor_backend.h"
+#include "diag.h"
+
+/*
+ * Sensor to pixel latency benchmark. Started when the file latency_bench is
+ * in the data directory (its content, if any, is the number of fixes to
+ * inject), with the window rendered by the Ecore buffer engine into memory.
+ * Timestamped synthetic events are injected through the inject backend and
+ * the pixels of each session value are hashed after every frame: the first
+ * frame in which they change is the one showing the new text. The latency
+ * distributions go to latency_bench.txt in the data directory, then the app
+ * exits without saving the session.
+ */
+
+#define LATENCY_BENCH_FILE "latency_bench"
+#define LATENCY_BENCH_REPORT_FILE "latency_bench.txt"
+#define LATENCY_BENCH_DEFAULT_FIXES 200
+#define LATENCY_BENCH_INTERVAL 0.1      /*seconds between injected steps*/
+#define LATENCY_BENCH_SETTLE 0.5        /*seconds for the last frames before the report*/
+#define LATENCY_BENCH_MAX_FRAMES 10     /*frames without new pixels after which a change counts as never shown*/
+#define LATENCY_BENCH_STEP_DEGREES 4.5e-5 /*about 5 m of latitude per step*/
+#define LATENCY_BENCH_LATITUDE 23.7808
+#define LATENCY_BENCH_LONGITUDE 90.4176
+#define LATENCY_BENCH_GRAVITY 9.81
+#define LATENCY_BENCH_SWING 2.5         /*m/s^2 on each axis, well past the step detector's threshold*/
+#define LATENCY_BENCH_TEXT_MAX 64
+#define LATENCY_BENCH_REPORT_MAX 2048
+
+#define LATENCY_BENCH_PART_LIST(X) \
+	X(STEPS, PART_STEPS_TEXT) \
+	X(DISTANCE, PART_DISTANCE_TEXT) \
+	X(FARE, PART_FARE_TEXT) \
+	X(CALORIES, PART_CALORIES_TEXT)
+
+#define LATENCY_BENCH_PART_ENUM(name, part) LATENCY_BENCH_PART_##name,
+#define LATENCY_BENCH_PART_NAME(name, part) part,
+
+typedef enum {
+	LATENCY_BENCH_PART_LIST(LATENCY_BENCH_PART_ENUM)
+	LATENCY_BENCH_PART_COUNT
+} latency_bench_part_e;
+
+static const char *const s_part_names[LATENCY_BENCH_PART_COUNT] = {
+	LATENCY_BENCH_PART_LIST(LATENCY_BENCH_PART_NAME)
+};
+
+typedef struct {
+	char text[LATENCY_BENCH_TEXT_MAX];
+	uint32_t hash;                  /*of the part's pixels in the last frame*/
+	double injected;                /*when the event behind a change not yet drawn was injected, 0 for none*/
+	int frames;                     /*frames since then*/
+	int changes;
+	int never_shown;
+	diag_histogram_s pipeline;      /*event injected to text set*/
+	diag_histogram_s visible;       /*event injected to the frame showing it*/
+} latency_bench_part_s;
+
+static struct latency_bench_info {
+	int requested;                  /*-1 until the marker file was looked for*/
+	Evas_Object *layout;
+	const uint32_t *pixels;
+	int width;
+	int height;
+	sensor_backend_s *backend;
+	int fixes_left;
+	int fixes;
+	double latitude;
+	double timestamp;
+	int accel_events;
+	int accel_changes;
+	bool baseline;
+	latency_bench_part_s parts[LATENCY_BENCH_PART_COUNT];
+} s_info = {
+	.requested = -1,
+	.layout = NULL,
+	.pixels = NULL,
+	.backend = NULL,
+	.baseline = false,
+};
+
+static Eina_Bool _latency_bench_tick_cb(void *data);
+static Eina_Bool _latency_bench_finish_cb(void *data);
+static void _latency_bench_frame_cb(void *data, Evas *e, void *event_info);
+
+/**
+ * @brief Internal function building the path of a benchmark file in the data directory.
+ * @return This function returns 'false' if the data directory is not known (yet).
+ */
+static bool _latency_bench_path(char *path, size_t size, const char *name)
+{
+	char *data_path = app_get_data_path();
+
+	if (!data_path)
+		return false;
+
+	snprintf(path, size, "%s%s", data_path, name);
+	free(data_path);
+	return true;
+}
+
+/**
+ * @brief Tells if the benchmark was asked for. Checked before the main loop
+ * starts, as the buffer engine has to be chosen before the window exists.
+ * @return The number of fixes to inject, 0 if the benchmark is not requested.
+ */
+int latency_bench_requested(void)
+{
+	char path[PATH_MAX];
+	FILE *file;
+	int fixes = 0;
+
+	if (s_info.requested >= 0)
+		return s_info.requested;
+
+	/* Before ui_app_main() the data directory may not be known; one decision holds for the run */
+	if (!_latency_bench_path(path, sizeof(path), LATENCY_BENCH_FILE)) {
+		dlog_print(DLOG_WARN, LOG_TAG, "No data path, latency benchmark not checked");
+		s_info.requested = 0;
+		return 0;
+	}
+
+	file = fopen(path, "r");
+	if (!file) {
+		s_info.requested = 0;
+		return 0;
+	}
+
+	if (fscanf(file, "%d", &fixes) != 1 || fixes <= 0)
+		fixes = LATENCY_BENCH_DEFAULT_FIXES;
+	fclose(file);
+
+	s_info.requested = fixes;
+	return fixes;
+}
+
+/**
+ * @brief Starts the tracking session and the injection timer.
+ * Needs the buffer engine and a data module using the inject backend,
+ * see data_use_injected_events().
+ * @param[in] layout The layout showing the session values.
+ * @return This function returns 'true' if the benchmark is running,
+ * otherwise 'false' is returned.
+ */
+bool latency_bench_start(Evas_Object *layout)
+{
+	Evas *evas = evas_object_evas_get(layout);
+	Ecore_Evas *ee = ecore_evas_ecore_evas_get(evas);
+
+	s_info.pixels = ee ? ecore_evas_buffer_pixels_get(ee) : NULL;
+	if (!s_info.pixels) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Latency benchmark needs the buffer engine");
+		return false;
+	}
+
+	ecore_evas_geometry_get(ee, NULL, NULL, &s_info.width, &s_info.height);
+
+	s_info.layout = layout;
+	s_info.backend = data_backend_get();
+	s_info.fixes = latency_bench_requested();
+	s_info.fixes_left = s_info.fixes;
+	s_info.latitude = LATENCY_BENCH_LATITUDE;
+
+	if (!data_tracking_start()) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Latency benchmark could not start a session");
+		return false;
+	}
+
+	evas_event_callback_add(evas, EVAS_CALLBACK_RENDER_POST, _latency_bench_frame_cb, NULL);
+	ecore_timer_add(LATENCY_BENCH_INTERVAL, _latency_bench_tick_cb, NULL);
+
+	dlog_print(DLOG_INFO, LOG_TAG, "Latency benchmark: %d fixes on a %dx%d canvas", s_info.fixes,
+			s_info.width, s_info.height);
+	return true;
+}
+
+/**
+ * @brief Internal function hashing the pixels under a part (FNV-1a), clipped to the canvas.
+ */
+static uint32_t _latency_bench_part_hash(const char *part)
+{
+	Evas_Object *edje = elm_layout_edje_get(s_info.layout);
+	Evas_Coord ox = 0, oy = 0, x, y, w, h;
+	uint32_t hash = 2166136261u;
+
+	if (!edje || !edje_object_part_geometry_get(edje, part, &x, &y, &w, &h))
+		return 0;
+
+	evas_object_geometry_get(edje, &ox, &oy, NULL, NULL);
+	x += ox;
+	y += oy;
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if (x + w > s_info.width)
+		w = s_info.width - x;
+	if (y + h > s_info.height)
+		h = s_info.height - y;
+
+	for (int row = y; row < y + h; row++) {
+		const uint32_t *pixel = s_info.pixels + (size_t) row * s_info.width + x;
+
+		for (int column = 0; column < w; column++) {
+			hash ^= pixel[column];
+			hash *= 16777619u;
+		}
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Internal function injecting one event and noting which values it changed.
+ * The text is set synchronously by the tracker callbacks, so any part whose
+ * text differs afterwards waits for the frame that draws it.
+ */
+static void _latency_bench_inject(const track_accel_s *sample, const track_fix_s *fix)
+{
+	double injected = ecore_time_get();
+	bool changed = false;
+
+	if (sample)
+		sensor_backend_inject_accel(s_info.backend, sample);
+	else
+		sensor_backend_inject_fix(s_info.backend, fix);
+
+	double set = ecore_time_get();
+
+	for (int i = 0; i < LATENCY_BENCH_PART_COUNT; i++) {
+		latency_bench_part_s *part = &s_info.parts[i];
+		const char *text = elm_object_part_text_get(s_info.layout, s_part_names[i]);
+
+		if (!text || !strncmp(text, part->text, sizeof(part->text) - 1))
+			continue;
+
+		snprintf(part->text, sizeof(part->text), "%s", text);
+		part->changes++;
+		diag_histogram_add(&part->pipeline, (uint64_t) ((set - injected) * 1e6));
+		changed = true;
+
+		/* A second change before a frame is still waited for since the first */
+		if (part->injected <= 0.0) {
+			part->injected = injected;
+			part->frames = 0;
+		}
+	}
+
+	if (sample) {
+		s_info.accel_events++;
+		if (changed)
+			s_info.accel_changes++;
+	}
+}
+
+/**
+ * @brief Internal callback function injecting one step: a sample above and one
+ * below the resting level, then a fix a step further north.
+ */
+static Eina_Bool _latency_bench_tick_cb(void *data)
+{
+	track_accel_s sample = { 0, };
+	track_fix_s fix = { 0, };
+	float level;
+
+	/* The first sample is the resting level of the step detector */
+	level = s_info.fixes_left == s_info.fixes ? LATENCY_BENCH_GRAVITY : LATENCY_BENCH_GRAVITY + LATENCY_BENCH_SWING;
+	for (int i = 0; i < 2; i++) {
+		s_info.timestamp += LATENCY_BENCH_INTERVAL / 2;
+		sample.timestamp = s_info.timestamp;
+		sample.x = sample.y = sample.z = level;
+		_latency_bench_inject(&sample, NULL);
+		level = LATENCY_BENCH_GRAVITY - LATENCY_BENCH_SWING;
+	}
+
+	s_info.latitude += LATENCY_BENCH_STEP_DEGREES;
+	fix.timestamp = s_info.timestamp;
+	fix.latitude = s_info.latitude;
+	fix.longitude = LATENCY_BENCH_LONGITUDE;
+	fix.accuracy = 5.0;
+	_latency_bench_inject(NULL, &fix);
+
+	if (--s_info.fixes_left > 0)
+		return ECORE_CALLBACK_RENEW;
+
+	ecore_timer_add(LATENCY_BENCH_SETTLE, _latency_bench_finish_cb, NULL);
+	return ECORE_CALLBACK_CANCEL;
+}
+
+/**
+ * @brief Internal callback function invoked after each frame is rendered into the buffer.
+ */
+static void _latency_bench_frame_cb(void *data, Evas *e, void *event_info)
+{
+	double now = ecore_time_get();
+
+	for (int i = 0; i < LATENCY_BENCH_PART_COUNT; i++) {
+		latency_bench_part_s *part = &s_info.parts[i];
+		uint32_t hash = _latency_bench_part_hash(s_part_names[i]);
+
+		if (s_info.baseline && part->injected > 0.0) {
+			if (hash != part->hash) {
+				diag_histogram_add(&part->visible, (uint64_t) ((now - part->injected) * 1e6));
+				part->injected = 0.0;
+			}
+			else if (++part->frames >= LATENCY_BENCH_MAX_FRAMES) {
+				part->never_shown++;
+				part->injected = 0.0;
+			}
+		}
+
+		part->hash = hash;
+	}
+
+	s_info.baseline = true;
+}
+
+/**
+ * @brief Internal function formatting the latency distributions.
+ */
+static size_t _latency_bench_report(char *report, size_t size)
+{
+	size_t len = 0;
+
+	len += snprintf(report + len, size - len,
+			"latency benchmark: %d fixes, %d accelerometer samples of which %d changed a value\n"
+			"%-14s %7s %6s %28s %28s\n", s_info.fixes, s_info.accel_events, s_info.accel_changes,
+			"part", "changes", "unseen", "pipeline p50/p99/max us", "visible p50/p90/p99/max us");
+
+	for (int i = 0; i < LATENCY_BENCH_PART_COUNT && len < size; i++) {
+		const latency_bench_part_s *part = &s_info.parts[i];
+
+		len += snprintf(report + len, size - len, "%-14s %7d %6d %8llu %8llu %10llu %6llu %6llu %6llu %7llu\n",
+				s_part_names[i], part->changes, part->never_shown,
+				(unsigned long long) diag_histogram_percentile(&part->pipeline, 50),
+				(unsigned long long) diag_histogram_percentile(&part->pipeline, 99),
+				(unsigned long long) part->pipeline.max_us,
+				(unsigned long long) diag_histogram_percentile(&part->visible, 50),
+				(unsigned long long) diag_histogram_percentile(&part->visible, 90),
+				(unsigned long long) diag_histogram_percentile(&part->visible, 99),
+				(unsigned long long) part->visible.max_us);
+	}
+
+	return len < size ? len : size - 1;
+}
+
+/**
+ * @brief Internal callback function writing the report once the last frames were drawn, then exiting.
+ */
+static Eina_Bool _latency_bench_finish_cb(void *data)
+{
+	char report[LATENCY_BENCH_REPORT_MAX];
+	char path[PATH_MAX];
+	size_t len = _latency_bench_report(report, sizeof(report));
+	FILE *file;
+
+	dlog_print(DLOG_INFO, LOG_TAG, "%s", report);
+
+	if (_latency_bench_path(path, sizeof(path), LATENCY_BENCH_REPORT_FILE)) {
+		file = fopen(path, "w");
+		if (!file || fwrite(report, 1, len, file) != len)
+			dlog_print(DLOG_ERROR, LOG_TAG, "Cannot write %s", path);
+		if (file)
+			fclose(file);
+	}
+
+	/* One run per request */
+	if (_latency_bench_path(path, sizeof(path), LATENCY_BENCH_FILE))
+		unlink(path);
+
+	ui_app_exit();
+	return ECORE_CALLBACK_CANCEL;
+}
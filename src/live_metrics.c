@@ -0,0 +1,134 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "avoidrickshaw.h"
+#include "live_metrics.h"
+
+static struct live_metrics_info {
+	live_metrics_region_s *region;
+} s_info = {
+	.region = NULL,
+};
+
+/**
+ * @brief Creates the shared memory region and publishes an idle snapshot.
+ * @return This function returns 'true' if the region is available,
+ * otherwise 'false' is returned and publishing does nothing.
+ */
+bool live_metrics_open(void)
+{
+	live_metrics_values_s idle = { 0, };
+	int fd;
+
+	if (s_info.region)
+		return true;
+
+	fd = shm_open(LIVE_METRICS_SHM_NAME, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create live metrics region");
+		return false;
+	}
+
+	if (ftruncate(fd, sizeof(live_metrics_region_s)) != 0) {
+		close(fd);
+		return false;
+	}
+
+	s_info.region = mmap(NULL, sizeof(live_metrics_region_s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (s_info.region == MAP_FAILED) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to map live metrics region");
+		s_info.region = NULL;
+		return false;
+	}
+
+	/*a region left by a crashed run may be mid-update; start from an even sequence*/
+	__atomic_store_n(&s_info.region->sequence, (s_info.region->sequence + 1) & ~1u, __ATOMIC_RELAXED);
+	s_info.region->version = LIVE_METRICS_VERSION;
+	live_metrics_publish(&idle);
+	__atomic_store_n(&s_info.region->magic, LIVE_METRICS_MAGIC, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/**
+ * @brief Publishes a new snapshot. Never blocks; readers retry around it.
+ * The updated time is filled in here.
+ */
+void live_metrics_publish(const live_metrics_values_s *values)
+{
+	live_metrics_region_s *region = s_info.region;
+	struct timespec now;
+	uint32_t sequence;
+
+	if (!region)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	sequence = region->sequence;
+	__atomic_store_n(&region->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	region->values = *values;
+	region->values.updated = (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+	__atomic_store_n(&region->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Unmaps and removes the region. Readers still attached keep their
+ * mapping of the last snapshot.
+ */
+void live_metrics_close(void)
+{
+	if (!s_info.region)
+		return;
+
+	munmap(s_info.region, sizeof(live_metrics_region_s));
+	shm_unlink(LIVE_METRICS_SHM_NAME);
+	s_info.region = NULL;
+}
+
+/**
+ * @brief Maps the published region read-only.
+ * @return The region, or NULL if the app is not running or the layout differs.
+ */
+const live_metrics_region_s *live_metrics_attach(void)
+{
+	live_metrics_region_s *region;
+	struct stat st;
+	int fd = shm_open(LIVE_METRICS_SHM_NAME, O_RDONLY, 0);
+
+	if (fd < 0)
+		return NULL;
+
+	/*the writer may not have sized the region yet; mapping past the end faults on access*/
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(live_metrics_region_s)) {
+		close(fd);
+		return NULL;
+	}
+
+	region = mmap(NULL, sizeof(live_metrics_region_s), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (region == MAP_FAILED)
+		return NULL;
+
+	if (__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != LIVE_METRICS_MAGIC ||
+			region->version != LIVE_METRICS_VERSION) {
+		munmap(region, sizeof(live_metrics_region_s));
+		return NULL;
+	}
+
+	return region;
+}
+
+void live_metrics_detach(const live_metrics_region_s *region)
+{
+	if (region)
+		munmap((void *) region, sizeof(live_metrics_region_s));
+}
@@ -4,8 +4,17 @@
 #include "avoidrickshaw.h"
 #include "view.h"
 #include "data.h"
+#include "recalc.h"
+#include "sync.h"
+#include "jobs.h"
+#include "maintenance.h"
+#include "trace.h"
+#include "diag.h"
+#include "memtrack.h"
+#include "latency_bench.h"
 
 static void _on_position_changed_cb(double total_distance);
+static void _dump_trace(void);
 
 /**
  * @brief Hook to take necessary actions before main event loop starts.
@@ -18,17 +27,37 @@ static bool app_create(void *user_data)
 	if (!view_create(NULL))
 			return false;
 
+	/* Background work of all modules shares these workers */
+	if (!jobs_init(JOBS_DEFAULT_WORKERS))
+		dlog_print(DLOG_ERROR, LOG_TAG, "No background workers, recalculation and sync are off");
+
 	view_set_button_callbacks(data_tracking_start, data_tracking_stop, data_show_db);
 	data_set_position_changed_callback(_on_position_changed_cb);
 	data_set_steps_count_changed_callback(view_set_steps_count);
 	data_set_fare_changed_callback(view_set_fare);
 	data_set_calorie_changed_callback(view_set_calories);
 
+	/* The benchmark replaces the device sensors with injected events */
+	if (latency_bench_requested())
+		data_use_injected_events();
+
 	if (!data_initialize())
 		return false;
 
 	view_set_gps_ok_text(data_gps_enabled_get());
 
+	/* Finish a calorie recalculation interrupted by the last exit */
+	recalc_calories_resume();
+
+	/* Push whatever the companion missed while the app was closed */
+	sync_start();
+
+	/* Backups and compaction while the watch charges */
+	maintenance_init();
+
+	if (latency_bench_requested() && !latency_bench_start(view_layout_get()))
+		return false;
+
 	return true;
 }
 
@@ -39,6 +68,8 @@ static bool app_create(void *user_data)
 static void app_control(app_control_h app_control, void *user_data)
 {
 	/* Handle the launch request. */
+	if (maintenance_app_control(app_control))
+		return;
 }
 
 /**
@@ -49,6 +80,7 @@ static void app_control(app_control_h app_control, void *user_data)
 static void app_pause(void *user_data)
 {
 	/* Take necessary actions when application becomes invisible. */
+	diag_watchdog_stop();
 }
 
 /**
@@ -58,6 +90,7 @@ static void app_pause(void *user_data)
 static void app_resume(void *user_data)
 {
 	/* Take necessary actions when application becomes visible. */
+	diag_watchdog_start();
 }
 
 /**
@@ -66,8 +99,15 @@ static void app_resume(void *user_data)
 static void app_terminate(void *user_data)
 {
 	/* Release all resources. */
+	diag_watchdog_stop();
+	recalc_calories_cancel();
+	sync_cancel();
+	maintenance_finalize();
+	jobs_shutdown();
 	data_finalize();
+	_dump_trace();
 	view_destroy();
+	memtrack_log_report();
 }
 
 /**
@@ -109,6 +149,10 @@ int main(int argc, char *argv[])
 	 */
 	ui_app_add_event_handler(&handlers[APP_EVENT_LANGUAGE_CHANGED], APP_EVENT_LANGUAGE_CHANGED, ui_app_lang_changed, NULL);
 
+	/* The latency benchmark reads the frames back, so they are rendered into memory */
+	if (latency_bench_requested())
+		setenv("ELM_ENGINE", "buffer", 1);
+
 	ret = ui_app_main(argc, argv, &event_callback, NULL);
 	if (ret != APP_ERROR_NONE)
 		dlog_print(DLOG_ERROR, LOG_TAG, "ui_app_main() failed. err = %d", ret);
@@ -127,3 +171,18 @@ static void _on_position_changed_cb(double total_distance)
 {
 	 view_set_total_distance(total_distance);
 }
+
+/**
+ * @brief Internal function saving the trace rings next to the database,
+ * to be pulled from the device and decoded with tools/tracedump.
+ */
+static void _dump_trace(void)
+{
+	char path[PATH_MAX];
+	char *data_path = app_get_data_path();
+
+	snprintf(path, sizeof(path), "%s%s", data_path, TRACE_FILE_NAME);
+	free(data_path);
+
+	trace_dump(path);
+}
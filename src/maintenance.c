@@ -0,0 +1,603 @@
+#include <limits.h>
+#include <time.h>
+#if !defined(AR_HOST_BUILD) || defined(AR_HOST_UI)
+#include <Ecore.h>
+#define MAINTENANCE_MAIN_LOOP 1 /*due windows are started by a timer; host tools call maintenance_check()*/
+#endif
+#if !defined(AR_HOST_BUILD)
+#include <app_alarm.h>
+#include <app_preference.h>
+#include <device/battery.h>
+#include <device/callback.h>
+#endif
+#include "avoidrickshaw.h"
+#include "maintenance.h"
+#include "Sqlitedbhelper.h"
+#include "jobs.h"
+#include "memtrack.h"
+
+#define MAINTENANCE_PROGRESS_OPS 10000      /*SQLite VM steps between budget checks*/
+#define MAINTENANCE_RETRY_S (15 * 60)       /*pause after a window ran out of budget or a task failed*/
+#define MAINTENANCE_BACKUP_PAGES 16         /*pages copied per backup step*/
+#define MAINTENANCE_COMPACT_RATIO 4         /*vacuum once a quarter of the pages is free*/
+#define MAINTENANCE_ALARM_PREFERENCE "maintenance_alarm"
+#define MAINTENANCE_EXIT_POLL_S 1.0         /*s between checks for background work left before an unattended exit*/
+
+struct maintenance_window {
+	job_s *job;             /*set by the worker*/
+	const maintenance_task_s *tasks[MAINTENANCE_MAX_TASKS];   /*copied at submission*/
+	int task_count;
+	uint64_t cpu_start_us;
+	uint64_t cpu_us;
+	bool over_budget;
+	uint32_t runs;
+	uint32_t failures;
+	long long next_due;     /*earliest database time a task is due again*/
+};
+
+static struct maintenance_info {
+	const maintenance_task_s *tasks[MAINTENANCE_MAX_TASKS];
+	int task_count;
+	job_s *job;                     /*the running window, NULL if none*/
+	bool charging;
+	bool tracking;
+	bool unattended;                /*launched by the alarm, the user has not opened the app since*/
+	bool opened;                    /*the user launched the app or started a session in this process*/
+	long long next_due;
+#if defined(MAINTENANCE_MAIN_LOOP)
+	Ecore_Timer *due_timer;         /*starts the window at next_due*/
+#endif
+#if !defined(AR_HOST_BUILD)
+	Ecore_Timer *exit_timer;        /*exits an unattended app once no background job is left*/
+#endif
+	maintenance_stats_s stats;
+} s_info = {
+	.task_count = 0,
+	.job = NULL,
+	.charging = false,
+	.tracking = false,
+	.unattended = false,
+	.opened = false,
+	.next_due = 0,
+};
+
+static bool _maintenance_retention_run(sqlite3 *db, maintenance_window_s *window);
+static bool _maintenance_sketches_run(sqlite3 *db, maintenance_window_s *window);
+static bool _maintenance_backup_run(sqlite3 *db, maintenance_window_s *window);
+static bool _maintenance_compact_run(sqlite3 *db, maintenance_window_s *window);
+static void _maintenance_run_cb(void *data, job_s *job);
+static void _maintenance_done_cb(void *data, job_s *job, bool cancelled);
+static void _maintenance_timer_update(void);
+#if !defined(AR_HOST_BUILD)
+static void _maintenance_charging_cb(device_callback_e type, void *value, void *user_data);
+static void _maintenance_alarm_set(bool charging);
+static void _maintenance_exit_if_unattended(void);
+#endif
+
+static const maintenance_task_s s_builtin_tasks[] = {
+	{ "retention", 24 * 3600,     _maintenance_retention_run }, /*drop days past the 28 day window*/
+	{ "sketches",  24 * 3600,     _maintenance_sketches_run },  /*roll finished months up*/
+	{ "backup",    24 * 3600,     _maintenance_backup_run },
+	{ "compact",   7 * 24 * 3600, _maintenance_compact_run },
+};
+
+/**
+ * @brief Adds a task to every following window. Tasks keep their
+ * registration order, so one may rely on the data of an earlier one.
+ * @param[in] task Kept by reference, it must outlive the module.
+ * @return This function returns 'false' if the name is taken or the table is full.
+ */
+bool maintenance_register(const maintenance_task_s *task)
+{
+	for (int i = 0; i < s_info.task_count; i++)
+		if (!strcmp(s_info.tasks[i]->name, task->name))
+			return false;
+
+	if (s_info.task_count == MAINTENANCE_MAX_TASKS) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "No room for maintenance task %s", task->name);
+		return false;
+	}
+
+	s_info.tasks[s_info.task_count++] = task;
+
+	return true;
+}
+
+/**
+ * @brief Internal function reading the CPU time of the calling thread.
+ */
+static uint64_t _maintenance_cpu_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Tells a running task to stop: the window was cancelled or its CPU
+ * budget is spent. Statements of the window's connection are interrupted
+ * then anyway, long loops outside SQLite poll this.
+ */
+bool maintenance_stop_requested(maintenance_window_s *window)
+{
+	if (jobs_cancelled(window->job))
+		return true;
+
+	if (!window->over_budget && _maintenance_cpu_us() - window->cpu_start_us >= MAINTENANCE_CPU_BUDGET_MS * 1000ULL)
+		window->over_budget = true;
+
+	return window->over_budget;
+}
+
+/**
+ * @brief Registers the built-in tasks and, on the device, starts following
+ * the charger and schedules the relaunch alarm while it charges.
+ */
+bool maintenance_init(void)
+{
+	for (size_t i = 0; i < sizeof(s_builtin_tasks) / sizeof(s_builtin_tasks[0]); i++)
+		maintenance_register(&s_builtin_tasks[i]);
+
+#if !defined(AR_HOST_BUILD)
+	bool charging = false;
+
+	if (device_battery_is_charging(&charging) != DEVICE_ERROR_NONE)
+		charging = false;
+	s_info.charging = charging;
+
+	if (device_add_callback(DEVICE_CALLBACK_BATTERY_CHARGING, _maintenance_charging_cb, NULL) != DEVICE_ERROR_NONE)
+		dlog_print(DLOG_WARN, LOG_TAG, "Charger not followed, maintenance runs only when launched on it");
+
+	_maintenance_alarm_set(charging);
+	maintenance_check();
+#endif
+
+	return true;
+}
+
+/**
+ * @brief Cancels the running window. An alarm scheduled while charging
+ * stays, so that the app is relaunched for the next one.
+ */
+void maintenance_finalize(void)
+{
+#if !defined(AR_HOST_BUILD)
+	device_remove_callback(DEVICE_CALLBACK_BATTERY_CHARGING, _maintenance_charging_cb);
+#endif
+	s_info.charging = false;
+	s_info.unattended = false;
+#if !defined(AR_HOST_BUILD)
+	if (s_info.exit_timer) {
+		ecore_timer_del(s_info.exit_timer);
+		s_info.exit_timer = NULL;
+	}
+#endif
+	maintenance_check();
+}
+
+void maintenance_set_charging(bool charging)
+{
+	s_info.charging = charging;
+#if !defined(AR_HOST_BUILD)
+	_maintenance_alarm_set(charging);
+#endif
+	maintenance_check();
+}
+
+void maintenance_set_tracking(bool tracking)
+{
+	s_info.tracking = tracking;
+	if (tracking) {
+		s_info.opened = true;
+		s_info.unattended = false;
+	}
+	maintenance_check();
+}
+
+#if defined(MAINTENANCE_MAIN_LOOP)
+/**
+ * @brief Internal callback starting the window that became due.
+ */
+static Eina_Bool _maintenance_due_cb(void *data)
+{
+	s_info.due_timer = NULL;
+	maintenance_check();
+
+	return ECORE_CALLBACK_CANCEL;
+}
+#endif
+
+/**
+ * @brief Internal function arming the timer for next_due while a window
+ * could run but none does, so the retry after a failed or exhausted window
+ * happens while the watch stays on the charger with the app open.
+ */
+static void _maintenance_timer_update(void)
+{
+#if defined(MAINTENANCE_MAIN_LOOP)
+	long long delay = s_info.next_due - (long long) dbTime();
+
+	if (s_info.due_timer) {
+		ecore_timer_del(s_info.due_timer);
+		s_info.due_timer = NULL;
+	}
+
+	if (!s_info.charging || s_info.tracking || s_info.job || !s_info.task_count || s_info.next_due == LLONG_MAX)
+		return;
+
+	s_info.due_timer = ecore_timer_add(delay > 0 ? (double) delay : 0.0, _maintenance_due_cb, NULL);
+#endif
+}
+
+/**
+ * @brief Starts a window if the watch is charging, no session runs and a
+ * task is due; cancels the running one when the conditions no longer hold.
+ */
+void maintenance_check(void)
+{
+	static const job_callbacks_s callbacks = {
+		.run = _maintenance_run_cb,
+		.done = _maintenance_done_cb,
+	};
+	maintenance_window_s *window;
+
+	if (!s_info.charging || s_info.tracking) {
+		if (s_info.job) {
+			jobs_cancel(s_info.job);
+			s_info.job = NULL;
+		}
+		_maintenance_timer_update();
+		return;
+	}
+
+	if (s_info.job || !s_info.task_count || (long long) dbTime() < s_info.next_due) {
+		_maintenance_timer_update();
+		return;
+	}
+
+	window = mt_calloc(MT_JOBS, 1, sizeof(maintenance_window_s));
+	if (!window)
+		return;
+
+	memcpy(window->tasks, s_info.tasks, sizeof(window->tasks));
+	window->task_count = s_info.task_count;
+
+	s_info.job = jobs_submit(JOB_IDLE, &callbacks, window);
+	if (!s_info.job) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to queue maintenance window");
+		mt_free(window);
+	}
+
+	_maintenance_timer_update();
+}
+
+bool maintenance_running(void)
+{
+	return s_info.job != NULL;
+}
+
+void maintenance_stats(maintenance_stats_s *stats)
+{
+	*stats = s_info.stats;
+}
+
+size_t maintenance_report(char *buf, size_t len)
+{
+	long long next = s_info.next_due - (long long) dbTime();
+	int n;
+
+	n = snprintf(buf, len, "maintenance: %s, %s, %s, next due in %lld s\n"
+			"windows %u, over budget %u, cancelled %u, task runs %u (%u failed), %.1f ms CPU\n",
+			s_info.charging ? "charging" : "on battery", s_info.tracking ? "tracking" : "idle",
+			s_info.job ? "running" : "waiting", next > 0 ? next : 0,
+			s_info.stats.windows, s_info.stats.over_budget, s_info.stats.cancelled,
+			s_info.stats.task_runs, s_info.stats.task_failures, s_info.stats.cpu_us / 1000.0);
+
+	if (n < 0)
+		return 0;
+
+	return (size_t) n < len ? (size_t) n : len - 1;
+}
+
+/**
+ * @brief Internal function interrupting the window's statements once it must stop.
+ */
+static int _maintenance_progress_cb(void *data)
+{
+	return maintenance_stop_requested(data);
+}
+
+/**
+ * @brief Internal function running the due tasks on the worker thread.
+ */
+static void _maintenance_run_cb(void *data, job_s *job)
+{
+	maintenance_window_s *window = data;
+	long long now = dbTime();
+	sqlite3 *db;
+
+	window->job = job;
+	window->cpu_start_us = _maintenance_cpu_us();
+	window->next_due = LLONG_MAX;
+
+	if (openWorkerDb(&db) != SQLITE_OK) {
+		window->next_due = now + MAINTENANCE_RETRY_S;
+		return;
+	}
+
+	for (int i = 0; i < window->task_count; i++) {
+		const maintenance_task_s *task = window->tasks[i];
+		long long last_run;
+		bool complete;
+
+		if (maintenance_stop_requested(window)) {
+			window->next_due = now;
+			break;
+		}
+
+		if (getMaintenanceRun(db, task->name, &last_run) != SQLITE_OK)
+			continue;
+
+		/* A clock set back makes everything due rather than nothing */
+		if (last_run <= now && now < last_run + task->interval) {
+			if (last_run + task->interval < window->next_due)
+				window->next_due = last_run + task->interval;
+			continue;
+		}
+
+		sqlite3_progress_handler(db, MAINTENANCE_PROGRESS_OPS, _maintenance_progress_cb, window);
+		complete = task->run(db, window);
+		sqlite3_progress_handler(db, 0, NULL, NULL);
+
+		window->runs++;
+		if (complete && setMaintenanceRun(db, task->name, now) == SQLITE_OK) {
+			if (now + task->interval < window->next_due)
+				window->next_due = now + task->interval;
+			continue;
+		}
+
+		window->failures++;
+		dlog_print(DLOG_WARN, LOG_TAG, "Maintenance task %s did not complete", task->name);
+
+		if (window->next_due > now + MAINTENANCE_RETRY_S)
+			window->next_due = now + MAINTENANCE_RETRY_S;
+	}
+
+	sqlite3_close(db);
+	window->cpu_us = _maintenance_cpu_us() - window->cpu_start_us;
+}
+
+/**
+ * @brief Internal function run in the main loop when a window ended or was cancelled.
+ */
+static void _maintenance_done_cb(void *data, job_s *job, bool cancelled)
+{
+	maintenance_window_s *window = data;
+
+	s_info.stats.task_runs += window->runs;
+	s_info.stats.task_failures += window->failures;
+	s_info.stats.cpu_us += window->cpu_us;
+
+	if (cancelled)
+		s_info.stats.cancelled++;
+	else if (window->over_budget)
+		s_info.stats.over_budget++;
+	else
+		s_info.stats.windows++;
+
+	if (s_info.job == job) {
+		s_info.job = NULL;
+		s_info.next_due = window->next_due;
+
+		/* What is left of an exhausted window waits, the budget is per window */
+		if (window->over_budget && s_info.next_due < (long long) dbTime() + MAINTENANCE_RETRY_S)
+			s_info.next_due = (long long) dbTime() + MAINTENANCE_RETRY_S;
+
+		_maintenance_timer_update();
+	}
+
+	mt_free(window);
+
+#if !defined(AR_HOST_BUILD)
+	_maintenance_exit_if_unattended();
+#endif
+}
+
+/**
+ * @brief Internal function deleting the day rows past the retention window,
+ * so that the history screen rarely has anything left to delete.
+ */
+static bool _maintenance_retention_run(sqlite3 *db, maintenance_window_s *window)
+{
+	return deleteExpiredRows(db) == SQLITE_OK;
+}
+
+static bool _maintenance_stop_cb(void *data)
+{
+	return maintenance_stop_requested(data);
+}
+
+/**
+ * @brief Internal function merging the day sketches of finished months, so
+ * that queries over long ranges read a row per month.
+ */
+static bool _maintenance_sketches_run(sqlite3 *db, maintenance_window_s *window)
+{
+	return rollupSketches(db, _maintenance_stop_cb, window) == SQLITE_OK;
+}
+
+/**
+ * @brief Internal function copying the database next to itself.
+ */
+static bool _maintenance_backup_run(sqlite3 *db, maintenance_window_s *window)
+{
+	return backupDb(db, MAINTENANCE_BACKUP_PAGES, _maintenance_stop_cb, window) == SQLITE_OK;
+}
+
+/**
+ * @brief Internal function reading an integer pragma, -1 on error.
+ */
+static int _maintenance_pragma(sqlite3 *db, const char *sql)
+{
+	sqlite3_stmt *stmt;
+	int value = -1;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return -1;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		value = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return value;
+}
+
+/**
+ * @brief Internal function giving the pages freed by deletions back to the
+ * file system once they make up a good part of it, and refreshing the
+ * statistics of the query planner.
+ */
+static bool _maintenance_compact_run(sqlite3 *db, maintenance_window_s *window)
+{
+	int pages = _maintenance_pragma(db, "PRAGMA page_count;");
+	int free_pages = _maintenance_pragma(db, "PRAGMA freelist_count;");
+	char *ErrMsg;
+
+	if (pages < 0 || free_pages < 0)
+		return false;
+
+	if (free_pages * MAINTENANCE_COMPACT_RATIO >= pages && free_pages > 0
+			&& sqlite3_exec(db, "VACUUM;", NULL, 0, &ErrMsg) != SQLITE_OK) {
+		dlog_print(DLOG_WARN, LOG_TAG, "Vacuum stopped [%s]", ErrMsg);
+		sqlite3_free(ErrMsg);
+		return false;
+	}
+
+	if (sqlite3_exec(db, "PRAGMA optimize;", NULL, 0, &ErrMsg) != SQLITE_OK) {
+		dlog_print(DLOG_WARN, LOG_TAG, "Optimize stopped [%s]", ErrMsg);
+		sqlite3_free(ErrMsg);
+		return false;
+	}
+
+	return true;
+}
+
+#if !defined(AR_HOST_BUILD)
+
+/**
+ * @brief Internal callback function invoked when the charger is plugged or unplugged.
+ */
+static void _maintenance_charging_cb(device_callback_e type, void *value, void *user_data)
+{
+	maintenance_set_charging((bool) (intptr_t) value);
+}
+
+/**
+ * @brief Internal function scheduling the alarm relaunching the app for
+ * maintenance while the watch charges, and cancelling it otherwise. Off the
+ * charger a relaunch could do nothing but bring the app up.
+ */
+static void _maintenance_alarm_set(bool charging)
+{
+	app_control_h app_control;
+	int alarm_id;
+	int period;
+	int ret;
+	bool scheduled = preference_get_int(MAINTENANCE_ALARM_PREFERENCE, &alarm_id) == PREFERENCE_ERROR_NONE
+			&& alarm_get_scheduled_period(alarm_id, &period) == ALARM_ERROR_NONE;
+
+	if (!charging) {
+		if (scheduled)
+			alarm_cancel(alarm_id);
+		preference_remove(MAINTENANCE_ALARM_PREFERENCE);
+		return;
+	}
+
+	if (scheduled)
+		return;
+
+	if (app_control_create(&app_control) != APP_CONTROL_ERROR_NONE)
+		return;
+
+	app_control_set_operation(app_control, APP_CONTROL_OPERATION_DEFAULT);
+	app_control_set_app_id(app_control, PACKAGE);
+	app_control_add_extra_data(app_control, MAINTENANCE_APP_CONTROL_KEY, "1");
+
+	ret = alarm_schedule_after_delay(app_control, MAINTENANCE_ALARM_PERIOD, MAINTENANCE_ALARM_PERIOD, &alarm_id);
+	if (ret == ALARM_ERROR_NONE)
+		preference_set_int(MAINTENANCE_ALARM_PREFERENCE, alarm_id);
+	else
+		dlog_print(DLOG_WARN, LOG_TAG, "Maintenance alarm not scheduled [%d]", ret);
+
+	app_control_destroy(app_control);
+}
+
+/**
+ * @brief Internal callback closing an app the alarm brought up once no
+ * background job is left: its window, and the recalculation or sync push
+ * that app_create() queued, run to their end first.
+ */
+static Eina_Bool _maintenance_exit_cb(void *data)
+{
+	if (s_info.unattended && jobs_pending())
+		return ECORE_CALLBACK_RENEW;
+
+	s_info.exit_timer = NULL;
+	if (!s_info.unattended)
+		return ECORE_CALLBACK_CANCEL;
+
+	dlog_print(DLOG_DEBUG, LOG_TAG, "Maintenance launch done, exiting");
+	s_info.unattended = false;
+	ui_app_exit();
+
+	return ECORE_CALLBACK_CANCEL;
+}
+
+/**
+ * @brief Internal function closing an app the alarm brought up, once its
+ * window and the other background jobs are over. The next alarm relaunches
+ * it for what is left.
+ */
+static void _maintenance_exit_if_unattended(void)
+{
+	if (!s_info.unattended || s_info.exit_timer)
+		return;
+
+	s_info.exit_timer = ecore_timer_add(MAINTENANCE_EXIT_POLL_S, _maintenance_exit_cb, NULL);
+}
+
+/**
+ * @brief Handles a launch request. Each launch by the maintenance alarm runs
+ * a window and, unless the user has opened the app in this process, exits
+ * afterwards; any other launch means the user brought the app up.
+ * @return This function returns 'true' if the launch request came from the alarm.
+ */
+bool maintenance_app_control(app_control_h app_control)
+{
+	char *value = NULL;
+
+	if (app_control_get_extra_data(app_control, MAINTENANCE_APP_CONTROL_KEY, &value) != APP_CONTROL_ERROR_NONE) {
+		s_info.opened = true;
+		s_info.unattended = false;
+		return false;
+	}
+
+	free(value);
+
+	s_info.unattended = !s_info.opened;
+
+	/* The charger callback may have been missed while the app was closed */
+	bool charging = false;
+
+	if (device_battery_is_charging(&charging) == DEVICE_ERROR_NONE)
+		maintenance_set_charging(charging);
+	else
+		maintenance_check();
+
+	_maintenance_exit_if_unattended();
+
+	return true;
+}
+
+#endif
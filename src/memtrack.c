@@ -0,0 +1,272 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "avoidrickshaw.h"
+#include "memtrack.h"
+
+#define MEMTRACK_MAGIC 0x4d54524bu /*"MTRK", catches blocks freed twice or not from mt_malloc()*/
+
+/*keeps the user block aligned like malloc() on 32 and 64 bit targets*/
+typedef union {
+	struct {
+		size_t size;
+		uint32_t tag;
+		uint32_t magic;
+	} info;
+	long double align_ld;
+	void *align_ptr;
+} memtrack_header_u;
+
+#define MEMTRACK_TAG_NAME(id, name) name,
+static const char *s_tag_names[] = {
+	MEMTRACK_TAG_LIST(MEMTRACK_TAG_NAME)
+};
+#undef MEMTRACK_TAG_NAME
+
+static struct memtrack_info {
+	memtrack_stats_s stats[MT_TAG_COUNT];
+	/*state of the previous report, for the allocation rate*/
+	uint64_t reported_allocs[MT_TAG_COUNT];
+	double reported_time;
+	uint64_t steady_violations;
+} s_info;
+
+static __thread int s_steady_depth; /*memtrack_steady_enter() nesting of the thread*/
+
+static double _memtrack_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _memtrack_account(memtrack_tag_e tag, int64_t bytes, int64_t blocks)
+{
+	memtrack_stats_s *stats = &s_info.stats[tag];
+	int64_t live = __atomic_add_fetch(&stats->live_bytes, bytes, __ATOMIC_RELAXED);
+	int64_t peak = __atomic_load_n(&stats->peak_bytes, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&stats->live_blocks, blocks, __ATOMIC_RELAXED);
+
+	if (bytes <= 0)
+		return;
+
+	__atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats->alloc_bytes, bytes, __ATOMIC_RELAXED);
+
+	while (live > peak && !__atomic_compare_exchange_n(&stats->peak_bytes, &peak, live, true,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*allocations are not expected while the thread is in steady state*/
+static void _memtrack_steady_check(memtrack_tag_e tag, size_t size)
+{
+	if (!s_steady_depth)
+		return;
+
+	__atomic_add_fetch(&s_info.steady_violations, 1, __ATOMIC_RELAXED);
+	dlog_print(DLOG_ERROR, LOG_TAG, "%s allocated %zu bytes in steady state", memtrack_tag_name(tag), size);
+	assert(!"allocation in steady state");
+}
+
+static void *_memtrack_init_block(memtrack_header_u *header, memtrack_tag_e tag, size_t size)
+{
+	if (!header)
+		return NULL;
+
+	header->info.size = size;
+	header->info.tag = tag < MT_TAG_COUNT ? tag : MT_OTHER;
+	header->info.magic = MEMTRACK_MAGIC;
+	_memtrack_account(header->info.tag, size, 1);
+	_memtrack_steady_check(header->info.tag, size);
+
+	return header + 1;
+}
+
+void *mt_malloc(memtrack_tag_e tag, size_t size)
+{
+	if (size > SIZE_MAX - sizeof(memtrack_header_u))
+		return NULL;
+
+	return _memtrack_init_block(malloc(sizeof(memtrack_header_u) + size), tag, size);
+}
+
+void *mt_calloc(memtrack_tag_e tag, size_t count, size_t size)
+{
+	if (size && count > (SIZE_MAX - sizeof(memtrack_header_u)) / size)
+		return NULL;
+
+	return _memtrack_init_block(calloc(1, sizeof(memtrack_header_u) + count * size), tag, count * size);
+}
+
+/**
+ * @brief Resizes a block like realloc(). The block keeps the tag it was
+ * allocated with; tag is only used when ptr is NULL.
+ */
+void *mt_realloc(memtrack_tag_e tag, void *ptr, size_t size)
+{
+	memtrack_header_u *header, *resized;
+	size_t old_size;
+
+	if (!ptr)
+		return mt_malloc(tag, size);
+
+	if (size > SIZE_MAX - sizeof(memtrack_header_u))
+		return NULL;
+
+	header = (memtrack_header_u *) ptr - 1;
+	if (header->info.magic != MEMTRACK_MAGIC) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "mt_realloc of a block not from mt_malloc");
+		abort();
+	}
+
+	old_size = header->info.size;
+	resized = realloc(header, sizeof(memtrack_header_u) + size);
+	if (!resized)
+		return NULL;
+
+	resized->info.size = size;
+	_memtrack_account(resized->info.tag, (int64_t) size - (int64_t) old_size, 0);
+	_memtrack_steady_check(resized->info.tag, size);
+
+	return resized + 1;
+}
+
+char *mt_strdup(memtrack_tag_e tag, const char *str)
+{
+	size_t size = strlen(str) + 1;
+	char *copy = mt_malloc(tag, size);
+
+	if (copy)
+		memcpy(copy, str, size);
+
+	return copy;
+}
+
+void mt_free(void *ptr)
+{
+	memtrack_header_u *header;
+
+	if (!ptr)
+		return;
+
+	header = (memtrack_header_u *) ptr - 1;
+	if (header->info.magic != MEMTRACK_MAGIC) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "mt_free of a block not from mt_malloc or freed twice");
+		abort();
+	}
+
+	header->info.magic = 0;
+	_memtrack_account(header->info.tag, -(int64_t) header->info.size, -1);
+	free(header);
+}
+
+const char *memtrack_tag_name(memtrack_tag_e tag)
+{
+	return tag < MT_TAG_COUNT ? s_tag_names[tag] : "unknown";
+}
+
+/**
+ * @brief Copies the counters of one module.
+ */
+void memtrack_stats(memtrack_tag_e tag, memtrack_stats_s *stats)
+{
+	memtrack_stats_s *src = &s_info.stats[tag];
+
+	stats->live_bytes = __atomic_load_n(&src->live_bytes, __ATOMIC_RELAXED);
+	stats->live_blocks = __atomic_load_n(&src->live_blocks, __ATOMIC_RELAXED);
+	stats->peak_bytes = __atomic_load_n(&src->peak_bytes, __ATOMIC_RELAXED);
+	stats->allocs = __atomic_load_n(&src->allocs, __ATOMIC_RELAXED);
+	stats->alloc_bytes = __atomic_load_n(&src->alloc_bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Live bytes of all modules together.
+ */
+int64_t memtrack_live_bytes(void)
+{
+	int64_t live = 0;
+
+	for (int tag = 0; tag < MT_TAG_COUNT; tag++)
+		live += __atomic_load_n(&s_info.stats[tag].live_bytes, __ATOMIC_RELAXED);
+
+	return live;
+}
+
+/**
+ * @brief Formats the per module counters as text. The allocation rate is
+ * measured since the previous report. Meant for the main loop.
+ * @return The length of the text, truncated to len - 1 characters.
+ */
+size_t memtrack_report(char *buf, size_t len)
+{
+	double now = _memtrack_now();
+	double elapsed = s_info.reported_time > 0.0 ? now - s_info.reported_time : 0.0;
+	size_t used = 0;
+	int n;
+
+	n = snprintf(buf, len, "module: live B (blocks), peak B, allocs, allocs/s\n");
+	used += n > 0 ? n : 0;
+
+	for (int tag = 0; tag < MT_TAG_COUNT && used < len; tag++) {
+		memtrack_stats_s stats;
+		double rate;
+
+		memtrack_stats(tag, &stats);
+		rate = elapsed > 0.0 ? (stats.allocs - s_info.reported_allocs[tag]) / elapsed : 0.0;
+		s_info.reported_allocs[tag] = stats.allocs;
+
+		if (!stats.allocs)
+			continue;
+
+		n = snprintf(buf + used, len - used, "%s: %lld (%lld), %lld, %llu, %.1f\n", s_tag_names[tag],
+				(long long) stats.live_bytes, (long long) stats.live_blocks, (long long) stats.peak_bytes,
+				(unsigned long long) stats.allocs, rate);
+		used += n > 0 ? n : 0;
+	}
+
+	s_info.reported_time = now;
+
+	return used < len ? used : len - 1;
+}
+
+/**
+ * @brief Writes the report to the log, one line per module.
+ */
+void memtrack_log_report(void)
+{
+	char report[1024];
+	char *line, *save = NULL;
+
+	memtrack_report(report, sizeof(report));
+
+	for (line = strtok_r(report, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+		dlog_print(DLOG_INFO, LOG_TAG, "heap %s", line);
+}
+
+/**
+ * @brief Marks the calling thread as running a path that must not allocate.
+ * Calls nest; each is matched by memtrack_steady_leave().
+ */
+void memtrack_steady_enter(void)
+{
+	s_steady_depth++;
+}
+
+void memtrack_steady_leave(void)
+{
+	if (s_steady_depth > 0)
+		s_steady_depth--;
+}
+
+/**
+ * @brief Number of allocations made in steady state, by any thread.
+ */
+uint64_t memtrack_steady_violations(void)
+{
+	return __atomic_load_n(&s_info.steady_violations, __ATOMIC_RELAXED);
+}
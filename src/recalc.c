@@ -0,0 +1,242 @@
+#include <unistd.h>
+#include "avoidrickshaw.h"
+#include "recalc.h"
+#include "jobs.h"
+#include "Sqlitedbhelper.h"
+#include "memtrack.h"
+
+#define RECALC_CHUNK_ROWS 64
+#define RECALC_CHUNK_PAUSE_US 10000 /*gap between chunks so the session save never waits long*/
+
+typedef struct {
+	job_s *handle;
+	int done;
+	int total;
+	bool success;
+} recalc_job_s;
+
+static struct recalc_info {
+	recalc_job_s *job;  /*the running job, NULL if none*/
+	bool restart;       /*the weight changed again while the job ran*/
+	recalc_progress_callback_t progress_callback;
+	recalc_done_callback_t done_callback;
+} s_info = {
+	.job = NULL,
+	.restart = false,
+	.progress_callback = NULL,
+	.done_callback = NULL,
+};
+
+static bool _recalc_run(void);
+static void _recalc_run_cb(void *data, job_s *handle);
+static void _recalc_notify_cb(void *data, job_s *handle, void *msg_data);
+static void _recalc_done_cb(void *data, job_s *handle, bool cancelled);
+
+/**
+ * @brief Attaches callbacks reporting recalculation progress in the main loop.
+ * @param[in] progress_callback Invoked after each committed chunk, may be NULL.
+ * @param[in] done_callback Invoked once all queued work finished or failed, may be NULL.
+ */
+void recalc_set_callbacks(recalc_progress_callback_t progress_callback, recalc_done_callback_t done_callback)
+{
+	s_info.progress_callback = progress_callback;
+	s_info.done_callback = done_callback;
+}
+
+/**
+ * @brief Starts recomputing stored calories for a new body weight.
+ * Day rows keep the weight their calories use and the weight term per kg
+ * (see tracker_core_calories()), so only the weight term is replaced.
+ * The new weight is stored before the job is queued, so an exit before it
+ * ran leaves it to recalc_calories_resume(). If a job is already running
+ * it is run again for the new weight once it ends.
+ * @param[in] old_weight The weight the stored values were computed with.
+ * @param[in] new_weight The weight to recompute with.
+ * @return This function returns 'true' if the work was started or queued,
+ * otherwise 'false' is returned.
+ */
+bool recalc_calories_start(double old_weight, double new_weight)
+{
+	if (old_weight <= 0.0 || new_weight <= 0.0) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Invalid weight for recalculation: %lf -> %lf", old_weight, new_weight);
+		return false;
+	}
+
+	if (setRecalcTarget(old_weight, new_weight) != SQLITE_OK)
+		return false;
+
+	if (s_info.job) {
+		s_info.restart = true;
+		return true;
+	}
+
+	return _recalc_run();
+}
+
+/**
+ * @brief Finishes a recalculation interrupted by application exit.
+ * @return This function returns 'true' if the job was started,
+ * otherwise 'false' is returned.
+ */
+bool recalc_calories_resume(void)
+{
+	if (s_info.job)
+		return true;
+
+	return _recalc_run();
+}
+
+/**
+ * @brief Cancels the running recalculation. Committed chunks stay committed
+ * and the rest is resumed by recalc_calories_resume().
+ */
+void recalc_calories_cancel(void)
+{
+	if (!s_info.job)
+		return;
+
+	jobs_cancel(s_info.job->handle);
+	s_info.job = NULL;
+	s_info.restart = false;
+}
+
+/**
+ * @brief Checks whether a recalculation job is in progress.
+ */
+bool recalc_calories_running(void)
+{
+	return s_info.job != NULL;
+}
+
+/**
+ * @brief Internal function queuing the job on the background workers.
+ */
+static bool _recalc_run(void)
+{
+	static const job_callbacks_s callbacks = {
+		.run = _recalc_run_cb,
+		.notify = _recalc_notify_cb,
+		.done = _recalc_done_cb,
+	};
+	recalc_job_s *job = mt_calloc(MT_RECALC, 1, sizeof(recalc_job_s));
+	if (!job)
+		return false;
+
+	job->handle = jobs_submit(JOB_NORMAL, &callbacks, job);
+	if (!job->handle) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to queue recalculation job");
+		mt_free(job);
+		return false;
+	}
+
+	s_info.job = job;
+
+	return true;
+}
+
+/**
+ * @brief Internal function doing the recalculation on the worker thread,
+ * chunk by chunk until every day row uses the stored weight.
+ */
+static void _recalc_run_cb(void *data, job_s *handle)
+{
+	recalc_job_s *job = data;
+	double weight;
+	sqlite3 *db;
+
+	if (openWorkerDb(&db) != SQLITE_OK)
+		return;
+
+	if (getRecalcTarget(db, &weight) != SQLITE_OK ||
+			(weight > 0.0 && countCaloriesToReweigh(db, weight, &job->total) != SQLITE_OK)) {
+		sqlite3_close(db);
+		return;
+	}
+
+	while (weight > 0.0) {
+		int rows;
+
+		if (jobs_cancelled(handle)) {
+			sqlite3_close(db);
+			return;
+		}
+
+		if (reweighCaloriesChunk(db, weight, RECALC_CHUNK_ROWS, &rows) != SQLITE_OK) {
+			sqlite3_close(db);
+			return;
+		}
+
+		if (!rows) {
+			if (clearRecalcTarget(db, weight) != SQLITE_OK) {
+				sqlite3_close(db);
+				return;
+			}
+			break;
+		}
+
+		job->done += rows;
+
+		int *done = mt_malloc(MT_RECALC, sizeof(int));
+		if (done) {
+			*done = job->done;
+			if (!jobs_feedback(handle, done))
+				mt_free(done);
+		}
+
+		usleep(RECALC_CHUNK_PAUSE_US);
+	}
+
+	job->success = true;
+	sqlite3_close(db);
+}
+
+/**
+ * @brief Internal callback reporting chunk progress in the main loop.
+ */
+static void _recalc_notify_cb(void *data, job_s *handle, void *msg_data)
+{
+	recalc_job_s *job = data;
+	int *done = msg_data;
+
+	dlog_print(DLOG_DEBUG, LOG_TAG, "Calorie recalculation: %d/%d rows", *done, job->total);
+
+	if (s_info.job == job && s_info.progress_callback)
+		s_info.progress_callback(*done, job->total);
+
+	mt_free(done);
+}
+
+/**
+ * @brief Internal callback invoked in the main loop when the job finished or was cancelled.
+ * Runs the job again if the weight changed while it ran.
+ */
+static void _recalc_done_cb(void *data, job_s *handle, bool cancelled)
+{
+	recalc_job_s *job = data;
+	bool success = job->success && !cancelled;
+	bool current = s_info.job == job;
+
+	if (cancelled)
+		dlog_print(DLOG_DEBUG, LOG_TAG, "Calorie recalculation cancelled after %d rows", job->done);
+	else
+		dlog_print(DLOG_DEBUG, LOG_TAG, "Calorie recalculation finished, success: %d", success);
+	mt_free(job);
+
+	if (!current)
+		return;
+
+	s_info.job = NULL;
+
+	if (cancelled)
+		return;
+
+	if (success && s_info.restart) {
+		s_info.restart = false;
+		if (_recalc_run())
+			return;
+		success = false;
+	}
+
+	if (s_info.done_callback)
+		s_info.done_callback(success);
+}
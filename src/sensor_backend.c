@@ -0,0 +1,479 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "avoidrickshaw.h"
+#include "sensor_backend.h"
+#include "tracker_core.h"
+#include "memtrack.h"
+
+#define SYNTH_GRAVITY 9.81
+#define SYNTH_STEP_AMPLITUDE 2.5   /*m/s^2 above and below gravity during a step*/
+#define SYNTH_ACCEL_NOISE 0.1
+#define SYNTH_METERS_PER_DEGREE 111320.0
+#define SYNTH_EARTH_RADIUS 6371000.0   /*as tracker_core_distance(), so the walked distance is measured exactly*/
+#define SYNTH_TO_RAD (M_PI / 180.0)
+#define SYNTH_EPOCH 1.0e9          /*generated times are unix times like recorded ones, never the unknown 0*/
+#define OFFLINE_CLOCK_START 1.0e9  /*the clock of a new backend; events moved onto it never read as the unknown 0*/
+
+/*state shared by the backends that replay or generate events*/
+typedef struct {
+	bool location_on;
+	bool motion_on;
+	bool motion_fresh;      /*motion just started, the next sample is taken at rest*/
+	double now;
+	/*added to event times, so every run continues the backend's clock*/
+	double offset;
+	bool offset_set;
+	/*pacing: event time over wall time, 0 for as fast as possible*/
+	double speed;
+	double pace_first;      /*event time the run started at*/
+	struct timespec pace_wall;
+} offline_state_s;
+
+typedef struct {
+	offline_state_s state;
+	char *path;
+} replay_ctx_s;
+
+typedef struct {
+	offline_state_s state;
+	sensor_synth_params_s params;
+	/*where the walk stands; the next run carries it on*/
+	double end;
+	long next_sample;
+	long next_fix;
+	unsigned int seed;
+} synth_ctx_s;
+
+/**
+ * @brief Delivers all remaining events of an offline backend.
+ * @return This function returns 'false' if the backend is driven by the main
+ * loop or its source could not be read, otherwise 'true' is returned.
+ */
+bool sensor_backend_run(sensor_backend_s *backend)
+{
+	if (!backend || !backend->run)
+		return false;
+
+	/* Offline backends place the events of this run after those already delivered */
+	((offline_state_s *) backend->ctx)->offset_set = false;
+	((offline_state_s *) backend->ctx)->pace_first = 0.0;
+
+	return backend->run(backend);
+}
+
+/**
+ * @brief Sets how fast an offline backend delivers its events.
+ * @param[in] speed 1 for the recorded pace, 10 for ten times faster,
+ * 0 for as fast as possible, the default.
+ * @return This function returns 'false' for backends driven by the main loop.
+ */
+bool sensor_backend_set_speed(sensor_backend_s *backend, double speed)
+{
+	if (!backend || !backend->run || speed < 0.0)
+		return false;
+
+	((offline_state_s *) backend->ctx)->speed = speed;
+	return true;
+}
+
+void sensor_backend_destroy(sensor_backend_s *backend)
+{
+	if (!backend)
+		return;
+
+	if (backend->destroy)
+		backend->destroy(backend);
+	mt_free(backend);
+}
+
+/*
+ * Functions shared by the replay and synthetic backends. Both keep an
+ * offline_state_s at the start of their context.
+ */
+
+static bool _offline_location_enabled(sensor_backend_s *backend)
+{
+	return true;
+}
+
+static bool _offline_location_start(sensor_backend_s *backend)
+{
+	((offline_state_s *) backend->ctx)->location_on = true;
+	return true;
+}
+
+static bool _offline_location_stop(sensor_backend_s *backend)
+{
+	((offline_state_s *) backend->ctx)->location_on = false;
+	return true;
+}
+
+static bool _offline_motion_start(sensor_backend_s *backend)
+{
+	offline_state_s *state = backend->ctx;
+
+	state->motion_on = true;
+	state->motion_fresh = true;
+	return true;
+}
+
+static bool _offline_motion_stop(sensor_backend_s *backend)
+{
+	((offline_state_s *) backend->ctx)->motion_on = false;
+	return true;
+}
+
+static double _offline_distance(sensor_backend_s *backend, double latitude1, double longitude1,
+		double latitude2, double longitude2)
+{
+	return tracker_core_distance(latitude1, longitude1, latitude2, longitude2);
+}
+
+static double _offline_now(sensor_backend_s *backend)
+{
+	return ((offline_state_s *) backend->ctx)->now;
+}
+
+/*moves an event time onto the backend's clock, 0 stays unknown*/
+static double _offline_clock(offline_state_s *state, double timestamp)
+{
+	if (timestamp <= 0.0)
+		return 0.0;
+
+	/* The first event of a run happens now; recorded times only give the spacing */
+	if (!state->offset_set) {
+		state->offset = state->now - timestamp;
+		state->offset_set = true;
+	}
+
+	state->now = timestamp + state->offset;
+	return state->now;
+}
+
+/*sleeps until the event is due at the set speed; events without a time are never held*/
+static void _offline_pace(offline_state_s *state, double timestamp)
+{
+	struct timespec due;
+	double delay;
+
+	if (state->speed <= 0.0 || timestamp <= 0.0)
+		return;
+
+	if (state->pace_first <= 0.0) {
+		state->pace_first = timestamp;
+		clock_gettime(CLOCK_MONOTONIC, &state->pace_wall);
+		return;
+	}
+
+	delay = (timestamp - state->pace_first) / state->speed;
+	if (delay <= 0.0)
+		return;
+
+	/* Absolute deadlines, so time spent handling events does not add up to drift */
+	due.tv_sec = state->pace_wall.tv_sec + (time_t) delay;
+	due.tv_nsec = state->pace_wall.tv_nsec + (long) ((delay - (time_t) delay) * 1e9);
+	if (due.tv_nsec >= 1000000000L) {
+		due.tv_sec++;
+		due.tv_nsec -= 1000000000L;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+		;
+}
+
+static void _offline_accel(sensor_backend_s *backend, const track_accel_s *sample)
+{
+	offline_state_s *state = backend->ctx;
+	track_accel_s event = *sample;
+
+	_offline_pace(state, sample->timestamp);
+	event.timestamp = _offline_clock(state, sample->timestamp);
+
+	if (state->motion_on && backend->handlers.accel_cb)
+		backend->handlers.accel_cb(&event, backend->user_data);
+}
+
+static void _offline_fix(sensor_backend_s *backend, const track_fix_s *fix)
+{
+	offline_state_s *state = backend->ctx;
+	track_fix_s event = *fix;
+
+	_offline_pace(state, fix->timestamp);
+	event.timestamp = _offline_clock(state, fix->timestamp);
+
+	if (state->location_on && backend->handlers.fix_cb)
+		backend->handlers.fix_cb(&event, backend->user_data);
+}
+
+static sensor_backend_s *_offline_create(const char *name, size_t ctx_size)
+{
+	sensor_backend_s *backend = mt_calloc(MT_DATA, 1, sizeof(sensor_backend_s));
+
+	if (!backend)
+		return NULL;
+
+	backend->ctx = mt_calloc(MT_DATA, 1, ctx_size);
+	if (!backend->ctx) {
+		mt_free(backend);
+		return NULL;
+	}
+
+	((offline_state_s *) backend->ctx)->now = OFFLINE_CLOCK_START;
+
+	backend->name = name;
+	backend->location_enabled = _offline_location_enabled;
+	backend->location_start = _offline_location_start;
+	backend->location_stop = _offline_location_stop;
+	backend->motion_start = _offline_motion_start;
+	backend->motion_stop = _offline_motion_stop;
+	backend->distance = _offline_distance;
+	backend->now = _offline_now;
+
+	return backend;
+}
+
+/*
+ * Inject backend: no source of its own, the caller hands in every event.
+ */
+
+static bool _inject_run(sensor_backend_s *backend)
+{
+	/* Everything was delivered as it was injected */
+	return true;
+}
+
+static void _inject_destroy(sensor_backend_s *backend)
+{
+	mt_free(backend->ctx);
+}
+
+/**
+ * @brief Creates a backend delivering only the events passed to
+ * sensor_backend_inject_accel() and sensor_backend_inject_fix(), for
+ * benchmarks timing the path from an event to its effect.
+ * @return The backend, or NULL on failure. Release it with sensor_backend_destroy().
+ */
+sensor_backend_s *sensor_backend_inject_create(void)
+{
+	sensor_backend_s *backend = _offline_create("inject", sizeof(offline_state_s));
+
+	if (!backend)
+		return NULL;
+
+	backend->run = _inject_run;
+	backend->destroy = _inject_destroy;
+
+	return backend;
+}
+
+/**
+ * @brief Delivers one accelerometer sample through an offline backend now,
+ * dropped like any other if motion is not started.
+ * @return This function returns 'false' for backends driven by the main loop.
+ */
+bool sensor_backend_inject_accel(sensor_backend_s *backend, const track_accel_s *sample)
+{
+	if (!backend || !backend->run)
+		return false;
+
+	_offline_accel(backend, sample);
+	return true;
+}
+
+/**
+ * @brief Delivers one fix through an offline backend now, dropped like any
+ * other if location is not started.
+ * @return This function returns 'false' for backends driven by the main loop.
+ */
+bool sensor_backend_inject_fix(sensor_backend_s *backend, const track_fix_s *fix)
+{
+	if (!backend || !backend->run)
+		return false;
+
+	_offline_fix(backend, fix);
+	return true;
+}
+
+/*
+ * Replay backend: a recorded track in one of the track_file.h formats.
+ */
+
+static void _replay_accel_cb(const track_accel_s *sample, void *user_data)
+{
+	_offline_accel(user_data, sample);
+}
+
+static void _replay_fix_cb(const track_fix_s *fix, void *user_data)
+{
+	_offline_fix(user_data, fix);
+}
+
+static bool _replay_run(sensor_backend_s *backend)
+{
+	static const track_file_handlers_s handlers = {
+		.accel_cb = _replay_accel_cb,
+		.fix_cb = _replay_fix_cb,
+	};
+	replay_ctx_s *ctx = backend->ctx;
+	track_file_stats_s stats;
+
+	if (!track_file_read(ctx->path, &handlers, backend, &stats)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to replay %s", ctx->path);
+		return false;
+	}
+
+	return true;
+}
+
+static void _replay_destroy(sensor_backend_s *backend)
+{
+	replay_ctx_s *ctx = backend->ctx;
+
+	mt_free(ctx->path);
+	mt_free(ctx);
+}
+
+/**
+ * @brief Creates a backend replaying a recorded track file.
+ * @param[in] path The track, in a format track_file_format() recognizes.
+ * @return The backend, or NULL on failure. Release it with sensor_backend_destroy().
+ */
+sensor_backend_s *sensor_backend_replay_create(const char *path)
+{
+	sensor_backend_s *backend;
+	replay_ctx_s *ctx;
+
+	if (track_file_format(path) == TRACK_FORMAT_UNKNOWN) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Unknown track format: %s", path);
+		return NULL;
+	}
+
+	backend = _offline_create("replay", sizeof(replay_ctx_s));
+	if (!backend)
+		return NULL;
+
+	ctx = backend->ctx;
+	ctx->path = mt_strdup(MT_DATA, path);
+	if (!ctx->path) {
+		mt_free(ctx);
+		mt_free(backend);
+		return NULL;
+	}
+
+	backend->run = _replay_run;
+	backend->destroy = _replay_destroy;
+
+	return backend;
+}
+
+/*
+ * Synthetic backend: a walk along a great circle at constant speed.
+ * Every step is a rise of the acceleration above gravity followed by a
+ * drop below it, sampled at accel_rate. Each run walks on for another
+ * duration from where the previous one stopped.
+ */
+
+static double _synth_noise(unsigned int *seed, double amplitude)
+{
+	return amplitude * (2.0 * rand_r(seed) / RAND_MAX - 1.0);
+}
+
+static void _synth_accel(sensor_backend_s *backend, double t, unsigned int *seed)
+{
+	synth_ctx_s *ctx = backend->ctx;
+	const sensor_synth_params_s *params = &ctx->params;
+	track_accel_s sample = { .timestamp = SYNTH_EPOCH + t };
+	double z = SYNTH_GRAVITY;
+
+	/* The detector takes the first sample after a start as the resting level */
+	if (params->cadence > 0.0 && !ctx->state.motion_fresh)
+		z += fmod(t * params->cadence, 1.0) < 0.5 ? SYNTH_STEP_AMPLITUDE : -SYNTH_STEP_AMPLITUDE;
+
+	sample.x = _synth_noise(seed, SYNTH_ACCEL_NOISE);
+	sample.y = _synth_noise(seed, SYNTH_ACCEL_NOISE);
+	sample.z = z + _synth_noise(seed, SYNTH_ACCEL_NOISE);
+
+	if (ctx->state.motion_on)
+		ctx->state.motion_fresh = false;
+
+	_offline_accel(backend, &sample);
+}
+
+static void _synth_fix(sensor_backend_s *backend, double t, unsigned int *seed)
+{
+	synth_ctx_s *ctx = backend->ctx;
+	const sensor_synth_params_s *params = &ctx->params;
+	double walked = params->speed * t / SYNTH_EARTH_RADIUS;
+	double latitude = params->latitude * SYNTH_TO_RAD;
+	double heading = params->heading * SYNTH_TO_RAD;
+	double north = _synth_noise(seed, params->gps_noise);
+	double east = _synth_noise(seed, params->gps_noise);
+	track_fix_s fix = {
+		.timestamp = SYNTH_EPOCH + t,
+		.accuracy = params->gps_noise > 0.0 ? params->gps_noise : 5.0,
+	};
+
+	/* Destination at the walked angle along the heading, then the jitter in meters */
+	fix.latitude = asin(sin(latitude) * cos(walked) + cos(latitude) * sin(walked) * cos(heading));
+	fix.longitude = params->longitude * SYNTH_TO_RAD + atan2(sin(heading) * sin(walked) * cos(latitude),
+			cos(walked) - sin(latitude) * sin(fix.latitude));
+	fix.longitude = fix.longitude / SYNTH_TO_RAD + east / (SYNTH_METERS_PER_DEGREE * cos(fix.latitude));
+	fix.latitude = fix.latitude / SYNTH_TO_RAD + north / SYNTH_METERS_PER_DEGREE;
+
+	_offline_fix(backend, &fix);
+}
+
+static bool _synth_run(sensor_backend_s *backend)
+{
+	synth_ctx_s *ctx = backend->ctx;
+	const sensor_synth_params_s *params = &ctx->params;
+
+	ctx->end += params->duration;
+
+	/* Merge both streams in time order; a fix goes first on a tie */
+	for (;;) {
+		double t_accel = params->accel_rate > 0.0 ? ctx->next_sample / params->accel_rate : INFINITY;
+		double t_fix = params->fix_interval > 0.0 ? ctx->next_fix * params->fix_interval : INFINITY;
+
+		if (t_accel > ctx->end && t_fix > ctx->end)
+			break;
+
+		if (t_fix <= t_accel) {
+			_synth_fix(backend, t_fix, &ctx->seed);
+			ctx->next_fix++;
+		}
+		else {
+			_synth_accel(backend, t_accel, &ctx->seed);
+			ctx->next_sample++;
+		}
+	}
+
+	return true;
+}
+
+static void _synth_destroy(sensor_backend_s *backend)
+{
+	mt_free(backend->ctx);
+}
+
+/**
+ * @brief Creates a backend generating a walk.
+ * @param[in] params The walk, SENSOR_SYNTH_PARAMS_WALK for a device-like one.
+ * @return The backend, or NULL on failure. Release it with sensor_backend_destroy().
+ */
+sensor_backend_s *sensor_backend_synth_create(const sensor_synth_params_s *params)
+{
+	sensor_backend_s *backend = _offline_create("synth", sizeof(synth_ctx_s));
+
+	if (!backend)
+		return NULL;
+
+	((synth_ctx_s *) backend->ctx)->params = *params;
+	((synth_ctx_s *) backend->ctx)->seed = params->seed;
+	backend->run = _synth_run;
+	backend->destroy = _synth_destroy;
+
+	return backend;
+}
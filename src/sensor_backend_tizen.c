@@ -0,0 +1,296 @@
+#include <locations.h>
+#include <sensor.h>
+#include <Ecore.h>
+#include "avoidrickshaw.h"
+#include "sensor_backend.h"
+#include "memtrack.h"
+
+#define POSITION_UPDATE_INTERVAL 4  /*seconds*/
+#define ACCEL_INTERVAL 200          /*milliseconds*/
+
+typedef struct {
+	location_manager_h location_manager;
+	sensor_listener_h acceleration_listener;
+} tizen_ctx_s;
+
+static bool _tizen_location_init(sensor_backend_s *backend);
+static void _tizen_location_destroy(sensor_backend_s *backend);
+
+/**
+ * @brief Internal callback function invoked on position obtained from GPS module update.
+ * This callback function is attached with the location_manager_set_position_updated_cb() function.
+ */
+static void _tizen_position_cb(double latitude, double longitude, double altitude, time_t timestamp, void *data)
+{
+	sensor_backend_s *backend = data;
+	tizen_ctx_s *ctx = backend->ctx;
+	location_accuracy_level_e level;
+	double vertical_acc = 0.0;
+	track_fix_s fix = {
+		.timestamp = ecore_time_get(),
+		.latitude = latitude,
+		.longitude = longitude,
+		.altitude = altitude,
+	};
+
+	location_manager_get_accuracy(ctx->location_manager, &level, &fix.accuracy, &vertical_acc);
+
+	if (backend->handlers.fix_cb)
+		backend->handlers.fix_cb(&fix, backend->user_data);
+}
+
+/**
+ * @brief Internal callback function invoked on acceleration measurement acquisition.
+ * This callback function is attached with the sensor_listener_set_event_cb() function.
+ */
+static void _tizen_accel_cb(sensor_h sensor, sensor_event_s *event, void *data)
+{
+	sensor_backend_s *backend = data;
+	track_accel_s sample = {
+		.timestamp = ecore_time_get(),
+		.x = event->values[0],
+		.y = event->values[1],
+		.z = event->values[2],
+	};
+
+	if (backend->handlers.accel_cb)
+		backend->handlers.accel_cb(&sample, backend->user_data);
+}
+
+/**
+ * @brief Obtains the state of the GPS module.
+ * @return This function returns 'true' if the GPS module is enabled,
+ * otherwise 'false' is returned.
+ */
+static bool _tizen_location_enabled(sensor_backend_s *backend)
+{
+	bool gps_enabled = false;
+
+	int ret = location_manager_is_enabled_method(LOCATIONS_METHOD_GPS, &gps_enabled);
+	if (ret != LOCATIONS_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to get GPS status");
+		return false;
+	}
+
+	if (!gps_enabled) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "GPS not enabled");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Internal function creating the location manager instance and attaching
+ * the position change callback.
+ */
+static bool _tizen_location_init(sensor_backend_s *backend)
+{
+	tizen_ctx_s *ctx = backend->ctx;
+
+	int ret = location_manager_create(LOCATIONS_METHOD_HYBRID, &ctx->location_manager);
+	if (ret != LOCATIONS_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create location manager");
+		ctx->location_manager = NULL;
+		return false;
+	}
+
+	ret = location_manager_set_position_updated_cb(ctx->location_manager, _tizen_position_cb,
+			POSITION_UPDATE_INTERVAL, backend);
+	if (ret != LOCATIONS_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to register callback for position update");
+		_tizen_location_destroy(backend);
+		return false;
+	}
+
+	return true;
+}
+
+static void _tizen_location_destroy(sensor_backend_s *backend)
+{
+	tizen_ctx_s *ctx = backend->ctx;
+
+	if (!ctx->location_manager)
+		return;
+
+	if (location_manager_destroy(ctx->location_manager) != LOCATIONS_ERROR_NONE)
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to destroy location manager");
+
+	ctx->location_manager = NULL;
+}
+
+static bool _tizen_location_start(sensor_backend_s *backend)
+{
+	tizen_ctx_s *ctx = backend->ctx;
+
+	if (!ctx->location_manager && !_tizen_location_init(backend)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Location manager not initialized");
+		return false;
+	}
+
+	if (location_manager_start(ctx->location_manager) != LOCATIONS_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to start location manager");
+		return false;
+	}
+
+	return true;
+}
+
+static bool _tizen_location_stop(sensor_backend_s *backend)
+{
+	tizen_ctx_s *ctx = backend->ctx;
+
+	if (!ctx->location_manager)
+		return false;
+
+	if (location_manager_stop(ctx->location_manager) != LOCATIONS_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to stop location manager");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Internal function creating the accelerometer listener.
+ */
+static bool _tizen_motion_init(sensor_backend_s *backend)
+{
+	tizen_ctx_s *ctx = backend->ctx;
+	sensor_h sensor;
+	bool supported = false;
+
+	int ret = sensor_is_supported(SENSOR_ACCELEROMETER, &supported);
+	if (ret != SENSOR_ERROR_NONE || !supported) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Accelerometer sensor not supported on current device");
+		return false;
+	}
+
+	ret = sensor_get_default_sensor(SENSOR_ACCELEROMETER, &sensor);
+	if (ret != SENSOR_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to get default accelerometer sensor");
+		return false;
+	}
+
+	ret = sensor_create_listener(sensor, &ctx->acceleration_listener);
+	if (ret != SENSOR_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create accelerometer sensor");
+		ctx->acceleration_listener = NULL;
+		return false;
+	}
+
+	ret = sensor_listener_set_event_cb(ctx->acceleration_listener, ACCEL_INTERVAL, _tizen_accel_cb, backend);
+	if (ret != SENSOR_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to set event callback for sensor listener");
+		sensor_destroy_listener(ctx->acceleration_listener);
+		ctx->acceleration_listener = NULL;
+		return false;
+	}
+
+	ret = sensor_listener_set_option(ctx->acceleration_listener, SENSOR_OPTION_ALWAYS_ON);
+	if (ret != SENSOR_ERROR_NONE)
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to set sensor's always on option");
+
+	return true;
+}
+
+static bool _tizen_motion_start(sensor_backend_s *backend)
+{
+	tizen_ctx_s *ctx = backend->ctx;
+
+	if (!ctx->acceleration_listener)
+		return false;
+
+	if (sensor_listener_start(ctx->acceleration_listener) != SENSOR_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to start accelerometer sensor listener");
+		return false;
+	}
+
+	return true;
+}
+
+static bool _tizen_motion_stop(sensor_backend_s *backend)
+{
+	tizen_ctx_s *ctx = backend->ctx;
+
+	if (!ctx->acceleration_listener)
+		return false;
+
+	if (sensor_listener_stop(ctx->acceleration_listener) != SENSOR_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to stop accelerometer sensor listener");
+		return false;
+	}
+
+	return true;
+}
+
+static double _tizen_distance(sensor_backend_s *backend, double latitude1, double longitude1,
+		double latitude2, double longitude2)
+{
+	double distance = 0.0;
+
+	if (location_manager_get_distance(latitude1, longitude1, latitude2, longitude2, &distance) != LOCATIONS_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to get distance");
+		return -1.0;
+	}
+
+	return distance;
+}
+
+static double _tizen_now(sensor_backend_s *backend)
+{
+	return ecore_time_get();
+}
+
+static void _tizen_destroy(sensor_backend_s *backend)
+{
+	tizen_ctx_s *ctx = backend->ctx;
+
+	_tizen_location_destroy(backend);
+
+	if (ctx->acceleration_listener &&
+			sensor_destroy_listener(ctx->acceleration_listener) != SENSOR_ERROR_NONE)
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to destroy accelerometer sensor listener");
+
+	mt_free(ctx);
+}
+
+/**
+ * @brief Creates the backend reading the device's location manager and accelerometer.
+ * The location manager is created now only if GPS is enabled, otherwise on the first start.
+ * @return The backend, or NULL if the accelerometer cannot be used.
+ * Release it with sensor_backend_destroy().
+ */
+sensor_backend_s *sensor_backend_tizen_create(void)
+{
+	sensor_backend_s *backend = mt_calloc(MT_DATA, 1, sizeof(sensor_backend_s));
+
+	if (!backend)
+		return NULL;
+
+	backend->ctx = mt_calloc(MT_DATA, 1, sizeof(tizen_ctx_s));
+	if (!backend->ctx) {
+		mt_free(backend);
+		return NULL;
+	}
+
+	backend->name = "tizen";
+	backend->location_enabled = _tizen_location_enabled;
+	backend->location_start = _tizen_location_start;
+	backend->location_stop = _tizen_location_stop;
+	backend->motion_start = _tizen_motion_start;
+	backend->motion_stop = _tizen_motion_stop;
+	backend->distance = _tizen_distance;
+	backend->now = _tizen_now;
+	backend->destroy = _tizen_destroy;
+
+	if (_tizen_location_enabled(backend))
+		_tizen_location_init(backend);
+
+	if (!_tizen_motion_init(backend)) {
+		sensor_backend_destroy(backend);
+		return NULL;
+	}
+
+	return backend;
+}
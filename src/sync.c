@@ -0,0 +1,238 @@
+#if !defined(AR_HOST_BUILD)
+#include <system_info.h>
+#endif
+#include "avoidrickshaw.h"
+#include "Sqlitedbhelper.h"
+#include "sync.h"
+#include "jobs.h"
+
+#define SYNC_SOCKET_NAME "companion.sock" /*companion link stand-in, in the data directory*/
+
+static bool _sync_handshake(sync_transport_s *transport, const char *device_id, uint32_t *remote_watermark);
+static bool _sync_wait_ack(sync_transport_s *transport, uint32_t *watermark);
+
+/**
+ * @brief Sends every row changed since the peer's watermark, in revision order.
+ * The watermark is the smaller of the locally stored one and the one the peer
+ * reports, so a receiver that lost data gets it again while rows it already
+ * has never cross the link twice. The local watermark advances after every
+ * acknowledged batch, so an interrupted push resumes from the last ack.
+ * @param[in] db Connection owned by the calling thread.
+ * @param[in] peer Name the watermark is stored under.
+ * @param[in] device_id Identifies this device to the receiver.
+ * @param[in] transport Connected transport, not closed by this function.
+ * @param[in] stop_callback Checked between batches, may be NULL.
+ * @param[in] data User data passed to stop_callback.
+ * @return The number of rows acknowledged by the peer, -1 on error.
+ */
+int sync_push(sqlite3 *db, const char *peer, const char *device_id, sync_transport_s *transport,
+		sync_stop_callback_t stop_callback, void *data)
+{
+	uint8_t frame[SYNC_FRAME_MAX];
+	QueryData rows[SYNC_BATCH_ROWS];
+	sync_record_s records[SYNC_BATCH_ROWS];
+	uint32_t remote_watermark;
+	uint32_t sequence = 0;
+	int watermark;
+	int num_of_rows;
+	int sent = 0;
+
+	if (getSyncWatermark(db, peer, &watermark) != SQLITE_OK)
+		return -1;
+
+	if (!_sync_handshake(transport, device_id, &remote_watermark))
+		return -1;
+
+	if (remote_watermark < (uint32_t) watermark)
+		watermark = remote_watermark;
+
+	while (!stop_callback || !stop_callback(data)) {
+		uint32_t acked;
+
+		if (getRowsAfterRevision(db, watermark, rows, SYNC_BATCH_ROWS, &num_of_rows) != SQLITE_OK)
+			return -1;
+
+		if (num_of_rows == 0)
+			break;
+
+		for (int i = 0; i < num_of_rows; i++) {
+			records[i].id = rows[i].id;
+			records[i].revision = rows[i].revision;
+			records[i].date = sync_date_pack(rows[i].date);
+			records[i].distance = rows[i].distance;
+			records[i].steps = rows[i].steps;
+			records[i].calories = rows[i].calories;
+			records[i].fare = rows[i].fare;
+		}
+
+		if (!sync_frame_send(transport, frame, sync_encode_batch(frame, sequence++, records, num_of_rows)))
+			return -1;
+
+		if (!_sync_wait_ack(transport, &acked))
+			return -1;
+
+		/*a receiver acks only what it stored, anything short of the batch is resent next time*/
+		if (acked <= (uint32_t) watermark) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Sync peer %s did not advance past %d", peer, watermark);
+			return -1;
+		}
+
+		for (int i = 0; i < num_of_rows && records[i].revision <= acked; i++)
+			sent++;
+
+		watermark = acked;
+		if (setSyncWatermark(db, peer, watermark) != SQLITE_OK)
+			return -1;
+	}
+
+	dlog_print(DLOG_INFO, LOG_TAG, "Synced %d rows to %s, watermark %d", sent, peer, watermark);
+
+	return sent;
+}
+
+/**
+ * @brief Internal function introducing this device and reading the peer's watermark.
+ */
+static bool _sync_handshake(sync_transport_s *transport, const char *device_id, uint32_t *remote_watermark)
+{
+	uint8_t frame[3 + SYNC_DEVICE_ID_MAX];
+
+	if (!sync_frame_send(transport, frame, sync_encode_hello(frame, device_id)))
+		return false;
+
+	return _sync_wait_ack(transport, remote_watermark);
+}
+
+/**
+ * @brief Internal function reading an ACK frame.
+ */
+static bool _sync_wait_ack(sync_transport_s *transport, uint32_t *watermark)
+{
+	uint8_t frame[SYNC_ACK_SIZE];
+	size_t len;
+
+	if (!sync_frame_recv(transport, frame, sizeof(frame), &len) || !sync_decode_ack(frame, len, watermark)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Sync peer sent no valid ack");
+		return false;
+	}
+
+	return true;
+}
+
+#if !defined(AR_HOST_BUILD)
+
+static struct sync_info {
+	job_s *job;
+	bool pending;
+} s_info = {
+	.job = NULL,
+	.pending = false,
+};
+
+static bool _sync_stop_cb(void *data);
+static void _sync_run_cb(void *data, job_s *job);
+static void _sync_done_cb(void *data, job_s *job, bool cancelled);
+
+/**
+ * @brief Pushes new records to the companion in the background.
+ * Does nothing visible when no companion is listening; a request made while
+ * a push is running is served once it ends.
+ * @return This function returns 'true' if the push was started or queued,
+ * otherwise 'false' is returned.
+ */
+bool sync_start(void)
+{
+	static const job_callbacks_s callbacks = {
+		.run = _sync_run_cb,
+		.done = _sync_done_cb,
+	};
+
+	if (s_info.job) {
+		s_info.pending = true;
+		return true;
+	}
+
+	s_info.pending = false;
+	/*nobody waits for the companion, it only gets workers nothing else needs*/
+	s_info.job = jobs_submit(JOB_IDLE, &callbacks, NULL);
+	if (!s_info.job) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to queue sync job");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Stops the running push after the batch in flight. Acknowledged
+ * batches stay recorded and the next push continues from there.
+ */
+void sync_cancel(void)
+{
+	s_info.pending = false;
+
+	if (!s_info.job)
+		return;
+
+	jobs_cancel(s_info.job);
+	s_info.job = NULL;
+}
+
+/**
+ * @brief Internal function checking for cancellation between batches.
+ */
+static bool _sync_stop_cb(void *data)
+{
+	return jobs_cancelled(data);
+}
+
+/**
+ * @brief Internal function doing the push on the worker thread.
+ */
+static void _sync_run_cb(void *data, job_s *job)
+{
+	sync_transport_s transport;
+	char *device_id = NULL;
+	char *dataPath;
+	char path[PATH_MAX];
+	sqlite3 *db;
+
+	dataPath = app_get_data_path();
+	snprintf(path, sizeof(path), "%s%s", dataPath, SYNC_SOCKET_NAME);
+	free(dataPath);
+
+	if (!sync_transport_unix_connect(&transport, path)) {
+		dlog_print(DLOG_DEBUG, LOG_TAG, "No companion listening on %s", path);
+		return;
+	}
+
+	if (openWorkerDb(&db) != SQLITE_OK) {
+		transport.close(transport.ctx);
+		return;
+	}
+
+	if (system_info_get_platform_string("http://tizen.org/system/tizenid", &device_id) != SYSTEM_INFO_ERROR_NONE)
+		device_id = NULL;
+
+	sync_push(db, SYNC_PEER_COMPANION, device_id ? device_id : PACKAGE, &transport, _sync_stop_cb, job);
+
+	free(device_id);
+	sqlite3_close(db);
+	transport.close(transport.ctx);
+}
+
+/**
+ * @brief Internal function run in the main loop when the push ended or was cancelled.
+ */
+static void _sync_done_cb(void *data, job_s *job, bool cancelled)
+{
+	if (s_info.job != job)
+		return;
+
+	s_info.job = NULL;
+
+	if (s_info.pending)
+		sync_start();
+}
+
+#endif
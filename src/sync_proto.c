@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "sync_proto.h"
+
+static void _put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void _put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint16_t _get_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t _get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void _put_f32(uint8_t *p, float v)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &v, sizeof(bits));
+	_put_u32(p, bits);
+}
+
+static float _get_f32(const uint8_t *p)
+{
+	uint32_t bits = _get_u32(p);
+	float v;
+
+	memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+static bool _fd_send(void *ctx, const void *buf, size_t len)
+{
+	int fd = (int) (intptr_t) ctx;
+	const uint8_t *p = buf;
+
+	while (len > 0) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool _fd_recv(void *ctx, void *buf, size_t len)
+{
+	int fd = (int) (intptr_t) ctx;
+	uint8_t *p = buf;
+
+	while (len > 0) {
+		ssize_t n = recv(fd, p, len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static void _fd_close(void *ctx)
+{
+	close((int) (intptr_t) ctx);
+}
+
+/**
+ * @brief Wraps a connected stream socket as a sync transport that owns the descriptor.
+ */
+bool sync_transport_fd(sync_transport_s *transport, int fd)
+{
+	if (fd < 0)
+		return false;
+
+	transport->ctx = (void *) (intptr_t) fd;
+	transport->send = _fd_send;
+	transport->recv = _fd_recv;
+	transport->close = _fd_close;
+
+	return true;
+}
+
+/**
+ * @brief Connects to a receiver listening on a local (AF_UNIX) socket.
+ * Stands in for the companion link on the emulator and in host tools.
+ * @param[out] transport The connected transport.
+ * @param[in] path The socket path.
+ * @return This function returns 'true' if connected, otherwise 'false' is returned.
+ */
+bool sync_transport_unix_connect(sync_transport_s *transport, const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return false;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		close(fd);
+		return false;
+	}
+
+	return sync_transport_fd(transport, fd);
+}
+
+/**
+ * @brief Sends one length-prefixed frame.
+ */
+bool sync_frame_send(sync_transport_s *transport, const uint8_t *payload, size_t len)
+{
+	uint8_t header[4];
+
+	_put_u32(header, len);
+
+	return transport->send(transport->ctx, header, sizeof(header)) &&
+			transport->send(transport->ctx, payload, len);
+}
+
+/**
+ * @brief Receives one length-prefixed frame. Frames larger than capacity are rejected.
+ */
+bool sync_frame_recv(sync_transport_s *transport, uint8_t *payload, size_t capacity, size_t *len)
+{
+	uint8_t header[4];
+
+	if (!transport->recv(transport->ctx, header, sizeof(header)))
+		return false;
+
+	*len = _get_u32(header);
+	if (*len == 0 || *len > capacity)
+		return false;
+
+	return transport->recv(transport->ctx, payload, *len);
+}
+
+/**
+ * @brief Encodes a HELLO payload. The device ID is truncated to SYNC_DEVICE_ID_MAX bytes.
+ * @return The payload length.
+ */
+size_t sync_encode_hello(uint8_t *buf, const char *device_id)
+{
+	size_t id_len = strlen(device_id);
+
+	if (id_len > SYNC_DEVICE_ID_MAX)
+		id_len = SYNC_DEVICE_ID_MAX;
+
+	buf[0] = SYNC_FRAME_HELLO;
+	buf[1] = SYNC_PROTO_VERSION;
+	buf[2] = id_len;
+	memcpy(&buf[3], device_id, id_len);
+
+	return 3 + id_len;
+}
+
+/**
+ * @brief Decodes a HELLO payload into a NUL terminated device ID of at most SYNC_DEVICE_ID_MAX bytes.
+ */
+bool sync_decode_hello(const uint8_t *buf, size_t len, char *device_id)
+{
+	if (len < 3 || buf[0] != SYNC_FRAME_HELLO || buf[1] != SYNC_PROTO_VERSION)
+		return false;
+
+	if (buf[2] == 0 || buf[2] > SYNC_DEVICE_ID_MAX || len != 3u + buf[2])
+		return false;
+
+	memcpy(device_id, &buf[3], buf[2]);
+	device_id[buf[2]] = '\0';
+
+	return true;
+}
+
+size_t sync_encode_ack(uint8_t *buf, uint32_t watermark)
+{
+	buf[0] = SYNC_FRAME_ACK;
+	_put_u32(&buf[1], watermark);
+
+	return SYNC_ACK_SIZE;
+}
+
+bool sync_decode_ack(const uint8_t *buf, size_t len, uint32_t *watermark)
+{
+	if (len != SYNC_ACK_SIZE || buf[0] != SYNC_FRAME_ACK)
+		return false;
+
+	*watermark = _get_u32(&buf[1]);
+	return true;
+}
+
+/**
+ * @brief Encodes a BATCH payload of at most SYNC_BATCH_MAX_RECORDS records.
+ * @return The payload length.
+ */
+size_t sync_encode_batch(uint8_t *buf, uint32_t sequence, const sync_record_s *records, int count)
+{
+	uint8_t *p = buf;
+
+	*p++ = SYNC_FRAME_BATCH;
+	_put_u32(p, sequence);
+	p += 4;
+	_put_u16(p, count);
+	p += 2;
+
+	for (int i = 0; i < count; i++) {
+		const sync_record_s *r = &records[i];
+
+		*p++ = SYNC_RECORD_SIZE;
+		_put_u32(p, r->id);
+		_put_u32(p + 4, r->revision);
+		_put_u32(p + 8, r->date);
+		_put_f32(p + 12, r->distance);
+		_put_u32(p + 16, r->steps);
+		_put_f32(p + 20, r->calories);
+		_put_u32(p + 24, r->fare);
+		p += SYNC_RECORD_SIZE;
+	}
+
+	return p - buf;
+}
+
+/**
+ * @brief Decodes a BATCH payload. Records must hold at least SYNC_BATCH_MAX_RECORDS entries.
+ * @return This function returns 'false' on any structural error.
+ */
+bool sync_decode_batch(const uint8_t *buf, size_t len, uint32_t *sequence, sync_record_s *records, int *count)
+{
+	const uint8_t *p = buf;
+	const uint8_t *end = buf + len;
+
+	if (len < 7 || buf[0] != SYNC_FRAME_BATCH)
+		return false;
+
+	*sequence = _get_u32(&buf[1]);
+	*count = _get_u16(&buf[5]);
+	p += 7;
+
+	if (*count > SYNC_BATCH_MAX_RECORDS)
+		return false;
+
+	for (int i = 0; i < *count; i++) {
+		sync_record_s *r = &records[i];
+		size_t record_len;
+
+		if (p >= end)
+			return false;
+		record_len = *p++;
+		if (record_len < SYNC_RECORD_SIZE || p + record_len > end)
+			return false;
+
+		r->id = _get_u32(p);
+		r->revision = _get_u32(p + 4);
+		r->date = _get_u32(p + 8);
+		r->distance = _get_f32(p + 12);
+		r->steps = _get_u32(p + 16);
+		r->calories = _get_f32(p + 20);
+		r->fare = _get_u32(p + 24);
+		p += record_len;
+	}
+
+	return p == end;
+}
+
+/**
+ * @brief Checks a decoded record for values the app can never produce.
+ */
+bool sync_record_valid(const sync_record_s *record)
+{
+	unsigned year = record->date / 10000;
+	unsigned month = record->date / 100 % 100;
+	unsigned day = record->date % 100;
+
+	return record->revision > 0 &&
+			year >= 2000 && year < 2100 && month >= 1 && month <= 12 && day >= 1 && day <= 31 &&
+			isfinite(record->distance) && record->distance >= 0.0f &&
+			isfinite(record->calories) && record->calories >= 0.0f &&
+			record->steps < 10000000 && record->fare < 10000000;
+}
+
+/**
+ * @brief Packs a YYYY-MM-DD date into the integer YYYYMMDD, 0 if malformed.
+ */
+uint32_t sync_date_pack(const char *date)
+{
+	unsigned year, month, day;
+
+	if (sscanf(date, "%4u-%2u-%2u", &year, &month, &day) != 3)
+		return 0;
+
+	return year * 10000 + month * 100 + day;
+}
+
+/**
+ * @brief Formats a packed YYYYMMDD date as YYYY-MM-DD.
+ */
+void sync_date_unpack(uint32_t date, char *buf, size_t len)
+{
+	snprintf(buf, len, "%04u-%02u-%02u", date / 10000, date / 100 % 100, date % 100);
+}
@@ -0,0 +1,181 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include "avoidrickshaw.h"
+#include "tariff.h"
+#include "Sqlitedbhelper.h"
+
+#define TARIFF_MAX_WORKERS 4
+#define TARIFF_MIN_ROWS_PER_WORKER 256 /*below this, thread start-up costs more than it saves*/
+
+const tariff_s tariff_default = {
+	.base_fare = 0.0,
+	.base_distance = 0.0,
+	.per_km = 15.0,
+};
+
+typedef struct {
+	const tariff_s *tariffs;
+	int tariff_count;
+	const float *distance;
+	const int *fare;
+	int begin;
+	int end;
+	double total_fare[TARIFF_MAX_COUNT];
+	double stored_fare;
+} tariff_worker_s;
+
+static void *_tariff_worker_cb(void *data);
+static int _tariff_lower_bound(const int *days, int count, int day);
+
+/**
+ * @brief Prices one trip at the given tariff, rounded down to whole Taka like count_fare().
+ * @param[in] tariff The rate card.
+ * @param[in] distance The trip distance in meters.
+ * @return The fare in Taka.
+ */
+int tariff_price(const tariff_s *tariff, double distance)
+{
+	double fare = tariff->base_fare;
+
+	if (distance <= 0.0)
+		return 0;
+
+	if (distance > tariff->base_distance)
+		fare += (distance - tariff->base_distance) / 1000.0 * tariff->per_km;
+
+	return (int) fare;
+}
+
+/**
+ * @brief Re-prices the whole stored history under each of the given tariffs.
+ * Every stored day is priced as one trip, since daily rows are the finest
+ * granularity kept. The date range is split into equal spans handled by
+ * separate threads; each thread evaluates all tariffs over its span.
+ * This call blocks; run it off the main loop for very large histories.
+ * @param[in] tariffs The rate cards to evaluate.
+ * @param[in] tariff_count Number of tariffs, at most TARIFF_MAX_COUNT.
+ * @param[out] results One result per tariff.
+ * @return This function returns 'true' if the history was evaluated,
+ * otherwise 'false' is returned.
+ */
+bool tariff_simulate_history(const tariff_s *tariffs, int tariff_count, tariff_result_s *results)
+{
+	tariff_worker_s workers[TARIFF_MAX_WORKERS];
+	pthread_t threads[TARIFF_MAX_WORKERS];
+	bool started[TARIFF_MAX_WORKERS] = {false, };
+	DistanceColumns cols;
+	sqlite3 *db;
+	int worker_count;
+
+	if (tariff_count <= 0 || tariff_count > TARIFF_MAX_COUNT)
+		return false;
+
+	if (openWorkerDb(&db) != SQLITE_OK)
+		return false;
+
+	if (getDistanceColumns(db, &cols) != SQLITE_OK) {
+		sqlite3_close(db);
+		return false;
+	}
+	sqlite3_close(db);
+
+	worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (worker_count > TARIFF_MAX_WORKERS)
+		worker_count = TARIFF_MAX_WORKERS;
+	if (worker_count > cols.count / TARIFF_MIN_ROWS_PER_WORKER)
+		worker_count = cols.count / TARIFF_MIN_ROWS_PER_WORKER;
+	if (worker_count < 1)
+		worker_count = 1;
+
+	/* Partition by date: each worker takes an equal span of days, rows found by binary search */
+	int first_day = cols.count ? cols.days[0] : 0;
+	int span = cols.count ? cols.days[cols.count - 1] - first_day + 1 : 0;
+
+	for (int w = 0; w < worker_count; w++) {
+		tariff_worker_s *worker = &workers[w];
+
+		memset(worker, 0, sizeof(*worker));
+		worker->tariffs = tariffs;
+		worker->tariff_count = tariff_count;
+		worker->distance = cols.distance;
+		worker->fare = cols.fare;
+		worker->begin = _tariff_lower_bound(cols.days, cols.count, first_day + (int) ((long) span * w / worker_count));
+		worker->end = (w == worker_count - 1) ? cols.count :
+				_tariff_lower_bound(cols.days, cols.count, first_day + (int) ((long) span * (w + 1) / worker_count));
+
+		/* The calling thread takes the first span itself */
+		if (w > 0)
+			started[w] = (pthread_create(&threads[w], NULL, _tariff_worker_cb, worker) == 0);
+	}
+
+	_tariff_worker_cb(&workers[0]);
+
+	for (int w = 1; w < worker_count; w++) {
+		if (started[w])
+			pthread_join(threads[w], NULL);
+		else
+			_tariff_worker_cb(&workers[w]);
+	}
+
+	for (int t = 0; t < tariff_count; t++) {
+		results[t].total_fare = 0.0;
+		results[t].stored_fare = 0.0;
+		results[t].days = cols.count;
+
+		for (int w = 0; w < worker_count; w++) {
+			results[t].total_fare += workers[w].total_fare[t];
+			results[t].stored_fare += workers[w].stored_fare;
+		}
+	}
+
+	dlog_print(DLOG_DEBUG, LOG_TAG, "Simulated %d tariffs over %d days with %d workers",
+			tariff_count, cols.count, worker_count);
+
+	freeDistanceColumns(&cols);
+
+	return true;
+}
+
+/**
+ * @brief Internal function pricing rows [begin, end) under every tariff.
+ */
+static void *_tariff_worker_cb(void *data)
+{
+	tariff_worker_s *worker = data;
+
+	for (int t = 0; t < worker->tariff_count; t++) {
+		const tariff_s *tariff = &worker->tariffs[t];
+		double total = 0.0;
+
+		for (int i = worker->begin; i < worker->end; i++)
+			total += tariff_price(tariff, worker->distance[i]);
+
+		worker->total_fare[t] = total;
+	}
+
+	for (int i = worker->begin; i < worker->end; i++)
+		worker->stored_fare += worker->fare[i];
+
+	return NULL;
+}
+
+/**
+ * @brief Internal function returning the first index whose day is not before the given day.
+ */
+static int _tariff_lower_bound(const int *days, int count, int day)
+{
+	int low = 0;
+	int high = count;
+
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+
+		if (days[mid] < day)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
@@ -0,0 +1,302 @@
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "tdigest.h"
+
+/**
+ * @brief Internal function mapping a quantile to the k1 scale, on which
+ * every centroid may span at most one unit.
+ */
+static double _tdigest_k(double q)
+{
+	return TDIGEST_COMPRESSION / (2.0 * M_PI) * asin(2.0 * q - 1.0);
+}
+
+static double _tdigest_q(double k)
+{
+	if (k >= TDIGEST_COMPRESSION / 4.0)
+		return 1.0;
+
+	return (sin(k * 2.0 * M_PI / TDIGEST_COMPRESSION) + 1.0) / 2.0;
+}
+
+/**
+ * @brief Prepares an empty digest.
+ */
+void tdigest_init(tdigest_s *digest)
+{
+	digest->merged = 0;
+	digest->buffered = 0;
+	digest->count = 0.0;
+	digest->min = DBL_MAX;
+	digest->max = -DBL_MAX;
+}
+
+/**
+ * @brief Adds a value; the buffer is merged once it is full.
+ * @param[in] weight How many times the value occurred, positive.
+ */
+void tdigest_add(tdigest_s *digest, double value, double weight)
+{
+	tdigest_centroid_s *centroid;
+
+	if (!(weight > 0.0) || isnan(value))
+		return;
+
+	if (digest->merged + digest->buffered == TDIGEST_CENTROIDS + TDIGEST_BUFFER)
+		tdigest_compress(digest);
+
+	centroid = &digest->centroids[digest->merged + digest->buffered++];
+	centroid->mean = value;
+	centroid->weight = weight;
+
+	digest->count += weight;
+	if (value < digest->min)
+		digest->min = value;
+	if (value > digest->max)
+		digest->max = value;
+}
+
+/**
+ * @brief Internal function combining sorted centroids: neighbours are
+ * merged while the result spans at most one unit of the k1 scale.
+ * @param[in] total Centroids at the start of the array, sorted by mean.
+ */
+static void _tdigest_sweep(tdigest_s *digest, int total)
+{
+	tdigest_centroid_s *centroids = digest->centroids;
+	double weight_before = 0.0;
+	double q_limit;
+	int out = 0;
+
+	q_limit = _tdigest_q(_tdigest_k(0.0) + 1.0);
+
+	for (int i = 1; i < total; i++) {
+		tdigest_centroid_s *current = &centroids[out];
+		double weight = current->weight + centroids[i].weight;
+
+		if ((weight_before + weight) / digest->count <= q_limit) {
+			current->mean += (centroids[i].mean - current->mean) * centroids[i].weight / weight;
+			current->weight = weight;
+			continue;
+		}
+
+		weight_before += current->weight;
+		q_limit = _tdigest_q(_tdigest_k(weight_before / digest->count) + 1.0);
+		centroids[++out] = centroids[i];
+	}
+
+	digest->merged = out + 1;
+	digest->buffered = 0;
+}
+
+/**
+ * @brief Internal function merging sorted centroids into the merged ones,
+ * from the back, so neither run has to move out of the way first.
+ * @param[in] other Centroids sorted by mean, outside the digest: those of
+ * another digest, or a copy of the buffer.
+ * @param[in] theirs How many there are.
+ */
+static void _tdigest_merge_sorted(tdigest_s *digest, const tdigest_centroid_s *other, int theirs)
+{
+	tdigest_centroid_s *centroids = digest->centroids;
+	int i = digest->merged - 1;
+	int j = theirs - 1;
+
+	for (int out = digest->merged + theirs - 1; j >= 0; out--) {
+		if (i >= 0 && centroids[i].mean > other[j].mean)
+			centroids[out] = centroids[i--];
+		else
+			centroids[out] = other[j--];
+	}
+}
+
+/**
+ * @brief Merges the buffer into the centroids. Only the buffer is sorted,
+ * by insertion as it is short, so a compression on the tracking path stays
+ * within a few microseconds.
+ */
+void tdigest_compress(tdigest_s *digest)
+{
+	tdigest_centroid_s buffer[TDIGEST_BUFFER + TDIGEST_CENTROIDS];
+	int buffered = digest->buffered;
+
+	if (!buffered)
+		return;
+
+	memcpy(buffer, &digest->centroids[digest->merged], buffered * sizeof(tdigest_centroid_s));
+	for (int i = 1; i < buffered; i++) {
+		tdigest_centroid_s value = buffer[i];
+		int j = i;
+
+		for (; j > 0 && buffer[j - 1].mean > value.mean; j--)
+			buffer[j] = buffer[j - 1];
+		buffer[j] = value;
+	}
+
+	_tdigest_merge_sorted(digest, buffer, buffered);
+	_tdigest_sweep(digest, digest->merged + buffered);
+}
+
+/**
+ * @brief Adds every value of another digest, as its centroids. Two merged
+ * digests, such as deserialized ones, are combined in one linear pass.
+ */
+void tdigest_merge(tdigest_s *digest, const tdigest_s *other)
+{
+	double min = digest->min < other->min ? digest->min : other->min;
+	double max = digest->max > other->max ? digest->max : other->max;
+
+	tdigest_compress(digest);
+
+	if (other->buffered || digest->merged + other->merged > TDIGEST_CENTROIDS + TDIGEST_BUFFER) {
+		for (int i = 0; i < other->merged + other->buffered; i++)
+			tdigest_add(digest, other->centroids[i].mean, other->centroids[i].weight);
+	}
+	else if (other->merged) {
+		_tdigest_merge_sorted(digest, other->centroids, other->merged);
+		digest->count += other->count;
+		_tdigest_sweep(digest, digest->merged + other->merged);
+	}
+
+	/*the extremes of the other stream may lie inside its end centroids*/
+	digest->min = min;
+	digest->max = max;
+}
+
+/**
+ * @brief Estimates the value below which the fraction q of the weight lies,
+ * interpolating between centroid centres and the extremes.
+ * @param[in] q The quantile, 0 to 1.
+ * @return The estimate, NAN for an empty digest.
+ */
+double tdigest_quantile(tdigest_s *digest, double q)
+{
+	const tdigest_centroid_s *centroids = digest->centroids;
+	double index;
+	double before;
+
+	tdigest_compress(digest);
+
+	if (!digest->merged)
+		return NAN;
+
+	if (q <= 0.0)
+		return digest->min;
+	if (q >= 1.0)
+		return digest->max;
+
+	index = q * digest->count;
+
+	/* Below the centre of the first centroid */
+	if (index < centroids[0].weight / 2.0)
+		return digest->min + (centroids[0].mean - digest->min) * index / (centroids[0].weight / 2.0);
+
+	before = centroids[0].weight / 2.0;
+	for (int i = 0; i + 1 < digest->merged; i++) {
+		double span = (centroids[i].weight + centroids[i + 1].weight) / 2.0;
+
+		if (index < before + span)
+			return centroids[i].mean + (centroids[i + 1].mean - centroids[i].mean) * (index - before) / span;
+
+		before += span;
+	}
+
+	/* Above the centre of the last centroid */
+	const tdigest_centroid_s *last = &centroids[digest->merged - 1];
+
+	return last->mean + (digest->max - last->mean) * (index - before) / (last->weight / 2.0);
+}
+
+static void _tdigest_put(uint8_t *buf, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		buf[i] = value >> (8 * i);
+}
+
+static uint64_t _tdigest_get(const uint8_t *buf, int bytes)
+{
+	uint64_t value = 0;
+
+	for (int i = 0; i < bytes; i++)
+		value |= (uint64_t) buf[i] << (8 * i);
+
+	return value;
+}
+
+/**
+ * @brief Writes the digest in its portable little-endian form, merging the
+ * buffer first.
+ * @return The bytes written, 0 if buf is shorter than needed.
+ */
+size_t tdigest_serialize(tdigest_s *digest, uint8_t *buf, size_t len)
+{
+	size_t size;
+	uint64_t bits;
+	float mean;
+
+	tdigest_compress(digest);
+
+	size = TDIGEST_HEADER_SIZE + (size_t) digest->merged * 8;
+	if (len < size)
+		return 0;
+
+	buf[0] = TDIGEST_VERSION;
+	_tdigest_put(buf + 1, (uint32_t) digest->count, 4);
+	memcpy(&bits, &digest->min, sizeof(bits));
+	_tdigest_put(buf + 5, bits, 8);
+	memcpy(&bits, &digest->max, sizeof(bits));
+	_tdigest_put(buf + 13, bits, 8);
+	_tdigest_put(buf + 21, digest->merged, 2);
+
+	buf += TDIGEST_HEADER_SIZE;
+	for (int i = 0; i < digest->merged; i++, buf += 8) {
+		uint32_t mean_bits;
+
+		mean = (float) digest->centroids[i].mean;
+		memcpy(&mean_bits, &mean, sizeof(mean_bits));
+		_tdigest_put(buf, mean_bits, 4);
+		_tdigest_put(buf + 4, (uint32_t) digest->centroids[i].weight, 4);
+	}
+
+	return size;
+}
+
+/**
+ * @brief Reads a digest written by tdigest_serialize().
+ * @return This function returns 'false' for a damaged or foreign blob; the
+ * digest is empty then.
+ */
+bool tdigest_deserialize(tdigest_s *digest, const uint8_t *buf, size_t len)
+{
+	uint64_t bits;
+	int merged;
+
+	tdigest_init(digest);
+
+	if (len < TDIGEST_HEADER_SIZE || buf[0] != TDIGEST_VERSION)
+		return false;
+
+	merged = _tdigest_get(buf + 21, 2);
+	if (merged > TDIGEST_CENTROIDS || len != TDIGEST_HEADER_SIZE + (size_t) merged * 8)
+		return false;
+
+	digest->count = _tdigest_get(buf + 1, 4);
+	bits = _tdigest_get(buf + 5, 8);
+	memcpy(&digest->min, &bits, sizeof(bits));
+	bits = _tdigest_get(buf + 13, 8);
+	memcpy(&digest->max, &bits, sizeof(bits));
+
+	buf += TDIGEST_HEADER_SIZE;
+	for (int i = 0; i < merged; i++, buf += 8) {
+		uint32_t mean_bits = _tdigest_get(buf, 4);
+		float mean;
+
+		memcpy(&mean, &mean_bits, sizeof(mean));
+		digest->centroids[i].mean = mean;
+		digest->centroids[i].weight = _tdigest_get(buf + 4, 4);
+	}
+	digest->merged = merged;
+
+	return true;
+}
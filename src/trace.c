@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "avoidrickshaw.h"
+#include "trace.h"
+#include "memtrack.h"
+
+__thread trace_ring_s *trace_current_ring;
+
+static struct trace_info {
+	pthread_mutex_t lock;
+	pthread_once_t once;
+	pthread_key_t key;
+	trace_ring_s *rings[TRACE_MAX_THREADS];
+	uint32_t next_thread;
+} s_info = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.once = PTHREAD_ONCE_INIT,
+	.next_thread = 0,
+};
+
+static void _trace_ring_release_cb(void *data);
+
+static void _trace_key_create(void)
+{
+	pthread_key_create(&s_info.key, _trace_ring_release_cb);
+}
+
+/**
+ * @brief Creates the ring of the calling thread on its first trace point.
+ * Only TRACE_MAX_THREADS rings are kept for trace_dump(); the rings of
+ * exited threads are replaced first, and threads beyond that trace into a
+ * ring that is never dumped.
+ * @return The ring, NULL if out of memory.
+ */
+trace_ring_s *trace_ring_attach(void)
+{
+	trace_ring_s *ring;
+	int slot = -1;
+
+	pthread_once(&s_info.once, _trace_key_create);
+
+	ring = mt_calloc(MT_TRACE, 1, sizeof(trace_ring_s));
+	if (!ring)
+		return NULL;
+
+	pthread_mutex_lock(&s_info.lock);
+	ring->thread = s_info.next_thread++;
+	ring->in_use = true;
+
+	for (int i = 0; i < TRACE_MAX_THREADS && slot < 0; i++)
+		if (!s_info.rings[i])
+			slot = i;
+	for (int i = 0; i < TRACE_MAX_THREADS && slot < 0; i++)
+		if (!s_info.rings[i]->in_use)
+			slot = i;
+
+	if (slot >= 0) {
+		mt_free(s_info.rings[slot]);
+		s_info.rings[slot] = ring;
+	}
+	pthread_mutex_unlock(&s_info.lock);
+
+	pthread_setspecific(s_info.key, ring);
+	trace_current_ring = ring;
+
+	return ring;
+}
+
+/**
+ * @brief Internal function run at thread exit. A dumped ring is kept until its
+ * slot is reused so the last events of finished workers stay visible.
+ */
+static void _trace_ring_release_cb(void *data)
+{
+	trace_ring_s *ring = data;
+	bool registered = false;
+
+	pthread_mutex_lock(&s_info.lock);
+	for (int i = 0; i < TRACE_MAX_THREADS; i++)
+		if (s_info.rings[i] == ring)
+			registered = true;
+
+	if (registered)
+		ring->in_use = false;
+	else
+		mt_free(ring);
+	pthread_mutex_unlock(&s_info.lock);
+}
+
+/**
+ * @brief Writes the retained records of every ring to a file, oldest first per thread.
+ * Threads keep tracing meanwhile; a record overwritten during the copy may be torn.
+ * @param[in] path The output file.
+ * @return This function returns 'true' on success, otherwise 'false' is returned.
+ */
+bool trace_dump(const char *path)
+{
+	trace_file_header_s header = {
+		.magic = TRACE_FILE_MAGIC,
+		.version = TRACE_FILE_VERSION,
+		.record_size = sizeof(trace_record_s),
+	};
+	struct timespec realtime, monotonic;
+	bool ok = true;
+	FILE *file;
+
+	file = fopen(path, "wb");
+	if (!file) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot write trace to %s", path);
+		return false;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+	header.realtime_offset = (int64_t) (realtime.tv_sec - monotonic.tv_sec) * 1000000000 +
+			(realtime.tv_nsec - monotonic.tv_nsec);
+
+	pthread_mutex_lock(&s_info.lock);
+
+	for (int i = 0; i < TRACE_MAX_THREADS; i++)
+		if (s_info.rings[i])
+			header.ring_count++;
+
+	ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	for (int i = 0; ok && i < TRACE_MAX_THREADS; i++) {
+		trace_ring_s *ring = s_info.rings[i];
+		trace_file_ring_s entry;
+
+		if (!ring)
+			continue;
+
+		entry.head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		entry.count = entry.head < TRACE_RING_RECORDS ? entry.head : TRACE_RING_RECORDS;
+		entry.thread = ring->thread;
+		ok = fwrite(&entry, sizeof(entry), 1, file) == 1;
+
+		for (uint64_t n = entry.head - entry.count; ok && n < entry.head; n++)
+			ok = fwrite(&ring->records[n & (TRACE_RING_RECORDS - 1)], sizeof(trace_record_s), 1, file) == 1;
+	}
+
+	pthread_mutex_unlock(&s_info.lock);
+
+	if (fclose(file) != 0)
+		ok = false;
+
+	return ok;
+}
@@ -0,0 +1,561 @@
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "track_file.h"
+#include "memtrack.h"
+
+#define TRACK_FILE_BUFFER_SIZE (64 * 1024)
+#define TRACK_LINE_MAX 512
+#define GPX_TAG_MAX 512
+#define GPX_TEXT_MAX 64
+
+#define TRACK_BINARY_MAGIC "ARTK"
+#define TRACK_BINARY_VERSION 1
+#define TRACK_BINARY_HEADER_SIZE 16
+#define TRACK_RECORD_ACCEL 'A'
+#define TRACK_RECORD_FIX 'G'
+#define TRACK_RECORD_TIME 'T'
+#define TRACK_RECORD_NO_TIME 0x80
+#define TRACK_RECORD_MAX 29         /*type, delta, two doubles and two floats of a fix*/
+
+struct track_writer {
+	FILE *file;
+	double start;       /*time the deltas count from*/
+	int64_t last_us;    /*time of the last timed event, microseconds after start*/
+	bool started;
+	bool failed;
+};
+
+static bool _track_read_text(FILE *file, const track_file_handlers_s *handlers, void *user_data,
+		track_file_stats_s *stats);
+static bool _track_read_gpx(FILE *file, const track_file_handlers_s *handlers, void *user_data,
+		track_file_stats_s *stats);
+static bool _gpx_attribute(const char *tag, const char *name, double *value);
+static double _gpx_time(const char *text);
+static bool _track_read_binary(FILE *file, const track_file_handlers_s *handlers, void *user_data,
+		track_file_stats_s *stats);
+
+/**
+ * @brief Detects the track format from the file name extension.
+ */
+track_format_e track_file_format(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+
+	if (!ext)
+		return TRACK_FORMAT_UNKNOWN;
+
+	if (!strcasecmp(ext, ".gpx"))
+		return TRACK_FORMAT_GPX;
+
+	if (!strcasecmp(ext, ".trace") || !strcasecmp(ext, ".csv"))
+		return TRACK_FORMAT_TEXT;
+
+	if (!strcasecmp(ext, ".artrk"))
+		return TRACK_FORMAT_BINARY;
+
+	return TRACK_FORMAT_UNKNOWN;
+}
+
+/**
+ * @brief Streams a track file, invoking the handlers for every event in file order.
+ * The file is never loaded whole; memory use is independent of its size.
+ * @param[in] path The track file.
+ * @param[in] handlers Event callbacks, either may be NULL.
+ * @param[in] user_data Passed to the callbacks.
+ * @param[out] stats Event and byte counts, may be NULL.
+ * @return This function returns 'true' if the file was read to the end,
+ * otherwise 'false' is returned.
+ */
+bool track_file_read(const char *path, const track_file_handlers_s *handlers, void *user_data,
+		track_file_stats_s *stats)
+{
+	track_file_stats_s local_stats;
+	track_format_e format = track_file_format(path);
+	FILE *file;
+	bool ret;
+
+	if (!stats)
+		stats = &local_stats;
+	memset(stats, 0, sizeof(*stats));
+
+	if (format == TRACK_FORMAT_UNKNOWN)
+		return false;
+
+	file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	setvbuf(file, NULL, _IOFBF, TRACK_FILE_BUFFER_SIZE);
+
+	if (format == TRACK_FORMAT_GPX)
+		ret = _track_read_gpx(file, handlers, user_data, stats);
+	else if (format == TRACK_FORMAT_BINARY)
+		ret = _track_read_binary(file, handlers, user_data, stats);
+	else
+		ret = _track_read_text(file, handlers, user_data, stats);
+
+	stats->bytes = ftell(file);
+	fclose(file);
+
+	return ret;
+}
+
+/**
+ * @brief Internal function parsing the line based text trace.
+ */
+static bool _track_read_text(FILE *file, const track_file_handlers_s *handlers, void *user_data,
+		track_file_stats_s *stats)
+{
+	char line[TRACK_LINE_MAX];
+
+	while (fgets(line, sizeof(line), file)) {
+		char *p = line;
+
+		while (*p == ' ' || *p == '\t')
+			p++;
+
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+			continue;
+
+		if (p[0] == 'A' && p[1] == ',') {
+			track_accel_s sample;
+
+			if (sscanf(p + 2, "%lf,%f,%f,%f", &sample.timestamp, &sample.x, &sample.y, &sample.z) != 4) {
+				stats->bad_lines++;
+				continue;
+			}
+			stats->samples++;
+			if (handlers->accel_cb)
+				handlers->accel_cb(&sample, user_data);
+		}
+		else if (p[0] == 'G' && p[1] == ',') {
+			track_fix_s fix = {0, };
+
+			if (sscanf(p + 2, "%lf,%lf,%lf,%lf,%lf", &fix.timestamp, &fix.latitude, &fix.longitude,
+					&fix.accuracy, &fix.altitude) < 3) {
+				stats->bad_lines++;
+				continue;
+			}
+			stats->fixes++;
+			if (handlers->fix_cb)
+				handlers->fix_cb(&fix, user_data);
+		}
+		else {
+			stats->bad_lines++;
+		}
+	}
+
+	return !ferror(file);
+}
+
+/**
+ * @brief Internal function parsing GPX with a character level tag scanner,
+ * so points spanning several lines are handled without buffering the document.
+ */
+static bool _track_read_gpx(FILE *file, const track_file_handlers_s *handlers, void *user_data,
+		track_file_stats_s *stats)
+{
+	char tag[GPX_TAG_MAX];
+	char text[GPX_TEXT_MAX];
+	int tag_len = 0;
+	int text_len = 0;
+	bool in_tag = false;
+	bool in_point = false;
+	track_fix_s fix = {0, };
+	int c;
+
+	while ((c = getc_unlocked(file)) != EOF) {
+		if (!in_tag) {
+			if (c == '<') {
+				in_tag = true;
+				tag_len = 0;
+			}
+			else if (text_len < GPX_TEXT_MAX - 1) {
+				text[text_len++] = c;
+			}
+			continue;
+		}
+
+		if (c != '>') {
+			if (tag_len < GPX_TAG_MAX - 1)
+				tag[tag_len++] = c;
+			continue;
+		}
+
+		/* A complete tag is in the buffer */
+		in_tag = false;
+		tag[tag_len] = '\0';
+		text[text_len] = '\0';
+
+		if (!strncmp(tag, "trkpt", 5) || !strncmp(tag, "rtept", 5)) {
+			memset(&fix, 0, sizeof(fix));
+			if (_gpx_attribute(tag, "lat", &fix.latitude) && _gpx_attribute(tag, "lon", &fix.longitude)) {
+				in_point = true;
+				/* Self-closing point without children */
+				if (tag_len > 0 && tag[tag_len - 1] == '/') {
+					in_point = false;
+					stats->fixes++;
+					if (handlers->fix_cb)
+						handlers->fix_cb(&fix, user_data);
+				}
+			}
+			else {
+				stats->bad_lines++;
+			}
+		}
+		else if (in_point && (!strcmp(tag, "/trkpt") || !strcmp(tag, "/rtept"))) {
+			in_point = false;
+			stats->fixes++;
+			if (handlers->fix_cb)
+				handlers->fix_cb(&fix, user_data);
+		}
+		else if (in_point && !strcmp(tag, "/time")) {
+			fix.timestamp = _gpx_time(text);
+		}
+		else if (in_point && !strcmp(tag, "/ele")) {
+			fix.altitude = atof(text);
+		}
+
+		text_len = 0;
+	}
+
+	return !ferror(file);
+}
+
+/**
+ * @brief Internal function reading a numeric attribute like lat="23.7" from a tag.
+ */
+static bool _gpx_attribute(const char *tag, const char *name, double *value)
+{
+	size_t len = strlen(name);
+	const char *p = tag;
+
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == tag || p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n' || p[-1] == '\r') &&
+				p[len] == '=' && (p[len + 1] == '"' || p[len + 1] == '\'')) {
+			char *end;
+
+			*value = strtod(p + len + 2, &end);
+			return end != p + len + 2;
+		}
+		p += len;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Internal function converting an ISO 8601 UTC time to seconds since the epoch.
+ */
+static double _gpx_time(const char *text)
+{
+	struct tm tm = {0, };
+	double seconds = 0.0;
+
+	while (*text == ' ' || *text == '\n' || *text == '\r' || *text == '\t')
+		text++;
+
+	if (sscanf(text, "%4d-%2d-%2dT%2d:%2d:%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			&tm.tm_hour, &tm.tm_min, &seconds) != 6)
+		return 0.0;
+
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_sec = 0;
+
+	return (double) timegm(&tm) + seconds;
+}
+
+/*
+ * Binary recording. Values are packed byte by byte, so files move between
+ * the device and a Linux host regardless of either side's layout.
+ */
+
+static unsigned char *_put_u16(unsigned char *p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	return p + 2;
+}
+
+static unsigned char *_put_u32(unsigned char *p, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = value >> (8 * i);
+	return p + 4;
+}
+
+static unsigned char *_put_u64(unsigned char *p, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+		p[i] = value >> (8 * i);
+	return p + 8;
+}
+
+static unsigned char *_put_f32(unsigned char *p, float value)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	return _put_u32(p, bits);
+}
+
+static unsigned char *_put_f64(unsigned char *p, double value)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	return _put_u64(p, bits);
+}
+
+static uint32_t _get_u32(const unsigned char *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t _get_u64(const unsigned char *p)
+{
+	return (uint64_t) _get_u32(p) | (uint64_t) _get_u32(p + 4) << 32;
+}
+
+static float _get_f32(const unsigned char *p)
+{
+	uint32_t bits = _get_u32(p);
+	float value;
+
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static double _get_f64(const unsigned char *p)
+{
+	uint64_t bits = _get_u64(p);
+	double value;
+
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+/**
+ * @brief Internal function reading the binary recording. A record cut short at the
+ * end, as left by a process killed while recording, is counted as bad and ends the read.
+ */
+static bool _track_read_binary(FILE *file, const track_file_handlers_s *handlers, void *user_data,
+		track_file_stats_s *stats)
+{
+	unsigned char buf[TRACK_RECORD_MAX];
+	double start;
+	int64_t time_us = 0;
+	int type;
+
+	if (fread(buf, 1, TRACK_BINARY_HEADER_SIZE, file) != TRACK_BINARY_HEADER_SIZE ||
+			memcmp(buf, TRACK_BINARY_MAGIC, 4) || (buf[4] | buf[5] << 8) != TRACK_BINARY_VERSION)
+		return false;
+
+	start = _get_f64(buf + 8);
+
+	while ((type = getc_unlocked(file)) != EOF) {
+		size_t size;
+
+		switch (type & ~TRACK_RECORD_NO_TIME) {
+		case TRACK_RECORD_ACCEL:
+			size = 4 + 3 * 4;
+			break;
+		case TRACK_RECORD_FIX:
+			size = 4 + 2 * 8 + 2 * 4;
+			break;
+		case TRACK_RECORD_TIME:
+			size = 8;
+			break;
+		default:
+			/* No way to find the next record */
+			stats->bad_lines++;
+			return false;
+		}
+
+		if (fread(buf, 1, size, file) != size) {
+			stats->bad_lines++;
+			break;
+		}
+
+		if (type == TRACK_RECORD_TIME) {
+			start = _get_f64(buf);
+			time_us = 0;
+			continue;
+		}
+
+		time_us += _get_u32(buf);
+		double timestamp = type & TRACK_RECORD_NO_TIME ? 0.0 : start + time_us / 1e6;
+
+		if ((type & ~TRACK_RECORD_NO_TIME) == TRACK_RECORD_ACCEL) {
+			track_accel_s sample = {
+				.timestamp = timestamp,
+				.x = _get_f32(buf + 4),
+				.y = _get_f32(buf + 8),
+				.z = _get_f32(buf + 12),
+			};
+
+			stats->samples++;
+			if (handlers->accel_cb)
+				handlers->accel_cb(&sample, user_data);
+		}
+		else {
+			track_fix_s fix = {
+				.timestamp = timestamp,
+				.latitude = _get_f64(buf + 4),
+				.longitude = _get_f64(buf + 12),
+				.altitude = _get_f32(buf + 20),
+				.accuracy = _get_f32(buf + 24),
+			};
+
+			stats->fixes++;
+			if (handlers->fix_cb)
+				handlers->fix_cb(&fix, user_data);
+		}
+	}
+
+	return !ferror(file);
+}
+
+/**
+ * @brief Creates a binary recording, replacing any file at path.
+ * @return The writer, or NULL if the file cannot be created.
+ * Finish the file with track_writer_close().
+ */
+track_writer_s *track_writer_open(const char *path)
+{
+	track_writer_s *writer = mt_calloc(MT_DATA, 1, sizeof(track_writer_s));
+
+	if (!writer)
+		return NULL;
+
+	writer->file = fopen(path, "wb");
+	if (!writer->file) {
+		mt_free(writer);
+		return NULL;
+	}
+
+	setvbuf(writer->file, NULL, _IOFBF, TRACK_FILE_BUFFER_SIZE);
+
+	return writer;
+}
+
+static void _track_writer_header(track_writer_s *writer, double start)
+{
+	unsigned char header[TRACK_BINARY_HEADER_SIZE];
+	unsigned char *p = header;
+
+	memcpy(p, TRACK_BINARY_MAGIC, 4);
+	p = _put_u16(p + 4, TRACK_BINARY_VERSION);
+	p = _put_u16(p, 0);
+	_put_f64(p, start);
+
+	if (fwrite(header, 1, sizeof(header), writer->file) != sizeof(header))
+		writer->failed = true;
+
+	writer->start = start;
+	writer->started = true;
+}
+
+/**
+ * @brief Internal function writing the type and time delta of a record. Writes the
+ * header on the first event, as its time is the start of the recording.
+ */
+static unsigned char *_track_writer_begin(track_writer_s *writer, unsigned char *p, int type, double timestamp)
+{
+	int64_t time_us;
+
+	if (!writer->started)
+		_track_writer_header(writer, timestamp > 0.0 ? timestamp : 0.0);
+
+	if (timestamp <= 0.0) {
+		*p++ = type | TRACK_RECORD_NO_TIME;
+		return _put_u32(p, 0);
+	}
+
+	time_us = llround((timestamp - writer->start) * 1e6);
+
+	/* Backwards or too far ahead for a delta: restart the deltas from this event */
+	if (time_us < writer->last_us || time_us - writer->last_us > UINT32_MAX) {
+		unsigned char sync[1 + 8];
+
+		sync[0] = TRACK_RECORD_TIME;
+		_put_f64(sync + 1, timestamp);
+		if (fwrite(sync, 1, sizeof(sync), writer->file) != sizeof(sync))
+			writer->failed = true;
+
+		writer->start = timestamp;
+		writer->last_us = 0;
+		time_us = 0;
+	}
+
+	*p++ = type;
+	p = _put_u32(p, time_us - writer->last_us);
+	writer->last_us = time_us;
+
+	return p;
+}
+
+bool track_writer_accel(track_writer_s *writer, const track_accel_s *sample)
+{
+	unsigned char record[TRACK_RECORD_MAX];
+	unsigned char *p = _track_writer_begin(writer, record, TRACK_RECORD_ACCEL, sample->timestamp);
+
+	p = _put_f32(p, sample->x);
+	p = _put_f32(p, sample->y);
+	p = _put_f32(p, sample->z);
+
+	if (fwrite(record, 1, p - record, writer->file) != (size_t) (p - record))
+		writer->failed = true;
+
+	return !writer->failed;
+}
+
+/**
+ * @brief Appends a fix. Altitude and accuracy are stored in single precision.
+ */
+bool track_writer_fix(track_writer_s *writer, const track_fix_s *fix)
+{
+	unsigned char record[TRACK_RECORD_MAX];
+	unsigned char *p = _track_writer_begin(writer, record, TRACK_RECORD_FIX, fix->timestamp);
+
+	p = _put_f64(p, fix->latitude);
+	p = _put_f64(p, fix->longitude);
+	p = _put_f32(p, fix->altitude);
+	p = _put_f32(p, fix->accuracy);
+
+	if (fwrite(record, 1, p - record, writer->file) != (size_t) (p - record))
+		writer->failed = true;
+
+	return !writer->failed;
+}
+
+/**
+ * @brief Flushes and closes the recording and releases the writer.
+ * @return This function returns 'true' if every event reached the file,
+ * otherwise 'false' is returned.
+ */
+bool track_writer_close(track_writer_s *writer)
+{
+	bool ok;
+
+	if (!writer)
+		return false;
+
+	/* An empty recording is still a valid file */
+	if (!writer->started)
+		_track_writer_header(writer, 0.0);
+
+	ok = fclose(writer->file) == 0 && !writer->failed;
+	mt_free(writer);
+
+	return ok;
+}
@@ -0,0 +1,488 @@
+#include <time.h>
+#include "avoidrickshaw.h"
+#include "tracker.h"
+#include "tracker_core.h"
+#include "tariff.h"
+#include "Sqlitedbhelper.h"
+#include "live_metrics.h"
+#include "trace.h"
+#include "diag.h"
+#include "energy.h"
+#include "memtrack.h"
+
+static struct tracker_info {
+	sensor_backend_s *backend;
+	tracker_callbacks_s callbacks;
+	bool tracking;
+	position_filter_s position;
+	step_detector_s step_detector;
+	session_stats_s stats;
+	int steps_count;
+	int fare;
+	double start_time;          /*on the backend's clock*/
+	time_t start_wall_time;     /*on the database clock*/
+	double calories;
+	double calories_per_kg;     /*weight term of calories divided by weight*/
+	double weight;
+	char *record_path;          /*recording of the next session, NULL for none*/
+	track_writer_s *recorder;
+} s_info = {
+	.backend = NULL,
+	.tracking = false,
+	.position = POSITION_FILTER_INIT,
+	.step_detector = STEP_DETECTOR_INIT,
+	.steps_count = 0,
+	.fare = 0,
+	.start_time = 0.0,
+	.start_wall_time = 0,
+	.calories = 0.0,
+	.calories_per_kg = 0.0,
+	.weight = 70.0,
+	.record_path = NULL,
+	.recorder = NULL,
+};
+
+static void _tracker_fix_cb(const track_fix_s *fix, void *user_data);
+static void _tracker_accel_cb(const track_accel_s *sample, void *user_data);
+static void _tracker_save_db(void);
+static void _tracker_save_session(void);
+static int _tracker_count_fare(void);
+static void _tracker_burn_calories(void);
+static void _tracker_publish_metrics(void);
+static void _tracker_record_start(void);
+static void _tracker_record_stop(void);
+
+/**
+ * @brief Attaches the tracker to a sensor backend.
+ * @param[in] backend The source of events, owned by the caller.
+ * @param[in] callbacks The view updates, copied.
+ */
+bool tracker_init(sensor_backend_s *backend, const tracker_callbacks_s *callbacks)
+{
+	if (!backend)
+		return false;
+
+	s_info.backend = backend;
+	s_info.callbacks = *callbacks;
+
+	backend->handlers.fix_cb = _tracker_fix_cb;
+	backend->handlers.accel_cb = _tracker_accel_cb;
+	backend->user_data = NULL;
+
+	return true;
+}
+
+/**
+ * @brief Detaches the tracker from its backend. A running session is
+ * stopped without being saved.
+ */
+void tracker_finalize(void)
+{
+	if (s_info.tracking) {
+		s_info.backend->location_stop(s_info.backend);
+		s_info.backend->motion_stop(s_info.backend);
+		s_info.tracking = false;
+	}
+
+	_tracker_record_stop();
+	tracker_set_recording(NULL);
+	s_info.backend = NULL;
+}
+
+bool tracker_location_enabled(void)
+{
+	return s_info.backend && s_info.backend->location_enabled(s_info.backend);
+}
+
+/**
+ * @brief Starts a tracking session.
+ * @return This function returns 'true' if both location and motion sources started.
+ */
+bool tracker_start(void)
+{
+	if (s_info.tracking || !tracker_location_enabled())
+		return false;
+
+	energy_session_begin();
+	_tracker_record_start();
+	bool track = s_info.backend->location_start(s_info.backend);
+	bool accel_sensor = s_info.backend->motion_start(s_info.backend);
+	s_info.start_time = s_info.backend->now(s_info.backend);
+	s_info.start_wall_time = dbTime();
+	session_stats_reset(&s_info.stats);
+	s_info.tracking = true;
+
+	/* Re-initialize count on start of another session */
+	if (!s_info.steps_count) {
+		if (s_info.callbacks.steps_changed)
+			s_info.callbacks.steps_changed(s_info.steps_count);
+		if (s_info.callbacks.distance_changed)
+			s_info.callbacks.distance_changed(s_info.position.total_distance);
+		s_info.fare = 0;
+		if (s_info.callbacks.fare_changed)
+			s_info.callbacks.fare_changed(0);
+		if (s_info.callbacks.calories_changed)
+			s_info.callbacks.calories_changed(s_info.calories);
+	}
+
+	_tracker_publish_metrics();
+	TRACE_INFO(SESSION_START, track, accel_sensor, 0);
+
+	return track && accel_sensor;
+}
+
+/**
+ * @brief Stops the session, saves it and clears the totals for the next one.
+ * @return This function returns 'true' if both location and motion sources stopped.
+ */
+bool tracker_stop(void)
+{
+	if (!s_info.tracking)
+		return false;
+
+	bool track = s_info.backend->location_stop(s_info.backend);
+
+	// Save info to database
+	if (track)
+		_tracker_save_db();
+
+	TRACE_INFO(SESSION_STOP, s_info.position.total_distance, s_info.steps_count, 0);
+
+	/* Re-initialize distance and steps */
+	position_filter_reset(&s_info.position);
+	s_info.steps_count = 0;
+	s_info.calories = 0.0;
+	s_info.calories_per_kg = 0.0;
+
+	bool accel_sensor = s_info.backend->motion_stop(s_info.backend);
+
+	/* Reset init/prev acceleration data */
+	step_detector_reset(&s_info.step_detector);
+	_tracker_record_stop();
+
+	s_info.tracking = false;
+	_tracker_publish_metrics();
+
+	return track && accel_sensor;
+}
+
+/**
+ * @brief Sets the body weight used for calories. It applies to the whole running session.
+ */
+void tracker_set_weight(double weight)
+{
+	s_info.weight = weight;
+
+	/*the session is saved with the weight of its calories*/
+	if (s_info.tracking)
+		_tracker_burn_calories();
+}
+
+/**
+ * @brief Records the raw events of the next session, as the tracker receives them,
+ * to a binary track file for replay with the replay backend.
+ * @param[in] path The .artrk file to create at the next start, copied. NULL cancels.
+ * @return This function returns 'false' if the path could not be kept.
+ */
+bool tracker_set_recording(const char *path)
+{
+	mt_free(s_info.record_path);
+	s_info.record_path = NULL;
+
+	if (!path)
+		return true;
+
+	s_info.record_path = mt_strdup(MT_DATA, path);
+	return s_info.record_path != NULL;
+}
+
+void tracker_get_totals(tracker_totals_s *totals)
+{
+	totals->distance = s_info.position.total_distance;
+	totals->steps = s_info.steps_count;
+	totals->fare = s_info.fare;
+	totals->calories = s_info.calories;
+	totals->elapsed = s_info.tracking ? s_info.backend->now(s_info.backend) - s_info.start_time : 0.0;
+	totals->tracking = s_info.tracking;
+	totals->gps_fix = position_filter_has_fix(&s_info.position);
+}
+
+/**
+ * @brief Internal function invoked after updating total distance to count Rickshaw fare.
+ * After calculating fare, total fare is updated in view.
+ * @return Calculated fare.
+ */
+static int _tracker_count_fare(void)
+{
+	int fare;
+
+	fare = tariff_price(&tariff_default, s_info.position.total_distance);
+	s_info.fare = fare;
+
+	TRACE_INFO(FARE, fare, s_info.position.total_distance, 0);
+	if (s_info.callbacks.fare_changed)
+		s_info.callbacks.fare_changed(fare);
+
+	return fare;
+}
+
+/**
+ * @brief Internal callback function computing total distance passed on a new position fix.
+ */
+static void _tracker_fix_cb(const track_fix_s *fix, void *user_data)
+{
+	double elapsed = s_info.backend->now(s_info.backend) - s_info.start_time;
+	double distance;
+
+	memtrack_steady_enter();
+	energy_count(ENERGY_GPS_FIX);
+	DIAG_BEGIN(POSITION);
+
+	if (s_info.recorder && !track_writer_fix(s_info.recorder, fix))
+		_tracker_record_stop();
+
+	TRACE_DEBUG(FIX_ACCURACY, fix->accuracy, 0, 0);
+
+	/* First fix only becomes the previous position */
+	if (!position_filter_has_fix(&s_info.position)) {
+		TRACE_INFO(FIX_FIRST, fix->latitude, fix->longitude, 0);
+		position_filter_feed(&s_info.position, fix->latitude, fix->longitude, 0.0, s_info.steps_count);
+		session_stats_feed(&s_info.stats, elapsed, 0.0, s_info.steps_count);
+		goto out;
+	}
+
+	/* Calculate distance between previous and current location data and
+	 * update view */
+	distance = s_info.backend->distance(s_info.backend, fix->latitude, fix->longitude,
+			s_info.position.prev_latitude, s_info.position.prev_longitude);
+	if (distance < 0.0)
+		goto out;
+
+	if (position_filter_feed(&s_info.position, fix->latitude, fix->longitude, distance, s_info.steps_count)) {
+		// If user is actually walking/running
+		TRACE_INFO(FIX, fix->latitude, fix->longitude, distance);
+		TRACE_DEBUG(DISTANCE, s_info.position.total_distance, 0, 0);
+		session_stats_feed(&s_info.stats, elapsed, distance, s_info.steps_count);
+
+		if (s_info.callbacks.distance_changed)
+			s_info.callbacks.distance_changed(s_info.position.total_distance);
+
+		_tracker_count_fare();
+		_tracker_burn_calories();
+		_tracker_publish_metrics();
+	}
+	else {
+		TRACE_INFO(FIX_STILL, fix->latitude, fix->longitude, s_info.steps_count);
+		session_stats_feed(&s_info.stats, elapsed, 0.0, s_info.steps_count);
+	}
+
+out:
+	DIAG_END(POSITION);
+	memtrack_steady_leave();
+}
+
+/**
+ * @brief Internal callback function invoked on acceleration measurement acquisition.
+ * It is responsible for acceleration peaks detection which is assumed to occur on step making.
+ */
+static void _tracker_accel_cb(const track_accel_s *sample, void *user_data)
+{
+	memtrack_steady_enter();
+	energy_count(ENERGY_ACCEL);
+	DIAG_BEGIN(ACCEL);
+
+	if (s_info.recorder && !track_writer_accel(s_info.recorder, sample))
+		_tracker_record_stop();
+
+	if (step_detector_feed(&s_info.step_detector, sample->x, sample->y, sample->z)) {
+		s_info.steps_count++;
+		TRACE_DEBUG(STEP, s_info.steps_count, 0, 0);
+		if (s_info.callbacks.steps_changed)
+			s_info.callbacks.steps_changed(s_info.position.total_distance/STEP_LENGTH);
+		_tracker_publish_metrics();
+	}
+
+	DIAG_END(ACCEL);
+	memtrack_steady_leave();
+}
+
+/**
+ * @brief Calculates burnt calories while walking or running.
+ */
+static void _tracker_burn_calories(void)
+{
+	double elapsed_hours = (s_info.backend->now(s_info.backend) - s_info.start_time) / 3600;
+
+	s_info.calories = tracker_core_calories(s_info.position.total_distance, elapsed_hours, s_info.weight);
+	s_info.calories_per_kg = tracker_core_calories_per_kg(elapsed_hours);
+	TRACE_INFO(CALORIES, s_info.calories, elapsed_hours, s_info.weight);
+
+	// If travelled distance is non-zero, then change 'calories burnt' value shown in view
+	if (s_info.position.total_distance > 0 && s_info.callbacks.calories_changed)
+		s_info.callbacks.calories_changed(s_info.calories);
+}
+
+/**
+ * @brief Internal function saving the session in the database: the session row
+ * and the totals of the day.
+ */
+static void _tracker_save_db(void)
+{
+	int temp;
+	temp = _tracker_count_fare();
+	int num_rows = 0;
+
+	int ret;
+
+	/*SQLite allocates from db_heap.c, the day row lives on the stack*/
+	memtrack_steady_enter();
+
+	DIAG_BEGIN(DB_INIT);
+	ret = initdb();
+	DIAG_END(DB_INIT);
+	dlog_print(DLOG_DEBUG, LOG_TAG, "Called initdb function...Status: %d", ret);
+
+	/*before the day totals, so the session row is kept even when nothing was walked*/
+	if (ret == SQLITE_OK)
+		_tracker_save_session();
+
+	QueryData msgdata = {0, };
+
+	DIAG_BEGIN(DB_QUERY_TODAY);
+	ret = getMsgByCurrentDate(&msgdata, &num_rows);
+	DIAG_END(DB_QUERY_TODAY);
+
+	if (!ret){
+		// If starting database for first time, populate database for App Demo.
+		// Only for an empty table, not on the first save of every new day.
+		int total_rows = 0;
+		if (num_rows == 0 && getTotalMsgItemsCount(&total_rows) == SQLITE_OK && total_rows == 0) {
+			populateDb();
+		}
+
+		if(num_rows > 0) {
+			msgdata.distance += (float) s_info.position.total_distance;
+			msgdata.fare += temp;
+			msgdata.steps += s_info.position.total_distance/STEP_LENGTH;
+			msgdata.calories += (float) s_info.calories;
+
+			dlog_print(DLOG_DEBUG, LOG_TAG, "Saving, fare: %d, calories: %.2f", msgdata.fare, msgdata.calories);
+
+			/*Update existing row in DB; calories are added in SQL, a recalculation may rewrite the row's*/
+			if (msgdata.steps > 0 && msgdata.distance > 0) {
+				DIAG_BEGIN(DB_UPDATE);
+				ret = updateInfoDb(msgdata.distance, msgdata.steps, (float) s_info.calories,
+						(float) s_info.calories_per_kg, s_info.weight, msgdata.fare);
+				DIAG_END(DB_UPDATE);
+			}
+			else {
+				memtrack_steady_leave();
+				return;
+			}
+		}
+		else {
+			msgdata.distance = (float) s_info.position.total_distance;
+			msgdata.fare = temp;
+			msgdata.steps = s_info.position.total_distance/STEP_LENGTH;
+			msgdata.calories = (float) s_info.calories;
+
+			dlog_print(DLOG_DEBUG, LOG_TAG, "Saving, fare: %d, calories: %.2f", msgdata.fare, msgdata.calories);
+
+			/*Insert new row in DB*/
+			if (msgdata.steps > 0 && msgdata.distance > 0) {
+				DIAG_BEGIN(DB_INSERT);
+				ret = insertIntoDb(msgdata.distance, msgdata.steps, msgdata.calories,
+						(float) s_info.calories_per_kg, s_info.weight, msgdata.fare);
+				DIAG_END(DB_INSERT);
+			}
+			else {
+				memtrack_steady_leave();
+				return;
+			}
+		}
+	}
+	else {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Error querying current date info in DB!");
+	}
+	memtrack_steady_leave();
+
+	dlog_print(DLOG_DEBUG, LOG_TAG, "Saving session data in database...Status: %d", ret);
+	TRACE_INFO(SESSION_SAVE, ret, s_info.position.total_distance, s_info.fare);
+
+	if (s_info.callbacks.saved)
+		s_info.callbacks.saved(ret);
+}
+
+/**
+ * @brief Internal function storing the finished session with its energy estimate
+ * and its statistics.
+ * Writes of the save itself are left out of the estimate.
+ */
+static void _tracker_save_session(void)
+{
+	SessionData session = {0, };
+	double duration = s_info.backend->now(s_info.backend) - s_info.start_time;
+
+	/*the receiver was on for the whole session*/
+	energy_add(ENERGY_GPS_ON, (uint32_t) duration);
+	energy_session_end(&session.energy);
+
+	session.start_time = s_info.start_wall_time;
+	session.duration = (int) duration;
+	session.distance = (float) s_info.position.total_distance;
+	session.stats = s_info.stats;
+
+	if (insertSession(&session) != SQLITE_OK)
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to save session energy");
+}
+
+/**
+ * @brief Publishes the current session values to the shared live metrics region.
+ * Steps are reported as shown in the view, derived from the walked distance.
+ */
+static void _tracker_publish_metrics(void)
+{
+	live_metrics_values_s values = {
+		.distance = s_info.position.total_distance,
+		.calories = s_info.calories,
+		.session_start = s_info.start_wall_time,
+		.steps = s_info.position.total_distance / STEP_LENGTH,
+		.fare = s_info.fare,
+		.tracking = s_info.tracking,
+		.gps_fix = position_filter_has_fix(&s_info.position),
+	};
+
+	live_metrics_publish(&values);
+}
+
+/**
+ * @brief Internal function opening the recording requested with tracker_set_recording().
+ * The request is used up, so only sessions asked for are recorded.
+ */
+static void _tracker_record_start(void)
+{
+	if (!s_info.record_path)
+		return;
+
+	s_info.recorder = track_writer_open(s_info.record_path);
+	if (!s_info.recorder)
+		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create recording %s", s_info.record_path);
+
+	mt_free(s_info.record_path);
+	s_info.record_path = NULL;
+}
+
+/**
+ * @brief Internal function finishing the recording, also on a failed write,
+ * which keeps the events written so far.
+ */
+static void _tracker_record_stop(void)
+{
+	if (!s_info.recorder)
+		return;
+
+	if (!track_writer_close(s_info.recorder))
+		dlog_print(DLOG_ERROR, LOG_TAG, "Recording of the session is incomplete");
+
+	s_info.recorder = NULL;
+}
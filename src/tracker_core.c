@@ -0,0 +1,269 @@
+#include <math.h>
+#include "tracker_core.h"
+
+#define TRESHOLD 0.2
+#define DOUBLE_COMPARIZON_THRESHOLD 0.0001
+
+#define RADIUS 6371
+#define TO_RAD (3.14159265/180)
+#define KM 1000
+
+/**
+ * @brief Resets the step detector so the next sample becomes the resting average.
+ * @param[in] detector The detector state.
+ */
+void step_detector_reset(step_detector_s *detector)
+{
+	detector->init_acc_av = detector->prev_acc_av = MAX_ACCEL_INIT_VALUE;
+}
+
+/**
+ * @brief Feeds one accelerometer sample to the step detector.
+ * A step is registered when the average acceleration drops below the resting
+ * average by more than TRESHOLD right after being above it.
+ * @param[in] detector The detector state.
+ * @param[in] x The acceleration on X axis.
+ * @param[in] y The acceleration on Y axis.
+ * @param[in] z The acceleration on Z axis.
+ * @return This function returns 'true' if the sample completes a step,
+ * otherwise 'false' is returned.
+ */
+bool step_detector_feed(step_detector_s *detector, float x, float y, float z)
+{
+	bool step = false;
+
+	/* Get current average value of acceleration on three axes */
+	double current_acc_av = (fabs(x) + fabs(y) + fabs(z)) / 3;
+
+	/* If initial average acceleration value is not set, do it now */
+	if (fabs(detector->init_acc_av - MAX_ACCEL_INIT_VALUE) < DOUBLE_COMPARIZON_THRESHOLD) {
+		detector->init_acc_av = detector->prev_acc_av = current_acc_av;
+		return false;
+	}
+
+	/* Register a drop of acceleration average value */
+	if (detector->prev_acc_av > detector->init_acc_av && detector->init_acc_av - current_acc_av > TRESHOLD)
+		step = true;
+
+	detector->prev_acc_av = current_acc_av;
+
+	return step;
+}
+
+/**
+ * @brief Resets the position filter to its no-fix state with zero distance.
+ * @param[in] filter The filter state.
+ */
+void position_filter_reset(position_filter_s *filter)
+{
+	filter->prev_latitude = LAT_UNINITIATED;
+	filter->prev_longitude = LONG_UNINITIATED;
+	filter->prev_steps_count = 0;
+	filter->total_distance = 0.0;
+}
+
+/**
+ * @brief Checks whether the filter has a previous fix to measure distance from.
+ * @param[in] filter The filter state.
+ */
+bool position_filter_has_fix(const position_filter_s *filter)
+{
+	return !(fabs(filter->prev_latitude - LAT_UNINITIATED) < DOUBLE_COMPARIZON_THRESHOLD &&
+			fabs(filter->prev_longitude - LONG_UNINITIATED) < DOUBLE_COMPARIZON_THRESHOLD);
+}
+
+/**
+ * @brief Feeds one position fix to the filter.
+ * Distance is added to the total only if steps were made since the last
+ * accepted fix; otherwise the user is assumed to ride, and only the position is kept.
+ * @param[in] filter The filter state.
+ * @param[in] latitude The value of latitude.
+ * @param[in] longitude The value of longitude.
+ * @param[in] distance Distance from the previous fix in meters, ignored without a previous fix.
+ * @param[in] steps_count Steps made in the session so far.
+ * @return This function returns 'true' if the total distance changed,
+ * otherwise 'false' is returned.
+ */
+bool position_filter_feed(position_filter_s *filter, double latitude, double longitude,
+		double distance, int steps_count)
+{
+	/* First fix only sets the previous position */
+	if (!position_filter_has_fix(filter)) {
+		filter->prev_latitude = latitude;
+		filter->prev_longitude = longitude;
+		return false;
+	}
+
+	if (steps_count > filter->prev_steps_count) {
+		/* User is actually walking/running */
+		filter->total_distance += distance;
+		filter->prev_latitude = latitude;
+		filter->prev_longitude = longitude;
+		filter->prev_steps_count = steps_count;
+		return true;
+	}
+
+	if (distance > 0) {
+		/* User is moving, but not walking/running */
+		filter->prev_latitude = latitude;
+		filter->prev_longitude = longitude;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Resets a running statistic to the empty stream.
+ */
+void running_stat_reset(running_stat_s *stat)
+{
+	*stat = (running_stat_s) RUNNING_STAT_INIT;
+}
+
+/**
+ * @brief Adds one value with Welford's update, which stays accurate for
+ * long streams where summing squares would cancel out.
+ */
+void running_stat_add(running_stat_s *stat, double value)
+{
+	running_stat_add_weighted(stat, value, 1.0);
+}
+
+/**
+ * @brief Adds one value counting weight times, e.g. a rate over the length
+ * of the interval it was measured in (West's weighted form of Welford's update).
+ */
+void running_stat_add_weighted(running_stat_s *stat, double value, double weight)
+{
+	if (weight <= 0.0)
+		return;
+
+	double delta = value - stat->mean;
+
+	stat->count++;
+	stat->weight += weight;
+	stat->mean += delta * weight / stat->weight;
+	stat->m2 += weight * delta * (value - stat->mean);
+
+	if (value < stat->min)
+		stat->min = value;
+	if (value > stat->max)
+		stat->max = value;
+}
+
+/**
+ * @brief Sample variance of the values added, 0 for fewer than two. Weighted
+ * values are corrected by their count, so unit weights give the usual estimate.
+ */
+double running_stat_variance(const running_stat_s *stat)
+{
+	return stat->count > 1 ? stat->m2 / stat->weight * stat->count / (stat->count - 1) : 0.0;
+}
+
+/**
+ * @brief Largest value added, 0 for the empty stream.
+ */
+double running_stat_max(const running_stat_s *stat)
+{
+	return stat->count ? stat->max : 0.0;
+}
+
+/**
+ * @brief Resets the session statistics for a session starting at time 0.
+ * @param[in] stats The statistics state.
+ */
+void session_stats_reset(session_stats_s *stats)
+{
+	stats->prev_time = -1.0;
+	stats->prev_steps_count = 0;
+	stats->moving_time = 0.0;
+	stats->distance = 0.0;
+	running_stat_reset(&stats->speed);
+	running_stat_reset(&stats->pace);
+	running_stat_reset(&stats->cadence);
+	tdigest_init(&stats->pace_sketch);
+	tdigest_init(&stats->cadence_sketch);
+	stats->split_start = 0.0;
+	stats->split_count = 0;
+}
+
+/**
+ * @brief Feeds one position fix to the session statistics. A kilometre
+ * ends where it is crossed within the fix interval, assuming a steady pace
+ * in between, so splits do not depend on the fix rate.
+ * @param[in] stats The statistics state.
+ * @param[in] time Seconds since the session started.
+ * @param[in] distance Meters the position filter counted for this fix, 0 if none.
+ * @param[in] steps_count Steps made in the session so far.
+ */
+void session_stats_feed(session_stats_s *stats, double time, double distance, int steps_count)
+{
+	double interval = time - stats->prev_time;
+	int steps = steps_count - stats->prev_steps_count;
+	bool first = stats->prev_time < 0.0;
+
+	stats->prev_time = time;
+	stats->prev_steps_count = steps_count;
+
+	if (first || interval <= 0.0 || distance <= 0.0)
+		return;
+
+	stats->moving_time += interval;
+	double pace = interval * KM / distance;
+	double cadence = steps * 60.0 / interval;
+
+	/*weighted so the means are those of the whole session, not of an average fix*/
+	running_stat_add_weighted(&stats->speed, distance / interval, interval);
+	running_stat_add_weighted(&stats->pace, pace, distance);
+	running_stat_add_weighted(&stats->cadence, cadence, interval);
+	tdigest_add(&stats->pace_sketch, pace, 1.0);
+	tdigest_add(&stats->cadence_sketch, cadence, 1.0);
+
+	stats->distance += distance;
+	while ((stats->split_count + 1) * SESSION_SPLIT_METERS <= stats->distance) {
+		double crossed = time - interval * (stats->distance - (stats->split_count + 1) * SESSION_SPLIT_METERS) / distance;
+
+		if (stats->split_count < SESSION_SPLITS_MAX)
+			stats->splits[stats->split_count] = (float) (crossed - stats->split_start);
+		stats->split_count++;
+		stats->split_start = crossed;
+	}
+}
+
+/**
+ * @brief Computes great-circle distance between two coordinates.
+ * Used where location_manager_get_distance() is not available.
+ * @return The distance in meters.
+ */
+double tracker_core_distance(double latitude1, double longitude1, double latitude2, double longitude2)
+{
+	double d_lat = (latitude2 - latitude1) * TO_RAD;
+	double d_lon = (longitude2 - longitude1) * TO_RAD;
+	double a = sin(d_lat / 2) * sin(d_lat / 2) +
+			cos(latitude1 * TO_RAD) * cos(latitude2 * TO_RAD) * sin(d_lon / 2) * sin(d_lon / 2);
+
+	return 2 * RADIUS * KM * asin(sqrt(a));
+}
+
+/**
+ * @brief Calculates burnt calories while walking or running, assuming 0% grade.
+ * @param[in] distance The distance walked in meters.
+ * @param[in] elapsed_hours The time walked in hours.
+ * @param[in] weight The body weight in kilograms.
+ * @return The calories burnt.
+ */
+double tracker_core_calories(double distance, double elapsed_hours, double weight)
+{
+	return tracker_core_calorie_distance_term(distance / KM) + weight * tracker_core_calories_per_kg(elapsed_hours);
+}
+
+/**
+ * @brief Calculates the weight dependent part of burnt calories per kilogram,
+ * which the day rows keep to recompute calories for another weight.
+ * @param[in] elapsed_hours The time walked in hours.
+ * @return The calories burnt per kilogram of body weight.
+ */
+double tracker_core_calories_per_kg(double elapsed_hours)
+{
+	return 1.4577 * elapsed_hours;
+}
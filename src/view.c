@@ -1,12 +1,26 @@
 #include <Elementary.h>
+#if !defined(AR_HOST_BUILD)
 #include <app_preference.h>
+#endif
 #include <cairo.h>
+#include <math.h>
 #include "avoidrickshaw.h"
 #include "view.h"
 #include "view_defines.h"
 #include "graph.h"
+#include "recalc.h"
+#include "jobs.h"
+#include "maintenance.h"
+#include "diag.h"
+#include "memtrack.h"
+#include "energy.h"
 
 #define BUF_MAX 16
+#define DIAG_SCREEN_TAPS 5          /*taps on the GPS status text opening the diagnostics screen*/
+#define DIAG_SCREEN_TAP_WINDOW 3.0  /*seconds the taps must fall within*/
+#define DIAG_REPORT_MAX 4096
+/*the history view data and the up to 29 rows of getLast28DaysInfo in one arena chunk*/
+#define HISTORY_ARENA_SIZE (2 * ARENA_ALIGN + sizeof(appdata_s) + 29 * sizeof(QueryData))
 
 static struct view_info {
 	Evas_Object *win;
@@ -17,6 +31,8 @@ static struct view_info {
 	view_button_clicked_callback_t button_start_clicked_cb;
 	view_button_clicked_callback_t button_stop_clicked_cb;
 	view_button_clicked_callback_t button_history_clicked_cb;
+	int diag_taps;
+	double diag_first_tap;
 } s_info = {
 	.win = NULL,
 	.main_layout = NULL,
@@ -26,6 +42,8 @@ static struct view_info {
 	.button_start_clicked_cb = NULL,
 	.button_stop_clicked_cb = NULL,
 	.button_history_clicked_cb = NULL,
+	.diag_taps = 0,
+	.diag_first_tap = 0.0,
 };
 
 
@@ -39,6 +57,11 @@ static void _settings_cb(void *data, Evas_Object *obj, void *event);
 static void _save_cb(void *data, Evas_Object *obj, void *event);
 static void show_toast_popup(void *parent, char *toast_text);
 static void popup_timeout_cb(void *data, Evas_Object *obj, void *event_info);
+static void _recalc_done_cb(bool success);
+static void _gps_status_clicked_cb(void *data, Evas_Object *obj, const char *emission, const char *source);
+static void _diag_reset_cb(void *data, Evas_Object *obj, void *event);
+static void _diag_refresh(Evas_Object *label);
+static void _frame_rendered_cb(void *data, Evas *e, void *event_info);
 
 /**
  * @brief Callback function that is invoked when initial naviframe view is popped from stack
@@ -68,6 +91,9 @@ Eina_Bool view_create(void *user_data)
 
 	//evas_object_smart_callback_add(s_info.win, "delete,request", win_delete_request_cb, NULL);
 
+	/* Every frame drawn counts towards the session energy estimate */
+	evas_event_callback_add(evas_object_evas_get(s_info.win), EVAS_CALLBACK_RENDER_POST, _frame_rendered_cb, NULL);
+
 	/* Create the conformant */
 	s_info.conform = view_create_conformant(s_info.win);
 	if (s_info.conform == NULL) {
@@ -183,6 +209,9 @@ Evas_Object *view_create_layout(Evas_Object *parent)
 	/* Add callback function for settings button */
 	eext_object_event_callback_add(layout, EEXT_CALLBACK_MORE, _settings_cb, parent);
 
+	/* Tapping the GPS status repeatedly opens the hidden diagnostics screen */
+	elm_layout_signal_callback_add(layout, "mouse,clicked,1", PART_GPS_STATUS, _gps_status_clicked_cb, parent);
+
 	evas_object_show(layout);
 
 	return layout;
@@ -296,6 +325,14 @@ void view_set_button_callbacks(view_button_clicked_callback_t start_button_click
 	s_info.button_history_clicked_cb = history_button_clicked_cb;
 }
 
+/**
+ * @brief Gives the layout showing the session values.
+ */
+Evas_Object *view_layout_get(void)
+{
+	return s_info.layout;
+}
+
 /**
  * @brief Destroys window and frees its resources.
  */
@@ -342,6 +379,8 @@ static void _get_app_resource(const char *edj_file_in, char *edj_path_out, int e
  */
 static void _start_cb(void *data, Evas_Object *obj, void *event)
 {
+	DIAG_BEGIN(BTN_START);
+
 	bool success = false;
 
 	dlog_print(DLOG_DEBUG, LOG_TAG, "Start button clicked");
@@ -353,6 +392,8 @@ static void _start_cb(void *data, Evas_Object *obj, void *event)
 		show_toast_popup(data, "Session Started Successfully!");
 	else
 		show_toast_popup(data, "Error! Session cannot start.");
+
+	DIAG_END(BTN_START);
 }
 
 /**
@@ -365,6 +406,8 @@ static void _start_cb(void *data, Evas_Object *obj, void *event)
  */
 static void _stop_cb(void *data, Evas_Object *obj, void *event)
 {
+	DIAG_BEGIN(BTN_STOP);
+
 	bool success = false;
 
 	dlog_print(DLOG_DEBUG, LOG_TAG, "Stop button clicked");
@@ -375,6 +418,8 @@ static void _stop_cb(void *data, Evas_Object *obj, void *event)
 			show_toast_popup(data, "Session Stopped Successfully!");
 		else
 			show_toast_popup(data, "Error! Session cannot be stopped.");
+
+	DIAG_END(BTN_STOP);
 }
 
 /**
@@ -382,6 +427,8 @@ static void _stop_cb(void *data, Evas_Object *obj, void *event)
  */
 static void _show_history_cb(void *data, Evas_Object *obj, void *event)
 {
+	DIAG_BEGIN(BTN_HISTORY);
+
 	dlog_print(DLOG_DEBUG, LOG_TAG, "History button clicked");
 
 	if (s_info.button_history_clicked_cb){
@@ -392,6 +439,31 @@ static void _show_history_cb(void *data, Evas_Object *obj, void *event)
 	if (!view_history_create(data)){
 		dlog_print(DLOG_ERROR, LOG_TAG, "Failed to create history view.");
 	}
+
+	DIAG_END(BTN_HISTORY);
+}
+
+/**
+ * @brief Internal callback function invoked after the canvas rendered a frame.
+ */
+static void _frame_rendered_cb(void *data, Evas *e, void *event_info)
+{
+	energy_count(ENERGY_UI_REDRAW);
+}
+
+/**
+ * @brief Releases the cairo objects backing the history image once the image is deleted,
+ * which happens when the view is popped. The image shows the surface pixels directly,
+ * so they cannot be freed any earlier. The view data goes with its arena.
+ */
+static void _history_img_del_cb(void *data, Evas *e, Evas_Object *obj, void *event_info)
+{
+	appdata_s *ad = data;
+
+	evas_object_image_data_set(obj, NULL);
+	cairo_destroy(ad->cairo);
+	cairo_surface_destroy(ad->surface);
+	arena_release(&ad->arena);
 }
 
 /**
@@ -400,55 +472,75 @@ static void _show_history_cb(void *data, Evas_Object *obj, void *event)
 Eina_Bool view_history_create(void *data)
 {
 	Evas_Object *nf = (Evas_Object *)data;
-	appdata_s ad = {0,};
+	arena_s arena;
+	appdata_s *ad;
+
+	arena_init(&arena, MT_VIEW, HISTORY_ARENA_SIZE);
+	ad = arena_calloc(&arena, 1, sizeof(appdata_s));
+
+	if (!ad) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot allocate history view data");
+		return EINA_FALSE;
+	}
+	ad->arena = arena;
 
 	/* Cairo library uses GPU for drawing graph */
 	elm_config_accel_preference_set("opengl");
 
 	/* Adds image for drawing cairo objects */
-	ad.img = evas_object_image_add(evas_object_evas_get(nf));
+	ad->img = evas_object_image_add(evas_object_evas_get(nf));
 
 	// Show added image
-	evas_object_show(ad.img);
+	evas_object_show(ad->img);
 
 	// Gets parent view width and height.
-	evas_object_geometry_get(nf, NULL, NULL, &ad.width, &ad.height);
+	evas_object_geometry_get(nf, NULL, NULL, &ad->width, &ad->height);
 
 	// Sets image size according to view width and height
-	evas_object_image_size_set(ad.img, ad.width, ad.height);
-	evas_object_image_fill_set(ad.img, 0, 0, ad.width, ad.height);
+	evas_object_image_size_set(ad->img, ad->width, ad->height);
+	evas_object_image_fill_set(ad->img, 0, 0, ad->width, ad->height);
 
-	ad.surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ad.width, ad.height);
-	ad.cairo = cairo_create(ad.surface);
+	ad->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ad->width, ad->height);
+	ad->cairo = cairo_create(ad->surface);
+	evas_object_event_callback_add(ad->img, EVAS_CALLBACK_DEL, _history_img_del_cb, ad);
 
-	// DataType for querying database
-	QueryData* msgdata;
-	msgdata = (QueryData*) calloc (1, sizeof(QueryData));
+	// DataType for querying database, filled by getLast28DaysInfo from the view's arena
+	QueryData* msgdata = NULL;
 
 	int num_of_rows = 0;
 	int ret;
 
+	DIAG_BEGIN(DB_COUNT);
 	getTotalMsgItemsCount(&num_of_rows);
+	DIAG_END(DB_COUNT);
 
 	// Deletes history from Database, if limit is reached
 	if (num_of_rows > 70) {
 		dlog_print(DLOG_DEBUG, LOG_TAG, "Before Delete, rows: %d", num_of_rows);
 
+		DIAG_BEGIN(DB_DELETE);
 		ret = delAllExceptLast28Days();
+		DIAG_END(DB_DELETE);
 		dlog_print(DLOG_DEBUG, LOG_TAG, "Deletion status: %d", ret);
 	}
 
-	ret = getLast28DaysInfo(&msgdata, &num_of_rows);
+	DIAG_BEGIN(DB_HISTORY);
+	ret = getLast28DaysInfo(&ad->arena, &msgdata, &num_of_rows);
+	DIAG_END(DB_HISTORY);
 
 	dlog_print(DLOG_DEBUG, LOG_TAG, "Querying database...Status: %d", ret);
+	if (ret != SQLITE_OK)
+		num_of_rows = 0; /*draw an empty graph, msgdata is not set*/
 	dlog_print(DLOG_DEBUG, LOG_TAG, "Query returned number of rows: %d", num_of_rows);
 
 	// num_of_rows is incremented by extra 1 by the callback function selectAllItemcb
 	num_of_rows--;
-	cairo_drawing(&ad, msgdata, num_of_rows);
+	DIAG_BEGIN(GRAPH_DRAW);
+	cairo_drawing(ad, msgdata, num_of_rows);
+	DIAG_END(GRAPH_DRAW);
 
 	// Push view to naviframe stack of views
-	elm_naviframe_item_push(nf, "History", NULL, NULL, ad.img, NULL);
+	elm_naviframe_item_push(nf, "History", NULL, NULL, ad->img, NULL);
 
 	return EINA_TRUE;
 }
@@ -576,11 +668,109 @@ Evas_Object *view_create_settings_layout(Evas_Object *parent)
 	return layout;
 }
 
+/**
+ * @brief Creates the diagnostics view showing callback latency histograms and main-loop stalls.
+ */
+Eina_Bool view_diag_create(void *data)
+{
+	Evas_Object *nf = (Evas_Object *)data;
+	Evas_Object *box, *scroller, *label, *reset_btn;
+
+	box = elm_box_add(nf);
+	evas_object_size_hint_weight_set(box, EVAS_HINT_EXPAND, EVAS_HINT_EXPAND);
+
+	scroller = elm_scroller_add(box);
+	evas_object_size_hint_weight_set(scroller, EVAS_HINT_EXPAND, EVAS_HINT_EXPAND);
+	evas_object_size_hint_align_set(scroller, EVAS_HINT_FILL, EVAS_HINT_FILL);
+
+	label = elm_label_add(scroller);
+	elm_label_line_wrap_set(label, ELM_WRAP_WORD);
+	evas_object_size_hint_weight_set(label, EVAS_HINT_EXPAND, 0.0);
+	evas_object_size_hint_align_set(label, EVAS_HINT_FILL, 0.0);
+	_diag_refresh(label);
+	evas_object_show(label);
+
+	elm_object_content_set(scroller, label);
+	evas_object_show(scroller);
+	elm_box_pack_end(box, scroller);
+
+	reset_btn = _create_button(box, BTN_RESET_TEXT, _diag_reset_cb, label);
+	evas_object_size_hint_align_set(reset_btn, EVAS_HINT_FILL, 1.0);
+	elm_box_pack_end(box, reset_btn);
+
+	evas_object_show(box);
+	elm_naviframe_item_push(nf, "Diagnostics", NULL, NULL, box, NULL);
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Internal function filling the diagnostics label with the current report.
+ */
+static void _diag_refresh(Evas_Object *label)
+{
+	char report[DIAG_REPORT_MAX];
+	char *markup;
+	size_t len;
+
+	len = diag_report(report, sizeof(report));
+	if (len + 1 < sizeof(report)) {
+		report[len++] = '\n';
+		len += memtrack_report(report + len, sizeof(report) - len);
+	}
+	if (len + 1 < sizeof(report)) {
+		report[len++] = '\n';
+		len += energy_report(report + len, sizeof(report) - len);
+	}
+	if (len + 1 < sizeof(report)) {
+		report[len++] = '\n';
+		len += jobs_report(report + len, sizeof(report) - len);
+	}
+	if (len + 1 < sizeof(report)) {
+		report[len++] = '\n';
+		maintenance_report(report + len, sizeof(report) - len);
+	}
+
+	markup = elm_entry_utf8_to_markup(report);
+	elm_object_text_set(label, markup ? markup : report);
+	free(markup);
+}
+
+/**
+ * @brief Internal callback function clearing the collected diagnostics.
+ */
+static void _diag_reset_cb(void *data, Evas_Object *obj, void *event)
+{
+	diag_reset();
+	_diag_refresh(data);
+}
+
+/**
+ * @brief Internal callback function counting taps on the GPS status text.
+ */
+static void _gps_status_clicked_cb(void *data, Evas_Object *obj, const char *emission, const char *source)
+{
+	double now = ecore_time_get();
+
+	if (s_info.diag_taps == 0 || now - s_info.diag_first_tap > DIAG_SCREEN_TAP_WINDOW) {
+		s_info.diag_taps = 0;
+		s_info.diag_first_tap = now;
+	}
+
+	if (++s_info.diag_taps < DIAG_SCREEN_TAPS)
+		return;
+
+	s_info.diag_taps = 0;
+	view_diag_create(data);
+}
+
 /**
  * @brief Callback function that gets invoked when 'clicked' event is fired by 'Save' button
  */
 static void _save_cb(void *data, Evas_Object *obj, void *event)
 {
+	DIAG_BEGIN(BTN_SAVE);
+
 	Evas_Object *weight_entry = data;
 
 	dlog_print(DLOG_DEBUG, LOG_TAG, "Save Button pressed!");
@@ -594,12 +784,38 @@ static void _save_cb(void *data, Evas_Object *obj, void *event)
 
 	weight = strtod(weight_str, &ptr);
 
+	// Stored calories were computed with the previous weight, 70 kg unless one was saved
+	double old_weight = 70.0;
+	bool existing = false;
+
+	preference_is_existing(key_name, &existing);
+	if (existing)
+		preference_get_double(key_name, &old_weight);
+
 	int ret = preference_set_double(key_name, weight);
 
-	if (!ret)
+	if (!ret) {
 		show_toast_popup(s_info.navi, "Weight Info Saved Successfully!");
+
+		// Bring history in line with the new weight without blocking the UI
+		if (weight > 0.0 && fabs(weight - old_weight) > 0.01) {
+			recalc_set_callbacks(NULL, _recalc_done_cb);
+			recalc_calories_start(old_weight, weight);
+		}
+	}
 	else
 		show_toast_popup(s_info.navi, "Error! Cannot Save Weight Info!");
+
+	DIAG_END(BTN_SAVE);
+}
+
+/**
+ * @brief Callback function invoked when stored calories were recomputed for a new weight
+ */
+static void _recalc_done_cb(bool success)
+{
+	if (!success)
+		show_toast_popup(s_info.navi, "Error! Cannot Update Calorie History!");
 }
 
 /**
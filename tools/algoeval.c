@@ -0,0 +1,469 @@
+/*
+ * algoeval - compares the step detectors and distance estimators of
+ * estimator.h over a corpus of labelled tracks.
+ *
+ * Usage: algoeval [-s step,...] [-d distance,...] [-m min_cpu_ms] [-o per_track.csv] <track or directory>...
+ *
+ * The truth of a track is read from a file next to it with ".truth"
+ * appended to its name, holding "steps=<count> distance=<meters>"; either
+ * may be left out. trackrun -S -R writes one for every synthetic recording.
+ *
+ * Every estimator runs over the events of every track, held in memory. The
+ * distance estimators are given the step count of the tracker's detector,
+ * as in the app, or the fix count for tracks without accelerometer data.
+ * Reported per estimator: mean absolute and signed error against the truth,
+ * the worst error, the total counted on tracks labelled 0 (standing still),
+ * CPU time per event, and the bytes of one instance, which is all the
+ * memory an estimator uses.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "estimator.h"
+
+#define DEFAULT_MIN_CPU_MS 5.0
+
+typedef struct {
+	track_fix_s fix;
+	int steps_count;        /*by the tracker's detector when the fix arrived*/
+} eval_fix_s;
+
+typedef struct {
+	const char *path;
+	track_accel_s *samples;
+	int sample_count;
+	int sample_capacity;
+	eval_fix_s *fixes;
+	int fix_count;
+	int fix_capacity;
+	double reference[16];   /*state of the tracker's detector*/
+	int reference_steps;
+	int truth_steps;        /*-1 when unknown*/
+	double truth_distance;  /*negative when unknown*/
+} eval_track_s;
+
+/*results of one estimator over the corpus*/
+typedef struct {
+	const char *name;
+	size_t state_size;
+	int labelled;
+	double sum_abs_error;
+	double sum_error;
+	double max_abs_error;
+	int rest_tracks;        /*labelled 0, no relative error*/
+	double rest_estimate;
+	double cpu;
+	long events;
+} eval_total_s;
+
+static struct algoeval_info {
+	const step_estimator_s *steps[16];
+	int step_count;
+	const distance_estimator_s *distances[16];
+	int distance_count;
+	eval_total_s step_totals[16];
+	eval_total_s distance_totals[16];
+	char **paths;
+	int path_count;
+	double min_cpu;
+	FILE *output;
+} s_info = {
+	.step_count = 0,
+	.distance_count = 0,
+	.paths = NULL,
+	.path_count = 0,
+	.min_cpu = DEFAULT_MIN_CPU_MS / 1000.0,
+	.output = NULL,
+};
+
+static double _cpu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _load_accel_cb(const track_accel_s *sample, void *user_data)
+{
+	eval_track_s *track = user_data;
+
+	if (track->sample_count == track->sample_capacity) {
+		track->sample_capacity = track->sample_capacity ? track->sample_capacity * 2 : 4096;
+		track->samples = realloc(track->samples, track->sample_capacity * sizeof(track_accel_s));
+	}
+	track->samples[track->sample_count++] = *sample;
+
+	if (step_estimators[0]->feed(track->reference, sample))
+		track->reference_steps++;
+}
+
+static void _load_fix_cb(const track_fix_s *fix, void *user_data)
+{
+	eval_track_s *track = user_data;
+
+	if (track->fix_count == track->fix_capacity) {
+		track->fix_capacity = track->fix_capacity ? track->fix_capacity * 2 : 1024;
+		track->fixes = realloc(track->fixes, track->fix_capacity * sizeof(eval_fix_s));
+	}
+
+	/* Without accelerometer data every fix counts as walked, as in tracebatch */
+	track->fixes[track->fix_count].fix = *fix;
+	track->fixes[track->fix_count].steps_count = track->sample_count ? track->reference_steps : track->fix_count + 1;
+	track->fix_count++;
+}
+
+static void _load_truth(eval_track_s *track)
+{
+	char path[4096];
+	char word[64];
+	FILE *file;
+
+	track->truth_steps = -1;
+	track->truth_distance = -1.0;
+
+	snprintf(path, sizeof(path), "%s.truth", track->path);
+	file = fopen(path, "r");
+	if (!file)
+		return;
+
+	while (fscanf(file, "%63s", word) == 1) {
+		if (!strncmp(word, "steps=", 6))
+			track->truth_steps = atoi(word + 6);
+		else if (!strncmp(word, "distance=", 9))
+			track->truth_distance = atof(word + 9);
+	}
+
+	fclose(file);
+}
+
+static bool _load_track(eval_track_s *track, const char *path)
+{
+	static const track_file_handlers_s handlers = {
+		.accel_cb = _load_accel_cb,
+		.fix_cb = _load_fix_cb,
+	};
+
+	memset(track, 0, sizeof(*track));
+	track->path = path;
+
+	if (step_estimators[0]->state_size > sizeof(track->reference))
+		return false;
+	step_estimators[0]->reset(track->reference);
+
+	if (!track_file_read(path, &handlers, track, NULL)) {
+		fprintf(stderr, "algoeval: cannot read %s\n", path);
+		return false;
+	}
+
+	_load_truth(track);
+	return true;
+}
+
+static void _free_track(eval_track_s *track)
+{
+	free(track->samples);
+	free(track->fixes);
+}
+
+/*adds one estimate to the totals and the per track output*/
+static void _account(eval_total_s *total, const char *kind, const eval_track_s *track,
+		double truth, double estimate, double cpu_per_event, int events)
+{
+	double error = 0.0;
+
+	total->cpu += cpu_per_event * events;
+	total->events += events;
+
+	if (truth > 0.0) {
+		error = 100.0 * (estimate - truth) / truth;
+		total->labelled++;
+		total->sum_error += error;
+		total->sum_abs_error += error < 0 ? -error : error;
+		if ((error < 0 ? -error : error) > total->max_abs_error)
+			total->max_abs_error = error < 0 ? -error : error;
+	}
+	else if (truth == 0.0) {
+		total->rest_tracks++;
+		total->rest_estimate += estimate;
+	}
+
+	if (s_info.output) {
+		fprintf(s_info.output, "%s,%s,%s,", track->path, kind, total->name);
+		if (truth >= 0.0)
+			fprintf(s_info.output, "%.1f,%.1f,%.2f,", truth, estimate, error);
+		else
+			fprintf(s_info.output, ",%.1f,,", estimate);
+		fprintf(s_info.output, "%.1f\n", cpu_per_event * 1e9);
+	}
+}
+
+/*
+ * Each estimator is run over the track until min_cpu is spent, for a
+ * stable time per event on short tracks; every run starts from a reset.
+ */
+
+static void _eval_steps(const eval_track_s *track, int index)
+{
+	const step_estimator_s *estimator = s_info.steps[index];
+	void *state = malloc(estimator->state_size);
+	double start = _cpu_now(), cpu;
+	long runs = 0;
+	int steps = 0;
+
+	do {
+		steps = 0;
+		estimator->reset(state);
+		for (int i = 0; i < track->sample_count; i++)
+			steps += estimator->feed(state, &track->samples[i]);
+		runs++;
+		cpu = _cpu_now() - start;
+	} while (cpu < s_info.min_cpu && track->sample_count);
+
+	_account(&s_info.step_totals[index], "steps", track, track->truth_steps, steps,
+			track->sample_count ? cpu / runs / track->sample_count : 0.0, track->sample_count);
+	free(state);
+}
+
+static void _eval_distance(const eval_track_s *track, int index)
+{
+	const distance_estimator_s *estimator = s_info.distances[index];
+	void *state = malloc(estimator->state_size);
+	double start = _cpu_now(), cpu;
+	long runs = 0;
+	double distance = 0.0;
+
+	do {
+		estimator->reset(state);
+		for (int i = 0; i < track->fix_count; i++)
+			estimator->feed(state, &track->fixes[i].fix, track->fixes[i].steps_count);
+		distance = estimator->distance(state);
+		runs++;
+		cpu = _cpu_now() - start;
+	} while (cpu < s_info.min_cpu && track->fix_count);
+
+	_account(&s_info.distance_totals[index], "distance", track, track->truth_distance, distance,
+			track->fix_count ? cpu / runs / track->fix_count : 0.0, track->fix_count);
+	free(state);
+}
+
+static void _print_totals(const char *title, const char *unit, const eval_total_s *totals, int count)
+{
+	printf("%-10s %8s %10s %8s %10s %8s %12s %6s\n", title, "labelled", "mean|err|", "bias", "max|err|", "at rest",
+			unit, "bytes");
+	for (int i = 0; i < count; i++) {
+		const eval_total_s *t = &totals[i];
+
+		printf("%-10s %8d", t->name, t->labelled);
+		if (t->labelled)
+			printf(" %9.2f%% %7.2f%% %9.2f%%", t->sum_abs_error / t->labelled, t->sum_error / t->labelled,
+					t->max_abs_error);
+		else
+			printf(" %10s %8s %10s", "-", "-", "-");
+		if (t->rest_tracks)
+			printf(" %8.1f", t->rest_estimate);
+		else
+			printf(" %8s", "-");
+		printf(" %12.1f %6zu\n", t->events ? t->cpu / t->events * 1e9 : 0.0, t->state_size);
+	}
+}
+
+static void _add_path(const char *path)
+{
+	s_info.paths = realloc(s_info.paths, (s_info.path_count + 1) * sizeof(char *));
+	s_info.paths[s_info.path_count++] = strdup(path);
+}
+
+static int _compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*a directory contributes the tracks directly in it*/
+static bool _collect(const char *path)
+{
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "algoeval: cannot open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		_add_path(path);
+		return true;
+	}
+
+	dir = opendir(path);
+	if (!dir) {
+		fprintf(stderr, "algoeval: cannot open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		char *file_path;
+
+		if (track_file_format(entry->d_name) == TRACK_FORMAT_UNKNOWN)
+			continue;
+
+		if (asprintf(&file_path, "%s/%s", path, entry->d_name) < 0)
+			break;
+		_add_path(file_path);
+		free(file_path);
+	}
+
+	closedir(dir);
+	return true;
+}
+
+/*picks estimators by comma separated names, all of them for NULL*/
+static bool _select(const char *names, bool steps)
+{
+	char *list, *name, *save;
+	int count = 0;
+
+	if (!names) {
+		for (int i = 0; steps ? step_estimators[i] != NULL : distance_estimators[i] != NULL; i++) {
+			if (steps)
+				s_info.steps[count++] = step_estimators[i];
+			else
+				s_info.distances[count++] = distance_estimators[i];
+		}
+		goto out;
+	}
+
+	list = strdup(names);
+	for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+		if (count == 16)
+			break;
+
+		if (steps)
+			s_info.steps[count] = step_estimator_find(name);
+		else
+			s_info.distances[count] = distance_estimator_find(name);
+
+		if (steps ? !s_info.steps[count] : !s_info.distances[count]) {
+			fprintf(stderr, "algoeval: no %s estimator '%s'\n", steps ? "step" : "distance", name);
+			free(list);
+			return false;
+		}
+		count++;
+	}
+	free(list);
+
+out:
+	if (steps)
+		s_info.step_count = count;
+	else
+		s_info.distance_count = count;
+
+	return true;
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: algoeval [-s step,...] [-d distance,...] [-m min_cpu_ms] [-o per_track.csv] <track or directory>...\n");
+	fprintf(stderr, "step estimators:\n");
+	for (int i = 0; step_estimators[i]; i++)
+		fprintf(stderr, "  %-10s %s\n", step_estimators[i]->name, step_estimators[i]->description);
+	fprintf(stderr, "distance estimators:\n");
+	for (int i = 0; distance_estimators[i]; i++)
+		fprintf(stderr, "  %-10s %s\n", distance_estimators[i]->name, distance_estimators[i]->description);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *step_names = NULL;
+	const char *distance_names = NULL;
+	const char *output_path = NULL;
+	int failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:d:m:o:h")) != -1) {
+		switch (opt) {
+		case 's':
+			step_names = optarg;
+			break;
+		case 'd':
+			distance_names = optarg;
+			break;
+		case 'm':
+			s_info.min_cpu = atof(optarg) / 1000.0;
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind == argc) {
+		_usage();
+		return 2;
+	}
+
+	if (!_select(step_names, true) || !_select(distance_names, false))
+		return 2;
+
+	for (int i = optind; i < argc; i++)
+		if (!_collect(argv[i]))
+			return 1;
+	qsort(s_info.paths, s_info.path_count, sizeof(char *), _compare_paths);
+
+	if (output_path) {
+		s_info.output = fopen(output_path, "w");
+		if (!s_info.output) {
+			fprintf(stderr, "algoeval: cannot write %s: %s\n", output_path, strerror(errno));
+			return 1;
+		}
+		fprintf(s_info.output, "track,kind,estimator,truth,estimate,error_pct,ns_per_event\n");
+	}
+
+	for (int i = 0; i < s_info.step_count; i++) {
+		s_info.step_totals[i].name = s_info.steps[i]->name;
+		s_info.step_totals[i].state_size = s_info.steps[i]->state_size;
+	}
+	for (int i = 0; i < s_info.distance_count; i++) {
+		s_info.distance_totals[i].name = s_info.distances[i]->name;
+		s_info.distance_totals[i].state_size = s_info.distances[i]->state_size;
+	}
+
+	for (int p = 0; p < s_info.path_count; p++) {
+		eval_track_s track;
+
+		if (!_load_track(&track, s_info.paths[p])) {
+			failed++;
+			continue;
+		}
+
+		for (int i = 0; i < s_info.step_count; i++)
+			_eval_steps(&track, i);
+		for (int i = 0; i < s_info.distance_count; i++)
+			_eval_distance(&track, i);
+
+		_free_track(&track);
+	}
+
+	printf("tracks: %d (%d failed)\n\n", s_info.path_count, failed);
+	_print_totals("steps", "ns/sample", s_info.step_totals, s_info.step_count);
+	printf("\n");
+	_print_totals("distance", "ns/fix", s_info.distance_totals, s_info.distance_count);
+
+	if (s_info.output)
+		fclose(s_info.output);
+	for (int i = 0; i < s_info.path_count; i++)
+		free(s_info.paths[i]);
+	free(s_info.paths);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,570 @@
+/*
+ * dbmerge - consolidates sample.db files collected from many devices.
+ *
+ * Usage: dbmerge [-j workers] [-t rows_per_transaction] -o merged.db <source.db>...
+ *
+ * Sources are split into shards of at most SHARD_MAX_SOURCES databases. Each
+ * shard worker ATTACHes its sources to a private connection and k-way merges
+ * their date ordered rows into a bounded channel. The main thread k-way merges
+ * the shard channels and writes rows in large transactions, so memory stays
+ * bounded however many rows the sources hold.
+ *
+ * The device ID of a source is its file name without ".db", or the name of
+ * the containing directory when the file is called sample.db. Two sources
+ * with the same device ID are refused, so that a file passed twice is not
+ * counted twice. The output keeps one row per device and day; re-running
+ * the merge replaces rows.
+ */
+
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHARD_MAX_SOURCES 8       /*below SQLite's default limit of 10 attached databases*/
+#define BLOCK_ROWS 512            /*rows handed from a shard to the merger at once*/
+#define CHANNEL_BLOCKS 4          /*blocks buffered per shard*/
+#define DEFAULT_TRANSACTION_ROWS 50000
+#define DATE_LEN 10               /*YYYY-MM-DD*/
+
+typedef struct {
+	char date[DATE_LEN + 1];
+	int device;
+	float distance;
+	int fare;
+	float calories;
+	int steps;
+} merge_row_s;
+
+typedef struct {
+	merge_row_s rows[BLOCK_ROWS];
+	int count;
+} row_block_s;
+
+/*single producer, single consumer queue of row blocks*/
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	row_block_s *blocks[CHANNEL_BLOCKS];
+	int head;
+	int count;
+	bool closed;
+} channel_s;
+
+typedef struct {
+	int first_source;
+	int source_count;
+	channel_s channel;
+	pthread_t thread;
+	long rows;
+	bool failed;
+	/*merger side*/
+	row_block_s *current;
+	int position;
+} shard_s;
+
+/*binary heap entry: a cursor over one shard (merger) or one source (shard worker)*/
+typedef struct {
+	const merge_row_s *row;
+	int index;
+} heap_entry_s;
+
+static struct dbmerge_info {
+	char **sources;
+	char **devices;
+	int source_count;
+	shard_s *shards;
+	int shard_count;
+} s_info;
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *_device_id(const char *path)
+{
+	char *copy = strdup(path);
+	char *name = basename(copy);
+	char *device;
+
+	if (!strcmp(name, "sample.db")) {
+		char *dir_copy = strdup(path);
+
+		device = strdup(basename(dirname(dir_copy)));
+		free(dir_copy);
+	}
+	else {
+		size_t len = strlen(name);
+
+		if (len > 3 && !strcmp(name + len - 3, ".db"))
+			name[len - 3] = '\0';
+		device = strdup(name);
+	}
+
+	free(copy);
+	return device;
+}
+
+static int _device_compare(const void *a, const void *b)
+{
+	return strcmp(s_info.devices[*(const int *) a], s_info.devices[*(const int *) b]);
+}
+
+/*reports sources sharing a device ID, false if there are any*/
+static bool _check_devices(void)
+{
+	int *order = malloc(s_info.source_count * sizeof(int));
+	bool unique = true;
+
+	for (int i = 0; i < s_info.source_count; i++)
+		order[i] = i;
+	qsort(order, s_info.source_count, sizeof(int), _device_compare);
+
+	for (int i = 1; i < s_info.source_count; i++) {
+		if (!_device_compare(&order[i - 1], &order[i])) {
+			fprintf(stderr, "dbmerge: %s and %s have the same device ID %s\n",
+					s_info.sources[order[i - 1]], s_info.sources[order[i]], s_info.devices[order[i]]);
+			unique = false;
+		}
+	}
+
+	free(order);
+	return unique;
+}
+
+/*orders rows by date, then device, the order of the output table*/
+static int _row_compare(const merge_row_s *a, const merge_row_s *b)
+{
+	int ret = memcmp(a->date, b->date, DATE_LEN);
+
+	if (ret)
+		return ret;
+
+	return a->device - b->device;
+}
+
+static void _heap_sift_down(heap_entry_s *heap, int count, int i)
+{
+	for (;;) {
+		int smallest = i;
+		int left = 2 * i + 1;
+		int right = left + 1;
+
+		if (left < count && _row_compare(heap[left].row, heap[smallest].row) < 0)
+			smallest = left;
+		if (right < count && _row_compare(heap[right].row, heap[smallest].row) < 0)
+			smallest = right;
+		if (smallest == i)
+			return;
+
+		heap_entry_s tmp = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = tmp;
+		i = smallest;
+	}
+}
+
+static void _heap_build(heap_entry_s *heap, int count)
+{
+	for (int i = count / 2 - 1; i >= 0; i--)
+		_heap_sift_down(heap, count, i);
+}
+
+static void _channel_init(channel_s *channel)
+{
+	pthread_mutex_init(&channel->lock, NULL);
+	pthread_cond_init(&channel->changed, NULL);
+	channel->head = channel->count = 0;
+	channel->closed = false;
+}
+
+static void _channel_push(channel_s *channel, row_block_s *block)
+{
+	pthread_mutex_lock(&channel->lock);
+	while (channel->count == CHANNEL_BLOCKS)
+		pthread_cond_wait(&channel->changed, &channel->lock);
+	channel->blocks[(channel->head + channel->count) % CHANNEL_BLOCKS] = block;
+	channel->count++;
+	pthread_cond_signal(&channel->changed);
+	pthread_mutex_unlock(&channel->lock);
+}
+
+static void _channel_close(channel_s *channel)
+{
+	pthread_mutex_lock(&channel->lock);
+	channel->closed = true;
+	pthread_cond_signal(&channel->changed);
+	pthread_mutex_unlock(&channel->lock);
+}
+
+/*returns NULL once the producer closed the channel and it is drained*/
+static row_block_s *_channel_pop(channel_s *channel)
+{
+	row_block_s *block = NULL;
+
+	pthread_mutex_lock(&channel->lock);
+	while (channel->count == 0 && !channel->closed)
+		pthread_cond_wait(&channel->changed, &channel->lock);
+	if (channel->count > 0) {
+		block = channel->blocks[channel->head];
+		channel->head = (channel->head + 1) % CHANNEL_BLOCKS;
+		channel->count--;
+		pthread_cond_signal(&channel->changed);
+	}
+	pthread_mutex_unlock(&channel->lock);
+
+	return block;
+}
+
+static bool _read_row(sqlite3_stmt *stmt, merge_row_s *row, int device)
+{
+	const unsigned char *date;
+
+	if (sqlite3_step(stmt) != SQLITE_ROW)
+		return false;
+
+	date = sqlite3_column_text(stmt, 0);
+	memset(row->date, 0, sizeof(row->date));
+	if (date)
+		strncpy(row->date, (const char *) date, DATE_LEN);
+	row->device = device;
+	row->distance = (float) sqlite3_column_double(stmt, 1);
+	row->fare = sqlite3_column_int(stmt, 2);
+	row->calories = (float) sqlite3_column_double(stmt, 3);
+	row->steps = sqlite3_column_int(stmt, 4);
+
+	return true;
+}
+
+/*shard worker: k-way merge of the attached sources into the shard channel*/
+static void *_shard_cb(void *data)
+{
+	shard_s *shard = data;
+	sqlite3_stmt *stmts[SHARD_MAX_SOURCES] = {NULL, };
+	merge_row_s heads[SHARD_MAX_SOURCES];
+	heap_entry_s heap[SHARD_MAX_SOURCES];
+	row_block_s *block = NULL;
+	int heap_count = 0;
+	sqlite3 *db;
+	char sql[256];
+
+	if (sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_URI, NULL) != SQLITE_OK) {
+		shard->failed = true;
+		_channel_close(&shard->channel);
+		return NULL;
+	}
+
+	for (int i = 0; i < shard->source_count; i++) {
+		int source = shard->first_source + i;
+		char *uri = sqlite3_mprintf("file:%s?mode=ro", s_info.sources[source]);
+		char *attach = sqlite3_mprintf("ATTACH %Q AS s%d;", uri, i);
+		int ret = sqlite3_exec(db, attach, NULL, NULL, NULL);
+
+		sqlite3_free(attach);
+		sqlite3_free(uri);
+
+		if (ret != SQLITE_OK) {
+			fprintf(stderr, "dbmerge: cannot attach %s: %s\n", s_info.sources[source], sqlite3_errmsg(db));
+			shard->failed = true;
+			continue;
+		}
+
+		snprintf(sql, sizeof(sql), "SELECT Info_DATE, Distance, Fare, Calories, Steps "
+				"FROM s%d.infoTable ORDER BY Info_DATE;", i);
+		if (sqlite3_prepare_v2(db, sql, -1, &stmts[i], NULL) != SQLITE_OK) {
+			fprintf(stderr, "dbmerge: cannot read %s: %s\n", s_info.sources[source], sqlite3_errmsg(db));
+			shard->failed = true;
+			continue;
+		}
+
+		if (_read_row(stmts[i], &heads[i], source)) {
+			heap[heap_count].row = &heads[i];
+			heap[heap_count].index = i;
+			heap_count++;
+		}
+	}
+
+	_heap_build(heap, heap_count);
+
+	while (heap_count > 0) {
+		int i = heap[0].index;
+
+		if (!block) {
+			block = malloc(sizeof(row_block_s));
+			block->count = 0;
+		}
+		block->rows[block->count++] = heads[i];
+		shard->rows++;
+
+		if (block->count == BLOCK_ROWS) {
+			_channel_push(&shard->channel, block);
+			block = NULL;
+		}
+
+		if (!_read_row(stmts[i], &heads[i], shard->first_source + i))
+			heap[0] = heap[--heap_count];
+		_heap_sift_down(heap, heap_count, 0);
+	}
+
+	if (block && block->count > 0)
+		_channel_push(&shard->channel, block);
+	else
+		free(block);
+
+	_channel_close(&shard->channel);
+
+	for (int i = 0; i < shard->source_count; i++)
+		sqlite3_finalize(stmts[i]);
+	sqlite3_close(db);
+
+	return NULL;
+}
+
+/*advances the merger cursor of a shard, false when the shard is exhausted*/
+static bool _shard_next(shard_s *shard, const merge_row_s **row)
+{
+	while (!shard->current || shard->position == shard->current->count) {
+		free(shard->current);
+		shard->current = _channel_pop(&shard->channel);
+		shard->position = 0;
+		if (!shard->current)
+			return false;
+	}
+
+	*row = &shard->current->rows[shard->position++];
+	return true;
+}
+
+static bool _exec(sqlite3 *db, const char *sql)
+{
+	char *err = NULL;
+
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		fprintf(stderr, "dbmerge: %s\n", err);
+		sqlite3_free(err);
+		return false;
+	}
+
+	return true;
+}
+
+static bool _open_output(const char *path, sqlite3 **db)
+{
+	if (sqlite3_open(path, db) != SQLITE_OK) {
+		fprintf(stderr, "dbmerge: cannot open %s: %s\n", path, sqlite3_errmsg(*db));
+		return false;
+	}
+
+	/* Output is rebuilt from the sources on failure, so trade durability for speed */
+	return _exec(*db, "PRAGMA journal_mode=MEMORY; PRAGMA synchronous=OFF;") &&
+		_exec(*db, "CREATE TABLE IF NOT EXISTS devices ("
+				"Device_ID TEXT PRIMARY KEY, "
+				"Source TEXT NOT NULL, "
+				"Rows INTEGER NOT NULL);") &&
+		_exec(*db, "CREATE TABLE IF NOT EXISTS infoTable ("
+				"Device_ID TEXT NOT NULL, "
+				"Info_DATE TEXT NOT NULL, "
+				"Distance REAL NOT NULL, "
+				"Fare INTEGER NOT NULL, "
+				"Calories REAL NOT NULL, "
+				"Steps INTEGER NOT NULL, "
+				"ID INTEGER PRIMARY KEY AUTOINCREMENT, "
+				"UNIQUE (Device_ID, Info_DATE));");
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: dbmerge [-j workers] [-t rows_per_transaction] -o merged.db <source.db>...\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output_path = NULL;
+	int transaction_rows = DEFAULT_TRANSACTION_ROWS;
+	int workers = sysconf(_SC_NPROCESSORS_ONLN);
+	long *device_rows;
+	sqlite3_stmt *insert;
+	sqlite3 *db;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:t:o:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			workers = atoi(optarg);
+			break;
+		case 't':
+			transaction_rows = atoi(optarg);
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (!output_path || optind == argc) {
+		_usage();
+		return 2;
+	}
+	if (workers < 1)
+		workers = 1;
+	if (transaction_rows < 1)
+		transaction_rows = DEFAULT_TRANSACTION_ROWS;
+
+	s_info.sources = &argv[optind];
+	s_info.source_count = argc - optind;
+	s_info.devices = calloc(s_info.source_count, sizeof(char *));
+	device_rows = calloc(s_info.source_count, sizeof(long));
+	for (int i = 0; i < s_info.source_count; i++)
+		s_info.devices[i] = _device_id(s_info.sources[i]);
+
+	if (!_check_devices())
+		return 2;
+
+	if (!_open_output(output_path, &db))
+		return 1;
+
+	/* At least one shard per worker, no shard above the attach limit */
+	s_info.shard_count = (s_info.source_count + SHARD_MAX_SOURCES - 1) / SHARD_MAX_SOURCES;
+	if (s_info.shard_count < workers)
+		s_info.shard_count = workers < s_info.source_count ? workers : s_info.source_count;
+	s_info.shards = calloc(s_info.shard_count, sizeof(shard_s));
+
+	double start = _now();
+
+	for (int s = 0, first = 0; s < s_info.shard_count; s++) {
+		shard_s *shard = &s_info.shards[s];
+
+		shard->first_source = first;
+		shard->source_count = (s_info.source_count - first) / (s_info.shard_count - s);
+		first += shard->source_count;
+
+		_channel_init(&shard->channel);
+		pthread_create(&shard->thread, NULL, _shard_cb, shard);
+	}
+
+	/* Merge shard streams and write them out */
+	heap_entry_s *heap = malloc(s_info.shard_count * sizeof(heap_entry_s));
+	int heap_count = 0;
+	long written = 0, combined = 0, in_transaction = 0;
+	merge_row_s pending;
+	bool have_pending = false;
+	bool ok = true;
+
+	for (int s = 0; s < s_info.shard_count; s++) {
+		if (_shard_next(&s_info.shards[s], &heap[heap_count].row)) {
+			heap[heap_count].index = s;
+			heap_count++;
+		}
+	}
+	_heap_build(heap, heap_count);
+
+	ok = sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO infoTable "
+			"(Device_ID, Info_DATE, Distance, Fare, Calories, Steps) VALUES (?, ?, ?, ?, ?, ?);",
+			-1, &insert, NULL) == SQLITE_OK && _exec(db, "BEGIN;");
+
+	while (ok && (heap_count > 0 || have_pending)) {
+		const merge_row_s *row = heap_count > 0 ? heap[0].row : NULL;
+
+		/* Rows of one device and day from the same source are summed, as the app would */
+		if (row && have_pending && !_row_compare(row, &pending)) {
+			pending.distance += row->distance;
+			pending.fare += row->fare;
+			pending.calories += row->calories;
+			pending.steps += row->steps;
+			combined++;
+		}
+		else {
+			if (have_pending) {
+				sqlite3_bind_text(insert, 1, s_info.devices[pending.device], -1, SQLITE_STATIC);
+				sqlite3_bind_text(insert, 2, pending.date, DATE_LEN, SQLITE_STATIC);
+				sqlite3_bind_double(insert, 3, pending.distance);
+				sqlite3_bind_int(insert, 4, pending.fare);
+				sqlite3_bind_double(insert, 5, pending.calories);
+				sqlite3_bind_int(insert, 6, pending.steps);
+				if (sqlite3_step(insert) != SQLITE_DONE) {
+					fprintf(stderr, "dbmerge: insert failed: %s\n", sqlite3_errmsg(db));
+					ok = false;
+				}
+				sqlite3_reset(insert);
+				device_rows[pending.device]++;
+				written++;
+
+				if (++in_transaction == transaction_rows) {
+					ok = ok && _exec(db, "COMMIT; BEGIN;");
+					in_transaction = 0;
+				}
+			}
+
+			have_pending = (row != NULL);
+			if (row)
+				pending = *row;
+		}
+
+		if (!row)
+			break;
+
+		shard_s *shard = &s_info.shards[heap[0].index];
+		if (!_shard_next(shard, &heap[0].row))
+			heap[0] = heap[--heap_count];
+		_heap_sift_down(heap, heap_count, 0);
+	}
+
+	sqlite3_finalize(insert);
+	ok = ok && _exec(db, "COMMIT;");
+
+	/* Drain and join the workers even after a write error */
+	for (int s = 0; s < s_info.shard_count; s++) {
+		shard_s *shard = &s_info.shards[s];
+		const merge_row_s *row;
+
+		while (_shard_next(shard, &row))
+			;
+		pthread_join(shard->thread, NULL);
+		ok = ok && !shard->failed;
+	}
+
+	double elapsed = _now() - start;
+
+	sqlite3_stmt *device_insert;
+	if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO devices (Device_ID, Source, Rows) VALUES (?, ?, ?);",
+			-1, &device_insert, NULL) == SQLITE_OK) {
+		_exec(db, "BEGIN;");
+		for (int i = 0; i < s_info.source_count; i++) {
+			sqlite3_bind_text(device_insert, 1, s_info.devices[i], -1, SQLITE_STATIC);
+			sqlite3_bind_text(device_insert, 2, s_info.sources[i], -1, SQLITE_STATIC);
+			sqlite3_bind_int64(device_insert, 3, device_rows[i]);
+			sqlite3_step(device_insert);
+			sqlite3_reset(device_insert);
+		}
+		_exec(db, "COMMIT;");
+		sqlite3_finalize(device_insert);
+	}
+
+	sqlite3_close(db);
+
+	fprintf(stderr, "sources: %d in %d shards, rows: %ld written, %ld combined\n",
+			s_info.source_count, s_info.shard_count, written, combined);
+	fprintf(stderr, "elapsed: %.3f s, %.0f rows/s\n", elapsed, elapsed > 0 ? (written + combined) / elapsed : 0.0);
+
+	for (int i = 0; i < s_info.source_count; i++)
+		free(s_info.devices[i]);
+	free(s_info.devices);
+	free(device_rows);
+	free(s_info.shards);
+	free(heap);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,550 @@
+/*
+ * ingestd - reference ingestion server for delta sync from many watches.
+ *
+ * Usage: ingestd [-w writers] [-q queue_depth] [-r rows_per_transaction] -s socket -o ingest.db
+ *
+ * Every connection gets a reader thread that decodes and validates frames
+ * (see sync_proto.h) and queues each batch as a job. A pool of writer
+ * threads, each with its own connection to the WAL mode database, takes as
+ * many queued jobs as fit in one transaction and stores them with multi-row
+ * upserts. A batch is acknowledged only after the transaction holding it
+ * committed, so the acknowledged watermark never runs ahead of the data.
+ *
+ * The server runs until SIGINT or SIGTERM and then prints ingest totals.
+ * Queued batches are still stored on shutdown; senders that are idle are
+ * cut off and resume from their watermark next time.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "sync_proto.h"
+
+#define MAX_WRITERS 16
+#define DEFAULT_QUEUE_DEPTH 256
+#define DEFAULT_TRANSACTION_ROWS 4096
+#define UPSERT_MAX_ROWS 64      /*rows per statement, 8 bound values each stays below SQLite's 999 limit*/
+#define BUSY_TIMEOUT_MS 10000
+#define SHUTDOWN_GRACE_S 2
+
+/*one decoded batch waiting for a writer; its reader sleeps until done is set*/
+typedef struct {
+	const char *device_id;
+	sync_record_s *records;
+	int count;
+	uint32_t watermark;         /*revision of the last record, the ack value once stored*/
+	bool done;
+	bool stored;
+	pthread_cond_t finished;
+} ingest_job_s;
+
+typedef struct {
+	int id;
+	pthread_t thread;
+	sqlite3 *db;
+	sqlite3_stmt *upsert[UPSERT_MAX_ROWS + 1];  /*indexed by row count, prepared on first use*/
+	sqlite3_stmt *watermark;
+	long transactions;
+	long rows;
+} writer_s;
+
+static struct ingestd_info {
+	const char *db_path;
+	int writer_count;
+	int transaction_rows;
+	writer_s writers[MAX_WRITERS];
+
+	/*bounded job queue shared by all readers and writers*/
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	ingest_job_s **jobs;
+	int queue_depth;
+	int head;
+	int count;
+	bool closed;
+
+	/*connections, guarded by lock*/
+	int active_connections;
+	long connections;
+	long batches;
+	long rejected;
+
+	volatile sig_atomic_t stopping;
+} s_info = {
+	.writer_count = 4,
+	.queue_depth = DEFAULT_QUEUE_DEPTH,
+	.transaction_rows = DEFAULT_TRANSACTION_ROWS,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER,
+};
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool _exec(sqlite3 *db, const char *sql)
+{
+	char *err = NULL;
+
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		fprintf(stderr, "ingestd: %s\n", err);
+		sqlite3_free(err);
+		return false;
+	}
+
+	return true;
+}
+
+static bool _open_db(sqlite3 **db)
+{
+	if (sqlite3_open(s_info.db_path, db) != SQLITE_OK) {
+		fprintf(stderr, "ingestd: cannot open %s: %s\n", s_info.db_path, sqlite3_errmsg(*db));
+		return false;
+	}
+
+	sqlite3_busy_timeout(*db, BUSY_TIMEOUT_MS);
+	return _exec(*db, "PRAGMA synchronous=NORMAL;");
+}
+
+static bool _create_schema(void)
+{
+	sqlite3 *db;
+	bool ok;
+
+	if (!_open_db(&db))
+		return false;
+
+	ok = _exec(db, "PRAGMA journal_mode=WAL;"
+			"CREATE TABLE IF NOT EXISTS records (Device_ID TEXT NOT NULL, ID INTEGER NOT NULL, "
+				"Revision INTEGER NOT NULL, Info_DATE TEXT NOT NULL, Distance REAL NOT NULL, "
+				"Steps INTEGER NOT NULL, Calories REAL NOT NULL, Fare INTEGER NOT NULL, "
+				"PRIMARY KEY (Device_ID, ID)) WITHOUT ROWID;"
+			"CREATE TABLE IF NOT EXISTS peers (Device_ID TEXT PRIMARY KEY, Watermark INTEGER NOT NULL);");
+
+	sqlite3_close(db);
+	return ok;
+}
+
+/* The stored watermark of a device, read once per connection */
+static uint32_t _load_watermark(sqlite3 *db, const char *device_id)
+{
+	sqlite3_stmt *stmt;
+	uint32_t watermark = 0;
+
+	if (sqlite3_prepare_v2(db, "SELECT Watermark FROM peers WHERE Device_ID=?;", -1, &stmt, NULL) != SQLITE_OK)
+		return 0;
+
+	sqlite3_bind_text(stmt, 1, device_id, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		watermark = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return watermark;
+}
+
+/* Builds the upsert for a given number of rows; a late revision never overwrites a newer one */
+static sqlite3_stmt *_upsert_stmt(writer_s *writer, int rows)
+{
+	char *sql, *p;
+	size_t size;
+
+	if (writer->upsert[rows])
+		return writer->upsert[rows];
+
+	size = 128 + rows * 24 + 256;
+	sql = malloc(size);
+	if (!sql)
+		return NULL;
+
+	p = sql + sprintf(sql, "INSERT INTO records VALUES ");
+	for (int i = 0; i < rows; i++)
+		p += sprintf(p, "%s(?,?,?,?,?,?,?,?)", i ? "," : "");
+	strcpy(p, " ON CONFLICT(Device_ID, ID) DO UPDATE SET Revision=excluded.Revision, "
+			"Info_DATE=excluded.Info_DATE, Distance=excluded.Distance, Steps=excluded.Steps, "
+			"Calories=excluded.Calories, Fare=excluded.Fare WHERE excluded.Revision>records.Revision;");
+
+	if (sqlite3_prepare_v2(writer->db, sql, -1, &writer->upsert[rows], NULL) != SQLITE_OK) {
+		fprintf(stderr, "ingestd: %s\n", sqlite3_errmsg(writer->db));
+		writer->upsert[rows] = NULL;
+	}
+	free(sql);
+
+	return writer->upsert[rows];
+}
+
+static bool _store_job(writer_s *writer, const ingest_job_s *job)
+{
+	char date[16];
+
+	for (int first = 0; first < job->count; first += UPSERT_MAX_ROWS) {
+		int rows = job->count - first;
+		sqlite3_stmt *stmt;
+		int column = 1;
+		int ret;
+
+		if (rows > UPSERT_MAX_ROWS)
+			rows = UPSERT_MAX_ROWS;
+
+		stmt = _upsert_stmt(writer, rows);
+		if (!stmt)
+			return false;
+
+		for (int i = first; i < first + rows; i++) {
+			const sync_record_s *r = &job->records[i];
+
+			sync_date_unpack(r->date, date, sizeof(date));
+			sqlite3_bind_text(stmt, column++, job->device_id, -1, SQLITE_STATIC);
+			sqlite3_bind_int64(stmt, column++, r->id);
+			sqlite3_bind_int64(stmt, column++, r->revision);
+			sqlite3_bind_text(stmt, column++, date, -1, SQLITE_TRANSIENT);
+			sqlite3_bind_double(stmt, column++, r->distance);
+			sqlite3_bind_int64(stmt, column++, r->steps);
+			sqlite3_bind_double(stmt, column++, r->calories);
+			sqlite3_bind_int64(stmt, column++, r->fare);
+		}
+
+		ret = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (ret != SQLITE_DONE)
+			return false;
+	}
+
+	sqlite3_bind_text(writer->watermark, 1, job->device_id, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(writer->watermark, 2, job->watermark);
+	bool ok = sqlite3_step(writer->watermark) == SQLITE_DONE;
+	sqlite3_reset(writer->watermark);
+
+	return ok;
+}
+
+/* Takes queued jobs until the transaction is full; blocks while the queue is empty */
+static int _take_jobs(ingest_job_s **jobs, int max_jobs)
+{
+	int taken = 0, rows = 0;
+
+	pthread_mutex_lock(&s_info.lock);
+	while (s_info.count == 0 && !s_info.closed)
+		pthread_cond_wait(&s_info.changed, &s_info.lock);
+
+	while (s_info.count > 0 && taken < max_jobs && (taken == 0 || rows < s_info.transaction_rows)) {
+		jobs[taken] = s_info.jobs[s_info.head];
+		rows += jobs[taken++]->count;
+		s_info.head = (s_info.head + 1) % s_info.queue_depth;
+		s_info.count--;
+	}
+	if (taken)
+		pthread_cond_broadcast(&s_info.changed);
+	pthread_mutex_unlock(&s_info.lock);
+
+	return taken;
+}
+
+static void _finish_jobs(ingest_job_s **jobs, int count, bool stored)
+{
+	pthread_mutex_lock(&s_info.lock);
+	for (int i = 0; i < count; i++) {
+		jobs[i]->stored = stored;
+		jobs[i]->done = true;
+		pthread_cond_signal(&jobs[i]->finished);
+	}
+	pthread_mutex_unlock(&s_info.lock);
+}
+
+static void *_writer_cb(void *data)
+{
+	writer_s *writer = data;
+	ingest_job_s **jobs = malloc(s_info.queue_depth * sizeof(ingest_job_s *));
+	int count;
+
+	while ((count = _take_jobs(jobs, s_info.queue_depth)) > 0) {
+		bool ok = _exec(writer->db, "BEGIN IMMEDIATE;");
+
+		for (int i = 0; ok && i < count; i++)
+			ok = _store_job(writer, jobs[i]);
+
+		if (ok)
+			ok = _exec(writer->db, "COMMIT;");
+		if (!ok) {
+			fprintf(stderr, "ingestd: writer %d: %s\n", writer->id, sqlite3_errmsg(writer->db));
+			sqlite3_exec(writer->db, "ROLLBACK;", NULL, NULL, NULL);
+		}
+		else {
+			writer->transactions++;
+			for (int i = 0; i < count; i++)
+				writer->rows += jobs[i]->count;
+		}
+
+		_finish_jobs(jobs, count, ok);
+	}
+
+	free(jobs);
+	return NULL;
+}
+
+/* Queues a job and waits until a writer committed or failed it */
+static bool _submit(ingest_job_s *job)
+{
+	pthread_mutex_lock(&s_info.lock);
+	while (s_info.count == s_info.queue_depth && !s_info.closed)
+		pthread_cond_wait(&s_info.changed, &s_info.lock);
+
+	if (s_info.closed) {
+		pthread_mutex_unlock(&s_info.lock);
+		return false;
+	}
+
+	job->done = false;
+	s_info.jobs[(s_info.head + s_info.count) % s_info.queue_depth] = job;
+	s_info.count++;
+	pthread_cond_broadcast(&s_info.changed);
+
+	while (!job->done)
+		pthread_cond_wait(&job->finished, &s_info.lock);
+	pthread_mutex_unlock(&s_info.lock);
+
+	return job->stored;
+}
+
+/* Checks a batch against the device's watermark: valid records in increasing revision order */
+static bool _validate(const sync_record_s *records, int count, uint32_t watermark)
+{
+	for (int i = 0; i < count; i++) {
+		if (!sync_record_valid(&records[i]) || records[i].revision <= watermark)
+			return false;
+		watermark = records[i].revision;
+	}
+
+	return count > 0;
+}
+
+static void *_connection_cb(void *data)
+{
+	int fd = (int) (intptr_t) data;
+	sync_transport_s transport;
+	uint8_t *frame = malloc(SYNC_FRAME_MAX);
+	sync_record_s *records = malloc(SYNC_BATCH_MAX_RECORDS * sizeof(sync_record_s));
+	char device_id[SYNC_DEVICE_ID_MAX + 1];
+	uint8_t ack[SYNC_ACK_SIZE];
+	ingest_job_s job = { .device_id = device_id, .records = records };
+	uint32_t watermark, sequence;
+	sqlite3 *db;
+	size_t len;
+	long batches = 0, rejected = 0;
+
+	sync_transport_fd(&transport, fd);
+	pthread_cond_init(&job.finished, NULL);
+
+	if (!frame || !records)
+		goto out;
+
+	if (!sync_frame_recv(&transport, frame, SYNC_FRAME_MAX, &len) || !sync_decode_hello(frame, len, device_id))
+		goto out;
+
+	if (!_open_db(&db))
+		goto out;
+	watermark = _load_watermark(db, device_id);
+	sqlite3_close(db);
+
+	if (!sync_frame_send(&transport, ack, sync_encode_ack(ack, watermark)))
+		goto out;
+
+	while (!s_info.stopping && sync_frame_recv(&transport, frame, SYNC_FRAME_MAX, &len)) {
+		if (!sync_decode_batch(frame, len, &sequence, records, &job.count) ||
+				!_validate(records, job.count, watermark)) {
+			/*the sender treats a stale ack as failure and resumes later from the stored watermark*/
+			rejected++;
+			sync_frame_send(&transport, ack, sync_encode_ack(ack, watermark));
+			break;
+		}
+
+		job.watermark = records[job.count - 1].revision;
+		if (!_submit(&job))
+			break;
+
+		watermark = job.watermark;
+		batches++;
+
+		if (!sync_frame_send(&transport, ack, sync_encode_ack(ack, watermark)))
+			break;
+	}
+
+out:
+	transport.close(transport.ctx);
+	pthread_cond_destroy(&job.finished);
+	free(frame);
+	free(records);
+
+	pthread_mutex_lock(&s_info.lock);
+	s_info.batches += batches;
+	s_info.rejected += rejected;
+	s_info.active_connections--;
+	pthread_cond_broadcast(&s_info.changed);
+	pthread_mutex_unlock(&s_info.lock);
+
+	return NULL;
+}
+
+static void _stop_cb(int signum)
+{
+	s_info.stopping = 1;
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: ingestd [-w writers] [-q queue_depth] [-r rows_per_transaction] -s socket -o ingest.db\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct sigaction action = { .sa_handler = _stop_cb };
+	const char *socket_path = NULL;
+	pthread_attr_t detached;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "w:q:r:s:o:h")) != -1) {
+		switch (opt) {
+		case 'w':
+			s_info.writer_count = atoi(optarg);
+			break;
+		case 'q':
+			s_info.queue_depth = atoi(optarg);
+			break;
+		case 'r':
+			s_info.transaction_rows = atoi(optarg);
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'o':
+			s_info.db_path = optarg;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (!socket_path || !s_info.db_path || optind != argc || strlen(socket_path) >= sizeof(addr.sun_path)) {
+		_usage();
+		return 2;
+	}
+
+	if (s_info.writer_count < 1)
+		s_info.writer_count = 1;
+	if (s_info.writer_count > MAX_WRITERS)
+		s_info.writer_count = MAX_WRITERS;
+	if (s_info.queue_depth < 1)
+		s_info.queue_depth = 1;
+
+	if (!_create_schema())
+		return 1;
+
+	s_info.jobs = calloc(s_info.queue_depth, sizeof(ingest_job_s *));
+
+	for (int w = 0; w < s_info.writer_count; w++) {
+		writer_s *writer = &s_info.writers[w];
+
+		writer->id = w;
+		if (!_open_db(&writer->db) ||
+				sqlite3_prepare_v2(writer->db, "INSERT INTO peers VALUES (?, ?) ON CONFLICT(Device_ID) "
+					"DO UPDATE SET Watermark=MAX(Watermark, excluded.Watermark);",
+					-1, &writer->watermark, NULL) != SQLITE_OK)
+			return 1;
+		pthread_create(&writer->thread, NULL, _writer_cb, writer);
+	}
+
+	/* No SA_RESTART, so a signal interrupts accept() */
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	strcpy(addr.sun_path, socket_path);
+	unlink(socket_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		fprintf(stderr, "ingestd: cannot listen on %s: %s\n", socket_path, strerror(errno));
+		return 1;
+	}
+
+	pthread_attr_init(&detached);
+	pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+
+	double start = _now();
+
+	while (!s_info.stopping) {
+		pthread_t thread;
+		int client = accept(fd, NULL, NULL);
+
+		if (client < 0) {
+			if (errno != EINTR)
+				fprintf(stderr, "ingestd: accept: %s\n", strerror(errno));
+			continue;
+		}
+
+		pthread_mutex_lock(&s_info.lock);
+		s_info.active_connections++;
+		s_info.connections++;
+		pthread_mutex_unlock(&s_info.lock);
+
+		if (pthread_create(&thread, &detached, _connection_cb, (void *) (intptr_t) client) != 0) {
+			close(client);
+			pthread_mutex_lock(&s_info.lock);
+			s_info.active_connections--;
+			pthread_mutex_unlock(&s_info.lock);
+		}
+	}
+
+	close(fd);
+	unlink(socket_path);
+
+	/* Give readers a moment to finish the batch in flight; idle senders are cut off */
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += SHUTDOWN_GRACE_S;
+
+	pthread_mutex_lock(&s_info.lock);
+	while (s_info.active_connections > 0)
+		if (pthread_cond_timedwait(&s_info.changed, &s_info.lock, &deadline) == ETIMEDOUT)
+			break;
+	s_info.closed = true;
+	pthread_cond_broadcast(&s_info.changed);
+	pthread_mutex_unlock(&s_info.lock);
+
+	long rows = 0, transactions = 0;
+
+	for (int w = 0; w < s_info.writer_count; w++) {
+		writer_s *writer = &s_info.writers[w];
+
+		pthread_join(writer->thread, NULL);
+		rows += writer->rows;
+		transactions += writer->transactions;
+		for (int i = 0; i <= UPSERT_MAX_ROWS; i++)
+			sqlite3_finalize(writer->upsert[i]);
+		sqlite3_finalize(writer->watermark);
+		sqlite3_close(writer->db);
+	}
+
+	double elapsed = _now() - start;
+
+	printf("%ld connections, %ld batches, %ld rows in %ld transactions, %ld rejected, %.1f s\n",
+			s_info.connections, s_info.batches, rows, transactions, s_info.rejected, elapsed);
+
+	free(s_info.jobs);
+	return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * jobstress - runs a burst of jobs through the job pool, cancelling some
+ * while queued and some while running, and checks the callbacks.
+ *
+ * Usage: jobstress [-n jobs] [-w workers]
+ *
+ * The jobs (30 by default) go round the priority classes. Each runs a few
+ * millisecond ticks, sending a message to its notify callback per tick and
+ * polling jobs_cancelled(). Every fifth is cancelled right after the burst
+ * is submitted, still queued behind the others, every seventh a few
+ * milliseconds later, which catches some of them running. A last few long
+ * jobs are left to jobs_shutdown() to cancel. Meant to run in the tsan build
+ * (make -C tools tsan), where ThreadSanitizer reports any race in the pool.
+ *
+ * Checks, each reported as ok or FAILED:
+ *   callbacks  every done callback ran once, after every message of its job;
+ *              a job not cancelled ran to its end, a cancelled one at most once
+ *   stats      the pool counted every submission and nothing is left queued,
+ *              running or waiting for its done callback
+ *   memory     the pool left nothing allocated after jobs_shutdown()
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "jobs.h"
+#include "memtrack.h"
+
+#define STRESS_MAX_JOBS 1000
+#define STRESS_TICK_NS 1000000L
+#define STRESS_SHUTDOWN_TICKS 1000  /*long enough to still run at jobs_shutdown()*/
+
+typedef struct {
+	job_s *job;
+	job_class_e job_class;
+	int ticks;
+	int runs;           /*written by the worker, read once the done callback ran*/
+	int sent;
+	bool finished;
+	int received;       /*main loop only from here*/
+	int done;
+	bool cancel;        /*jobs_cancel() was called*/
+	bool cancelled;     /*as the done callback saw it*/
+} stress_job_s;
+
+static struct stress_info {
+	stress_job_s jobs[STRESS_MAX_JOBS];
+	int count;
+	int pending;        /*done callbacks not run yet*/
+	bool ok;
+} s_info = {
+	.ok = true,
+};
+
+static void _check(const char *name, bool passed, const char *format, ...)
+{
+	va_list args;
+
+	printf("%-10s %-7s ", name, passed ? "ok" : "FAILED");
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+
+	if (!passed)
+		s_info.ok = false;
+}
+
+static void _sleep_ns(long ns)
+{
+	struct timespec delay = { 0, ns };
+
+	nanosleep(&delay, NULL);
+}
+
+static void _stress_run(void *data, job_s *job)
+{
+	stress_job_s *stress = data;
+
+	stress->runs++;
+	for (int tick = 0; tick < stress->ticks; tick++) {
+		if (jobs_cancelled(job))
+			return;
+		if (jobs_feedback(job, stress))
+			stress->sent++;
+		_sleep_ns(STRESS_TICK_NS);
+	}
+	stress->finished = true;
+}
+
+static void _stress_notify(void *data, job_s *job, void *msg)
+{
+	stress_job_s *stress = data;
+
+	if (msg == stress && !stress->done)
+		stress->received++;
+}
+
+static void _stress_done(void *data, job_s *job, bool cancelled)
+{
+	stress_job_s *stress = data;
+
+	stress->done++;
+	stress->cancelled = cancelled;
+	s_info.pending--;
+}
+
+static const job_callbacks_s s_stress_callbacks = {
+	.run = _stress_run,
+	.notify = _stress_notify,
+	.done = _stress_done,
+};
+
+static void _submit(int ticks)
+{
+	stress_job_s *stress = &s_info.jobs[s_info.count];
+
+	stress->job_class = (job_class_e) (s_info.count % JOB_CLASS_COUNT);
+	stress->ticks = ticks;
+	stress->job = jobs_submit(stress->job_class, &s_stress_callbacks, stress);
+	if (!stress->job)
+		return;
+
+	s_info.count++;
+	s_info.pending++;
+}
+
+static void _cancel(int every, int offset, int count)
+{
+	for (int i = offset; i < count; i += every) {
+		stress_job_s *stress = &s_info.jobs[i];
+
+		if (!stress->done) {
+			stress->cancel = true;
+			jobs_cancel(stress->job);
+		}
+	}
+}
+
+static void _check_callbacks(void)
+{
+	int wrong = 0, finished = 0, cancelled_queued = 0, cancelled_running = 0;
+
+	for (int i = 0; i < s_info.count; i++) {
+		stress_job_s *stress = &s_info.jobs[i];
+		bool right = stress->done == 1 && stress->runs <= 1 && stress->received == stress->sent;
+
+		if (!stress->cancelled)
+			right = right && stress->finished && stress->runs == 1;
+		else if (!stress->cancel)
+			right = false;
+
+		if (!right)
+			wrong++;
+		else if (!stress->cancelled)
+			finished++;
+		else if (stress->runs)
+			cancelled_running++;
+		else
+			cancelled_queued++;
+	}
+
+	_check("callbacks", !wrong && !s_info.pending,
+			"%d jobs: %d ran to the end, %d cancelled while queued, %d while running, %d wrong",
+			s_info.count, finished, cancelled_queued, cancelled_running, wrong);
+}
+
+static void _check_stats(void)
+{
+	uint64_t submitted = 0, cancelled = 0;
+	uint32_t left = 0;
+
+	for (int job_class = 0; job_class < JOB_CLASS_COUNT; job_class++) {
+		jobs_stats_s stats;
+
+		jobs_stats(job_class, &stats);
+		submitted += stats.submitted;
+		cancelled += stats.cancelled;
+		left += stats.queued + stats.running;
+	}
+
+	_check("stats", submitted == (uint64_t) s_info.count && !left && !jobs_pending(),
+			"%llu submitted, %llu cancelled, %u left queued or running, %d pending",
+			(unsigned long long) submitted, (unsigned long long) cancelled, left, jobs_pending());
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: jobstress [-n jobs] [-w workers]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int count = 30;
+	int workers = JOBS_DEFAULT_WORKERS;
+	int64_t live;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:w:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'w':
+			workers = atoi(optarg);
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (count < 1 || count + workers + 2 > STRESS_MAX_JOBS || workers < 1) {
+		_usage();
+		return 2;
+	}
+
+	live = memtrack_live_bytes();
+	if (!jobs_init(workers)) {
+		fprintf(stderr, "jobstress: cannot start %d workers\n", workers);
+		return 1;
+	}
+
+	for (int i = 0; i < count; i++)
+		_submit(2 + i % 7);
+	_cancel(5, 4, count);
+	_sleep_ns(3 * STRESS_TICK_NS);
+	_cancel(7, 3, count);
+
+	while (s_info.pending) {
+		jobs_dispatch();
+		_sleep_ns(STRESS_TICK_NS);
+	}
+
+	/*a job per worker running and two queued when the pool stops*/
+	for (int i = 0; i < workers + 2; i++) {
+		s_info.jobs[s_info.count].cancel = true;
+		_submit(STRESS_SHUTDOWN_TICKS);
+	}
+	_sleep_ns(2 * STRESS_TICK_NS);
+	jobs_shutdown();
+
+	_check_callbacks();
+	_check_stats();
+	_check("memory", memtrack_live_bytes() == live, "%lld B left allocated",
+			(long long) (memtrack_live_bytes() - live));
+
+	return s_info.ok ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+/*
+ * livemetrics - prints the live session metrics the app publishes in shared memory.
+ *
+ * Usage: livemetrics [-f interval_ms]
+ *
+ * Without -f prints one snapshot. With -f prints a line per interval until
+ * interrupted, and counts reads that had to be retried around the writer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "live_metrics.h"
+
+static void _print(const live_metrics_values_s *values)
+{
+	printf("%s distance %.1f m, steps %u, fare %u Tk, calories %.2f, gps %s, updated %lld\n",
+			values->tracking ? "tracking" : "idle", values->distance, values->steps, values->fare,
+			values->calories, values->gps_fix ? "fix" : "none", (long long) values->updated);
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: livemetrics [-f interval_ms]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const live_metrics_region_s *region;
+	live_metrics_values_s values;
+	int interval_ms = 0;
+	long failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			interval_ms = atoi(optarg);
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	region = live_metrics_attach();
+	if (!region) {
+		fprintf(stderr, "livemetrics: the app is not publishing metrics\n");
+		return 1;
+	}
+
+	do {
+		if (live_metrics_read(region, &values))
+			_print(&values);
+		else if (++failed % 100 == 1)
+			fprintf(stderr, "livemetrics: %ld reads gave up on a busy writer\n", failed);
+
+		if (interval_ms > 0) {
+			struct timespec delay = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+
+			fflush(stdout);
+			nanosleep(&delay, NULL);
+		}
+	} while (interval_ms > 0);
+
+	live_metrics_detach(region);
+	return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * loadgen - simulates many watches syncing to an ingestion server at once.
+ *
+ * Usage: loadgen [-n devices] [-c connections] [-d days] [-b batch_rows] [-p prefix] -s socket
+ *
+ * Each simulated device owns a synthetic history of one row per day and
+ * pushes it with the same protocol the app uses: HELLO, then batches sent
+ * one at a time, each waiting for its ACK. It starts from the watermark the
+ * server reports, so running loadgen again against the same server only
+ * sends what the server has not stored. Up to -c devices are connected at
+ * the same time.
+ *
+ * Reports rows per second and the latency from sending a batch to
+ * receiving its ACK.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sync_proto.h"
+
+#define MAX_CONNECTIONS 1024
+
+typedef struct {
+	pthread_t thread;
+	double *latencies;          /*seconds per acknowledged batch*/
+	long latency_count;
+	long latency_capacity;
+	long rows;
+	int failed;
+} client_s;
+
+static struct loadgen_info {
+	const char *socket_path;
+	const char *prefix;
+	int device_count;
+	int connection_count;
+	int days;
+	int batch_rows;
+	client_s clients[MAX_CONNECTIONS];
+	pthread_mutex_t lock;
+	int next_device;
+} s_info = {
+	.prefix = "sim",
+	.device_count = 100,
+	.connection_count = 32,
+	.days = 365,
+	.batch_rows = 64,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int _take_device(void)
+{
+	int device = -1;
+
+	pthread_mutex_lock(&s_info.lock);
+	if (s_info.next_device < s_info.device_count)
+		device = s_info.next_device++;
+	pthread_mutex_unlock(&s_info.lock);
+
+	return device;
+}
+
+/* Day d of the device's history; the same device always gets the same values */
+static void _synth_record(int device, int day, sync_record_s *record)
+{
+	unsigned seed = device * 7919u + day;
+	struct tm tm = { .tm_year = 2020 - 1900, .tm_mday = 1 + day, .tm_hour = 12 };
+
+	mktime(&tm);
+
+	record->id = day + 1;
+	record->revision = day + 1;
+	record->date = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+	record->distance = 500.0f + rand_r(&seed) % 8000;
+	record->steps = record->distance / 0.6f;
+	record->calories = record->distance * 0.05f;
+	record->fare = 15 + (int) (record->distance / 1000.0f * 15.0f);
+}
+
+static void _record_latency(client_s *client, double seconds)
+{
+	if (client->latency_count == client->latency_capacity) {
+		long capacity = client->latency_capacity ? client->latency_capacity * 2 : 1024;
+		double *latencies = realloc(client->latencies, capacity * sizeof(double));
+
+		if (!latencies)
+			return;
+		client->latencies = latencies;
+		client->latency_capacity = capacity;
+	}
+
+	client->latencies[client->latency_count++] = seconds;
+}
+
+static bool _wait_ack(sync_transport_s *transport, uint32_t *watermark)
+{
+	uint8_t frame[SYNC_ACK_SIZE];
+	size_t len;
+
+	return sync_frame_recv(transport, frame, sizeof(frame), &len) && sync_decode_ack(frame, len, watermark);
+}
+
+/* Pushes one device's history, resuming from the server's watermark */
+static bool _run_device(client_s *client, int device, uint8_t *frame, sync_record_s *records)
+{
+	sync_transport_s transport;
+	char device_id[SYNC_DEVICE_ID_MAX + 1];
+	uint32_t watermark, acked, sequence = 0;
+	bool ok = false;
+
+	snprintf(device_id, sizeof(device_id), "%s%05d", s_info.prefix, device);
+
+	if (!sync_transport_unix_connect(&transport, s_info.socket_path))
+		return false;
+
+	if (!sync_frame_send(&transport, frame, sync_encode_hello(frame, device_id)) || !_wait_ack(&transport, &watermark))
+		goto out;
+
+	for (int day = watermark; day < s_info.days; ) {
+		int count = s_info.days - day;
+
+		if (count > s_info.batch_rows)
+			count = s_info.batch_rows;
+		for (int i = 0; i < count; i++)
+			_synth_record(device, day + i, &records[i]);
+
+		double start = _now();
+
+		if (!sync_frame_send(&transport, frame, sync_encode_batch(frame, sequence++, records, count)) ||
+				!_wait_ack(&transport, &acked) || acked != records[count - 1].revision)
+			goto out;
+
+		_record_latency(client, _now() - start);
+		client->rows += count;
+		day += count;
+	}
+
+	ok = true;
+
+out:
+	transport.close(transport.ctx);
+	return ok;
+}
+
+static void *_client_cb(void *data)
+{
+	client_s *client = data;
+	uint8_t *frame = malloc(SYNC_FRAME_MAX);
+	sync_record_s *records = malloc(s_info.batch_rows * sizeof(sync_record_s));
+	int device;
+
+	while ((device = _take_device()) >= 0)
+		if (!_run_device(client, device, frame, records))
+			client->failed++;
+
+	free(frame);
+	free(records);
+	return NULL;
+}
+
+static int _compare_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static double _percentile(const double *sorted, long count, double p)
+{
+	long index = (long) ceil(p / 100.0 * count) - 1;
+
+	if (count == 0)
+		return 0.0;
+	if (index < 0)
+		index = 0;
+
+	return sorted[index];
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: loadgen [-n devices] [-c connections] [-d days] [-b batch_rows] [-p prefix] -s socket\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:c:d:b:p:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			s_info.device_count = atoi(optarg);
+			break;
+		case 'c':
+			s_info.connection_count = atoi(optarg);
+			break;
+		case 'd':
+			s_info.days = atoi(optarg);
+			break;
+		case 'b':
+			s_info.batch_rows = atoi(optarg);
+			break;
+		case 'p':
+			s_info.prefix = optarg;
+			break;
+		case 's':
+			s_info.socket_path = optarg;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (!s_info.socket_path || optind != argc || s_info.device_count < 1 || s_info.days < 1) {
+		_usage();
+		return 2;
+	}
+
+	if (s_info.connection_count < 1)
+		s_info.connection_count = 1;
+	if (s_info.connection_count > MAX_CONNECTIONS)
+		s_info.connection_count = MAX_CONNECTIONS;
+	if (s_info.connection_count > s_info.device_count)
+		s_info.connection_count = s_info.device_count;
+	if (s_info.batch_rows < 1 || s_info.batch_rows > SYNC_BATCH_MAX_RECORDS)
+		s_info.batch_rows = 64;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	double start = _now();
+
+	for (int c = 0; c < s_info.connection_count; c++)
+		pthread_create(&s_info.clients[c].thread, NULL, _client_cb, &s_info.clients[c]);
+	for (int c = 0; c < s_info.connection_count; c++)
+		pthread_join(s_info.clients[c].thread, NULL);
+
+	double elapsed = _now() - start;
+
+	/* Merge the per-client latencies */
+	long rows = 0, batches = 0;
+	int failed = 0;
+
+	for (int c = 0; c < s_info.connection_count; c++) {
+		rows += s_info.clients[c].rows;
+		batches += s_info.clients[c].latency_count;
+		failed += s_info.clients[c].failed;
+	}
+
+	double *latencies = malloc((batches ? batches : 1) * sizeof(double));
+	long n = 0;
+
+	for (int c = 0; c < s_info.connection_count; c++) {
+		memcpy(&latencies[n], s_info.clients[c].latencies, s_info.clients[c].latency_count * sizeof(double));
+		n += s_info.clients[c].latency_count;
+		free(s_info.clients[c].latencies);
+	}
+	qsort(latencies, n, sizeof(double), _compare_double);
+
+	printf("devices %d (%d failed), connections %d, %ld rows in %ld batches, %.2f s\n",
+			s_info.device_count, failed, s_info.connection_count, rows, batches, elapsed);
+	printf("throughput %.0f rows/s, %.0f batches/s\n",
+			elapsed > 0 ? rows / elapsed : 0.0, elapsed > 0 ? batches / elapsed : 0.0);
+	printf("ack latency ms: p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+			_percentile(latencies, n, 50) * 1e3, _percentile(latencies, n, 90) * 1e3,
+			_percentile(latencies, n, 99) * 1e3, _percentile(latencies, n, 99.9) * 1e3,
+			n ? latencies[n - 1] * 1e3 : 0.0);
+
+	free(latencies);
+	return failed ? 1 : 0;
+}
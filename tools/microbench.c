@@ -0,0 +1,491 @@
+/*
+ * microbench - times the numeric core of the app: calories, fares, dates,
+ * distances and step detection, plus every step detector and distance
+ * estimator of estimator.h, so candidates added there are timed too.
+ *
+ * Usage: microbench [-l] [-f filter] [-w warmup_ms] [-t rep_ms] [-r reps] [-j] [-L label]
+ *
+ * Each benchmark loops over a fixed set of 1024 generated inputs. It is
+ * first run for warmup_ms, then its iteration count is doubled until one
+ * repetition takes at least rep_ms, and that many iterations are timed reps
+ * times. Reported per benchmark: nanoseconds per call as median, mean,
+ * standard deviation, minimum and maximum over the repetitions, and heap
+ * allocations and bytes per call, counted by wrapping malloc and friends.
+ *
+ * -f runs only the benchmarks whose name contains filter. -j prints one
+ * JSON object per benchmark per line instead of the table, tagged with the
+ * -L label (e.g. the commit), so runs of two commits can be diffed.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "avoidrickshaw.h"
+#include "tracker_core.h"
+#include "tariff.h"
+#include "Sqlitedbhelper.h"
+#include "estimator.h"
+
+#define BENCH_INPUTS 1024           /*power of two, inputs are indexed with a mask*/
+#define BENCH_MAX_CASES 64
+#define BENCH_MAX_REPS 1000
+#define BENCH_STATE_MAX 256         /*bytes of estimator state*/
+#define DEFAULT_WARMUP_MS 100.0
+#define DEFAULT_REP_MS 20.0
+#define DEFAULT_REPS 10
+#define SAMPLE_RATE 50.0            /*Hz of the generated accelerometer walk*/
+#define WALK_CADENCE 1.8            /*steps per second*/
+
+typedef struct {
+	const char *name;
+	const char *description;
+	/*calls the function under test iterations times, returns something depending on every result*/
+	double (*run)(const void *arg, long iterations);
+	const void *arg;
+} bench_case_s;
+
+typedef struct {
+	double median;
+	double mean;
+	double stddev;
+	double min;
+	double max;
+	double allocs;
+	double bytes;
+} bench_result_s;
+
+static struct microbench_info {
+	bench_case_s cases[BENCH_MAX_CASES];
+	int case_count;
+	double distances[BENCH_INPUTS];     /*meters*/
+	double hours[BENCH_INPUTS];
+	double weights[BENCH_INPUTS];
+	char dates[BENCH_INPUTS][11];
+	track_fix_s fixes[BENCH_INPUTS];
+	track_accel_s samples[BENCH_INPUTS];
+	unsigned long allocs;
+	unsigned long alloc_bytes;
+	volatile double sink;
+} s_info = {
+	.case_count = 0,
+	.allocs = 0,
+	.alloc_bytes = 0,
+};
+
+/*
+ * Allocation counting: the tool's own definitions take precedence over the
+ * C library's, which is still reached through its internal names (glibc).
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+	s_info.allocs++;
+	s_info.alloc_bytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	s_info.allocs++;
+	s_info.alloc_bytes += count * size;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	s_info.allocs++;
+	s_info.alloc_bytes += size;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Benchmarks of the functions the app calls.
+ */
+
+static double _bench_calories(const void *arg, long iterations)
+{
+	double sum = 0.0;
+
+	for (long i = 0; i < iterations; i++) {
+		int k = i & (BENCH_INPUTS - 1);
+
+		sum += tracker_core_calories(s_info.distances[k], s_info.hours[k], s_info.weights[k]);
+	}
+
+	return sum;
+}
+
+static double _bench_calorie_distance_term(const void *arg, long iterations)
+{
+	double sum = 0.0;
+
+	for (long i = 0; i < iterations; i++)
+		sum += tracker_core_calorie_distance_term(s_info.distances[i & (BENCH_INPUTS - 1)] / 1000.0);
+
+	return sum;
+}
+
+static double _bench_fare(const void *arg, long iterations)
+{
+	const tariff_s *tariff = arg;
+	double sum = 0.0;
+
+	for (long i = 0; i < iterations; i++)
+		sum += tariff_price(tariff, s_info.distances[i & (BENCH_INPUTS - 1)]);
+
+	return sum;
+}
+
+static double _bench_numeric_date(const void *arg, long iterations)
+{
+	double sum = 0.0;
+	int d, m, y;
+
+	for (long i = 0; i < iterations; i++) {
+		getNumericDate(&d, &m, &y, s_info.dates[i & (BENCH_INPUTS - 1)]);
+		sum += d + m + y;
+	}
+
+	return sum;
+}
+
+static double _bench_days(const void *arg, long iterations)
+{
+	double sum = 0.0;
+
+	for (long i = 0; i < iterations; i++) {
+		int k = i & (BENCH_INPUTS - 1);
+
+		sum += getDays(s_info.dates[k], s_info.dates[(k + 1) & (BENCH_INPUTS - 1)]);
+	}
+
+	return sum;
+}
+
+static double _bench_distance(const void *arg, long iterations)
+{
+	double sum = 0.0;
+
+	for (long i = 0; i < iterations; i++) {
+		const track_fix_s *a = &s_info.fixes[i & (BENCH_INPUTS - 1)];
+		const track_fix_s *b = &s_info.fixes[(i + 1) & (BENCH_INPUTS - 1)];
+
+		sum += tracker_core_distance(a->latitude, a->longitude, b->latitude, b->longitude);
+	}
+
+	return sum;
+}
+
+static double _bench_step_detector(const void *arg, long iterations)
+{
+	step_detector_s detector = STEP_DETECTOR_INIT;
+	double steps = 0.0;
+
+	for (long i = 0; i < iterations; i++) {
+		const track_accel_s *sample = &s_info.samples[i & (BENCH_INPUTS - 1)];
+
+		steps += step_detector_feed(&detector, sample->x, sample->y, sample->z);
+	}
+
+	return steps;
+}
+
+/*
+ * Benchmarks of the estimator tables, one per entry.
+ */
+
+static double _bench_step_estimator(const void *arg, long iterations)
+{
+	const step_estimator_s *estimator = arg;
+	double state[BENCH_STATE_MAX / sizeof(double)];
+	double steps = 0.0;
+
+	estimator->reset(state);
+	for (long i = 0; i < iterations; i++)
+		steps += estimator->feed(state, &s_info.samples[i & (BENCH_INPUTS - 1)]);
+
+	return steps;
+}
+
+static double _bench_distance_estimator(const void *arg, long iterations)
+{
+	const distance_estimator_s *estimator = arg;
+	double state[BENCH_STATE_MAX / sizeof(double)];
+	double sum = 0.0;
+
+	/* Every fix's distance is consumed, or link time optimization folds the loop away */
+	estimator->reset(state);
+	for (long i = 0; i < iterations; i++) {
+		estimator->feed(state, &s_info.fixes[i & (BENCH_INPUTS - 1)], (int) i);
+		sum += estimator->distance(state);
+	}
+
+	return sum;
+}
+
+static void _add_case(const char *name, const char *description, double (*run)(const void *, long), const void *arg)
+{
+	if (s_info.case_count == BENCH_MAX_CASES) {
+		fprintf(stderr, "microbench: more than %d benchmarks, %s left out\n", BENCH_MAX_CASES, name);
+		return;
+	}
+
+	s_info.cases[s_info.case_count++] = (bench_case_s) { name, description, run, arg };
+}
+
+static void _register_cases(void)
+{
+	/* A rate card with a base fare takes the other branch of tariff_price() */
+	static const tariff_s based = { 20.0, 1000.0, 12.0 };
+	static char names[BENCH_MAX_CASES][64];
+	int n = 0;
+
+	_add_case("calories", "tracker_core_calories(), as on every fix", _bench_calories, NULL);
+	_add_case("calories/distance_term", "the inlined polynomial splitting calories of older day rows", _bench_calorie_distance_term, NULL);
+	_add_case("fare/default", "tariff_price() at the default tariff, count_fare()", _bench_fare, &tariff_default);
+	_add_case("fare/base", "tariff_price() with a base fare and distance", _bench_fare, &based);
+	_add_case("date/getNumericDate", "YYYY-MM-DD to numbers", _bench_numeric_date, NULL);
+	_add_case("date/getDays", "days between two YYYY-MM-DD dates", _bench_days, NULL);
+	_add_case("distance", "tracker_core_distance() between consecutive fixes", _bench_distance, NULL);
+	_add_case("steps", "step_detector_feed() per accelerometer sample", _bench_step_detector, NULL);
+
+	for (int i = 0; step_estimators[i] && n < BENCH_MAX_CASES; i++, n++) {
+		if (step_estimators[i]->state_size > BENCH_STATE_MAX)
+			continue;
+		snprintf(names[n], sizeof(names[n]), "estimator/steps/%s", step_estimators[i]->name);
+		_add_case(names[n], step_estimators[i]->description, _bench_step_estimator, step_estimators[i]);
+	}
+
+	for (int i = 0; distance_estimators[i] && n < BENCH_MAX_CASES; i++, n++) {
+		if (distance_estimators[i]->state_size > BENCH_STATE_MAX)
+			continue;
+		snprintf(names[n], sizeof(names[n]), "estimator/distance/%s", distance_estimators[i]->name);
+		_add_case(names[n], distance_estimators[i]->description, _bench_distance_estimator, distance_estimators[i]);
+	}
+}
+
+/*
+ * Inputs: the same pseudo random values on every run and machine.
+ */
+
+static double _random(unsigned int *seed)
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return (*seed >> 8) / (double) (1u << 24);
+}
+
+static void _generate_inputs(void)
+{
+	unsigned int seed = 1;
+	double latitude = 23.7808;
+	double longitude = 90.4176;
+
+	for (int i = 0; i < BENCH_INPUTS; i++) {
+		double t = i / SAMPLE_RATE;
+		double swing = 3.0 * sin(2.0 * M_PI * WALK_CADENCE * t);
+		int day = (int) (_random(&seed) * 3650);
+		struct tm tm = { .tm_year = 116, .tm_mon = 0, .tm_mday = 1 + day, .tm_hour = 12 };
+
+		s_info.distances[i] = _random(&seed) * 20000.0;
+		s_info.hours[i] = 0.05 + _random(&seed) * 3.0;
+		s_info.weights[i] = 45.0 + _random(&seed) * 60.0;
+
+		mktime(&tm);
+		strftime(s_info.dates[i], sizeof(s_info.dates[i]), "%Y-%m-%d", &tm);
+
+		/* A walk north-east, a few meters between fixes */
+		latitude += (2.0 + _random(&seed) * 4.0) * 9e-6;
+		longitude += (_random(&seed) - 0.3) * 4.0 * 9e-6;
+		s_info.fixes[i] = (track_fix_s) { .timestamp = i, .latitude = latitude, .longitude = longitude,
+				.accuracy = 3.0 + _random(&seed) * 10.0 };
+
+		s_info.samples[i] = (track_accel_s) { .timestamp = t,
+				.x = 0.5 * swing + _random(&seed) - 0.5,
+				.y = 0.3 * swing + _random(&seed) - 0.5,
+				.z = 9.81 + swing + _random(&seed) - 0.5 };
+	}
+}
+
+/*
+ * Measurement.
+ */
+
+static int _compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void _measure(const bench_case_s *bench, double warmup, double rep_time, int reps, bench_result_s *result)
+{
+	double times[BENCH_MAX_REPS];
+	unsigned long allocs = 0, bytes = 0;
+	long iterations = 1;
+	double start, elapsed;
+
+	start = _now();
+	while (_now() - start < warmup)
+		s_info.sink += bench->run(bench->arg, BENCH_INPUTS);
+
+	for (;;) {
+		start = _now();
+		s_info.sink += bench->run(bench->arg, iterations);
+		elapsed = _now() - start;
+		if (elapsed >= rep_time || iterations > (1L << 40))
+			break;
+		iterations *= 2;
+	}
+
+	memset(result, 0, sizeof(*result));
+	for (int r = 0; r < reps; r++) {
+		unsigned long allocs_before = s_info.allocs, bytes_before = s_info.alloc_bytes;
+
+		start = _now();
+		s_info.sink += bench->run(bench->arg, iterations);
+		times[r] = (_now() - start) * 1e9 / iterations;
+
+		allocs += s_info.allocs - allocs_before;
+		bytes += s_info.alloc_bytes - bytes_before;
+		result->mean += times[r];
+	}
+
+	result->mean /= reps;
+	for (int r = 0; r < reps; r++)
+		result->stddev += (times[r] - result->mean) * (times[r] - result->mean);
+	result->stddev = reps > 1 ? sqrt(result->stddev / (reps - 1)) : 0.0;
+
+	qsort(times, reps, sizeof(double), _compare_doubles);
+	result->min = times[0];
+	result->max = times[reps - 1];
+	result->median = reps % 2 ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2.0;
+	result->allocs = (double) allocs / ((double) iterations * reps);
+	result->bytes = (double) bytes / ((double) iterations * reps);
+}
+
+static void _print_json_string(const char *str)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			putchar('\\');
+		putchar(*str);
+	}
+	putchar('"');
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: microbench [-l] [-f filter] [-w warmup_ms] [-t rep_ms] [-r reps] [-j] [-L label]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filter = NULL;
+	const char *label = "";
+	double warmup = DEFAULT_WARMUP_MS;
+	double rep_time = DEFAULT_REP_MS;
+	int reps = DEFAULT_REPS;
+	bool list = false;
+	bool json = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "lf:w:t:r:jL:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			list = true;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'w':
+			warmup = atof(optarg);
+			break;
+		case 't':
+			rep_time = atof(optarg);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 'j':
+			json = true;
+			break;
+		case 'L':
+			label = optarg;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind != argc || reps < 1 || reps > BENCH_MAX_REPS || warmup < 0.0 || rep_time <= 0.0) {
+		_usage();
+		return 2;
+	}
+
+	_register_cases();
+
+	if (list) {
+		for (int i = 0; i < s_info.case_count; i++)
+			printf("%-28s %s\n", s_info.cases[i].name, s_info.cases[i].description);
+		return 0;
+	}
+
+	_generate_inputs();
+
+	if (!json)
+		printf("%-28s %9s %9s %8s %9s %9s %8s %8s\n", "benchmark", "median ns", "mean ns", "rel.sd",
+				"min ns", "max ns", "allocs", "bytes");
+
+	for (int i = 0; i < s_info.case_count; i++) {
+		const bench_case_s *bench = &s_info.cases[i];
+		bench_result_s result;
+
+		if (filter && !strstr(bench->name, filter))
+			continue;
+
+		_measure(bench, warmup / 1000.0, rep_time / 1000.0, reps, &result);
+
+		if (json) {
+			printf("{\"label\":");
+			_print_json_string(label);
+			printf(",\"name\":");
+			_print_json_string(bench->name);
+			printf(",\"reps\":%d,\"median_ns\":%.3f,\"mean_ns\":%.3f,\"stddev_ns\":%.3f,"
+					"\"min_ns\":%.3f,\"max_ns\":%.3f,\"allocs_per_call\":%.4f,\"bytes_per_call\":%.2f}\n",
+					reps, result.median, result.mean, result.stddev, result.min, result.max,
+					result.allocs, result.bytes);
+		}
+		else {
+			printf("%-28s %9.2f %9.2f %7.1f%% %9.2f %9.2f %8.3f %8.1f\n", bench->name, result.median,
+					result.mean, result.mean > 0.0 ? 100.0 * result.stddev / result.mean : 0.0,
+					result.min, result.max, result.allocs, result.bytes);
+		}
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+# pgo.sh - builds the session tools with profile guided optimization and
+# reports the speedup over the plain release build. Run through
+# "make -C tools pgo [TRACES='a.artrk b.txt ...']".
+#
+# 1. release build (RELEASE_CFLAGS), kept aside for the comparison
+# 2. instrumented build, run on the training workloads:
+#    - trackrun over every trace, recorded sessions (.artrk) or text and
+#      GPX tracks; a synthetic walk is recorded when none is given
+#    - soak over two simulated days, saving and querying the day history
+#    - microbench, the numeric core
+# 3. build using the collected profile, left in tools/ as the result
+# 4. both builds are run on the same workloads and compared
+#
+# Environment: MAKE, RELEASE_CFLAGS (from the Makefile), PGO_DIR for the
+# work files (a new directory under /tmp by default).
+
+set -e
+
+cd "$(dirname "$0")"
+
+MAKE=${MAKE:-make}
+RELEASE_CFLAGS=${RELEASE_CFLAGS:-"-O2 -g -flto=auto -DNDEBUG -Wall"}
+PGO_TOOLS="trackrun soak microbench"
+PGO_DIR=${PGO_DIR:-$(mktemp -d /tmp/pgo-XXXXXX)}
+PROFILE="$PGO_DIR/profile"
+
+mkdir -p "$PGO_DIR/release" "$PGO_DIR/data"
+rm -rf "$PROFILE"
+
+build() {
+	# -B: the three builds share the output names, which the profile is keyed on
+	$MAKE -s -B CFLAGS="$RELEASE_CFLAGS $1" $PGO_TOOLS
+}
+
+# Prints "<benchmark> <value>" lines, higher is better for events/s,
+# lower for seconds and ns
+workload() {
+	bin=$1
+	for trace in $TRACES; do
+		rate=$("$bin/trackrun" -n 16 -D "$PGO_DIR/data/" "$trace" 2>&1 >/dev/null |
+				sed -n 's/.* \([0-9]*\) events\/s$/\1/p')
+		echo "trackrun:$(basename "$trace") $rate events/s"
+	done
+
+	rm -rf "$PGO_DIR/data/soak"
+	mkdir -p "$PGO_DIR/data/soak"
+	seconds=$("$bin/soak" -H 48 -D "$PGO_DIR/data/soak/" 2>/dev/null |
+			sed -n 's/^simulated .* in \([0-9.]*\) s .*/\1/p')
+	echo "soak:48h $seconds s"
+
+	"$bin/microbench" -j -w 20 -t 10 -r 5 |
+			sed -n 's/.*"name":"\([^"]*\)".*"median_ns":\([0-9.]*\).*/microbench:\1 \2 ns/p'
+}
+
+if [ -z "$TRACES" ]; then
+	"$MAKE" -s trackrun
+	./trackrun -S -t 1800 -D "$PGO_DIR/data/" -R "$PGO_DIR/walk.artrk" >/dev/null 2>&1
+	TRACES="$PGO_DIR/walk.artrk"
+fi
+
+echo "pgo: release build"
+build ""
+cp $PGO_TOOLS "$PGO_DIR/release/"
+
+echo "pgo: instrumented build, training"
+build "-fprofile-generate=$PROFILE -fprofile-update=single"
+workload . >/dev/null
+
+echo "pgo: optimized build"
+build "-fprofile-use=$PROFILE -fprofile-correction -Wno-missing-profile"
+
+echo "pgo: comparing, work files in $PGO_DIR"
+workload "$PGO_DIR/release" >"$PGO_DIR/release.txt"
+workload . >"$PGO_DIR/pgo.txt"
+
+paste -d ' ' "$PGO_DIR/release.txt" "$PGO_DIR/pgo.txt" | awk '
+	BEGIN { printf "%-36s %12s %-8s %12s %-8s %8s\n", "benchmark", "release", "", "pgo", "", "speedup" }
+	{
+		speedup = $3 == "events/s" ? ($2 > 0 ? $5 / $2 : 0) : ($5 > 0 ? $2 / $5 : 0)
+		printf "%-36s %12s %-8s %12s %-8s %7.2fx\n", $1, $2, $3, $5, $6, speedup
+	}'
@@ -0,0 +1,618 @@
+/*
+ * soak - runs the tracking pipeline through a simulated day or more of
+ * sessions in accelerated time and checks that it holds up.
+ *
+ * Usage: soak [-H hours] [-s "YYYY-MM-DD HH:MM"] [-u unit_s] [-w walk_units] [-g gap_units]
+ *             [-x pace] [-n gps_noise_m] [-L max_event_us] [-D data_dir] [-M]
+ *
+ * Time advances in units of synthetic walk (900 s by default): a session
+ * is walk_units long, followed by gap_units of walking with the tracker
+ * stopped, and so on for the given hours from the start time (local). The
+ * database runs on the simulated clock, so saves and the 28 day retention
+ * see every midnight crossed. Events are fed as fast as possible unless -x
+ * paces them, e.g. -x 100 for 100 times real time. With -M the watch goes
+ * on the charger after every session and the maintenance window runs to
+ * its end before the gap is walked.
+ *
+ * Checks, each reported as ok or FAILED:
+ *   memory   heap of the app modules and of SQLite after every session stays
+ *            at what it was after the first one
+ *   latency  no accelerometer or fix callback took longer than max_event_us,
+ *            and the 99th percentile of the last hour is within one
+ *            histogram bucket of the first hour
+ *   days     every day has one row holding the distance of the sessions
+ *            stopped that day, every session has its row, and no row
+ *            older than the retention window is left
+ *   drift    every session counts the steps walked; without GPS noise its
+ *            distance is the walked distance, late sessions like early ones
+ *   stats    every session row has a split per kilometre; without GPS noise
+ *            its mean speed, cadence and splits are those of the walk
+ *   sketch   the sketches over the whole run count every session; without
+ *            GPS noise their median pace is that of the walk
+ *   alloc    nothing was allocated on the tracking and save paths once the
+ *            sessions started, and SQLite stayed within its reserved heap
+ *   maint    with -M, maintenance windows ran, every task completed and a
+ *            backup of the database exists
+ *
+ * The data directory defaults to a new one under /tmp.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include "avoidrickshaw.h"
+#include "tracker.h"
+#include "tracker_core.h"
+#include "sensor_backend.h"
+#include "Sqlitedbhelper.h"
+#include "memtrack.h"
+#include "db_heap.h"
+#include "diag.h"
+#include "jobs.h"
+#include "maintenance.h"
+
+#define SOAK_MAX_DAYS 400
+#define SOAK_DISTANCE_TOLERANCE 0.001   /*of the walked distance without GPS noise, besides the first fix interval*/
+#define SOAK_FLOAT_TOLERANCE 1e-5       /*day totals are stored as float*/
+#define RETENTION_DAYS 28
+#define SOAK_STATS_TOLERANCE 0.02       /*of the walked speed and cadence, per fix interval rounding*/
+
+typedef struct {
+	char date[sizeof("YYYY-MM-DD")];
+	double distance;        /*of the sessions stopped that day*/
+	int sessions;
+	double session_distance;/*of the sessions started that day*/
+	int started;
+} soak_day_s;
+
+static struct soak_info {
+	sensor_backend_s *backend;
+	sensor_synth_params_s synth;
+	time_t start;
+	double origin;          /*backend clock at start*/
+	soak_day_s days[SOAK_MAX_DAYS];
+	int day_count;
+	int sessions;
+	int failed_saves;
+	bool maintenance;
+	int64_t memory_baseline;
+	int64_t memory_max;
+	int64_t sqlite_baseline;
+	int64_t sqlite_max;
+	uint64_t first_hour_p99;
+	uint64_t last_hour_p99;
+	uint64_t event_max_us;
+	int hours_measured;
+	int step_errors;
+	double distance_error_max;
+	double first_distance;
+	double last_distance;
+	bool ok;
+} s_info = {
+	.synth = SENSOR_SYNTH_PARAMS_WALK,
+	.day_count = 0,
+	.ok = true,
+};
+
+/*the database clock: the start time plus what the backend has played*/
+static time_t _sim_clock(time_t *t)
+{
+	time_t now = s_info.start + (time_t) (s_info.backend->now(s_info.backend) - s_info.origin);
+
+	if (t)
+		*t = now;
+	return now;
+}
+
+static double _wall_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static soak_day_s *_day(time_t time)
+{
+	char date[sizeof("YYYY-MM-DD")];
+	struct tm tm;
+
+	localtime_r(&time, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+
+	for (int i = 0; i < s_info.day_count; i++)
+		if (!strcmp(s_info.days[i].date, date))
+			return &s_info.days[i];
+
+	if (s_info.day_count == SOAK_MAX_DAYS)
+		return NULL;
+
+	soak_day_s *day = &s_info.days[s_info.day_count++];
+	memset(day, 0, sizeof(*day));
+	strcpy(day->date, date);
+	return day;
+}
+
+static void _saved_cb(int status)
+{
+	if (status != SQLITE_OK)
+		s_info.failed_saves++;
+}
+
+static void _check(const char *name, bool passed, const char *format, ...)
+{
+	va_list args;
+
+	printf("%-8s %-7s ", name, passed ? "ok" : "FAILED");
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+
+	if (!passed)
+		s_info.ok = false;
+}
+
+/*closes the latency histograms of a simulated hour*/
+static void _hour_done(void)
+{
+	const diag_histogram_s *accel = diag_histogram(DIAG_PROBE_ACCEL);
+	const diag_histogram_s *position = diag_histogram(DIAG_PROBE_POSITION);
+	uint64_t p99 = diag_histogram_percentile(accel, 99.0);
+
+	if (diag_histogram_percentile(position, 99.0) > p99)
+		p99 = diag_histogram_percentile(position, 99.0);
+
+	if (accel->max_us > s_info.event_max_us)
+		s_info.event_max_us = accel->max_us;
+	if (position->max_us > s_info.event_max_us)
+		s_info.event_max_us = position->max_us;
+
+	if (accel->count + position->count > 0) {
+		if (!s_info.hours_measured)
+			s_info.first_hour_p99 = p99;
+		s_info.last_hour_p99 = p99;
+		s_info.hours_measured++;
+	}
+
+	diag_reset();
+}
+
+static void _sample_memory(void)
+{
+	int64_t live = memtrack_live_bytes();
+	int64_t sqlite = sqlite3_memory_used();
+
+	if (s_info.sessions == 1) {
+		s_info.memory_baseline = s_info.memory_max = live;
+		s_info.sqlite_baseline = s_info.sqlite_max = sqlite;
+		return;
+	}
+
+	if (live > s_info.memory_max)
+		s_info.memory_max = live;
+	if (sqlite > s_info.sqlite_max)
+		s_info.sqlite_max = sqlite;
+}
+
+/*one session: start, walk_units of events, stop and save*/
+static void _session(int units, double unit)
+{
+	tracker_totals_s totals;
+	soak_day_s *day;
+	time_t start = _sim_clock(NULL);
+
+	tracker_start();
+	for (int i = 0; i < units; i++)
+		sensor_backend_run(s_info.backend);
+	tracker_get_totals(&totals);
+	tracker_stop();
+
+	s_info.sessions++;
+
+	/* Day totals are saved under the day of the stop, the session row under its start */
+	day = _day(_sim_clock(NULL));
+	if (day) {
+		day->distance += totals.distance;
+		day->sessions++;
+	}
+	day = _day(start);
+	if (day) {
+		day->session_distance += totals.distance;
+		day->started++;
+	}
+
+	/* The first sample after a start is the resting level, so one step may be missed */
+	double walked = units * unit;
+	int steps = (int) (s_info.synth.cadence * walked);
+	if (totals.steps > steps || totals.steps < steps - 1)
+		s_info.step_errors++;
+
+	if (s_info.synth.gps_noise <= 0.0 && s_info.synth.speed > 0.0) {
+		/* The walk before the first fix of the session is not counted */
+		double truth = s_info.synth.speed * walked;
+		double error = fabs(totals.distance - truth);
+
+		error = fmax(0.0, error - s_info.synth.speed * s_info.synth.fix_interval) / truth;
+		if (error > s_info.distance_error_max)
+			s_info.distance_error_max = error;
+	}
+
+	if (s_info.sessions == 1)
+		s_info.first_distance = totals.distance;
+	s_info.last_distance = totals.distance;
+
+	_sample_memory();
+}
+
+/*on the charger between sessions: the maintenance window runs to its end*/
+static void _maintenance_window(void)
+{
+	maintenance_set_charging(true);
+	while (maintenance_running()) {
+		jobs_dispatch();
+		usleep(1000);
+	}
+	maintenance_set_charging(false);
+}
+
+static void _check_maintenance(void)
+{
+	maintenance_stats_s stats;
+	char path[PATH_MAX];
+	bool backup;
+
+	maintenance_stats(&stats);
+	snprintf(path, sizeof(path), "%ssample.db.bak", getenv("AR_DATA_PATH"));
+	backup = access(path, F_OK) == 0;
+
+	_check("maint", stats.windows > 0 && !stats.task_failures && !stats.over_budget && backup,
+			"%u windows (%u over budget), %u task runs, %u failed, %.1f ms CPU, %s",
+			stats.windows, stats.over_budget, stats.task_runs, stats.task_failures, stats.cpu_us / 1000.0,
+			backup ? "backup written" : "no backup");
+}
+
+/*compares the rows of a table grouped by day with the expected totals*/
+static bool _check_rows(sqlite3 *db, const char *sql, bool by_stop, int *rows, int *mismatches, int *stale)
+{
+	char oldest[sizeof("YYYY-MM-DD")];
+	time_t now = _sim_clock(NULL) - (RETENTION_DAYS - 1) * 24 * 3600;
+	sqlite3_stmt *stmt;
+	struct tm tm;
+
+	localtime_r(&now, &tm);
+	strftime(oldest, sizeof(oldest), "%Y-%m-%d", &tm);
+
+	*rows = *mismatches = *stale = 0;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		const char *date = (const char *) sqlite3_column_text(stmt, 0);
+		double distance = sqlite3_column_double(stmt, 1);
+		int count = sqlite3_column_int(stmt, 2);
+		soak_day_s *day = NULL;
+
+		(*rows)++;
+		if (strcmp(date, oldest) < 0)
+			(*stale)++;
+
+		for (int i = 0; i < s_info.day_count; i++)
+			if (!strcmp(s_info.days[i].date, date))
+				day = &s_info.days[i];
+
+		double expected = !day ? 0.0 : by_stop ? day->distance : day->session_distance;
+		int expected_count = !day ? 0 : by_stop ? (day->sessions ? 1 : 0) : day->started;
+
+		if (count != expected_count || fabs(distance - expected) > SOAK_FLOAT_TOLERANCE * fmax(expected, 1.0)) {
+			fprintf(stderr, "soak: %s on %s: %d rows, %.1f m, expected %d rows, %.1f m\n",
+					by_stop ? "infoTable" : "sessionTable", date, count, distance, expected_count, expected);
+			(*mismatches)++;
+		}
+	}
+
+	sqlite3_finalize(stmt);
+	return true;
+}
+
+static void _check_days(void)
+{
+	int rows, mismatches, stale;
+	int session_rows, session_mismatches, session_stale;
+	int expected_days = 0;
+	sqlite3 *db;
+
+	/* What the history screen does when opened on the last day */
+	delAllExceptLast28Days();
+
+	if (openWorkerDb(&db) != SQLITE_OK) {
+		_check("days", false, "cannot open the database");
+		return;
+	}
+
+	_check_rows(db, "SELECT Info_DATE, SUM(Distance), COUNT(*) FROM infoTable GROUP BY Info_DATE;",
+			true, &rows, &mismatches, &stale);
+	_check_rows(db, "SELECT Info_DATE, SUM(Distance), COUNT(*) FROM sessionTable GROUP BY Info_DATE;",
+			false, &session_rows, &session_mismatches, &session_stale);
+	sqlite3_close(db);
+
+	for (int i = 0; i < s_info.day_count; i++)
+		if (s_info.days[i].sessions)
+			expected_days++;
+	if (expected_days > RETENTION_DAYS)
+		expected_days = RETENTION_DAYS;
+
+	_check("days", !mismatches && !stale && !session_mismatches && rows == expected_days && !s_info.failed_saves,
+			"%d days with sessions, %d day rows (%d expected, %d wrong, %d past retention), "
+			"%d session days (%d wrong), %d failed saves",
+			s_info.day_count, rows, expected_days, mismatches, stale, session_rows, session_mismatches,
+			s_info.failed_saves);
+}
+
+static void _check_stats(void)
+{
+	sqlite3_stmt *stmt;
+	sqlite3 *db;
+	int rows = 0, wrong = 0, splits = 0;
+	double speed_error = 0.0, cadence_error = 0.0, split_error = 0.0;
+	bool exact = s_info.synth.gps_noise <= 0.0 && s_info.synth.speed > 0.0;
+
+	if (openWorkerDb(&db) != SQLITE_OK
+			|| sqlite3_prepare_v2(db, "SELECT Distance, SpeedMean, CadenceMean, SplitCount, Splits FROM sessionTable;",
+					-1, &stmt, NULL) != SQLITE_OK) {
+		_check("stats", false, "cannot read the sessions");
+		sqlite3_close(db);
+		return;
+	}
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		int split_count = sqlite3_column_int(stmt, 3);
+		const unsigned char *blob = sqlite3_column_blob(stmt, 4);
+		int stored = sqlite3_column_bytes(stmt, 4) / 4;
+
+		rows++;
+		if (split_count != (int) (sqlite3_column_double(stmt, 0) / SESSION_SPLIT_METERS)
+				|| stored != (split_count < SESSION_SPLITS_MAX ? split_count : SESSION_SPLITS_MAX))
+			wrong++;
+
+		if (!exact)
+			continue;
+
+		speed_error = fmax(speed_error, fabs(sqlite3_column_double(stmt, 1) / s_info.synth.speed - 1.0));
+		cadence_error = fmax(cadence_error, fabs(sqlite3_column_double(stmt, 2) / (s_info.synth.cadence * 60.0) - 1.0));
+
+		/* The first kilometre includes the walk before the first fix */
+		for (int i = 1; i < stored; i++) {
+			uint32_t ms = blob[4 * i] | blob[4 * i + 1] << 8 | blob[4 * i + 2] << 16 | (uint32_t) blob[4 * i + 3] << 24;
+
+			split_error = fmax(split_error, fabs(ms / 1000.0 * s_info.synth.speed / SESSION_SPLIT_METERS - 1.0));
+			splits++;
+		}
+	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+
+	_check("stats", rows == s_info.sessions && !wrong && speed_error <= SOAK_DISTANCE_TOLERANCE
+			&& cadence_error <= SOAK_STATS_TOLERANCE && split_error <= SOAK_DISTANCE_TOLERANCE,
+			"%d session rows, %d with wrong splits; speed off by at most %.2f%%, cadence %.2f%%, "
+			"%d later splits %.2f%%%s",
+			rows, wrong, 100.0 * speed_error, 100.0 * cadence_error, splits, 100.0 * split_error,
+			exact ? "" : " (not checked with GPS noise)");
+}
+
+static void _check_sketches(void)
+{
+	char from[sizeof("YYYY-MM-DD")], to[sizeof("YYYY-MM-DD")];
+	time_t end = _sim_clock(NULL);
+	struct tm tm;
+	tdigest_s distance, pace;
+	double start, query_us;
+	double pace_error = 0.0;
+	bool exact = s_info.synth.gps_noise <= 0.0 && s_info.synth.speed > 0.0;
+	int ret;
+
+	localtime_r(&s_info.start, &tm);
+	strftime(from, sizeof(from), "%Y-%m-%d", &tm);
+	localtime_r(&end, &tm);
+	strftime(to, sizeof(to), "%Y-%m-%d", &tm);
+
+	start = _wall_now();
+	ret = getSketchRange(SKETCH_DISTANCE, from, to, &distance);
+	query_us = (_wall_now() - start) * 1e6;
+	if (ret == SQLITE_OK)
+		ret = getSketchRange(SKETCH_PACE, from, to, &pace);
+
+	if (exact && pace.count > 0)
+		pace_error = fabs(tdigest_quantile(&pace, 0.5) * s_info.synth.speed / 1000.0 - 1.0);
+
+	_check("sketch", ret == SQLITE_OK && distance.count == s_info.sessions && pace_error <= SOAK_DISTANCE_TOLERANCE,
+			"%.0f sessions in the distance sketch, median %.1f m; median pace %.1f s/km, off by %.2f%%%s; "
+			"%s to %s merged in %.0f us",
+			distance.count, tdigest_quantile(&distance, 0.5), tdigest_quantile(&pace, 0.5), 100.0 * pace_error,
+			exact ? "" : " (not checked with GPS noise)", from, to, query_us);
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: soak [-H hours] [-s \"YYYY-MM-DD HH:MM\"] [-u unit_s] [-w walk_units] [-g gap_units]\n"
+			"            [-x pace] [-n gps_noise_m] [-L max_event_us] [-D data_dir] [-M]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const tracker_callbacks_s callbacks = {
+		.saved = _saved_cb,
+	};
+	const char *start = "2026-03-14 21:30";
+	char data_dir[] = "/tmp/soak-XXXXXX";
+	double hours = 24.0;
+	double pace = 0.0;
+	int walk_units = 3;
+	int gap_units = 1;
+	uint64_t max_event_us = 5000;
+	struct tm tm = {0, };
+	int opt;
+
+	s_info.synth.duration = 900.0;
+	s_info.synth.gps_noise = 0.0;
+
+	while ((opt = getopt(argc, argv, "H:s:u:w:g:x:n:L:D:Mh")) != -1) {
+		switch (opt) {
+		case 'H':
+			hours = atof(optarg);
+			break;
+		case 's':
+			start = optarg;
+			break;
+		case 'u':
+			s_info.synth.duration = atof(optarg);
+			break;
+		case 'w':
+			walk_units = atoi(optarg);
+			break;
+		case 'g':
+			gap_units = atoi(optarg);
+			break;
+		case 'x':
+			pace = atof(optarg);
+			break;
+		case 'n':
+			s_info.synth.gps_noise = atof(optarg);
+			break;
+		case 'L':
+			max_event_us = strtoull(optarg, NULL, 10);
+			break;
+		case 'D':
+			setenv("AR_DATA_PATH", optarg, 1);
+			break;
+		case 'M':
+			s_info.maintenance = true;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind != argc || hours <= 0.0 || s_info.synth.duration <= 0.0 || walk_units < 1 || gap_units < 0) {
+		_usage();
+		return 2;
+	}
+
+	if (!strptime(start, "%Y-%m-%d %H:%M", &tm)) {
+		fprintf(stderr, "soak: bad start time %s\n", start);
+		return 2;
+	}
+	tm.tm_isdst = -1;
+	s_info.start = mktime(&tm);
+
+	if (!getenv("AR_DATA_PATH")) {
+		char path[sizeof(data_dir) + 1];
+
+		if (!mkdtemp(data_dir)) {
+			perror("soak: mkdtemp");
+			return 1;
+		}
+		snprintf(path, sizeof(path), "%s/", data_dir);
+		setenv("AR_DATA_PATH", path, 1);
+	}
+
+	/* Like data_initialize(), before SQLite is used */
+	prepareDbStorage();
+
+	s_info.backend = sensor_backend_synth_create(&s_info.synth);
+	if (!s_info.backend)
+		return 1;
+	s_info.origin = s_info.backend->now(s_info.backend);
+	sensor_backend_set_speed(s_info.backend, pace);
+
+	setDbClock(_sim_clock);
+	tracker_init(s_info.backend, &callbacks);
+
+	if (s_info.maintenance && (!jobs_init(JOBS_DEFAULT_WORKERS) || !maintenance_init())) {
+		fprintf(stderr, "soak: no maintenance workers\n");
+		return 1;
+	}
+
+	long units = (long) ceil(hours * 3600.0 / s_info.synth.duration);
+	long unit = 0;
+	int hour = 0;
+	double wall_start = _wall_now();
+
+	diag_reset();
+	while (unit < units) {
+		int walk = units - unit < walk_units ? (int) (units - unit) : walk_units;
+
+		_session(walk, s_info.synth.duration);
+		unit += walk;
+
+		if (s_info.maintenance)
+			_maintenance_window();
+
+		/* Walking on with the tracker stopped, its events are dropped */
+		for (int i = 0; i < gap_units && unit < units; i++, unit++)
+			sensor_backend_run(s_info.backend);
+
+		int now_hour = (int) (unit * s_info.synth.duration / 3600.0);
+		if (now_hour != hour) {
+			_hour_done();
+			hour = now_hour;
+		}
+	}
+
+	double wall = _wall_now() - wall_start;
+	double simulated = units * s_info.synth.duration;
+
+	printf("simulated %.1f h from %s in %.2f s (%.0fx real time), %d sessions over %d days, data in %s\n",
+			simulated / 3600.0, start, wall, wall > 0 ? simulated / wall : 0.0, s_info.sessions,
+			s_info.day_count, getenv("AR_DATA_PATH"));
+
+	_check("memory", s_info.memory_max <= s_info.memory_baseline && s_info.sqlite_max <= s_info.sqlite_baseline,
+			"app heap %lld B after the first session, at most %lld B later; SQLite %lld B, at most %lld B",
+			(long long) s_info.memory_baseline, (long long) s_info.memory_max,
+			(long long) s_info.sqlite_baseline, (long long) s_info.sqlite_max);
+
+	_check("latency", s_info.event_max_us <= max_event_us && s_info.last_hour_p99 <= 2 * s_info.first_hour_p99 + 1,
+			"slowest event %llu us (limit %llu), p99 %llu us in the first hour, %llu us in the last",
+			(unsigned long long) s_info.event_max_us, (unsigned long long) max_event_us,
+			(unsigned long long) s_info.first_hour_p99, (unsigned long long) s_info.last_hour_p99);
+
+	_check_days();
+
+	_check("drift", !s_info.step_errors && s_info.distance_error_max <= SOAK_DISTANCE_TOLERANCE,
+			"%d sessions with wrong steps, distance off by at most %.2f%%%s, first session %.1f m, last %.1f m",
+			s_info.step_errors, 100.0 * s_info.distance_error_max,
+			s_info.synth.gps_noise > 0.0 ? " (not checked with GPS noise)" : "",
+			s_info.first_distance, s_info.last_distance);
+
+	_check_stats();
+	_check_sketches();
+
+	db_heap_stats_s heap;
+
+	db_heap_stats(&heap);
+	_check("alloc", !memtrack_steady_violations() && heap.arena_size && !heap.overflow_allocs,
+			"%llu allocations in steady state; SQLite heap peak %lld B, %zu of %zu B carved, %llu overflows",
+			(unsigned long long) memtrack_steady_violations(), (long long) heap.peak_bytes,
+			heap.arena_used, heap.arena_size, (unsigned long long) heap.overflow_allocs);
+
+	if (s_info.maintenance) {
+		_check_maintenance();
+		maintenance_finalize();
+		jobs_shutdown();
+	}
+
+	tracker_finalize();
+	sensor_backend_destroy(s_info.backend);
+	setDbClock(NULL);
+
+	return s_info.ok ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+/*
+ * syncpush - pushes the app's database to a sync receiver from the host.
+ *
+ * Usage: AR_DATA_PATH=dir/ syncpush [-p peer] [-d device_id] -s socket
+ *
+ * Runs the same sync_push() the app runs after each session, against the
+ * sample.db in AR_DATA_PATH. The watermark is stored in that database, so
+ * running it again sends only rows added or changed since the last ack.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "avoidrickshaw.h"
+#include "Sqlitedbhelper.h"
+#include "sync.h"
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: syncpush [-p peer] [-d device_id] -s socket\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *peer = SYNC_PEER_COMPANION;
+	const char *device_id = "host";
+	const char *socket_path = NULL;
+	sync_transport_s transport;
+	sqlite3 *db;
+	int opt, sent;
+
+	while ((opt = getopt(argc, argv, "p:d:s:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			peer = optarg;
+			break;
+		case 'd':
+			device_id = optarg;
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (!socket_path || optind != argc) {
+		_usage();
+		return 2;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Brings older databases up to the schema with revisions */
+	if (initdb() != SQLITE_OK || openWorkerDb(&db) != SQLITE_OK) {
+		fprintf(stderr, "syncpush: cannot open the database\n");
+		return 1;
+	}
+
+	if (!sync_transport_unix_connect(&transport, socket_path)) {
+		fprintf(stderr, "syncpush: nothing listening on %s\n", socket_path);
+		sqlite3_close(db);
+		return 1;
+	}
+
+	sent = sync_push(db, peer, device_id, &transport, NULL, NULL);
+	transport.close(transport.ctx);
+	sqlite3_close(db);
+
+	if (sent < 0) {
+		fprintf(stderr, "syncpush: interrupted, the next run resumes from the last ack\n");
+		return 1;
+	}
+
+	printf("sent %d rows\n", sent);
+	return 0;
+}
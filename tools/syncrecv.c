@@ -0,0 +1,254 @@
+/*
+ * syncrecv - reference receiver for delta sync, standing in for the companion.
+ *
+ * Usage: syncrecv [-n connections] [-x batches] -s socket -o received.db
+ *
+ * Listens on a local socket and serves one sender at a time. Each batch is
+ * validated, stored per device in a single transaction together with the
+ * device's new watermark, and only then acknowledged, so a sender that is
+ * cut off mid-batch resends exactly the rows that were not stored.
+ *
+ * -n exits after serving that many connections. -x drops every connection
+ * after that many batches, to exercise resuming.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "sync_proto.h"
+
+static struct {
+	sqlite3 *db;
+	sqlite3_stmt *get_watermark;
+	sqlite3_stmt *put_watermark;
+	sqlite3_stmt *put_record;
+	int drop_after;
+} s_info = {
+	.drop_after = 0,
+};
+
+static bool _exec(const char *sql)
+{
+	char *err = NULL;
+
+	if (sqlite3_exec(s_info.db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		fprintf(stderr, "syncrecv: %s\n", err);
+		sqlite3_free(err);
+		return false;
+	}
+
+	return true;
+}
+
+static bool _open_db(const char *path)
+{
+	if (sqlite3_open(path, &s_info.db) != SQLITE_OK) {
+		fprintf(stderr, "syncrecv: cannot open %s: %s\n", path, sqlite3_errmsg(s_info.db));
+		return false;
+	}
+
+	if (!_exec("PRAGMA journal_mode=WAL;"
+			"CREATE TABLE IF NOT EXISTS records (Device_ID TEXT NOT NULL, ID INTEGER NOT NULL, "
+				"Revision INTEGER NOT NULL, Info_DATE TEXT NOT NULL, Distance REAL NOT NULL, "
+				"Steps INTEGER NOT NULL, Calories REAL NOT NULL, Fare INTEGER NOT NULL, "
+				"PRIMARY KEY (Device_ID, ID));"
+			"CREATE TABLE IF NOT EXISTS peers (Device_ID TEXT PRIMARY KEY, Watermark INTEGER NOT NULL);"))
+		return false;
+
+	return sqlite3_prepare_v2(s_info.db, "SELECT Watermark FROM peers WHERE Device_ID=?;",
+				-1, &s_info.get_watermark, NULL) == SQLITE_OK &&
+			sqlite3_prepare_v2(s_info.db, "INSERT OR REPLACE INTO peers VALUES (?, ?);",
+				-1, &s_info.put_watermark, NULL) == SQLITE_OK &&
+			sqlite3_prepare_v2(s_info.db, "INSERT OR REPLACE INTO records VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+				-1, &s_info.put_record, NULL) == SQLITE_OK;
+}
+
+static uint32_t _watermark(const char *device_id)
+{
+	uint32_t watermark = 0;
+
+	sqlite3_bind_text(s_info.get_watermark, 1, device_id, -1, SQLITE_STATIC);
+	if (sqlite3_step(s_info.get_watermark) == SQLITE_ROW)
+		watermark = sqlite3_column_int64(s_info.get_watermark, 0);
+	sqlite3_reset(s_info.get_watermark);
+
+	return watermark;
+}
+
+/* Stores a batch and advances the watermark in one transaction */
+static bool _store(const char *device_id, const sync_record_s *records, int count, uint32_t *watermark)
+{
+	uint32_t next = *watermark;
+	char date[16];
+	bool ok = true;
+
+	/* Revisions arrive in order; anything else means a confused sender */
+	for (int i = 0; i < count; i++) {
+		if (!sync_record_valid(&records[i]) || records[i].revision <= next) {
+			fprintf(stderr, "syncrecv: %s: rejecting record %u rev %u\n", device_id, records[i].id, records[i].revision);
+			return false;
+		}
+		next = records[i].revision;
+	}
+
+	if (!_exec("BEGIN;"))
+		return false;
+
+	for (int i = 0; ok && i < count; i++) {
+		sqlite3_stmt *stmt = s_info.put_record;
+
+		sync_date_unpack(records[i].date, date, sizeof(date));
+		sqlite3_bind_text(stmt, 1, device_id, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, records[i].id);
+		sqlite3_bind_int64(stmt, 3, records[i].revision);
+		sqlite3_bind_text(stmt, 4, date, -1, SQLITE_TRANSIENT);
+		sqlite3_bind_double(stmt, 5, records[i].distance);
+		sqlite3_bind_int64(stmt, 6, records[i].steps);
+		sqlite3_bind_double(stmt, 7, records[i].calories);
+		sqlite3_bind_int64(stmt, 8, records[i].fare);
+		ok = sqlite3_step(stmt) == SQLITE_DONE;
+		sqlite3_reset(stmt);
+	}
+
+	if (ok) {
+		sqlite3_bind_text(s_info.put_watermark, 1, device_id, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(s_info.put_watermark, 2, next);
+		ok = sqlite3_step(s_info.put_watermark) == SQLITE_DONE;
+		sqlite3_reset(s_info.put_watermark);
+	}
+
+	if (!ok || !_exec("COMMIT;")) {
+		fprintf(stderr, "syncrecv: store failed: %s\n", sqlite3_errmsg(s_info.db));
+		_exec("ROLLBACK;");
+		return false;
+	}
+
+	*watermark = next;
+	return true;
+}
+
+/* Serves one sender until it disconnects */
+static void _serve(sync_transport_s *transport)
+{
+	static uint8_t frame[SYNC_FRAME_MAX];
+	static sync_record_s records[SYNC_BATCH_MAX_RECORDS];
+	char device_id[SYNC_DEVICE_ID_MAX + 1];
+	uint8_t ack[SYNC_ACK_SIZE];
+	uint32_t watermark, sequence;
+	size_t len;
+	int count, batches = 0, rows = 0;
+
+	if (!sync_frame_recv(transport, frame, sizeof(frame), &len) || !sync_decode_hello(frame, len, device_id)) {
+		fprintf(stderr, "syncrecv: bad hello\n");
+		return;
+	}
+
+	watermark = _watermark(device_id);
+	if (!sync_frame_send(transport, ack, sync_encode_ack(ack, watermark)))
+		return;
+
+	while (sync_frame_recv(transport, frame, sizeof(frame), &len)) {
+		if (!sync_decode_batch(frame, len, &sequence, records, &count)) {
+			fprintf(stderr, "syncrecv: %s: malformed batch\n", device_id);
+			break;
+		}
+
+		if (s_info.drop_after > 0 && batches == s_info.drop_after) {
+			printf("%s: dropping connection before batch %u\n", device_id, sequence);
+			break;
+		}
+
+		if (!_store(device_id, records, count, &watermark))
+			break;
+
+		batches++;
+		rows += count;
+
+		if (!sync_frame_send(transport, ack, sync_encode_ack(ack, watermark)))
+			break;
+	}
+
+	printf("%s: %d batches, %d rows, watermark %u\n", device_id, batches, rows, watermark);
+	fflush(stdout);
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: syncrecv [-n connections] [-x batches] -s socket -o received.db\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const char *socket_path = NULL;
+	const char *db_path = NULL;
+	int connections = 0;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "n:x:s:o:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			connections = atoi(optarg);
+			break;
+		case 'x':
+			s_info.drop_after = atoi(optarg);
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'o':
+			db_path = optarg;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (!socket_path || !db_path || optind != argc || strlen(socket_path) >= sizeof(addr.sun_path)) {
+		_usage();
+		return 2;
+	}
+
+	if (!_open_db(db_path))
+		return 1;
+
+	signal(SIGPIPE, SIG_IGN);
+	strcpy(addr.sun_path, socket_path);
+	unlink(socket_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+		fprintf(stderr, "syncrecv: cannot listen on %s: %s\n", socket_path, strerror(errno));
+		return 1;
+	}
+
+	for (int served = 0; connections == 0 || served < connections; served++) {
+		sync_transport_s transport;
+		int client = accept(fd, NULL, NULL);
+
+		if (client < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "syncrecv: accept: %s\n", strerror(errno));
+			break;
+		}
+
+		sync_transport_fd(&transport, client);
+		_serve(&transport);
+		transport.close(transport.ctx);
+	}
+
+	close(fd);
+	unlink(socket_path);
+	sqlite3_close(s_info.db);
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * tariffsim - times the what-if tariff simulation over a stored history.
+ *
+ * Usage: tariffsim [-D data_dir | -y years] [-r runs]
+ *
+ * Prices the history under ten rate cards, tariff_default and nine others,
+ * with tariff_simulate_history(), and prints the total of each next to the
+ * fare stored at save time. With -D the database of that directory is used,
+ * e.g. the one a soak run leaves; otherwise a new database under /tmp gets a
+ * day row for every day of the given years (3 by default), priced at save
+ * time with tariff_default like the tracker does.
+ *
+ * Checks, each reported as ok or FAILED:
+ *   default  on a generated history, tariff_default reproduces the stored fare
+ *   time     the slowest of the runs (5 by default) stays within a second
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "tariff.h"
+#include "Sqlitedbhelper.h"
+#include "tracker_core.h"
+
+#define TARIFFSIM_COUNT 10
+#define TARIFFSIM_BUDGET_MS 1000.0
+#define TARIFFSIM_WEIGHT 70.0
+#define TARIFFSIM_EPOCH 1577880000 /*2020-01-01 12:00 UTC, noon of the first generated day*/
+
+static struct tariffsim_info {
+	time_t now;         /*database clock while generating*/
+	bool ok;
+} s_info = {
+	.now = 0,
+	.ok = true,
+};
+
+static void _check(const char *name, bool passed, const char *format, ...)
+{
+	va_list args;
+
+	printf("%-8s %-7s ", name, passed ? "ok" : "FAILED");
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+
+	if (!passed)
+		s_info.ok = false;
+}
+
+static time_t _sim_clock(time_t *t)
+{
+	if (t)
+		*t = s_info.now;
+	return s_info.now;
+}
+
+static double _now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/*one day row per day from TARIFFSIM_EPOCH on, walked as one trip of 0.5 to 8 km*/
+static bool _generate(int days)
+{
+	srand(1);
+	setDbClock(_sim_clock);
+
+	if (initdb() != SQLITE_OK)
+		return false;
+
+	for (int day = 0; day < days; day++) {
+		double distance = 500.0 + rand() % 7500;
+		double hours = distance / 1.4 / 3600.0;
+
+		s_info.now = TARIFFSIM_EPOCH + (time_t) day * 24 * 3600;
+		if (insertIntoDb((float) distance, (int) (distance / STEP_LENGTH),
+				(float) tracker_core_calories(distance, hours, TARIFFSIM_WEIGHT),
+				(float) tracker_core_calories_per_kg(hours), TARIFFSIM_WEIGHT,
+				tariff_price(&tariff_default, distance)) != SQLITE_OK)
+			return false;
+	}
+
+	return true;
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: tariffsim [-D data_dir | -y years] [-r runs]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	tariff_s tariffs[TARIFFSIM_COUNT];
+	tariff_result_s results[TARIFFSIM_COUNT];
+	char data_dir[] = "/tmp/tariffsim-XXXXXX";
+	bool generated = false;
+	double best = 0.0, slowest = 0.0;
+	int years = 3;
+	int runs = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "D:y:r:h")) != -1) {
+		switch (opt) {
+		case 'D':
+			setenv("AR_DATA_PATH", optarg, 1);
+			break;
+		case 'y':
+			years = atoi(optarg);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind != argc || years < 1 || runs < 1) {
+		_usage();
+		return 2;
+	}
+
+	if (!getenv("AR_DATA_PATH")) {
+		char path[sizeof(data_dir) + 1];
+		double start;
+
+		if (!mkdtemp(data_dir)) {
+			perror("tariffsim: mkdtemp");
+			return 1;
+		}
+		snprintf(path, sizeof(path), "%s/", data_dir);
+		setenv("AR_DATA_PATH", path, 1);
+
+		start = _now_ms();
+		if (!_generate(years * 365)) {
+			fprintf(stderr, "tariffsim: cannot write the history to %s\n", data_dir);
+			return 1;
+		}
+		generated = true;
+		printf("generated %d days in %.0f ms, data in %s/\n", years * 365, _now_ms() - start, data_dir);
+	}
+
+	/* The current rate card and nine alternatives: base fares over the first kilometres */
+	tariffs[0] = tariff_default;
+	for (int t = 1; t < TARIFFSIM_COUNT; t++) {
+		tariffs[t].base_fare = 5.0 * t;
+		tariffs[t].base_distance = 250.0 * t;
+		tariffs[t].per_km = 12.0 + t;
+	}
+
+	for (int run = 0; run < runs; run++) {
+		double start = _now_ms();
+		double elapsed;
+
+		if (!tariff_simulate_history(tariffs, TARIFFSIM_COUNT, results)) {
+			fprintf(stderr, "tariffsim: cannot read the history\n");
+			return 1;
+		}
+
+		elapsed = _now_ms() - start;
+		if (!run || elapsed < best)
+			best = elapsed;
+		if (elapsed > slowest)
+			slowest = elapsed;
+	}
+
+	for (int t = 0; t < TARIFFSIM_COUNT; t++)
+		printf("tariff %d: %5.1f Tk + %5.1f Tk/km after %4.0f m: %10.0f Tk over %d days, %10.0f Tk stored\n",
+				t, tariffs[t].base_fare, tariffs[t].per_km, tariffs[t].base_distance,
+				results[t].total_fare, results[t].days, results[t].stored_fare);
+
+	if (generated)
+		_check("default", results[0].total_fare == results[0].stored_fare,
+				"%.0f Tk simulated, %.0f Tk stored", results[0].total_fare, results[0].stored_fare);
+
+	_check("time", slowest <= TARIFFSIM_BUDGET_MS, "%d tariffs over %d days in %.2f ms at best, %.2f ms at worst of %d runs",
+			TARIFFSIM_COUNT, results[0].days, best, slowest, runs);
+
+	return s_info.ok ? 0 : 1;
+}
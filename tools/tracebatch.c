@@ -0,0 +1,382 @@
+/*
+ * tracebatch - runs the app's distance, step, fare and calorie pipeline over
+ * a directory of exported tracks on all cores.
+ *
+ * Usage: tracebatch [-j workers] [-w weight_kg] [-o results.csv] <directory>
+ *
+ * Files are dealt round-robin to per-worker queues; a worker whose queue runs
+ * dry steals from the front of another worker's queue, so a few very long
+ * tracks do not leave the other cores idle. Per-file results are written as
+ * CSV, aggregate totals and throughput go to stderr.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "tracker_core.h"
+#include "tariff.h"
+#include "track_file.h"
+
+#define MAX_WORKERS 256
+
+typedef struct {
+	char *path;
+	size_t bytes;
+	int samples;
+	int fixes;
+	int steps;
+	double distance;
+	double duration;
+	int fare;
+	double calories;
+	bool ok;
+} file_result_s;
+
+typedef struct {
+	pthread_mutex_t lock;
+	int *items;
+	int head;
+	int tail;
+} file_queue_s;
+
+typedef struct {
+	int id;
+	int processed;
+	int stolen;
+	pthread_t thread;
+} worker_s;
+
+/*pipeline state for one file, mirrors what data.c keeps in s_info*/
+typedef struct {
+	step_detector_s step_detector;
+	position_filter_s position;
+	int steps_count;
+	int fixes;
+	bool has_accel;
+	double first_time;
+	double last_time;
+} session_s;
+
+static struct tracebatch_info {
+	file_result_s *results;
+	int file_count;
+	file_queue_s queues[MAX_WORKERS];
+	worker_s workers[MAX_WORKERS];
+	int worker_count;
+	double weight;
+} s_info = {
+	.results = NULL,
+	.file_count = 0,
+	.worker_count = 0,
+	.weight = 70.0,
+};
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _session_time(session_s *session, double timestamp)
+{
+	if (timestamp <= 0.0)
+		return;
+
+	if (session->first_time == 0.0)
+		session->first_time = timestamp;
+	session->last_time = timestamp;
+}
+
+static void _accel_cb(const track_accel_s *sample, void *user_data)
+{
+	session_s *session = user_data;
+
+	session->has_accel = true;
+	_session_time(session, sample->timestamp);
+
+	if (step_detector_feed(&session->step_detector, sample->x, sample->y, sample->z))
+		session->steps_count++;
+}
+
+static void _fix_cb(const track_fix_s *fix, void *user_data)
+{
+	session_s *session = user_data;
+	double distance = 0.0;
+
+	_session_time(session, fix->timestamp);
+	session->fixes++;
+
+	if (position_filter_has_fix(&session->position))
+		distance = tracker_core_distance(session->position.prev_latitude, session->position.prev_longitude,
+				fix->latitude, fix->longitude);
+
+	/* Without accelerometer data every fix counts as walked, as for a plain GPX export */
+	position_filter_feed(&session->position, fix->latitude, fix->longitude, distance,
+			session->has_accel ? session->steps_count : session->fixes);
+}
+
+static void _process_file(file_result_s *result)
+{
+	static const track_file_handlers_s handlers = {
+		.accel_cb = _accel_cb,
+		.fix_cb = _fix_cb,
+	};
+	session_s session = {
+		.step_detector = STEP_DETECTOR_INIT,
+		.position = POSITION_FILTER_INIT,
+	};
+	track_file_stats_s stats;
+
+	result->ok = track_file_read(result->path, &handlers, &session, &stats);
+	result->bytes = stats.bytes;
+	result->samples = stats.samples;
+	result->fixes = stats.fixes;
+	result->distance = session.position.total_distance;
+	result->duration = session.last_time - session.first_time;
+	result->steps = session.has_accel ? session.steps_count : (int) (result->distance / STEP_LENGTH);
+	result->fare = tariff_price(&tariff_default, result->distance);
+	result->calories = tracker_core_calories(result->distance, result->duration / 3600, s_info.weight);
+}
+
+static bool _queue_pop(file_queue_s *queue, int *item)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->tail > queue->head) {
+		*item = queue->items[--queue->tail];
+		found = true;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return found;
+}
+
+static bool _queue_steal(file_queue_s *queue, int *item)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->tail > queue->head) {
+		*item = queue->items[queue->head++];
+		found = true;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return found;
+}
+
+static void *_worker_cb(void *data)
+{
+	worker_s *worker = data;
+	int item;
+
+	for (;;) {
+		if (_queue_pop(&s_info.queues[worker->id], &item)) {
+			_process_file(&s_info.results[item]);
+			worker->processed++;
+			continue;
+		}
+
+		/* Own queue is empty: steal from the others, nearest first */
+		bool stolen = false;
+		for (int i = 1; i < s_info.worker_count && !stolen; i++) {
+			int victim = (worker->id + i) % s_info.worker_count;
+
+			if (_queue_steal(&s_info.queues[victim], &item)) {
+				_process_file(&s_info.results[item]);
+				worker->processed++;
+				worker->stolen++;
+				stolen = true;
+			}
+		}
+
+		/* No work is added after start, so all queues empty means done */
+		if (!stolen)
+			break;
+	}
+
+	return NULL;
+}
+
+static bool _collect_files(const char *dir_path)
+{
+	int capacity = 0;
+	struct dirent *entry;
+	DIR *dir = opendir(dir_path);
+
+	if (!dir) {
+		fprintf(stderr, "tracebatch: cannot open %s: %s\n", dir_path, strerror(errno));
+		return false;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		struct stat st;
+		char *path;
+
+		if (track_file_format(entry->d_name) == TRACK_FORMAT_UNKNOWN)
+			continue;
+
+		if (asprintf(&path, "%s/%s", dir_path, entry->d_name) < 0)
+			break;
+
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+
+		if (s_info.file_count == capacity) {
+			int grown = capacity ? capacity * 2 : 256;
+			file_result_s *results = realloc(s_info.results, grown * sizeof(file_result_s));
+
+			if (!results) {
+				fprintf(stderr, "tracebatch: out of memory listing %s\n", dir_path);
+				free(path);
+				closedir(dir);
+				return false;
+			}
+			s_info.results = results;
+			capacity = grown;
+		}
+
+		memset(&s_info.results[s_info.file_count], 0, sizeof(file_result_s));
+		s_info.results[s_info.file_count].path = path;
+		s_info.file_count++;
+	}
+
+	closedir(dir);
+	return true;
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: tracebatch [-j workers] [-w weight_kg] [-o results.csv] <directory>\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output_path = NULL;
+	FILE *output = stdout;
+	int opt;
+
+	s_info.worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "j:w:o:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			s_info.worker_count = atoi(optarg);
+			break;
+		case 'w':
+			s_info.weight = atof(optarg);
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind != argc - 1) {
+		_usage();
+		return 2;
+	}
+
+	if (s_info.worker_count < 1)
+		s_info.worker_count = 1;
+	if (s_info.worker_count > MAX_WORKERS)
+		s_info.worker_count = MAX_WORKERS;
+
+	if (!_collect_files(argv[optind]))
+		return 1;
+
+	if (output_path) {
+		output = fopen(output_path, "w");
+		if (!output) {
+			fprintf(stderr, "tracebatch: cannot write %s: %s\n", output_path, strerror(errno));
+			return 1;
+		}
+	}
+
+	/* Deal files round-robin to the worker queues */
+	for (int w = 0; w < s_info.worker_count; w++) {
+		pthread_mutex_init(&s_info.queues[w].lock, NULL);
+		s_info.queues[w].items = malloc((s_info.file_count / s_info.worker_count + 1) * sizeof(int));
+		s_info.queues[w].head = s_info.queues[w].tail = 0;
+	}
+	for (int i = 0; i < s_info.file_count; i++) {
+		file_queue_s *queue = &s_info.queues[i % s_info.worker_count];
+
+		queue->items[queue->tail++] = i;
+	}
+
+	double start = _now();
+
+	for (int w = 0; w < s_info.worker_count; w++) {
+		s_info.workers[w].id = w;
+		pthread_create(&s_info.workers[w].thread, NULL, _worker_cb, &s_info.workers[w]);
+	}
+	for (int w = 0; w < s_info.worker_count; w++)
+		pthread_join(s_info.workers[w].thread, NULL);
+
+	double elapsed = _now() - start;
+
+	/* Per-file results */
+	size_t total_bytes = 0;
+	long total_samples = 0, total_fixes = 0, total_steps = 0, total_fare = 0;
+	double total_distance = 0.0, total_calories = 0.0;
+	int failed = 0, stolen = 0;
+
+	fprintf(output, "file,bytes,samples,fixes,steps,distance_m,duration_s,fare_tk,calories,status\n");
+	for (int i = 0; i < s_info.file_count; i++) {
+		file_result_s *r = &s_info.results[i];
+
+		fprintf(output, "%s,%zu,%d,%d,%d,%.1f,%.0f,%d,%.2f,%s\n", r->path, r->bytes, r->samples, r->fixes,
+				r->steps, r->distance, r->duration, r->fare, r->calories, r->ok ? "ok" : "error");
+
+		total_bytes += r->bytes;
+		total_samples += r->samples;
+		total_fixes += r->fixes;
+		if (!r->ok) {
+			failed++;
+			continue;
+		}
+		total_steps += r->steps;
+		total_distance += r->distance;
+		total_fare += r->fare;
+		total_calories += r->calories;
+	}
+
+	for (int w = 0; w < s_info.worker_count; w++)
+		stolen += s_info.workers[w].stolen;
+
+	/* Aggregate totals and throughput */
+	fprintf(stderr, "files: %d (%d failed), workers: %d, stolen: %d\n",
+			s_info.file_count, failed, s_info.worker_count, stolen);
+	fprintf(stderr, "totals: %ld steps, %.1f m, %ld Tk, %.2f Cal\n",
+			total_steps, total_distance, total_fare, total_calories);
+	fprintf(stderr, "elapsed: %.3f s, %.1f files/s, %.1f MB/s, %.0f events/s\n", elapsed,
+			elapsed > 0 ? s_info.file_count / elapsed : 0.0,
+			elapsed > 0 ? total_bytes / elapsed / 1e6 : 0.0,
+			elapsed > 0 ? (total_samples + total_fixes) / elapsed : 0.0);
+
+	if (output != stdout)
+		fclose(output);
+
+	for (int i = 0; i < s_info.file_count; i++)
+		free(s_info.results[i].path);
+	free(s_info.results);
+	for (int w = 0; w < s_info.worker_count; w++)
+		free(s_info.queues[w].items);
+
+	return failed ? 1 : 0;
+}
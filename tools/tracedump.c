@@ -0,0 +1,172 @@
+/*
+ * tracedump - decodes the binary trace the app writes on exit (trace.bin).
+ *
+ * Usage: tracedump [-e event] [-c] <trace.bin>
+ *
+ * Prints the records of all threads merged in time order, one per line:
+ * wall clock time, milliseconds since the first record, thread, level,
+ * event and named arguments. -e keeps one event, -c prints only counts
+ * per event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+typedef struct {
+	trace_record_s record;
+	uint32_t thread;
+} decoded_record_s;
+
+#define TRACE_EVENT_DESC(id, name, a0, a1, a2) { name, { a0, a1, a2 } },
+static const struct {
+	const char *name;
+	const char *args[3];
+} s_events[] = {
+	TRACE_EVENT_LIST(TRACE_EVENT_DESC)
+};
+#undef TRACE_EVENT_DESC
+
+static const char *s_levels[] = { "off", "E", "I", "D" };
+
+static int _compare_time(const void *a, const void *b)
+{
+	const decoded_record_s *x = a, *y = b;
+
+	if (x->record.timestamp != y->record.timestamp)
+		return x->record.timestamp < y->record.timestamp ? -1 : 1;
+
+	return (int) x->thread - (int) y->thread;
+}
+
+static int _event_id(const char *name)
+{
+	for (int i = 0; i < TRACE_EV_COUNT; i++)
+		if (!strcmp(s_events[i].name, name))
+			return i;
+
+	return -1;
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: tracedump [-e event] [-c] <trace.bin>\n");
+}
+
+int main(int argc, char *argv[])
+{
+	trace_file_header_s header;
+	decoded_record_s *records = NULL;
+	long count = 0, counts[TRACE_EV_COUNT + 1] = { 0, };
+	int filter = -1;
+	bool summary = false;
+	FILE *file;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:ch")) != -1) {
+		switch (opt) {
+		case 'e':
+			filter = _event_id(optarg);
+			if (filter < 0) {
+				fprintf(stderr, "tracedump: unknown event %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'c':
+			summary = true;
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind != argc - 1) {
+		_usage();
+		return 2;
+	}
+
+	file = fopen(argv[optind], "rb");
+	if (!file) {
+		fprintf(stderr, "tracedump: cannot open %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_FILE_MAGIC ||
+			header.version != TRACE_FILE_VERSION || header.record_size != sizeof(trace_record_s)) {
+		fprintf(stderr, "tracedump: %s is not a trace of this version\n", argv[optind]);
+		return 1;
+	}
+
+	for (uint32_t r = 0; r < header.ring_count; r++) {
+		trace_file_ring_s ring;
+
+		if (fread(&ring, sizeof(ring), 1, file) != 1 || ring.count > TRACE_RING_RECORDS) {
+			fprintf(stderr, "tracedump: truncated trace\n");
+			return 1;
+		}
+
+		records = realloc(records, (count + ring.count) * sizeof(decoded_record_s));
+		for (uint32_t i = 0; i < ring.count; i++) {
+			if (fread(&records[count].record, sizeof(trace_record_s), 1, file) != 1) {
+				fprintf(stderr, "tracedump: truncated trace\n");
+				return 1;
+			}
+			records[count++].thread = ring.thread;
+		}
+
+		if (ring.head > ring.count)
+			fprintf(stderr, "tracedump: thread %u: %llu older records were overwritten\n",
+					ring.thread, (unsigned long long) (ring.head - ring.count));
+	}
+	fclose(file);
+
+	qsort(records, count, sizeof(decoded_record_s), _compare_time);
+
+	for (long i = 0; i < count; i++) {
+		const trace_record_s *record = &records[i].record;
+		int event = record->event < TRACE_EV_COUNT ? record->event : TRACE_EV_COUNT;
+
+		if (filter >= 0 && event != filter)
+			continue;
+
+		counts[event]++;
+		if (summary)
+			continue;
+
+		int64_t wall_ns = (int64_t) record->timestamp + header.realtime_offset;
+		time_t wall = wall_ns / 1000000000;
+		struct tm tm;
+		char clock[16];
+
+		localtime_r(&wall, &tm);
+		strftime(clock, sizeof(clock), "%H:%M:%S", &tm);
+
+		printf("%s.%03d %+10.3f ms  t%-2u %s %-14s", clock, (int) (wall_ns / 1000000 % 1000),
+				(record->timestamp - records[0].record.timestamp) / 1e6, records[i].thread,
+				record->level < 4 ? s_levels[record->level] : "?",
+				event < TRACE_EV_COUNT ? s_events[event].name : "unknown");
+
+		for (int a = 0; a < 3; a++) {
+			const char *name = event < TRACE_EV_COUNT ? s_events[event].args[a] : "arg";
+
+			if (name)
+				printf(" %s=%.7g", name, record->args[a]);
+		}
+		putchar('\n');
+	}
+
+	if (summary) {
+		for (int e = 0; e < TRACE_EV_COUNT; e++)
+			if (counts[e])
+				printf("%-14s %ld\n", s_events[e].name, counts[e]);
+		if (counts[TRACE_EV_COUNT])
+			printf("%-14s %ld\n", "unknown", counts[TRACE_EV_COUNT]);
+	}
+
+	free(records);
+	return 0;
+}
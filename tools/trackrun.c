@@ -0,0 +1,226 @@
+/*
+ * trackrun - runs the app's tracking session (tracker.c) on Linux, fed by
+ * the replay or the synthetic sensor backend.
+ *
+ * Usage: trackrun [-w weight_kg] [-n sessions] [-D data_dir] [-x pace] [-R out.artrk] [-L] <track file>
+ *        trackrun [-w weight_kg] [-n sessions] [-D data_dir] [-x pace] [-R out.artrk] [-L] -S [-t seconds] [-c cadence] [-v speed] [-g noise_m] [-e seed]
+ *
+ * Each session is started, fed every event of the source and stopped, which
+ * saves it to sample.db in the data directory exactly as the app does.
+ * Prints the totals of each session and the event throughput.
+ *
+ * -x paces the events: 1 replays in real time, 10 ten times faster; by
+ * default they are fed as fast as possible. -R records the first session to
+ * a binary track, which also converts text traces, GPX and synthetic walks.
+ * A synthetic recording gets the walk's true steps and distance in
+ * <out.artrk>.truth, for tools/algoeval.
+ *
+ * -L checks for leaks: after each session the history is queried as the
+ * history screen does, and the heap tracked by memtrack must return to what
+ * it was after the first session. "trackrun -L -n 1000 -S -t 60" is the
+ * thousand session check; the exit status is 1 on any growth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "avoidrickshaw.h"
+#include "Sqlitedbhelper.h"
+#include "memtrack.h"
+#include "tracker.h"
+#include "sensor_backend.h"
+
+static struct trackrun_info {
+	long fixes;
+	long samples;
+	track_file_handlers_s tracker_handlers;
+} s_info;
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Counts events on their way to the tracker */
+static void _accel_cb(const track_accel_s *sample, void *user_data)
+{
+	s_info.samples++;
+	s_info.tracker_handlers.accel_cb(sample, user_data);
+}
+
+static void _fix_cb(const track_fix_s *fix, void *user_data)
+{
+	s_info.fixes++;
+	s_info.tracker_handlers.fix_cb(fix, user_data);
+}
+
+/*what the synthetic walk really was, in the format algoeval reads*/
+static bool _write_truth(const char *record, const sensor_synth_params_s *synth)
+{
+	char path[4096];
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s.truth", record);
+	file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "steps=%d distance=%.1f\n", (int) (synth->cadence * synth->duration),
+			synth->speed * synth->duration);
+
+	return fclose(file) == 0;
+}
+
+/*the history screen's query, with its rows released as the screen releases them*/
+static bool _query_history(void)
+{
+	arena_s arena = ARENA_INIT(MT_VIEW);
+	QueryData *rows = NULL;
+	int num_of_rows = 0;
+	int ret;
+
+	ret = getLast28DaysInfo(&arena, &rows, &num_of_rows);
+	arena_release(&arena);
+
+	return ret == SQLITE_OK;
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: trackrun [-w weight_kg] [-n sessions] [-D data_dir] [-x pace] [-R out.artrk] [-L] <track file>\n"
+			"       trackrun [-w weight_kg] [-n sessions] [-D data_dir] [-x pace] [-R out.artrk] [-L] -S [-t seconds] [-c cadence] [-v speed] [-g noise_m] [-e seed]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const tracker_callbacks_s callbacks = { 0, };
+	sensor_synth_params_s synth = SENSOR_SYNTH_PARAMS_WALK;
+	sensor_backend_s *backend;
+	bool synthetic = false;
+	bool leak_check = false;
+	int64_t baseline = 0;
+	int64_t growth_max = 0;
+	const char *record = NULL;
+	double pace = 0.0;
+	double weight = 70.0;
+	int sessions = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:n:D:x:R:LSt:c:v:g:e:h")) != -1) {
+		switch (opt) {
+		case 'w':
+			weight = atof(optarg);
+			break;
+		case 'n':
+			sessions = atoi(optarg);
+			break;
+		case 'D':
+			setenv("AR_DATA_PATH", optarg, 1);
+			break;
+		case 'x':
+			pace = atof(optarg);
+			break;
+		case 'R':
+			record = optarg;
+			break;
+		case 'L':
+			leak_check = true;
+			break;
+		case 'S':
+			synthetic = true;
+			break;
+		case 't':
+			synth.duration = atof(optarg);
+			break;
+		case 'c':
+			synth.cadence = atof(optarg);
+			break;
+		case 'v':
+			synth.speed = atof(optarg);
+			break;
+		case 'g':
+			synth.gps_noise = atof(optarg);
+			break;
+		case 'e':
+			synth.seed = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (synthetic == (optind < argc) || optind + (synthetic ? 0 : 1) != argc || sessions < 1) {
+		_usage();
+		return 2;
+	}
+
+	backend = synthetic ? sensor_backend_synth_create(&synth) : sensor_backend_replay_create(argv[optind]);
+	if (!backend) {
+		fprintf(stderr, "trackrun: cannot create the %s backend\n", synthetic ? "synthetic" : "replay");
+		return 1;
+	}
+
+	sensor_backend_set_speed(backend, pace);
+	tracker_init(backend, &callbacks);
+	tracker_set_weight(weight);
+	if (record) {
+		tracker_set_recording(record);
+		if (synthetic && !_write_truth(record, &synth))
+			fprintf(stderr, "trackrun: cannot write the truth of %s\n", record);
+	}
+
+	s_info.tracker_handlers = backend->handlers;
+	backend->handlers.accel_cb = _accel_cb;
+	backend->handlers.fix_cb = _fix_cb;
+
+	double start = _now();
+	bool ok = true;
+
+	for (int i = 0; i < sessions && ok; i++) {
+		tracker_totals_s totals;
+
+		tracker_start();
+		ok = sensor_backend_run(backend);
+		tracker_get_totals(&totals);
+		tracker_stop();
+
+		if (!leak_check) {
+			printf("session %d: distance %.1f m, steps %d, fare %d Tk, calories %.3f, %.0f s\n",
+					i + 1, totals.distance, totals.steps, totals.fare, totals.calories, totals.elapsed);
+			continue;
+		}
+
+		ok = ok && _query_history();
+
+		/* The first session sets up what lives as long as the process */
+		if (i == 0)
+			baseline = memtrack_live_bytes();
+		else if (memtrack_live_bytes() - baseline > growth_max)
+			growth_max = memtrack_live_bytes() - baseline;
+	}
+
+	if (leak_check) {
+		printf("leak check: %d sessions, %lld B live after the first, at most %lld B more later\n",
+				sessions, (long long) baseline, (long long) growth_max);
+		if (growth_max > 0) {
+			memtrack_log_report();
+			ok = false;
+		}
+	}
+
+	double elapsed = _now() - start;
+
+	fprintf(stderr, "%ld samples, %ld fixes in %.3f s, %.0f events/s\n", s_info.samples, s_info.fixes,
+			elapsed, elapsed > 0 ? (s_info.samples + s_info.fixes) / elapsed : 0.0);
+
+	tracker_finalize();
+	sensor_backend_destroy(backend);
+
+	return ok ? 0 : 1;
+}
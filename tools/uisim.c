@@ -0,0 +1,483 @@
+/*
+ * uisim - runs the app's views (view.c, graph.c) on Linux with the EFL
+ * buffer engine and drives them from a script, timing every frame.
+ *
+ * Usage: uisim [-s WxH] [-D data_dir] [-R res_dir] [-o steps.csv] <script>
+ *
+ * The session behind the views is the real tracker, fed by the inject
+ * backend, saving to sample.db in the data directory as the app does. The
+ * resource directory holds edje/main.edj (built by make uisim).
+ *
+ * Script, one command per line, '#' starts a comment:
+ *   press start|stop|history|save|gps    taps a button; gps taps the GPS status,
+ *                                        five times open the diagnostics screen
+ *   key back|more                        the hardware keys
+ *   weight <kg>                          types into the weight entry of the settings view
+ *   walk <steps> [meters_per_step]       a step on the accelerometer and a fix per step
+ *   fix <latitude> <longitude> [accuracy]
+ *   accel <x> <y> <z>
+ *   wait <seconds>                       runs the main loop: toasts, timers, recalculation
+ *   snapshot <file.ppm>
+ *   expect frame_ms|heap_kb <max>        fails the run if a later step goes above
+ *
+ * After each command the main loop runs until no more frames are drawn.
+ * Printed per step: the time of the command itself, the frames drawn after
+ * it and the slowest of them, and the heap in use, all of it and the part
+ * allocated by the app modules (memtrack.h). Then the frame time
+ * distribution over the whole run. The exit status is 1 if an expectation
+ * failed or a command could not run.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <Ecore_Evas.h>
+#include "avoidrickshaw.h"
+#include "view.h"
+#include "view_defines.h"
+#include "tracker.h"
+#include "sensor_backend.h"
+#include "diag.h"
+#include "jobs.h"
+#include "memtrack.h"
+
+#define DEFAULT_WIDTH 720
+#define DEFAULT_HEIGHT 1280
+#define SETTLE_MAX_ITERATIONS 200   /*main loop iterations waiting for the canvas to settle*/
+#define SETTLE_IDLE_ITERATIONS 3    /*iterations without a frame that count as settled*/
+#define WAIT_TICK_US 4000
+#define GPS_TAPS 5
+#define WALK_LATITUDE 23.7808
+#define WALK_LONGITUDE 90.4176
+#define WALK_STEP_METERS 0.75
+#define METERS_PER_DEGREE 111195.0
+#define ACCEL_GRAVITY 9.81
+#define ACCEL_SWING 2.5
+#define SCRIPT_LINE_MAX 512
+
+static struct uisim_info {
+	Ecore_Evas *ee;
+	Evas_Object *layout;
+	sensor_backend_s *backend;
+	/*frames of the current step*/
+	double frame_start;
+	int frames;
+	double frame_max;
+	double frame_total;
+	diag_histogram_s frame_histogram;
+	/*synthetic walk*/
+	double timestamp;
+	double latitude;
+	bool accel_started;
+	/*limits set with expect, 0 for none*/
+	double max_frame_ms;
+	double max_heap_kb;
+	int failures;
+	FILE *output;
+} s_info = {
+	.ee = NULL,
+	.layout = NULL,
+	.backend = NULL,
+	.latitude = WALK_LATITUDE,
+	.accel_started = false,
+	.max_frame_ms = 0.0,
+	.max_heap_kb = 0.0,
+	.failures = 0,
+	.output = NULL,
+};
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _render_pre_cb(void *data, Evas *e, void *event_info)
+{
+	s_info.frame_start = _now();
+}
+
+static void _render_post_cb(void *data, Evas *e, void *event_info)
+{
+	double elapsed = _now() - s_info.frame_start;
+
+	s_info.frames++;
+	s_info.frame_total += elapsed;
+	if (elapsed > s_info.frame_max)
+		s_info.frame_max = elapsed;
+	diag_histogram_add(&s_info.frame_histogram, (uint64_t) (elapsed * 1e6));
+}
+
+/*runs the main loop until a few iterations in a row drew nothing*/
+static void _settle(void)
+{
+	int idle = 0;
+
+	for (int i = 0; i < SETTLE_MAX_ITERATIONS && idle < SETTLE_IDLE_ITERATIONS; i++) {
+		int frames = s_info.frames;
+
+		ecore_main_loop_iterate();
+		idle = s_info.frames == frames ? idle + 1 : 0;
+	}
+}
+
+static void _wait(double seconds)
+{
+	double end = _now() + seconds;
+
+	while (_now() < end) {
+		ecore_main_loop_iterate();
+		usleep(WAIT_TICK_US);
+	}
+}
+
+/*
+ * The session, wired to the view as data.c does on the device.
+ */
+
+static bool _start_cb(void)
+{
+	bool existing = false;
+	double weight = 70.0;
+
+	preference_is_existing("weight", &existing);
+	if (existing)
+		preference_get_double("weight", &weight);
+	tracker_set_weight(weight);
+
+	return tracker_start();
+}
+
+static void _inject_accel(float level)
+{
+	track_accel_s sample = { 0, };
+
+	s_info.timestamp += 0.25;
+	sample.timestamp = s_info.timestamp;
+	sample.x = sample.y = sample.z = level;
+	sensor_backend_inject_accel(s_info.backend, &sample);
+}
+
+static void _inject_fix(double latitude, double longitude, double accuracy)
+{
+	track_fix_s fix = { 0, };
+
+	fix.timestamp = s_info.timestamp;
+	fix.latitude = latitude;
+	fix.longitude = longitude;
+	fix.accuracy = accuracy;
+	sensor_backend_inject_fix(s_info.backend, &fix);
+}
+
+static void _walk(int steps, double step_meters)
+{
+	/* The first sample of a session is the resting level of the step detector */
+	if (!s_info.accel_started) {
+		_inject_accel(ACCEL_GRAVITY);
+		s_info.accel_started = true;
+	}
+
+	for (int i = 0; i < steps; i++) {
+		_inject_accel(ACCEL_GRAVITY + ACCEL_SWING);
+		_inject_accel(ACCEL_GRAVITY - ACCEL_SWING);
+		s_info.latitude += step_meters / METERS_PER_DEGREE;
+		_inject_fix(s_info.latitude, WALK_LONGITUDE, 5.0);
+	}
+}
+
+/*
+ * Finding what to tap.
+ */
+
+static Evas_Object *_navi(void)
+{
+	return elm_object_parent_widget_get(s_info.layout);
+}
+
+static Evas_Object *_top_content(void)
+{
+	Elm_Object_Item *item = elm_naviframe_top_item_get(_navi());
+
+	return item ? elm_object_item_content_get(item) : NULL;
+}
+
+static bool _click(Evas_Object *button)
+{
+	if (!button)
+		return false;
+
+	evas_object_smart_callback_call(button, "clicked", NULL);
+	return true;
+}
+
+static bool _press(const char *what)
+{
+	if (!strcmp(what, "start"))
+		return _click(elm_object_part_content_get(s_info.layout, PART_START_BTN));
+	if (!strcmp(what, "stop"))
+		return _click(elm_object_part_content_get(s_info.layout, PART_STOP_BTN));
+	if (!strcmp(what, "history"))
+		return _click(elm_object_part_content_get(s_info.layout, PART_SHOW_HISTORY_BTN));
+	if (!strcmp(what, "save") && _top_content())
+		return _click(elm_object_part_content_get(_top_content(), PART_SAVE_BTN));
+
+	if (!strcmp(what, "gps")) {
+		for (int i = 0; i < GPS_TAPS; i++)
+			elm_layout_signal_emit(s_info.layout, "mouse,clicked,1", PART_GPS_STATUS);
+		return true;
+	}
+
+	return false;
+}
+
+static bool _weight(const char *kg)
+{
+	Evas_Object *entry = _top_content() ? elm_object_part_content_get(_top_content(), PART_WEIGHT_ENTRY) : NULL;
+
+	if (!entry)
+		return false;
+
+	elm_entry_entry_set(entry, kg);
+	return true;
+}
+
+static bool _snapshot(const char *path)
+{
+	const uint32_t *pixels = ecore_evas_buffer_pixels_get(s_info.ee);
+	int width, height;
+	FILE *file;
+
+	ecore_evas_geometry_get(s_info.ee, NULL, NULL, &width, &height);
+	if (!pixels || !(file = fopen(path, "wb")))
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	for (int i = 0; i < width * height; i++) {
+		unsigned char rgb[3] = { pixels[i] >> 16, pixels[i] >> 8, pixels[i] };
+
+		fwrite(rgb, 1, sizeof(rgb), file);
+	}
+
+	return fclose(file) == 0;
+}
+
+/*runs one script command, false if it is unknown or could not be done*/
+static bool _run(char *command)
+{
+	char *args = command + strcspn(command, " \t");
+	char arg1[SCRIPT_LINE_MAX], arg2[SCRIPT_LINE_MAX];
+	double x, y, z;
+	int count;
+
+	if (*args)
+		*args++ = '\0';
+
+	if (!strcmp(command, "press") && sscanf(args, "%s", arg1) == 1)
+		return _press(arg1);
+
+	if (!strcmp(command, "key") && sscanf(args, "%s", arg1) == 1) {
+		if (!strcmp(arg1, "back"))
+			return host_ui_key(EEXT_CALLBACK_BACK);
+		if (!strcmp(arg1, "more"))
+			return host_ui_key(EEXT_CALLBACK_MORE);
+		return false;
+	}
+
+	if (!strcmp(command, "weight") && sscanf(args, "%s", arg1) == 1)
+		return _weight(arg1);
+
+	if (!strcmp(command, "walk") && (count = sscanf(args, "%lf %lf", &x, &y)) >= 1) {
+		_walk((int) x, count == 2 ? y : WALK_STEP_METERS);
+		return true;
+	}
+
+	if (!strcmp(command, "fix") && (count = sscanf(args, "%lf %lf %lf", &x, &y, &z)) >= 2) {
+		s_info.timestamp += 1.0;
+		_inject_fix(x, y, count == 3 ? z : 5.0);
+		return true;
+	}
+
+	if (!strcmp(command, "accel") && sscanf(args, "%lf %lf %lf", &x, &y, &z) == 3) {
+		track_accel_s sample = { s_info.timestamp += 0.02, x, y, z };
+
+		return sensor_backend_inject_accel(s_info.backend, &sample);
+	}
+
+	if (!strcmp(command, "wait") && sscanf(args, "%lf", &x) == 1) {
+		_wait(x);
+		return true;
+	}
+
+	if (!strcmp(command, "snapshot") && sscanf(args, "%s", arg1) == 1)
+		return _snapshot(arg1);
+
+	if (!strcmp(command, "expect") && sscanf(args, "%s %s", arg1, arg2) == 2) {
+		if (!strcmp(arg1, "frame_ms"))
+			s_info.max_frame_ms = atof(arg2);
+		else if (!strcmp(arg1, "heap_kb"))
+			s_info.max_heap_kb = atof(arg2);
+		else
+			return false;
+		return true;
+	}
+
+	return false;
+}
+
+static size_t _heap_bytes(void)
+{
+	struct mallinfo2 info = mallinfo2();
+
+	return info.uordblks + info.hblkhd;
+}
+
+static void _usage(void)
+{
+	fprintf(stderr, "usage: uisim [-s WxH] [-D data_dir] [-R res_dir] [-o steps.csv] <script>\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const tracker_callbacks_s callbacks = {
+		.distance_changed = view_set_total_distance,
+		.steps_changed = view_set_steps_count,
+		.fare_changed = view_set_fare,
+		.calories_changed = view_set_calories,
+	};
+	char line[SCRIPT_LINE_MAX];
+	int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+	int number = 0;
+	FILE *script;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:D:R:o:h")) != -1) {
+		switch (opt) {
+		case 's':
+			if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+				_usage();
+				return 2;
+			}
+			break;
+		case 'D':
+			setenv("AR_DATA_PATH", optarg, 1);
+			break;
+		case 'R':
+			setenv("AR_RES_PATH", optarg, 1);
+			break;
+		case 'o':
+			s_info.output = fopen(optarg, "w");
+			if (!s_info.output) {
+				fprintf(stderr, "uisim: cannot write %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			_usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		_usage();
+		return 2;
+	}
+
+	script = fopen(argv[optind], "r");
+	if (!script) {
+		fprintf(stderr, "uisim: cannot read %s\n", argv[optind]);
+		return 1;
+	}
+
+	/* Frames go to memory, no display needed */
+	setenv("ELM_ENGINE", "buffer", 1);
+	elm_init(argc, argv);
+	jobs_init(JOBS_DEFAULT_WORKERS);
+
+	s_info.backend = sensor_backend_inject_create();
+	if (!s_info.backend || !tracker_init(s_info.backend, &callbacks) || !view_create(NULL)) {
+		fprintf(stderr, "uisim: cannot create the views\n");
+		return 1;
+	}
+
+	view_set_button_callbacks(_start_cb, tracker_stop, NULL);
+	view_set_gps_ok_text(tracker_location_enabled());
+
+	s_info.layout = view_layout_get();
+	evas_object_resize(elm_object_top_widget_get(s_info.layout), width, height);
+	s_info.ee = ecore_evas_ecore_evas_get(evas_object_evas_get(s_info.layout));
+	evas_event_callback_add(ecore_evas_get(s_info.ee), EVAS_CALLBACK_RENDER_PRE, _render_pre_cb, NULL);
+	evas_event_callback_add(ecore_evas_get(s_info.ee), EVAS_CALLBACK_RENDER_POST, _render_post_cb, NULL);
+	_settle();
+
+	printf("%4s %-28s %10s %6s %10s %10s %10s\n", "line", "command", "command ms", "frames",
+			"frame ms", "heap KB", "app KB");
+	if (s_info.output)
+		fprintf(s_info.output, "line,command,command_ms,frames,frame_max_ms,frame_total_ms,heap_bytes,app_bytes\n");
+
+	while (fgets(line, sizeof(line), script) && !host_ui_exit_requested()) {
+		char *command = line + strspn(line, " \t");
+		char label[29];
+		double start, command_ms;
+		bool ok;
+
+		number++;
+		command[strcspn(command, "#\r\n")] = '\0';
+		if (!*command)
+			continue;
+		snprintf(label, sizeof(label), "%s", command);
+
+		s_info.frames = 0;
+		s_info.frame_max = 0.0;
+		s_info.frame_total = 0.0;
+
+		start = _now();
+		ok = _run(command);
+		command_ms = (_now() - start) * 1000.0;
+		_settle();
+
+		size_t heap = _heap_bytes();
+		int64_t app = memtrack_live_bytes();
+
+		printf("%4d %-28s %10.2f %6d %10.2f %10zu %10lld%s\n", number, label, command_ms, s_info.frames,
+				s_info.frame_max * 1000.0, heap / 1024, (long long) app / 1024, ok ? "" : "  FAILED");
+		if (s_info.output)
+			fprintf(s_info.output, "%d,\"%s\",%.3f,%d,%.3f,%.3f,%zu,%lld\n", number, label, command_ms,
+					s_info.frames, s_info.frame_max * 1000.0, s_info.frame_total * 1000.0, heap, (long long) app);
+
+		if (!ok)
+			s_info.failures++;
+		if (s_info.max_frame_ms > 0.0 && s_info.frame_max * 1000.0 > s_info.max_frame_ms) {
+			printf("     frame took %.2f ms, expected at most %.2f\n", s_info.frame_max * 1000.0, s_info.max_frame_ms);
+			s_info.failures++;
+		}
+		if (s_info.max_heap_kb > 0.0 && heap / 1024.0 > s_info.max_heap_kb) {
+			printf("     heap is %.0f KB, expected at most %.0f\n", heap / 1024.0, s_info.max_heap_kb);
+			s_info.failures++;
+		}
+	}
+
+	fclose(script);
+
+	printf("%llu frames, frame time p50 %llu us, p90 %llu us, p99 %llu us, max %llu us; %d failures\n",
+			(unsigned long long) s_info.frame_histogram.count,
+			(unsigned long long) diag_histogram_percentile(&s_info.frame_histogram, 50),
+			(unsigned long long) diag_histogram_percentile(&s_info.frame_histogram, 90),
+			(unsigned long long) diag_histogram_percentile(&s_info.frame_histogram, 99),
+			(unsigned long long) s_info.frame_histogram.max_us, s_info.failures);
+
+	if (s_info.output)
+		fclose(s_info.output);
+
+	jobs_shutdown();
+	tracker_finalize();
+	view_destroy();
+	sensor_backend_destroy(s_info.backend);
+	elm_shutdown();
+
+	return s_info.failures ? 1 : 0;
+}